@@ -599,26 +599,64 @@ const unsigned short plugin[] = { /* Compressed plugin (vs1053b-patches.plg, V2.
 	0x0050,
 };
 
-void VS1053::loadVS1053Patch(void) {
-  int i = 0;
+// CRC-16/CCITT over 16 bit words, used to verify the uploaded patch
+static uint16_t patchCrc16(uint16_t crc, uint16_t w)
+{
+  for (int b = 0; b < 16; b++) {
+    bool bit = ((crc ^ w) & 0x8000) != 0;
+    crc <<= 1;
+    w <<= 1;
+    if (bit) crc ^= 0x1021;
+  }
+  return crc;
+}
+
+// Uploads a compressed plugin image. Every record is sent as one SCI multiple write (CS held LOW),
+// runs into SCI_WRAM targeting X/Y data RAM (< 0x8000) are read back and compared by CRC.
+// Instruction RAM (0x8000..0xBFFF) is not checked, it can't be read back reliably through SCI_WRAM.
+bool VS1053::loadPlugin(const unsigned short* image, size_t size, const char* name) {
+  uint32_t       start = micros();
+  size_t         i = 0;
+  unsigned short wramaddr = 0xFFFF;                 // start address of next SCI_WRAM run
+  uint16_t       crcw = 0xFFFF, crcr = 0xFFFF;      // CRC of written and read back words
+  uint16_t       verified = 0;                      // number of words read back
 
-  while (i<sizeof(plugin)/sizeof(plugin[0])) {
+  while (i<size) {
     unsigned short addr, n, val;
-    addr = plugin[i++];
-    n = plugin[i++];
+    addr = image[i++];
+    n = image[i++];
     if (n & 0x8000U) { /* RLE run, replicate n samples */
       n &= 0x7FFF;
-      val = plugin[i++];
-      while (n--) {
-        write_register(addr, val);
+      val = image[i++];
+      sci_fill_multiple(addr, val, n);
+      if (addr == SCI_WRAM) {
+        wramaddr = 0xFFFF;                          // address unknown from now on
       }
     } else {           /* Copy run, copy n samples */
-      while (n--) {
-        val = plugin[i++];
-        write_register(addr, val);
+      sci_write_multiple(addr, &image[i], n);
+      if (addr == SCI_WRAMADDR && n == 1) {
+        wramaddr = image[i];                        // remember where the next run goes
       }
+      else if (addr == SCI_WRAM && wramaddr < 0x8000) {   // X/Y data RAM only
+        write_register(SCI_WRAMADDR, wramaddr);     // read back this run
+        for (unsigned short k = 0; k < n; k++) {
+          crcw = patchCrc16(crcw, image[i + k]);
+          crcr = patchCrc16(crcr, read_register(SCI_WRAM));
+        }
+        verified += n;
+        wramaddr = 0xFFFF;
+      }
+      i += n;
     }
   }
+  dbgprint("VS1053B %s upload took %d ms at %d kHz SPI, %d words verified, CRC %04X/%04X",
+           name, (int)((micros() - start + 500) / 1000), (int)(VS1053_SPI._clock / 1000),
+           verified, crcw, crcr);
+  return (crcw == crcr);
+}
+
+bool VS1053::loadVS1053Patch(void) {
+  return loadPlugin(plugin, sizeof(plugin)/sizeof(plugin[0]), "patch");
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,6 +1,6 @@
 // about.html file in raw data format for PROGMEM
 //
-#define about_html_version 220714
+#define about_html_version 261021
 const char about_html[] PROGMEM = R"=====(
 <!DOCTYPE html>
 <html>
@@ -28,6 +28,28 @@ const char about_html[] PROGMEM = R"=====(
   App (Android): <a target="blank" href="https://play.google.com/store/apps/details?id=com.thunkable.android.sander542jochems.ESP_Radio">Sander Jochems</a></p>
 	<p>Author of this project: Thomas Jentzsch (yellobyte@bluewin.ch), documented at <a target="blank" href="https://github.com/yellobyte/ESP32-Webradio-PlusDLNA">Github</a>.<br>
 	Date: July 2022</p>
+  <h3>Statistics</h3>
+  <p>Only available if the firmware is built with TASK_STATS, HEAP_STATS resp. POWER_SAVE.</p>
+  <button class="button" onclick="stats('taskstats')">Tasks</button>
+  <button class="button" onclick="stats('heapstats')">Heap</button>
+  <button class="button" onclick="stats('powerstats')">Power</button>
+  <pre id="stats"></pre>
+  <script>
+   // Show the statistics as plain text
+   function stats ( theReq )
+   {
+    var theUrl = "/?" + theReq + "&version=" + Math.random() ;
+    var xhr = new XMLHttpRequest() ;
+    xhr.onreadystatechange = function() {
+      if ( xhr.readyState == XMLHttpRequest.DONE )
+      {
+        document.getElementById("stats").textContent = xhr.responseText ;
+      }
+    }
+    xhr.open ( "GET", theUrl ) ;
+    xhr.send() ;
+   }
+  </script>
  </body>
 </html>
 )=====" ;
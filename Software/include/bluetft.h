@@ -97,6 +97,13 @@ bool dsp_begin()
   releaseSPI () ; \
 })  
 
+#define dsp_drawRGBBitmap(a,b,c,d,e) \
+({ \
+  claimSPI ( "tftbitmap" ) ; \
+  tft->drawRGBBitmap ( a, b, c, d, e ) ; \
+  releaseSPI () ; \
+})
+
 #define dsp_erase() \
 ({ \
   claimSPI ( "tftfillscrn" ) ; \
@@ -25,6 +25,28 @@ toneha = 0
 tonehf = 0
 tonela = 0
 tonelf = 0
+# Volume fade curves in ms: fade out, silence, fade in
+fade_start = 80,1200,600
+fade_stop = 100,0,0
+fade_seek = 50,150,300
+fade_mute = 250,0,400
+# Play next SD/media server track without stopping the decoder
+gapless = 1
+# Directory levels scanned on SD card (root = 1), deeper directories are skipped
+#sd_maxdepth = 8
+# SD card on the SD/MMC bus 1 or 4 bit wide instead of SPI (CLK 14, CMD 15, D0 2, D1 4, D2 12, D3 13),
+# pins must not be in use by TFT, VS1053 or buttons, active after reset
+#sd_mmc = 0
+# Random mode shuffles only the directory of the current track
+#shuffle_dir = 0
+# Music library from the ID3 tags of the SD tracks, browse by artist/album (SD button) or genre
+#sd_library = 0
+# Task layout (stack,priority,core -1 = any[,priority while playing]), becomes active after reset
+#task_vumeter = 2048,1,1
+#task_extender = 2048,1,1
+#task_sdread = 3072,1,-1,2
+# CPU clock in MHz while no audio flows (80/160/240), active after reset
+#pm_minfreq = 80
 #
 preset = 0
 # Some preset examples
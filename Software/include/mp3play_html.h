@@ -1,6 +1,6 @@
 // index.html file in raw data format for PROGMEM
 //
-#define mp3play_html_version 210201
+#define mp3play_html_version 261020
 const char mp3play_html[] PROGMEM = R"=====(
 <!DOCTYPE html>
 <html>
@@ -31,6 +31,32 @@ const char mp3play_html[] PROGMEM = R"=====(
     <option value="-1">Select a track here</option>
    </select>
    <br><br>
+   <label for="searchtxt"><big>Search SD tracks:</big></label>
+   <br>
+   <input type="text" size="40" id="searchtxt" placeholder="Part of track name"
+          onkeydown="if ( event.key == 'Enter' ) searchfill ( 0 )">
+   <button class="button" onclick="searchfill(0)">SEARCH</button>
+   <br>
+   <select class="select selectw" onChange="foundreq(this)" id="selfound">
+    <option value="-1">Select a match here</option>
+   </select>
+   <br><br>
+   <label for="selartist"><big>Music library:</big></label>
+   <br>
+   <select class="select" onChange="libfill('albums,' + this.value, selalbum)" id="selartist">
+    <option value="-1">Select an artist here</option>
+   </select>
+   <select class="select" onChange="libfill('tracks,' + this.value, sellib)" id="selalbum">
+    <option value="-1">Select an album here</option>
+   </select>
+   <select class="select" onChange="libfill('genre,' + this.value, sellib)" id="selgenre">
+    <option value="-1">Select a genre here</option>
+   </select>
+   <br>
+   <select class="select selectw" onChange="trackreq(this)" id="sellib">
+    <option value="-1">Select a track here</option>
+   </select>
+   <br><br>
    <button class="button" onclick="httpGet('previous')">PREV</button>
    <button class="button" onclick="httpGet('next')">NEXT</button>
    <button class="button" onclick="httpGet('mp3track=0')">RANDOM</button>
@@ -65,27 +91,102 @@ const char mp3play_html[] PROGMEM = R"=====(
     }
    }
 
-   // Fill track list initially
-   //
-   var i, select, opt, tracks, strparts ;
-   select = document.getElementById("seltrack") ;
-   var theUrl = "/?mp3list" + "&version=" + Math.random();
-   var xhr = new XMLHttpRequest() ;
-   xhr.onreadystatechange = function(){
-     if ( xhr.readyState == XMLHttpRequest.DONE )
-     {
-       tracks = xhr.responseText.split ( "\n" ) ;
-       for ( i = 0 ; i < ( tracks.length - 1 ) ; i++ ){
-         opt = document.createElement( "OPTION" ) ;
-         strparts = tracks[i].split ( "/" ) ;
-         opt.value = strparts[0] ;
-         opt.text = strparts[1] ;
-         select.add( opt ) ;
-       }
-     }
+   function libfill ( theReq, select )
+   {
+    if ( theReq.endsWith ( ",-1" ) ) return ;      // "Select ..." entry chosen
+    var theUrl = "/?sdlib=" + theReq + "&version=" + Math.random() ;
+    var xhr = new XMLHttpRequest() ;
+    xhr.onreadystatechange = function() {
+      if ( xhr.readyState == XMLHttpRequest.DONE )
+      {
+        var lines = xhr.responseText.split ( "\n" ) ;
+        select.length = 1 ;                         // keep "Select ..." entry
+        for ( var i = 0 ; i < ( lines.length - 1 ) ; i++ ){
+          var opt = document.createElement( "OPTION" ) ;
+          var parts = lines[i].split ( "/" ) ;
+          opt.value = parts[0] ;
+          opt.text = parts.slice(1).join ( "/" ) ;
+          select.add( opt ) ;
+        }
+      }
+    }
+    xhr.open ( "GET", theUrl ) ;
+    xhr.send() ;
    }
-   xhr.open ( "GET", theUrl, false ) ;
-   xhr.send() ;
+
+   function searchfill ( offset )
+   {
+    var theUrl = "/?search=" + encodeURIComponent ( searchtxt.value ) + "," + offset +
+                 "&version=" + Math.random() ;
+    var xhr = new XMLHttpRequest() ;
+    xhr.onreadystatechange = function() {
+      if ( xhr.readyState == XMLHttpRequest.DONE )
+      {
+        var lines = xhr.responseText.split ( "\n" ) ;
+        if ( offset == 0 )
+        {
+          selfound.length = 1 ;                     // keep "Select ..." entry
+        }
+        else
+        {
+          selfound.remove ( selfound.length - 1 ) ; // "... more" entry
+        }
+        for ( var i = 0 ; i < ( lines.length - 1 ) ; i++ ){
+          var opt = document.createElement( "OPTION" ) ;
+          var parts = lines[i].split ( "/" ) ;
+          opt.value = parts[0] ;
+          opt.text = parts.slice(1).join ( "/" ) ;
+          selfound.add( opt ) ;
+        }
+      }
+    }
+    xhr.open ( "GET", theUrl ) ;
+    xhr.send() ;
+   }
+
+   function foundreq ( presctrl )
+   {
+    if ( presctrl.value.startsWith ( "more," ) )
+    {
+      searchfill ( presctrl.value.substring ( 5 ) ) ; // next page of matches
+    }
+    else
+    {
+      trackreq ( presctrl ) ;
+    }
+   }
+
+   function listfill ( offset )
+   {
+    var theUrl = "/?mp3list=" + offset + ",200" + "&version=" + Math.random() ;
+    var xhr = new XMLHttpRequest() ;
+    xhr.onreadystatechange = function() {
+      if ( xhr.readyState == XMLHttpRequest.DONE )
+      {
+        var lines = xhr.responseText.split ( "\n" ) ;
+        for ( var i = 0 ; i < ( lines.length - 1 ) ; i++ ){
+          var parts = lines[i].split ( "/" ) ;
+          if ( parts[0].startsWith ( "more," ) )
+          {
+            listfill ( parts[0].substring ( 5 ) ) ;  // load next page
+            return ;
+          }
+          var opt = document.createElement( "OPTION" ) ;
+          opt.value = parts[0] ;
+          opt.text = parts[1] ;
+          seltrack.add( opt ) ;
+        }
+      }
+    }
+    xhr.open ( "GET", theUrl ) ;
+    xhr.send() ;
+   }
+
+   // Fill track list initially, 200 tracks per request
+   //
+   listfill ( 0 ) ;
+   libfill ( "artists", selartist ) ;
+   libfill ( "genres", selgenre ) ;
   </script>
  </body>
 </html>
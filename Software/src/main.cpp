@@ -96,14 +96,33 @@
 #define ENABLE_I2S                     // Activates I2S on VS1053B for communication with WM8805 module (I2S/OPT)
 #define LOAD_VS1053_PATCH              // Loads a patch into the VS1053 which fixes the SS_REFERENCE_SEL bug
 #define VU_METER                       // Displays VU-Meter levels provided by VS1053B
+//#define SPECTRUM_ANALYZER              // Spectrum analyzer next to VU-Meter, needs VU_METER and the
+                                       // VLSI plugin as array spectrum_plugin[] in VS1053_spectrum.h
+                                       // (not part of the source, download it from VLSI)
 #define SD_UPDATES                     // SW-Updates via SD-Card during power-up
 #define ENABLE_ESP32_HW_WDT            // Enable ESP32 Hardware Watchdog
 #define FRONT_PANEL_BUTTONS            // Use front panel buttons
+#define TASK_STATS                     // Sample FreeRTOS task statistics ("tasks" command)
+#define HEAP_STATS                     // Sample free heap and fragmentation ("heap" command)
+//#define HEAP_TRACE                     // Count allocations per HEAP_TAG, needs build flags
+                                       // -Wl,--wrap=malloc -Wl,--wrap=realloc (platformio.ini)
+#define POWER_SAVE                     // Lower CPU clock while no audio is flowing ("power" command)
+#define SD_LIBRARY                     // Browse SD tracks by artist/album/genre from their ID3 tags ("sd_library")
+#define SD_READER                      // Read SD tracks ahead in big blocks by a task of its own
+#define SD_MMC_BUS                     // SD card may be on the SD/MMC bus instead of SPI ("sd_mmc")
+
+// The spectrum analyzer plugin is not shipped, SPECTRUM_ANALYZER stays off unless it is added
+#if defined SPECTRUM_ANALYZER && !(defined VU_METER && defined LOAD_VS1053_PATCH)
+#error "SPECTRUM_ANALYZER needs VU_METER and LOAD_VS1053_PATCH"
+#endif
 
 #include <Arduino.h>
 //#include <FS.h>
 //#include <SPI.h>
 #include <SD.h>
+#ifdef SD_MMC_BUS
+#include <SD_MMC.h>
+#endif
 #include <nvs.h>
 #include <stdio.h>
 #include <string.h>
@@ -127,6 +146,12 @@
 #include <esp_task_wdt.h>
 #endif
 #include <esp_partition.h>
+#ifdef POWER_SAVE
+#include <esp_pm.h>
+#endif
+#if defined TASK_STATS && !configGENERATE_RUN_TIME_STATS
+#include <esp_freertos_hooks.h>
+#endif
 #include "driver/i2c.h"
 
 #ifdef USE_ETHERNET
@@ -152,6 +177,11 @@ byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED};
 #define WDT_TIMEOUT 60
 // Number of entries in the queue
 #define QSIZ 1000
+// loop() sleeps until woken by an event: max. wait while idle, while a network stream is read
+#define LOOP_IDLE_WAIT 100
+#define LOOP_NET_WAIT  10
+// playTask wakes loop() when this many queue entries are free again
+#define LOOP_QSPACE_WAKE (QSIZ / 4)
 // Debug buffer size
 #define DEBUG_BUFFER_SIZE 250
 // Access point name if connection to WiFi network fails.  Also the hostname for WiFi and OTA.
@@ -168,10 +198,78 @@ byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED};
 #define METASIZ 1024
 // Max. number of NVS keys in table
 #define MAXKEYS 200
-// Max. node depth on SD card we will recognize
-#define SD_MAXDEPTH 4
-// Max mp3-files to recognize on SD card (we skip all the others)
-#define SD_MAXFILES 500
+// Volume ramp engine: one volume step per mp3 frame time (1152 samples @ 44.1kHz = 26ms)
+#define VOLRAMP_STEP 26
+// Volume ramps start/end at this level (-62dB), below it the output is silent anyway
+#define VOLRAMP_FLOOR 50
+// Interval in ms for reading stream info (codec, bitrate, decode time) from VS1053
+#define TELEMETRY_INTERVAL 500
+#ifdef TASK_STATS
+// Interval in ms for task statistics snapshots, number of snapshots kept, max. tasks recorded
+#define TASKSTAT_INTERVAL 2000
+#define TASKSTAT_RING     30
+#define TASKSTAT_MAXTASKS 24
+// Stack high water mark in bytes below which a task is reported
+#define TASKSTAT_STACKLOW 512
+#endif
+#ifdef HEAP_STATS
+// Interval in ms for heap snapshots, number of snapshots kept
+#define HEAPSTAT_INTERVAL 10000
+#define HEAPSTAT_RING     30
+#endif
+#ifdef HEAP_TRACE
+// Max. number of different tags counted by the malloc wrapper
+#define HEAPTRACE_TAGS    24
+// Thread local storage slot for the HEAP_TAG of a task.  Slot 0 is also used by pthread keys,
+// which this firmware does not use.
+#define HEAPTRACE_TLS     (configNUM_THREAD_LOCAL_STORAGE_POINTERS - 1)
+#endif
+#ifdef POWER_SAVE
+// Full CPU clock in MHz while audio is flowing, default clock while stopped/paused ("pm_minfreq")
+#define PM_MAXFREQ 240
+#define PM_MINFREQ 80
+#endif
+// Max. number of VS1053 WRAM words transferred in one SPI window while playing (ca. 10us per word)
+#define WRAM_MAX_BURST 32
+// Default max. node depth on SD card we will recognize ("sd_maxdepth")
+#define SD_MAXDEPTH 8
+// Node table of the SD card is kept in this file, loaded on mount if the card has not changed
+#define SDINDEX_FILE    "/.sdindex.bin"
+#define SDINDEX_VERSION 3
+// Max. length of a node name in bytes: 255 UTF-16 characters of a long file name in UTF-8
+#define SDNAME_MAX      765
+// Max mp3-files to recognize on SD card (we skip all the others), node indexes are 16 bit
+#define SD_MAXFILES 10000
+// Size of the buffer the SD track list for the web interface is sent from
+#define SDLIST_BUFSIZE 1024
+// Max. length of a full path on SD card, directory paths kept by sdPath() for the next tracks
+#define SDPATH_MAX   512
+#define SDPATH_CACHE 4
+// Max. number of directory entries handled by one slice of the background SD scan
+#define SDSCAN_SLICE 8
+// Max. number of matches sent by one "search" reply, the next page is asked for with an offset
+#define SDSEARCH_PAGE 50
+// Max. length of a search text
+#define SDSEARCH_TEXTMAX 64
+#ifdef SD_READER
+// Size of the two buffers SD tracks are read ahead into, 32 sectors
+#define SDREAD_BLOCK 16384
+// Bytes read per SPI claim, a multi-block read of 8 sectors that keeps the bus free for the VS1053
+#define SDREAD_CHUNK 4096
+#endif
+// ID3 tags are read in blocks of this size, frames we don't need (like cover art) are seeked over
+#define ID3_BLOCK   2048
+// Max. length of artist, album and title shown from ID3 tags (longer ones are cut)
+#define ID3_TEXTMAX 128
+#ifdef SD_LIBRARY
+// Music library built from the ID3 tags of the SD tracks, valid as long as the SD index is
+#define SDLIB_FILE    "/.sdlib.bin"
+#define SDLIB_VERSION 1
+// Max. length of artist, album, title and genre (longer ones are cut)
+#define SDLIB_TEXTMAX 64
+// Min. time in ms between two tracks indexed while playing, leaves the SD card to the player
+#define SDLIB_PAUSE   250
+#endif
 //length of longest debug command string plus two spaces for CR + LF (from client on port 23)
 #define MAXSIZE_TELNET_CMD 10 
 // defaults, can be overridden by preferences
@@ -190,6 +288,23 @@ IPAddress secondaryDNS(195, 186, 4, 162);     //optional
 #if defined VU_METER && defined LOAD_VS1053_PATCH
 #define VUMETERPOS  -61
 #endif
+#ifdef SPECTRUM_ANALYZER
+#if defined __has_include
+#if !__has_include("VS1053_spectrum.h")
+#error "SPECTRUM_ANALYZER needs include/VS1053_spectrum.h with spectrum_plugin[] from VLSI"
+#endif
+#endif
+#include "VS1053_spectrum.h"
+#define SPECTRUMPOS    -86                     // 8 bars of 2 pixels + 1 pixel gap left of VU-meter
+#define SPECTRUM_BARS  8                       // Bars on display, plugin bands are merged to fit
+#define SPECTRUM_BANDS 23                      // Max. number of bands the plugin delivers
+#if 2 + SPECTRUM_BANDS > WRAM_MAX_BURST
+#error "Spectrum frame does not fit in one WRAM burst"
+#endif
+#define TOPLINE_MP3 "ESP32 MP3"                // Shorter top line to leave room for the bars
+#else
+#define TOPLINE_MP3 "ESP32 MP3Player"
+#endif
 // I2C stuff: PCF8574 Addresses & assigned Pins
 #define PCF8574_1_ADDR (0x20)
 #define PCF8574_2_ADDR (0x21)
@@ -221,6 +336,7 @@ String      limitString(String& strg, int maxPixel);
 String      httpHeader(String contentstype);
 bool        nvsSearch(const char* key);
 void        mp3loop();
+void        wakeLoop();                       // Wake loop() from waitForWork()
 //void        tftlog(const char *str, uint16_t textColor = (WHITE));
 void        playTask(void * parameter);       // Task to play the stream
 void        spfTask(void * parameter);        // Task for special functions
@@ -229,6 +345,43 @@ void        getTime();
 void        extenderTask(void * parameter);   // Task for communication with PCF8574 ICs
 #endif			
 void        vumeterTask(void * parameter);    // Task for showing vu meter readings
+#if defined VU_METER && defined LOAD_VS1053_PATCH
+void        vuSample();                       // Read VU-Meter in playTask's SPI window
+#endif
+#ifdef TASK_STATS
+String      taskStatsText();                  // Task statistics as text
+#if !configGENERATE_RUN_TIME_STATS
+void        taskTickHook();                   // Counts run time per task at every tick
+#endif
+#endif
+#ifdef HEAP_STATS
+String      heapStatsText();                  // Heap statistics as text
+#endif
+#ifdef POWER_SAVE
+enum enum_pmholder { PM_STREAM, PM_PLAY, PM_HOLDERS };   // who needs the full CPU clock
+enum enum_pmmode { PM_PLAYING, PM_PAUSED, PM_STOPPED, PM_MENU, PM_MODES }; // reported power modes
+void        pmBegin();                        // Set up clock scaling
+void        pmHold(enum_pmholder holder, bool hold); // Full CPU clock needed or not
+void        pmUpdate();                       // Clock and power mode from loop()
+String      powerStatsText();                 // Time spent per power mode as text
+#endif
+void        dbgprintLines(const String& txt); // Multi line text to debug output
+void        sdScanAbort();                    // Stop a running SD scan
+void        sdScanClose();                    // Close directory being scanned
+void        sdScanFinish();                   // SD scan done, save index
+void        sdLoadPublish();                  // Make the loaded SD index the node table
+void        sdSearchBuild();                  // Sort mp3 file nodes by name for "search"
+void        sdSearchReset();                  // Forget search index
+void        sdPathReset();                    // Forget directory paths of old nodes
+void        id3Copy(char* dst, size_t size, const uint8_t* src, int n); // Text field of a tag
+int         id3ReadTags(File& f, char* tag, size_t width); // Artist, album, title... of a file
+void        sdReadFlush(bool more);           // mp3file or its position changed, SPI claimed
+#ifdef SD_READER
+void        sdReadTask(void * parameter);     // Task to read SD tracks ahead
+#endif
+#ifdef SD_LIBRARY
+void        sdLibAbort();                     // Stop library build, forget library
+#endif
 bool        handlePCF8574();
 #ifdef USE_ETHERNET
 void        tzset(void);
@@ -249,7 +402,68 @@ struct scrseg_struct                                 // For screen segments
   String   str;                                      // String to be displayed (Name)
 };
 
-enum qdata_type { QDATA, QSTARTSONG, QSTOPSONG };    // datatyp in qdata_struct
+enum qdata_type { QDATA, QSTARTSONG, QSTOPSONG, QNEWTRACK }; // datatyp in qdata_struct
+enum enum_volramp { VR_START, VR_STOP, VR_SEEK, VR_MUTE }; // kind of volume ramp (index in volramp[])
+struct vstelemetry_struct                            // Stream info as reported by VS1053
+{
+  const char* codec;                                 // Codec of stream, e.g. "MP3"
+  uint16_t    samplerate;                            // Sample rate in Hz
+  uint16_t    byterate;                              // Actual data rate in bytes/sec
+  uint16_t    bitrate;                               // Actual bitrate in kbps
+  uint16_t    decodetime;                            // Seconds decoded since start/seek
+};
+struct volramp_struct                                // Fade curve for volume ramp engine
+{
+  uint16_t down;                                     // Time to fade out in ms
+  uint16_t hold;                                     // Time output stays silent after fading out in ms
+  uint16_t up;                                       // Time to fade in again in ms
+};
+#ifdef TASK_STATS
+struct taskstat_struct                               // One snapshot of the task statistics
+{
+  uint32_t time;                                     // Seconds since boot
+  uint8_t  load[2];                                  // Load of core 0 and 1 in percent
+  uint8_t  topload;                                  // CPU usage of busiest task in percent
+  char     top[configMAX_TASK_NAME_LEN];             // Name of busiest task (IDLE excluded)
+};
+#endif
+#ifdef HEAP_STATS
+struct heapstat_struct                               // One snapshot of the heap
+{
+  uint32_t time;                                     // Seconds since boot
+  uint32_t free;                                     // Free heap in bytes
+  uint32_t maxalloc;                                 // Largest free block in bytes
+  uint32_t minfree;                                  // Lowest free heap since boot
+};
+#endif
+#ifdef HEAP_TRACE
+struct heaptrace_struct                              // Allocations counted for one tag
+{
+  char     tag[16];                                  // HEAP_TAG or name of task without tag
+  uint32_t count;                                    // Number of malloc/realloc calls
+  uint32_t bytes;                                    // Sum of requested bytes
+};
+#endif
+struct taskdef_struct                                // Task layout, can be changed with "task_xxx"
+{
+  TaskFunction_t func;                               // Task function
+  const char*    name;                               // Name of task
+  uint16_t       stack;                              // Stack size in bytes
+  uint8_t        prio;                               // Priority
+  uint8_t        playprio;                           // Priority while playing, 0 = no change
+  int8_t         core;                               // CPU to run on, -1 = any
+  TaskHandle_t*  handle;                             // Task handle to keep track of created task
+};
+#ifdef SD_READER
+struct sdread_buf_t                                  // Block of a track read ahead by sdReadTask
+{
+  uint8_t* data;                                     // SDREAD_BLOCK bytes, DMA capable
+  int32_t  len;                                      // Bytes read, -1 on read error
+  uint32_t used;                                     // Bytes taken by mp3loop()
+  uint16_t gen;                                      // sdReadGen at the time of reading
+};
+#endif
+
 struct qdata_struct
 {
   int datatyp;                                       // Identifier
@@ -329,11 +543,137 @@ struct keyname_t                                      // For keys in NVS
 
 struct mp3node_t                                      // for directories/files on SD card
 {
-  bool    isDirectory;                                // node is file or directory
-  int16_t parentDir;                                  // which directory is it in
-  String  name;                                       // file/directory name
+  int16_t  parentDir;                                 // which directory is it in
+  int16_t  firstChild;                                // directory: first entry, -1 if empty
+  int16_t  firstFile;                                 // directory: first mp3 file, -1 if none
+  int16_t  nextSibling, prevSibling;                  // entries of same directory, circular
+  int16_t  nextFile, prevFile;                        // mp3 files of same directory, circular
+                                                      // directory: directories with files, circular
+  uint16_t files, dirs;                               // directory: number of files/subdirectories
+  bool     isDirectory;                               // node is file or directory
+  uint32_t nameOfs;                                   // file/directory name in name arena
+};
+
+class mp3nodetable                                    // Fixed size nodes plus one name arena
+{
+  private:
+    mp3node_t* nodes = NULL;                          // Node records
+    char*      arena = NULL;                          // All names, '\0' terminated
+    int16_t    count = 0, maxCount = 0;               // Nodes used/allocated
+    int16_t    fileDirs = -1;                         // First directory with mp3 files
+    uint32_t   arenaLen = 0, arenaMax = 0;            // Name bytes used/allocated
+    void       link(int16_t& first, int16_t inx, int16_t mp3node_t::*next,
+                    int16_t mp3node_t::*prev);
+  public:
+    mp3node_t&  operator[](int16_t inx) { return nodes[inx]; }
+    int16_t     size() const { return count; }
+    int16_t     firstFileDir() const { return fileDirs; }
+    const char* name(int16_t inx) const { return arena + nodes[inx].nameOfs; }
+    uint32_t    memUsage() const { return maxCount * sizeof(mp3node_t) + arenaMax; }
+    int16_t     add(bool isDirectory, int16_t parentDir, const char* name);
+    void        shrink();
+    void        clear();
+    void        take(mp3nodetable& other);           // Move other table into this one
+};
+
+struct sdpath_cache_t                                 // Directory path resolved by sdPath()
+{
+  int16_t  dir;                                       // its node in mp3nodeList, -1 = unused
+  uint16_t len;                                       // strlen(path)
+  uint32_t used;                                      // sdPathTick of last use, for LRU
+  char     path[SDPATH_MAX];                          // like "/dir/subdir"
+};
+
+struct id3src_t                                       // Tag data of a file read by id3Get()
+{
+  File*    f;                                         // The file
+  uint32_t bufPos;                                    // File position of id3Block[0]
+  uint32_t bufLen;                                    // Bytes in id3Block
+  uint32_t pos;                                       // File position of the next byte
+  bool     unsync;                                    // Drop 0x00 after 0xFF (v2.2/v2.3 tag)
+  uint8_t  last;                                      // Last byte delivered, for unsync
+  uint16_t reads;                                     // Blocks read so far
+};
+
+struct sdscan_dir_struct                              // A directory of the SD scan
+{
+  int16_t node;                                       // its node in mp3nodeList
+  uint8_t depth;                                      // nesting level, root is 0
+};
+
+struct sdsig_struct                                   // Identifies the content of an SD card
+{
+  uint64_t used;                                      // Used bytes on card
+  uint32_t serial;                                    // Volume serial number from boot sector
+  uint32_t rootTime;                                  // Newest last write time in root directory
+  uint16_t rootEntries;                               // Number of entries in root directory
+  uint16_t version;                                   // SDINDEX_VERSION
+  uint16_t maxFiles;                                  // SD_MAXFILES at time of scan
+  uint16_t maxDepth;                                  // sdMaxDepth at time of scan
+};
+
+struct sdix_struct                                    // Buffered access to an index file
+{
+  uint8_t  buf[512];                                  // Read/write buffer
+  uint16_t len, pos;                                  // Bytes in buffer, read position
+  uint32_t sum;                                       // FNV-1a checksum
+};
+
+struct sdindex_head_struct                            // Header of SDINDEX_FILE
+{
+  char         magic[4];                              // "SDIX"
+  uint16_t     nodes;                                 // Entries in mp3nodeList
+  uint16_t     files;                                 // Number of mp3 files
+  sdsig_struct sig;                                   // Card content the index belongs to
+  uint32_t     checksum;                              // FNV-1a of everything after the header
 };
 
+#ifdef SD_LIBRARY
+struct sdlib_head_struct                              // Header of SDLIB_FILE
+{
+  char     magic[4];                                  // "SDLB"
+  uint16_t version;                                   // SDLIB_VERSION
+  uint16_t nodes;                                     // Entries in mp3nodeList at build time
+  uint32_t indexId;                                   // Checksum of the SD index it belongs to
+  uint16_t artists, albums, tracks, genres;           // Number of records per section
+  uint32_t artistOfs, albumOfs, trackOfs;             // Start of sections in file
+  uint32_t genreOfs, genreListOfs, textOfs;
+  uint32_t size;                                      // Total file size
+};
+
+struct sdlib_list_t                                   // Artist or genre in SDLIB_FILE
+{
+  uint32_t name;                                      // Offset in text section
+  uint16_t first, count;                              // Albums of artist, genre list entries of genre
+};
+
+struct sdlib_album_t                                  // Album in SDLIB_FILE
+{
+  uint32_t name;                                      // Offset in text section
+  uint16_t first, count;                              // Tracks of album
+  uint16_t artist;                                    // Artist record
+  uint16_t year;                                      // Year of first track that has one
+};
+
+struct sdlib_track_t                                  // Track in SDLIB_FILE
+{
+  uint32_t title;                                     // Offset in text section
+  int16_t  node;                                      // File node in mp3nodeList
+  uint16_t album, genre;                              // Album and genre record
+  uint16_t year;                                      // 0 if unknown
+  uint8_t  trackNo;                                   // Track number on album, 0 if unknown
+  uint8_t  spare[3];
+};
+
+struct sdlib_tags_t                                   // ID3 tags of a track while building
+{
+  int16_t  node;                                      // File node in mp3nodeList
+  uint16_t year;                                      // 0 if unknown
+  uint8_t  trackNo;                                   // 0 if unknown
+  uint32_t artist, album, title, genre;               // Strings in sdLibPool
+};
+#endif
+
 #ifdef ENABLE_SOAP
 struct soapChain_t
 {
@@ -402,7 +742,41 @@ TaskHandle_t      xextenderTask;                         // Task handle for comm
 #if defined VU_METER && defined LOAD_VS1053_PATCH
 TaskHandle_t      xvumeterTask;                          // Task handle for displaying vu-meter value
 #endif
+#ifdef SD_READER
+TaskHandle_t      xsdReadTask;                           // Task handle for reading SD tracks ahead
+#endif
+taskdef_struct    taskdef[] = {                          // Tasks started in setup(), see "task_xxx"
+  { playTask,     "playTask",     3072, 2, 0,  0, &xplayTask },     // play data in dataQueue
+  { spfTask,      "spfTask",      6144, 1, 0, -1, &xspfTask },      // scanning SD card needs big stack
+#ifdef FRONT_PANEL_BUTTONS
+  { extenderTask, "extenderTask", 2048, 1, 0, -1, &xextenderTask }, // communication with PCF8574 ICs
+#endif
+#if defined VU_METER && defined LOAD_VS1053_PATCH
+  { vumeterTask,  "vumeterTask",  2048, 1, 0, -1, &xvumeterTask },  // displaying the vu-meter value
+#endif
+#ifdef SD_READER
+  { sdReadTask,   "sdReadTask",   3072, 1, 2, -1, &xsdReadTask },   // reading SD tracks ahead
+#endif
+};
+bool              tasksStarted = false;                  // taskdef[] is in use
+uint32_t          underruns = 0;                         // Times data stopped flowing while playing
+uint32_t          sdReadCalls = 0;                       // mp3file.read() calls (SPI claims) for playing
+uint32_t          sdReadBytes = 0;                       // Bytes read for playing
+uint64_t          sdReadTime = 0;                        // Time in us spent in these calls
+#ifdef SD_READER
+sdread_buf_t      sdReadBuf[2];                          // One is filled while the other drains
+QueueHandle_t     sdReadFull = NULL;                     // Numbers of buffers filled by sdReadTask
+QueueHandle_t     sdReadFree = NULL;                     // Numbers of buffers to fill
+int8_t            sdReadCur = -1;                        // Buffer mp3loop() takes data from
+uint16_t          sdReadGen = 0;                         // Changes with mp3file or its position
+bool              sdReadEof = true;                      // Nothing (more) to read ahead
+bool              sdReadOn = false;                      // Buffers allocated, sdReadTask in use
+#endif
 SemaphoreHandle_t SPIsem = NULL;                         // For exclusive SPI usage
+SemaphoreHandle_t SDsem = NULL;                          // For exclusive SD usage on SD/MMC bus
+#ifdef FRONT_PANEL_BUTTONS
+SemaphoreHandle_t I2Csem = NULL;                         // For exclusive I2C usage (port extenders)
+#endif
 hw_timer_t*       timer = NULL;                          // For timer
 char              timetxt[6];                            // Converted timeinfo
 QueueHandle_t     dataQueue;                             // Queue for mp3 datastream
@@ -413,7 +787,8 @@ uint32_t          totalCount = 0;                        // Counter mp3 data
 enum_datamode     dataMode = STOPPED;                    // State of datastream
 int               metacount;                             // Number of bytes in metadata
 int               datacount;                             // Counter databytes before metadata
-char              metalinebf[METASIZ + 1];               // Buffer for metaline/ID3 tags
+char              metalinebf[METASIZ + 1];               // Buffer for metaline
+uint8_t           id3Block[ID3_BLOCK];                   // Tag data, used by loop() only
 int16_t           metalinebfx;                           // Index for metalinebf
 String            icystreamtitle;                        // Streamtitle from metadata
 String            icyname;                               // Icecast station name
@@ -427,7 +802,83 @@ String            host;                                  // The URL to connect t
 String            playlist;                              // The URL of the specified playlist
 bool              hostreq = false;                       // Request for new host
 bool              reqtone = false;                       // New tone setting requested
-int8_t            muteFlag = 0;                          // Mute output (0=unmuted, -1=permanently, >0 temp. in 1/10 sec)
+bool              muteFlag = false;                      // Mute output permanently
+volramp_struct    volramp[] = {                          // Fade curves (ms), can be changed with "fade_xxx"
+  {  80, 1200, 600 },                                    // VR_START: new station or track
+  { 100,    0,   0 },                                    // VR_STOP:  player stops, fade out VS1053 FIFO
+  {  50,  150, 300 },                                    // VR_SEEK:  jump forward/back in mp3 file
+  { 250,    0, 400 }                                     // VR_MUTE:  mute/unmute
+};
+uint32_t          rampHoldUntil = 0;                     // Output stays silent until this time (millis)
+uint16_t          rampDownTime = 0;                      // Fade out time of active curve (ms)
+uint16_t          rampUpTime = 0;                        // Fade in time of active curve (ms)
+vstelemetry_struct vstelemetry = { "", 0, 0, 0, 0 };     // Stream info read from VS1053
+volatile uint32_t decodeBase = 0;                        // File position where decode time started
+volatile bool     decodeTimeReset = false;               // Request to reset decode time (after seek)
+volatile bool     decodeResetQueued = false;             // Gapless: reset waits for QNEWTRACK in queue
+bool              newTrackPending = false;               // Gapless: QNEWTRACK not queued yet, retry
+#ifdef TASK_STATS
+TaskStatus_t      taskStat[TASKSTAT_MAXTASKS];           // Last snapshot of all tasks
+uint8_t           taskCpu[TASKSTAT_MAXTASKS];            // CPU usage per task in last interval (%)
+UBaseType_t       taskCount = 0;                         // Number of tasks in taskStat[]
+taskstat_struct   taskRing[TASKSTAT_RING];               // Core loads of the last snapshots
+uint8_t           taskRingInx = 0;                       // Next entry to fill in taskRing[]
+uint8_t           taskRingCount = 0;                     // Number of valid entries in taskRing[]
+#if !configGENERATE_RUN_TIME_STATS
+struct tasktick_struct                                   // Ticks a task was found running
+{
+  TaskHandle_t    handle;                                // Task, NULL if entry is free
+  uint32_t        ticks;                                 // Ticks counted for this task
+};
+tasktick_struct   taskTick[TASKSTAT_MAXTASKS];           // Filled by taskTickHook() on both cores
+tasktick_struct   taskTickCopy[TASKSTAT_MAXTASKS];       // Copy of taskTick[] for sampleTaskStats()
+volatile uint32_t taskTickTotal = 0;                     // Ticks counted on core 0
+portMUX_TYPE      taskTickMux = portMUX_INITIALIZER_UNLOCKED; // Protects taskTick[]
+#endif
+#endif
+#ifdef HEAP_STATS
+heapstat_struct   heapRing[HEAPSTAT_RING];               // Heap of the last snapshots
+uint8_t           heapRingInx = 0;                       // Next entry to fill in heapRing[]
+uint8_t           heapRingCount = 0;                     // Number of valid entries in heapRing[]
+uint32_t          heapMinMaxAlloc = 0xFFFFFFFF;          // Smallest largest free block seen
+#endif
+#ifdef POWER_SAVE
+uint16_t          pmMinFreq = PM_MINFREQ;                // CPU clock while no audio flows ("pm_minfreq")
+bool              pmStarted = false;                     // pmBegin() done, settings are fixed
+bool              pmDFS = false;                         // Clock switched by esp_pm, else by loop()
+volatile bool     pmHeld[PM_HOLDERS];                    // Full clock needed by stream reader/playTask
+enum_pmmode       pmMode = PM_STOPPED;                   // Current power mode
+uint32_t          pmTime[PM_MODES];                      // Time spent per power mode in ms
+uint16_t          pmFreq[PM_MODES];                      // CPU clock last seen per power mode
+const char*       pmModeNames[PM_MODES] = { "playing", "paused", "stopped", "menu" };
+#ifdef CONFIG_PM_ENABLE
+esp_pm_lock_handle_t pmLock[PM_HOLDERS];                 // ESP_PM_CPU_FREQ_MAX per holder
+#endif
+#endif
+#ifdef HEAP_TRACE
+heaptrace_struct  heapTrace[HEAPTRACE_TAGS];             // Allocations per tag
+portMUX_TYPE      heapTraceMux = portMUX_INITIALIZER_UNLOCKED;
+// Attribute allocations of this task until end of scope to a subsystem, e.g. HEAP_TAG("tftset");
+// The tag is kept per task, so tags of tasks on both cores do not mix.
+struct heaptag_guard
+{
+  void* prevTag;
+  heaptag_guard(const char* tag) : prevTag(pvTaskGetThreadLocalStoragePointer(NULL, HEAPTRACE_TLS))
+  {
+    vTaskSetThreadLocalStoragePointer(NULL, HEAPTRACE_TLS, (void*)tag);
+  }
+  ~heaptag_guard()
+  {
+    vTaskSetThreadLocalStoragePointer(NULL, HEAPTRACE_TLS, prevTag);
+  }
+};
+#define HEAP_TAG(t) heaptag_guard _heaptag(t)
+#else
+#define HEAP_TAG(t)
+#endif
+#ifdef SPECTRUM_ANALYZER
+uint8_t           spectrumRate = 25;                     // Spectrum frames per second, 0 = off ("spectrum")
+#endif
 bool              resetreq = false;                      // Request to reset the ESP32
 bool              NetworkFound = false;                  // True if WiFi network connected
 String            networks;                              // Found networks in the surrounding
@@ -453,17 +904,59 @@ int16_t           SD_mp3fileCount = 0;                   // Number of mp3 files
 int16_t           currentIndex = -1;                     // current index in mp3List when SD (0 means random) and in soapList when Mediaserver
 uint16_t          clength;                               // Content length found in http header
 enum_repeat_mode  mp3fileRepeatFlag = NOREPEAT;
+bool              mp3fileGapless = true;                 // gapless transition to next track ("gapless")
+std::vector<int16_t> shuffleList;                        // node indices of tracks in RANDOM mode order
+int16_t           shufflePos = -1;                       // position of current track in shuffleList
+uint32_t          shuffleSeed = 0;                       // seed of shuffleList order, 0 = none yet
+int16_t           shuffleDir = -1;                       // directory node shuffled, -1 = whole card
+uint16_t          shuffleCount = 0;                      // number of tracks shuffled with shuffleSeed
+bool              shufflePerDir = false;                 // shuffle directory of current track only ("shuffle_dir")
 bool              mp3fileJumpForward = false;            // jump forward in mp3 file
 bool              mp3fileJumpBack = false;               // jump backwards in mp3 file
 bool              mp3filePause = false;                  // pause playing mp3 file
 bool              staticIPs = false;
 bool              dhcpRequested = false;
-String            sdOutbuf;                              // Output buffer for cmdclient
 String            lastArtistSong;                        // for restoring text after timeout
 String            lastAlbumStation;                      // for restoring text after timeout
 bool              tryToMountSD = false;                  // request to mount SD when system is already up and running
+bool              SD_rescanReq = false;                  // ignore SDINDEX_FILE on next mount
+std::vector<sdscan_dir_struct> sdScanStack;              // directories still to scan
+sdscan_dir_struct sdScanCur;                             // directory being scanned
+File              sdScanDir;                             // its handle, the only one open
+size_t            sdScanMark = 0;                        // its subdirectories start here in sdScanStack
+uint16_t          sdScanSkipped = 0;                     // directories skipped because of limits
+uint8_t           sdMaxDepth = SD_MAXDEPTH;              // max. nesting level ("sd_maxdepth")
+uint8_t           sdMmc = 0;                             // SD/MMC bus width 1 or 4, 0 = SPI ("sd_mmc")
+fs::FS*           sdfs = &SD;                            // File system of the SD card, SD or SD_MMC
+bool              sdScanReq = false;                     // handle_spec() asks loop() for a scan
+bool              sdScanActive = false;                  // SD scan running
+int16_t           sdScanFiles = 0;                       // mp3 files found by SD scan
+uint32_t          sdIndexId = 0;                         // checksum of SD index in use, 0 if not on card
+int16_t*          sdSearchIndex = NULL;                  // mp3 file nodes sorted by name, ignoring case
+sdpath_cache_t    sdPathCache[SDPATH_CACHE];             // directory paths used last by sdPath()
+uint32_t          sdPathTick = 0;                        // counts sdPathCache lookups
+int16_t           sdSearchCount = 0;                     // entries in sdSearchIndex, 0 if not built
+#ifdef SD_LIBRARY
+bool              sdLibEnabled = false;                  // music library from ID3 tags ("sd_library")
+bool              sdLibReq = false;                      // load or build library when possible
+bool              sdLibActive = false;                   // library build running
+bool              sdLibReady = false;                    // SDLIB_FILE belongs to mp3nodeList
+sdlib_head_struct sdLibHead;                             // its header
+int16_t           sdLibNode = 0;                         // next node to read the tags from
+uint32_t          sdLibTime = 0;                         // last track indexed
+uint32_t          sdLibStartTime = 0;                    // start of library build
+sdlib_tags_t*     sdLibTags = NULL;                      // tags read so far while building
+uint16_t          sdLibCount = 0, sdLibMax = 0;          // tags used/allocated
+char*             sdLibPool = NULL;                      // their strings
+uint32_t          sdLibPoolLen = 0, sdLibPoolMax = 0;    // string bytes used/allocated
+#endif
+uint32_t          sdScanTime;                            // start of SD scan
 bool              forceProgressBar = false;              // request progress bar to be painted
-std::vector<mp3node_t> mp3nodeList;
+mp3nodetable      mp3nodeList;                          // Directories and mp3 files on SD card
+mp3nodetable      sdLoadList;                           // Loaded from SDINDEX_FILE by spfTask
+volatile bool     sdLoadDone = false;                    // sdLoadList complete, loop() takes it
+uint16_t          sdLoadFiles;                           // Number of mp3 files in sdLoadList
+uint32_t          sdLoadId;                              // Checksum of the index it came from
 #ifndef USE_ETHERNET
 std::vector<WifiInfo_t> wifilist;                        // List with wifi_xx info
 #else
@@ -636,9 +1129,12 @@ class VS1053
     const uint8_t SCI_STATUS        = 0x1;       // 80 CLKI
     const uint8_t SCI_BASS          = 0x2;       // 80 CLKI
     const uint8_t SCI_CLOCKF        = 0x3;       // 1200 XTALI -> 98us
+    const uint8_t SCI_DECODE_TIME   = 0x4;       // 100 CLKI -> 2.32us
     const uint8_t SCI_AUDATA        = 0x5;       // 450 CLKI -> 10.46us
     const uint8_t SCI_WRAM          = 0x6;       // 100 CLKI -> 2.32us
     const uint8_t SCI_WRAMADDR      = 0x7;       // 100 CLKI
+    const uint8_t SCI_HDAT0         = 0x8;       // 80 CLKI
+    const uint8_t SCI_HDAT1         = 0x9;       // 80 CLKI
     const uint8_t SCI_AIADDR        = 0xA;       // 210 CLKI -> 4.88us
     const uint8_t SCI_VOL           = 0xB;       // 80 CLKI
     const uint8_t SCI_AICTRL0       = 0xC;       // 80 CLKI
@@ -655,9 +1151,18 @@ class VS1053
     // SCI_STATUS bits
     const uint16_t SS_VU_ENABLE     = 0x0200;    // Enables VU-Meter (needs newest patches)
     const uint16_t SS_REFERENCE_SEL = 0x0101;    // Sets higher reference voltage 1.65V instead of 1.3V
+    // Parametric structure in X memory
+    const uint16_t PAR_BYTERATE     = 0x1E05;    // Average data speed in bytes/sec
+    const uint16_t PAR_ENDFILLBYTE  = 0x1E06;    // Byte to send at end of stream
+#ifdef SPECTRUM_ANALYZER
+    // Spectrum analyzer plugin in X memory
+    const uint16_t SPC_NBANDS       = 0x1802;    // Number of active bands
+    const uint16_t SPC_VALUES       = 0x1804;    // Band values, bits 5:0 = level
+#endif
     SPISettings   VS1053_SPI;                    // SPI settings for this slave
     uint8_t       endFillByte;                   // Byte to send when stopping song
     bool          okay              = true;      // VS1053 is working
+    bool          patched           = false;     // Patch loaded and verified
 
   protected:
     inline void await_data_request(unsigned long maxDelay_us = 0) const
@@ -702,11 +1207,15 @@ class VS1053
     // if max delay is 0 then below routines will only return when DREQ is HIGH again !
     uint16_t    read_register(uint8_t _reg, unsigned long maxDelay_us = 0) const;
     void        write_register(uint8_t _reg, uint16_t _value, unsigned long maxDelay_us = 0) const;
+    // SCI multiple write: CS stays LOW, all words go to the same register (datasheet: SCI Multiple Write)
+    void        sci_write_multiple(uint8_t _reg, const uint16_t* _values, size_t n) const;
+    void        sci_fill_multiple(uint8_t _reg, uint16_t _value, size_t n) const;
     //
     inline bool sdi_send_buffer(uint8_t* data, size_t len);
     void        sdi_send_fillers(size_t length);
     void        wram_write(uint16_t address, uint16_t data);
     uint16_t    wram_read(uint16_t address);
+    void        setClock();                      // Raise VS1053 clock, then switch to fast SPI
 
   public:
     // Constructor.  Only sets pin values.  Doesn't touch the chip.  Be sure to call begin()!
@@ -737,11 +1246,21 @@ class VS1053
       return (digitalRead(dreq_pin) == HIGH);
     }
 #ifdef LOAD_VS1053_PATCH
-    void     loadVS1053Patch(void);
+    bool     loadPlugin(const unsigned short* image,    // Upload compressed plugin image,
+                        size_t size, const char* name); // returns false if read back failed
+    bool     loadVS1053Patch(void);                     // Returns false if read back failed
 #endif
 #if defined VU_METER && defined LOAD_VS1053_PATCH
     uint16_t readVuMeter();
 #endif
+#ifdef SPECTRUM_ANALYZER
+    void     readSpectrum(uint16_t* buf);               // Band count, then SPECTRUM_BANDS levels
+#endif
+    void     readTelemetry(vstelemetry_struct* t);     // Read codec, rates and decode time
+    // Block read of X/Y WRAM, address is set once and auto-incremented by the VS1053.
+    // SPI bus must be claimed, while playing n must not exceed WRAM_MAX_BURST.
+    void     wram_read_block(uint16_t address, uint16_t* data, size_t n);
+    void     resetDecodeTime();                         // Restart counting decoded seconds
 };
 
 //**************************************************************************************************
@@ -749,7 +1268,7 @@ class VS1053
 //**************************************************************************************************
 
 VS1053::VS1053(int8_t _cs_pin, int8_t _dcs_pin, int8_t _dreq_pin, int8_t _shutdown_pin) :
-  cs_pin(_cs_pin), dcs_pin(_dcs_pin), dreq_pin(_dreq_pin), shutdown_pin(_shutdown_pin)
+  cs_pin(_cs_pin), dcs_pin(_dcs_pin), dreq_pin(_dreq_pin), shutdown_pin(_shutdown_pin), curvol(0)
 {
 }
 
@@ -778,6 +1297,30 @@ void VS1053::write_register(uint8_t _reg, uint16_t _value, unsigned long maxDela
   control_mode_off();
 }
 
+void VS1053::sci_write_multiple(uint8_t _reg, const uint16_t* _values, size_t n) const
+{
+  control_mode_on();
+  SPI.write(2);                                   // Write operation
+  SPI.write(_reg);                                // Register to write (0..0xF)
+  while (n--) {
+    SPI.write16(*_values++);                      // Send next 16 bits data
+    await_data_request();                         // VS1053 has to process it before the next one
+  }
+  control_mode_off();
+}
+
+void VS1053::sci_fill_multiple(uint8_t _reg, uint16_t _value, size_t n) const
+{
+  control_mode_on();
+  SPI.write(2);                                   // Write operation
+  SPI.write(_reg);                                // Register to write (0..0xF)
+  while (n--) {
+    SPI.write16(_value);                          // Send same 16 bits data again
+    await_data_request();                         // VS1053 has to process it before the next one
+  }
+  control_mode_off();
+}
+
 bool VS1053::sdi_send_buffer(uint8_t* data, size_t len)
 {
   size_t chunk_length;                            // Length of chunk 32 byte or shorter
@@ -828,6 +1371,15 @@ uint16_t VS1053::wram_read(uint16_t address)
   return read_register(SCI_WRAM);                    // Read back result
 }
 
+void VS1053::wram_read_block(uint16_t address, uint16_t* data, size_t n)
+{
+  if (!okay) return;
+  write_register(SCI_WRAMADDR, address, 3);          // Set start address once
+  while (n--) {
+    *data++ = read_register(SCI_WRAM, 3);            // Address increments with every read
+  }
+}
+
 // write_register() is already defined at this point
 #ifdef LOAD_VS1053_PATCH
 #include "VS1053_patch.h"
@@ -871,6 +1423,24 @@ bool VS1053::testComm(const char *header)
   return (okay);                                       // Return the result
 }
 
+// The clock multiplier allows faster SPI clocking.  SCI_CLOCKF is written with slow SPI, as the
+// clock may have fallen back to XTALI after a reset.
+void VS1053::setClock()
+{
+  VS1053_SPI = SPISettings(200000, MSBFIRST, SPI_MODE0);
+#if defined VU_METER && defined LOAD_VS1053_PATCH
+  // CLKI = XTALI * 3.5, No Multiplier modification allowed, XTALI = 12.288 MHz
+  write_register(SCI_CLOCKF, 8 << 12);
+#else
+  // CLKI = XTALI * 3.0, No Multiplier modification allowed, XTALI = 12.288 MHz
+  write_register(SCI_CLOCKF, 6 << 12);
+#endif
+  delay(10);
+  await_data_request(1000000);                         // wait for DREQ to rise (max 1 sec)
+  // Now we can set high speed SPI clock.
+  VS1053_SPI = SPISettings(5000000, MSBFIRST, SPI_MODE0);   // Speed up SPI
+}
+
 void VS1053::begin()
 {
   pinMode(dreq_pin, INPUT);                            // DREQ is an input
@@ -897,32 +1467,44 @@ void VS1053::begin()
     //
     delay(100);
     softReset();                                       // do a soft reset
+    setClock();                                        // fast SPI for the patch upload
 #ifdef LOAD_VS1053_PATCH
     dbgprint("VS1053B loading patch %s", PATCH_VERSION); // patch must be loaded >after< reset/sw reset
     delay(20);
-    loadVS1053Patch();
+    patched = loadVS1053Patch();
+    if (!patched) {                                    // verify failed, try once more
+      dbgprint("VS1053B patch verify error, loading again");
+      softReset();
+      setClock();
+      delay(20);
+      patched = loadVS1053Patch();
+    }
+    if (!patched) {                                    // a damaged patch may hang the decoder
+      dbgprint("VS1053B patch verify error again, running without patch");
+      softReset();                                     // remove what was loaded
+      setClock();
+      delay(20);
+    }
+#ifdef SPECTRUM_ANALYZER
+    // spectrum analyzer plugin runs together with patch V2.7, load it afterwards
+    if (patched &&
+        !loadPlugin(spectrum_plugin, sizeof(spectrum_plugin)/sizeof(spectrum_plugin[0]),
+                    "spectrum analyzer")) {
+      dbgprint("VS1053B spectrum analyzer verify error");
+    }
+#endif
     delay(10);
     await_data_request(2000000);                       // wait for DREQ to rise (max 2sec)
 #endif    
     // Switch on the analog parts
     write_register(SCI_AUDATA, 44100 + 1);             // 44.1kHz + stereo
-    // The next clocksetting allows higher SPI clocking
-#if defined VU_METER && defined LOAD_VS1053_PATCH
-    // CLKI = XTALI * 3.5, No Multiplier modification allowed, XTALI = 12.288 MHz
-    write_register(SCI_CLOCKF, 8 << 12);
-#else
-    // CLKI = XTALI * 3.0, No Multiplier modification allowed, XTALI = 12.288 MHz
-    write_register(SCI_CLOCKF, 6 << 12);
-#endif
-    delay(10);
-    await_data_request(1000000);                       // wait for DREQ to rise (max 1 sec)
-    // Now we can set high speed SPI clock.
-    VS1053_SPI = SPISettings (5000000, MSBFIRST, SPI_MODE0);   // Speed up SPI
     write_register(SCI_MODE, _BV (SM_SDINEW) | _BV (SM_LINE1));
     testComm("Fast SPI, Testing VS1053 read/write registers again...");
     delay(10);
     await_data_request(1000000);                       // wait for DREQ to rise (max 1sec)
-    endFillByte = wram_read(0x1E06) & 0xFF;
+    write_register(SCI_VOL, 0xF8F8);                   // start silent, volRampStep() will fade in
+    curvol = 0;
+    endFillByte = wram_read(PAR_ENDFILLBYTE) & 0xFF;
     dbgprint("VS1053B endFillByte is %X", endFillByte);
     uint16_t stat = read_register(SCI_STATUS);
     dbgprint("VS1053B Status Register = 0x%04X", stat);
@@ -938,10 +1520,12 @@ void VS1053::begin()
 #endif    
 #if defined VU_METER && defined LOAD_VS1053_PATCH
     // patch V2.7 is needed to get VU meter feature
-    dbgprint("VS1053B setting VU-Meter bit [see VS1053-patches.pdf, Chapter 1.2]");
-    write_register(SCI_STATUS, stat | SS_VU_ENABLE);
-    stat = read_register(SCI_STATUS);
-    dbgprint("VS1053B Status Register now = 0x%04X", stat);
+    if (patched) {
+      dbgprint("VS1053B setting VU-Meter bit [see VS1053-patches.pdf, Chapter 1.2]");
+      write_register(SCI_STATUS, stat | SS_VU_ENABLE);
+      stat = read_register(SCI_STATUS);
+      dbgprint("VS1053B Status Register now = 0x%04X", stat);
+    }
 #endif
 #ifdef ENABLE_I2S
     // Enabling I2S with MCLK output and sample rate 48kHz 
@@ -987,6 +1571,7 @@ void VS1053::setTone(uint8_t *rtone)                   // Set bass/treble (4 nib
 
 void VS1053::startSong()
 {
+  resetDecodeTime();                                   // Count decoded seconds from here
   sdi_send_fillers (10);
   if (shutdown_pin >= 0) {                             // Shutdown in use?
     digitalWrite(shutdown_pin, LOW);                   // Enable audio output
@@ -1015,6 +1600,7 @@ void VS1053::stopSong()
     modereg = read_register(SCI_MODE, 3);              // Read status
     if ((modereg & _BV (SM_CANCEL)) == 0) {
       sdi_send_fillers(2052);
+      resetDecodeTime();                               // Next song starts at 0 sec
       //dbgprint("Song stopped correctly after %d msec", i * 10);
       return;
     }
@@ -1050,10 +1636,60 @@ void VS1053::printDetails(const char *header)
 #if defined VU_METER && defined LOAD_VS1053_PATCH
 uint16_t VS1053::readVuMeter()
 {
-  return okay ? read_register(SCI_AICTRL3, 3) : 0;         // Read back VU-Meter result
+  return (okay && patched) ? read_register(SCI_AICTRL3, 3) : 0; // Read back VU-Meter result
+}
+#endif
+
+#ifdef SPECTRUM_ANALYZER
+void VS1053::readSpectrum(uint16_t* buf)
+{
+  // one burst from the band count up to the last band value
+  wram_read_block(SPC_NBANDS, buf, SPC_VALUES - SPC_NBANDS + SPECTRUM_BANDS);
 }
 #endif
 
+void VS1053::readTelemetry(vstelemetry_struct* t)
+{
+  // Read stream info while playing. Short timeouts as DREQ may be LOW with a full FIFO.
+  uint16_t hdat0, hdat1, audata;
+
+  if (!okay) return;
+  t->decodetime = read_register(SCI_DECODE_TIME, 3);       // Seconds decoded
+  audata = read_register(SCI_AUDATA, 3);                   // Sample rate and stereo bit
+  hdat0 = read_register(SCI_HDAT0, 3);
+  hdat1 = read_register(SCI_HDAT1, 3);                     // Format of stream
+  wram_read_block(PAR_BYTERATE, &t->byterate, 1);         // Average data rate from parametric
+                                                           // structure, valid for all formats
+  t->samplerate = audata & 0xFFFE;
+  if (hdat1 >= 0xFFE0) {                                   // MPEG audio, bits 2:1 give layer
+    static const char* layers[] = { "MP?", "MP3", "MP2", "MP1" };
+    t->codec = layers[(hdat1 >> 1) & 3];
+  }
+  else {
+    switch (hdat1) {
+      case 0x7665: t->codec = "WAV";  break;
+      case 0x4154:                                         // ADTS
+      case 0x4144:                                         // ADIF
+      case 0x4D34: t->codec = "AAC";  break;               // MP4
+      case 0x574D: t->codec = "WMA";  break;
+      case 0x4F67: t->codec = "OGG";  break;
+      case 0x664C: t->codec = "FLAC"; break;
+      case 0x4D54: t->codec = "MIDI"; break;
+      default:     t->codec = "";     break;               // Nothing decoded (yet)
+    }
+    if (t->byterate == 0 && hdat1 != 0) {                  // No average yet?
+      t->byterate = hdat0;                                 // HDAT0 holds bytes/sec for these formats
+    }
+  }
+  t->bitrate = ((uint32_t)t->byterate * 8 + 500) / 1000;  // bytes/sec to kbps
+}
+
+void VS1053::resetDecodeTime()
+{
+  write_register(SCI_DECODE_TIME, 0, 3);                   // Has to be written twice
+  write_register(SCI_DECODE_TIME, 0, 3);                   // (see datasheet, chapter 9.6.5)
+}
+
 // The object for the MP3 player
 VS1053* vs1053player;
 
@@ -1185,77 +1821,326 @@ void releaseSPI()
 }
 
 //**************************************************************************************************
-//                                      Q U E U E F U N C                                          *
+//                                        C L A I M S D                                            *
 //**************************************************************************************************
-// Queue a special function for the play task.                                                     *
+// Claim the SD card for reading mp3file.  On the SPI bus that is the SPI bus itself.  On the      *
+// SD/MMC bus the card has a semaphore of its own, so the read ahead of sdReadTask does not wait   *
+// for VS1053 and TFT transfers.                                                                   *
 //**************************************************************************************************
-void queuefunc(int func)
+void claimSD(const char* p)
 {
-  qdata_struct specchunk;                              // Special function to queue
+  const TickType_t ctry = 10;                         // Time to wait for semaphore (10ms)
 
-  specchunk.datatyp = func;                            // Put function in datatyp
-  xQueueSend(dataQueue, &specchunk, 200);              // Send to queue
+  if (!sdMmc) {
+    claimSPI(p);                                      // SD card on SPI bus
+    return;
+  }
+  while (xSemaphoreTake(SDsem, ctry) != pdTRUE) {     // claim SD card
+    //...
+  }
 }
 
 //**************************************************************************************************
-//                                      N V S S E A R C H                                          *
+//                                     R E L E A S E S D                                           *
 //**************************************************************************************************
-// Check if key exists in nvs.                                                                     *
+// Free the SD card.                                                                               *
 //**************************************************************************************************
-bool nvsSearch(const char* key)
+void releaseSD()
 {
-  size_t len = NVSBUFSIZE;                              // Length of the string
+  if (!sdMmc) {
+    releaseSPI();                                     // SD card on SPI bus
+    return;
+  }
+  xSemaphoreGive(SDsem);                              // release SD card
+}
 
-  nvsopen();                                            // Be sure to open nvs
-  nvserr = nvs_get_str(nvshandle, key, NULL, &len);     // Get length of contents
-  return (nvserr == ESP_OK);                            // Return true if found
+//**************************************************************************************************
+//                                    S D C O N F I G U R E D                                      *
+//**************************************************************************************************
+// An SD card is configured if it has a CS pin on the SPI bus or if it is on the SD/MMC bus.       *
+//**************************************************************************************************
+bool sdConfigured()
+{
+  return sdMmc || ini_block.sd_cs_pin >= 0;
 }
 
 //**************************************************************************************************
-//                                      T F T S E T                                                *
+//                                          S D B E G I N                                          *
 //**************************************************************************************************
-// Request to display a segment on TFT.  Version for char* and String parameter.                   *
+// Mounts the SD card on the SPI bus or, with "sd_mmc = 1" or "sd_mmc = 4", on the SD/MMC bus in   *
+// 1 or 4 bit mode.  The SD/MMC bus has fixed pins: CLK 14, CMD 15, D0 2, D1 4, D2 12 and D3 13,   *
+// 1 bit mode uses CLK, CMD and D0 only.  All file access goes through sdfs afterwards.            *
 //**************************************************************************************************
-void tftset(uint16_t inx, const char *str)
+bool sdBegin()
 {
-  if (inx < TFTSECS) {                                 // segment available on display ?
-    if (str) {                                         // string specified?
-      tftdata[inx].str = String(str);                  // set string
-    }
-    tftdata[inx].update_req = true;                    // and request update
+#ifdef SD_MMC_BUS
+  if (sdMmc) {
+    sdfs = &SD_MMC;
+    return SD_MMC.begin("/sdcard", sdMmc == 1);       // mode1bit
   }
+#endif
+  sdfs = &SD;
+  return SD.begin(ini_block.sd_cs_pin, SPI, SDSPEED);
 }
 
-void tftset(uint16_t inx, String& str)
+//**************************************************************************************************
+//                                            S D E N D                                            *
+//**************************************************************************************************
+// Unmounts the SD card.                                                                           *
+//**************************************************************************************************
+void sdEnd()
 {
-  tftdata[inx].str = str;                              // set string
-  tftdata[inx].update_req = true;                      // and request update
+#ifdef SD_MMC_BUS
+  if (sdMmc) {
+    SD_MMC.end();
+    return;
+  }
+#endif
+  SD.end();
 }
 
 //**************************************************************************************************
-//                                      U T F 8 A S C I I                                          *
+//                                      S D C A R D T Y P E                                        *
 //**************************************************************************************************
-// UTF8-Decoder: convert UTF8-string to extended ASCII.                                            *
-// Convert a single Character from UTF8 to Extended ASCII.                                         *
-// Return "0" if a byte has to be ignored.                                                         *
+// Type of the mounted card, CARD_NONE if there is none.                                           *
 //**************************************************************************************************
-byte utf8ascii(byte ascii)
+sdcard_type_t sdCardType()
 {
-  static const byte lut_C3[] = { "AAAAAAACEEEEIIIIDNOOOOO#0UUUU##Baaaaaaaceeeeiiiidnooooo##uuuuyyy" };
-  static byte       c1;              // Last character buffer
-  byte              res = 0;         // Result, default 0
+#ifdef SD_MMC_BUS
+  if (sdMmc) {
+    return SD_MMC.cardType();
+  }
+#endif
+  return SD.cardType();
+}
 
-  if (ascii <= 0x7F) {               // Standard ASCII-set 0..0x7F handling
-    c1 = 0;  res = ascii;            // Return unmodified
+//**************************************************************************************************
+//                                     S D U S E D B Y T E S                                       *
+//**************************************************************************************************
+// Bytes in use on the mounted card.                                                               *
+//**************************************************************************************************
+uint64_t sdUsedBytes()
+{
+#ifdef SD_MMC_BUS
+  if (sdMmc) {
+    return SD_MMC.usedBytes();
   }
-  else if ((c1 != 0xC3) && (ascii == 0xC9)) {
-    c1 = 0;  res = 'E';              // É
+#endif
+  return SD.usedBytes();
+}
+
+//**************************************************************************************************
+//                                       S D R E A D R A W                                         *
+//**************************************************************************************************
+// Reads one raw sector of the card.  Only possible on the SPI bus, SD_MMC has no such function.   *
+//**************************************************************************************************
+bool sdReadRaw(uint8_t* buf, uint32_t sector)
+{
+  if (sdMmc) {
+    return false;
   }
-  else if ((c1 != 0xC3) && (ascii == 0x84 || ascii == 0x86 || ascii == 0xE0 || ascii == 0xE1 || ascii == 0xE4 || ascii == 0xE5)) {
-    c1 = 0;  res = 'a';              // à, á, å oder ä
+  return SD.readRAW(buf, sector);
+}
+
+//**************************************************************************************************
+//                                      Q U E U E F U N C                                          *
+//**************************************************************************************************
+// Queue a special function for the play task.  Waits max. "wait" ticks for space in the queue.    *
+//**************************************************************************************************
+bool queuefunc(int func, TickType_t wait = 200)
+{
+  qdata_struct specchunk;                              // Special function to queue
+
+  specchunk.datatyp = func;                            // Put function in datatyp
+  return xQueueSend(dataQueue, &specchunk, wait) == pdTRUE; // Send to queue
+}
+
+//**************************************************************************************************
+//                                   Q U E U E N E W T R A C K                                     *
+//**************************************************************************************************
+// Gapless: the decode time of the next track starts when playTask sees QNEWTRACK.  Does not wait  *
+// for space in the queue, if it is full mp3loop() tries again before queueing more data.          *
+//**************************************************************************************************
+void queueNewTrack()
+{
+  decodeResetQueued = true;                            // progress from bytes read until then
+  newTrackPending = !queuefunc(QNEWTRACK, 0);
+}
+
+//**************************************************************************************************
+//                                     P L A Y S E C O N D S                                       *
+//**************************************************************************************************
+// Seconds played of the current track.  The VS1053 counts from the last seek or gapless start,    *
+// the time up to that position (decodeBase) is added if the data rate is known.                   *
+//**************************************************************************************************
+uint32_t playSeconds()
+{
+  uint32_t secs = vstelemetry.decodetime;              // Counted by the VS1053
+
+  if (vstelemetry.byterate && !decodeResetQueued) {    // Base refers to this track?
+    secs += decodeBase / vstelemetry.byterate;
   }
-  else if ((c1 != 0xC3) && (ascii == 0xE7)) {
-    c1 = 0;  res = 'c';              // ç
+  return secs;
+}
+
+//**************************************************************************************************
+//                                        V O L R A M P                                            *
+//**************************************************************************************************
+// Request a volume ramp of the given kind. The output fades out, stays silent for the hold time   *
+// of the curve and fades in again. The ramp itself is executed by volRampStep() in playTask.      *
+//**************************************************************************************************
+void volRamp(enum_volramp kind)
+{
+  rampDownTime = volramp[kind].down;                   // Take over fade times of this curve
+  rampUpTime = volramp[kind].up;
+  if (volramp[kind].hold) {                            // Silence requested?
+    rampHoldUntil = millis() + volramp[kind].down +    // Yes, fade out first, then hold
+                    volramp[kind].hold;
+  }
+}
+
+//**************************************************************************************************
+//                                  V O L R A M P T A R G E T                                      *
+//**************************************************************************************************
+// Volume the ramp has to reach: the requested volume, or 0 if muted, during a hold time or if     *
+// fadeout is set.                                                                                 *
+//**************************************************************************************************
+int16_t volRampTarget(bool fadeout = false)
+{
+  int16_t target = 0;                                  // Volume to reach
+
+  if (!fadeout && !muteFlag &&                         // Output wanted and
+      (int32_t)(rampHoldUntil - millis()) <= 0) {      // no hold time active?
+    target = (currentSource == SDCARD) ? (ini_block.reqvol + 8) : ini_block.reqvol; // increase loudness when playing mp3 files
+    if (target > 100) target = 100;
+  }
+  return target;
+}
+
+//**************************************************************************************************
+//                                    V O L R A M P S T E P                                        *
+//**************************************************************************************************
+// Move the VS1053 volume one step towards the requested volume. Called from playTask between two  *
+// SDI chunks with the SPI bus already claimed, so no extra polling or SPI transaction is needed.  *
+// If no data arrives playTask claims the bus for the step, so pause and mute are handled as well. *
+// Steps are not done faster than one mp3 frame time (VOLRAMP_STEP). The volume moves linear in    *
+// dB between VOLRAMP_FLOOR and the target, below VOLRAMP_FLOOR the output is switched off.        *
+// If fadeout is set the target is 0. Returns true as long as the target has not been reached.     *
+//**************************************************************************************************
+bool volRampStep(bool fadeout = false)
+{
+  static uint32_t lastStep = 0;                        // Time of last volume step
+  uint32_t        now = millis();
+  int16_t         curvol = vs1053player->getVolume();  // Volume as set in VS1053
+  int16_t         target = volRampTarget(fadeout);     // Volume to reach
+  int16_t         step;                                // Volume change per step
+  uint16_t        ramptime;                            // Time for a complete ramp
+
+  if (target == curvol) {
+    return false;                                      // Nothing to do
+  }
+  if ((now - lastStep) < VOLRAMP_STEP) {               // Next step due?
+    return true;                                       // No, wait for the next frame
+  }
+  lastStep = now;
+  ramptime = (target > curvol) ? rampUpTime : rampDownTime;
+  step = ramptime ? ((100 - VOLRAMP_FLOOR) * VOLRAMP_STEP / ramptime) : 100;
+  if (step < 1) step = 1;
+  if (target > curvol) {                               // Fade in
+    curvol = ((curvol < VOLRAMP_FLOOR) ? VOLRAMP_FLOOR : curvol) + step;
+    if (curvol > target) curvol = target;
+  }
+  else {                                               // Fade out
+    curvol -= step;
+    if (curvol < target || curvol <= VOLRAMP_FLOOR) curvol = target;
+  }
+  vs1053player->setVolume(curvol);                     // Set new volume
+  return (curvol != target);
+}
+
+//**************************************************************************************************
+//                                  R E A D T E L E M E T R Y                                      *
+//**************************************************************************************************
+// Update vstelemetry (codec, sample rate, bitrate, decode time) from the VS1053 every             *
+// TELEMETRY_INTERVAL ms. Called in the SPI window of the VU-meter read or from handle_spec() if   *
+// there is no VU-meter. The SPI bus is already claimed.                                           *
+//**************************************************************************************************
+void readTelemetry()
+{
+  static uint32_t lastRead = 0;                        // Time of last read
+
+  if (decodeTimeReset) {                               // Jump in file happened?
+    decodeTimeReset = false;
+    vs1053player->resetDecodeTime();                   // Yes, count from new position
+  }
+  if ((millis() - lastRead) < TELEMETRY_INTERVAL) {    // Time for next read?
+    return;                                            // No, keep SPI window short
+  }
+  lastRead = millis();
+  vs1053player->readTelemetry(&vstelemetry);           // Read info from VS1053
+}
+
+//**************************************************************************************************
+//                                      N V S S E A R C H                                          *
+//**************************************************************************************************
+// Check if key exists in nvs.                                                                     *
+//**************************************************************************************************
+bool nvsSearch(const char* key)
+{
+  size_t len = NVSBUFSIZE;                              // Length of the string
+
+  nvsopen();                                            // Be sure to open nvs
+  nvserr = nvs_get_str(nvshandle, key, NULL, &len);     // Get length of contents
+  return (nvserr == ESP_OK);                            // Return true if found
+}
+
+//**************************************************************************************************
+//                                      T F T S E T                                                *
+//**************************************************************************************************
+// Request to display a segment on TFT.  Version for char* and String parameter.                   *
+//**************************************************************************************************
+void tftset(uint16_t inx, const char *str)
+{
+  HEAP_TAG("tftset");
+  if (inx < TFTSECS) {                                 // segment available on display ?
+    if (str) {                                         // string specified?
+      tftdata[inx].str = String(str);                  // set string
+    }
+    tftdata[inx].update_req = true;                    // and request update
+  }
+}
+
+void tftset(uint16_t inx, String& str)
+{
+  HEAP_TAG("tftset");
+  tftdata[inx].str = str;                              // set string
+  tftdata[inx].update_req = true;                      // and request update
+}
+
+//**************************************************************************************************
+//                                      U T F 8 A S C I I                                          *
+//**************************************************************************************************
+// UTF8-Decoder: convert UTF8-string to extended ASCII.                                            *
+// Convert a single Character from UTF8 to Extended ASCII.                                         *
+// Return "0" if a byte has to be ignored.                                                         *
+//**************************************************************************************************
+byte utf8ascii(byte ascii)
+{
+  static const byte lut_C3[] = { "AAAAAAACEEEEIIIIDNOOOOO#0UUUU##Baaaaaaaceeeeiiiidnooooo##uuuuyyy" };
+  static byte       c1;              // Last character buffer
+  byte              res = 0;         // Result, default 0
+
+  if (ascii <= 0x7F) {               // Standard ASCII-set 0..0x7F handling
+    c1 = 0;  res = ascii;            // Return unmodified
+  }
+  else if ((c1 != 0xC3) && (ascii == 0xC9)) {
+    c1 = 0;  res = 'E';              // É
+  }
+  else if ((c1 != 0xC3) && (ascii == 0x84 || ascii == 0x86 || ascii == 0xE0 || ascii == 0xE1 || ascii == 0xE4 || ascii == 0xE5)) {
+    c1 = 0;  res = 'a';              // à, á, å oder ä
+  }
+  else if ((c1 != 0xC3) && (ascii == 0xE7)) {
+    c1 = 0;  res = 'c';              // ç
   }
   else if ((c1 != 0xC3) && (ascii == 0x82 || ascii == 0xD9 || ascii == 0xE9 || ascii == 0xEB)) {
     c1 = 0;  res = 'e';              // é, ë
@@ -1342,32 +2227,6 @@ String utf8ascii(const char *s)
   return String(buf);
 }
 
-//**************************************************************************************************
-//                                      U T F 16 A S C I I                                         *
-//**************************************************************************************************
-// For encoding ID3-Tags                                                                           *
-//**************************************************************************************************
-void utf16ascii(char *s, int length)
-{
-  int  i, k = 0;
-
-  if (s[0] == 0xFF && s[1] == 0xFE) {       // Little Endian
-    i = 2;
-  }
-  else if (s[0] == 0xFE && s[1] == 0xFF) {  // Big Endian
-    i = 3;
-  }
-  else {
-    //dbgprint("utf16ascii: ID3-Tag UTF16-Format not recognized 0x%02x 0x%02x", s[0], s[1]);
-    return;
-  }
-  for (; i < length;) {
-    s[k++] = s[i];                          // put in output string
-    i += 2;
-  }
-  s[k] = 0;                                 // Take care of delimeter
-}
-
 //**************************************************************************************************
 //                                          D B G P R I N T                                        *
 //**************************************************************************************************
@@ -1407,6 +2266,21 @@ char* dbgprint(const char* format, ...)
   return sbuf;                                         // Return stored string
 }
 
+//**************************************************************************************************
+//                                   D B G P R I N T L I N E S                                     *
+//**************************************************************************************************
+// Sends a multi line text (tables for "tasks", "heap") line by line through dbgprint().           *
+//**************************************************************************************************
+void dbgprintLines(const String& txt)
+{
+  int start = 0, end;
+
+  while ((end = txt.indexOf('\n', start)) >= 0) {
+    dbgprint("%s", txt.substring(start, end).c_str());
+    start = end + 1;
+  }
+}
+
 #ifdef ENABLE_SOAP
 //**************************************************************************************************
 //                           N E X T S O A P F I L E I N D E X                                     *
@@ -1476,17 +2350,9 @@ int16_t nextSoapFileIndex(int16_t inx, int16_t delta)
 //**************************************************************************************************
 bool noSubDirInSameDir(int16_t inx)
 {
-  int16_t parentDir;
-  
   if (mp3nodeList[inx].isDirectory) return false;
 
-  parentDir = mp3nodeList[inx].parentDir;
-  for (int16_t i = 1; i < mp3nodeList.size(); i++) {
-    if (parentDir == mp3nodeList[i].parentDir && mp3nodeList[i].isDirectory) {
-      return false;
-    }
-  }
-  return true;
+  return mp3nodeList[mp3nodeList[inx].parentDir].dirs == 0;
 }  
 
 //**************************************************************************************************
@@ -1498,9 +2364,6 @@ bool noSubDirInSameDir(int16_t inx)
 //**************************************************************************************************
 int firstSDindexInDir(int16_t inx)
 {
-  bool    found = false;
-  int16_t i;
-
   if (inx >= mp3nodeList.size()) {
     dbgprint("firstSDindexInDir: error, inx=%d out ouf bounds (0...%d)",
              inx, mp3nodeList.size() - 1);
@@ -1510,14 +2373,10 @@ int firstSDindexInDir(int16_t inx)
     dbgprint("firstSDindexInDir: error, inx=%d is not a directory", inx);
     return 0;
   }
-  for (i = 1; i < mp3nodeList.size(); i++) {
-    if (inx == mp3nodeList[i].parentDir) {
-      found = true;
-      break;
-    }
+  if (mp3nodeList[inx].firstChild < 0) {            // empty directory
+    return inx;
   }
-
-  return found ? i : inx;                           // return new index
+  return mp3nodeList[inx].firstChild;               // return new index
 }
 
 //**************************************************************************************************
@@ -1529,8 +2388,7 @@ int firstSDindexInDir(int16_t inx)
 //**************************************************************************************************
 int nextSDindexInSameDir(int16_t inx, int16_t rotationcount)
 {
-  bool    found = false;
-  int16_t x, dir;
+  int16_t first;                                     // first entry of directory
 
   if (inx >= mp3nodeList.size()) {
     dbgprint("nextSDindexInSameDir: error, inx=%d out ouf bounds (0...%d)",
@@ -1538,19 +2396,18 @@ int nextSDindexInSameDir(int16_t inx, int16_t rotationcount)
     return 0;
   }
   if (inx != 0) {                                    // Random playing?
-    x = inx;
-    dir = mp3nodeList[x].parentDir;
-    rotationcount = (rotationcount > 0) ? 1 : -1;
-    x += rotationcount;
-    for (; x > 0 && x < mp3nodeList.size(); x += rotationcount) {
-      if (dir == mp3nodeList[x].parentDir) {
-        found = true;
-        break;
+    first = mp3nodeList[mp3nodeList[inx].parentDir].firstChild;
+    if (rotationcount > 0) {
+      if (mp3nodeList[inx].nextSibling != first) {   // no wrap at end of directory
+        inx = mp3nodeList[inx].nextSibling;
       }
     }
+    else if (inx != first) {                         // no wrap at begin of directory
+      inx = mp3nodeList[inx].prevSibling;
+    }
   }
 
-  return found ? x : inx;                           // return new index
+  return inx;                                       // return new index
 }
 
 //**************************************************************************************************
@@ -1562,7 +2419,6 @@ int nextSDindexInSameDir(int16_t inx, int16_t rotationcount)
 //**************************************************************************************************
 int nextSDfileIndexInSameDir(int16_t inx, int16_t delta)
 {
-  int16_t currentDir;
 
   dbgprint("nextSDfileIndexInSameDir: current index is %d", inx);
   if (inx >= mp3nodeList.size()) {
@@ -1571,26 +2427,16 @@ int nextSDfileIndexInSameDir(int16_t inx, int16_t delta)
     return 0;
   }
   if (inx != 0) {                                   // Random playing?
-    currentDir = mp3nodeList[inx].parentDir;        // current directory we are playing from
-    if (delta > 0) {
-      while (true) {
-        inx++;
-        if (inx >= mp3nodeList.size())
-          inx = 0;
-        if (!mp3nodeList[inx].isDirectory &&
-             currentDir == mp3nodeList[inx].parentDir)
-          break;                                    // we found next file index
+    if (mp3nodeList[inx].isDirectory) {             // no file, take first file of its directory
+      if (mp3nodeList[mp3nodeList[inx].parentDir].firstFile >= 0) {
+        inx = mp3nodeList[mp3nodeList[inx].parentDir].firstFile;
       }
     }
+    else if (delta > 0) {
+      inx = mp3nodeList[inx].nextFile;              // wraps to first file of directory
+    }
     else {
-      while (true) {
-        inx--;
-        if (inx == 0)
-          inx = mp3nodeList.size() - 1;
-        if (!mp3nodeList[inx].isDirectory &&
-            currentDir == mp3nodeList[inx].parentDir)
-          break;                                    // we found previous file index
-      }
+      inx = mp3nodeList[inx].prevFile;              // wraps to last file of directory
     }
   }
   dbgprint("nextSDfileIndexInSameDir: return=%d", inx);
@@ -1602,10 +2448,13 @@ int nextSDfileIndexInSameDir(int16_t inx, int16_t delta)
 //**************************************************************************************************
 // Select the next or previous mp3 file from SD. We wrap around if needed. If parameter inx is 0   *
 // we select the first mp3 file on SD card. Delta is +1 or -1 for next or previous track. The new  *
-// nodeIndex will be returned.                                                                     *
+// nodeIndex will be returned.  The files of a directory and the directories having files are      *
+// circular lists in scan order, so no other nodes are visited.                                    *
 //**************************************************************************************************
 int nextSDfileIndex(int16_t inx, int16_t delta)
 {
+  int16_t dir;                                      // directory of the file
+
   if (hostreq) return 0;                            // no action when host request already set
 
   if (inx >= mp3nodeList.size()) {
@@ -1613,5517 +2462,8785 @@ int nextSDfileIndex(int16_t inx, int16_t delta)
                inx, mp3nodeList.size() - 1);
     return 0;
   }
+  if (inx < 0) {                                    // nothing selected yet
+    inx = 0;
+  }
   dbgprint("nextSDfileIndex: inx=%d delta=%d", inx, delta);
-  if (inx != 0) {                                   // random playing?
-    while (true) {
-      if (delta > 0) {
-        inx++;
-        if (inx >= mp3nodeList.size()) inx = 0;
-      }
-      else {
-        inx--;
-        if (inx < 0) inx = mp3nodeList.size() - 1;
-      }
-      if (!mp3nodeList[inx].isDirectory) break;
+  if (mp3nodeList.firstFileDir() < 0) {             // no mp3 files at all
+    return inx;
+  }
+  if (mp3nodeList[inx].isDirectory) {               // searching the first mp3 file
+    dir = (inx && mp3nodeList[inx].files) ? inx : mp3nodeList.firstFileDir();
+    inx = mp3nodeList[dir].firstFile;
+  }
+  else if (delta > 0) {
+    dir = mp3nodeList[inx].parentDir;
+    inx = mp3nodeList[inx].nextFile;
+    if (inx == mp3nodeList[dir].firstFile) {        // was last file, take first of next directory
+      inx = mp3nodeList[mp3nodeList[dir].nextFile].firstFile;
     }
   }
-  else { // searching the first mp3 file on SD card
-    for (int x = 1; x < mp3nodeList.size(); x += 1) {
-      if (!mp3nodeList[x].isDirectory) {
-        inx = x;
-        break;
-      }
+  else {
+    dir = mp3nodeList[inx].parentDir;
+    if (inx == mp3nodeList[dir].firstFile) {        // was first file, take last of previous directory
+      inx = mp3nodeList[mp3nodeList[dir].prevFile].firstFile;
     }
+    inx = mp3nodeList[inx].prevFile;
   }
   dbgprint("nextSDfileIndex: return=%d", inx);
   return inx;                                       // return new index
 }
 
 //**************************************************************************************************
-//                                      G E T S D F I L E N A M E                                  *
+//                                      S H U F F L E B U I L D                                    *
 //**************************************************************************************************
-// Translate the mp3fileIndex of a track to the full filename that can be used as a station.       *
-// If index is 0 choose a random track.                                                            *
+// Fill shuffleList with the mp3 files of directory dir (-1 is the whole card) in the order given  *
+// by seed (Fisher-Yates).  The same seed gives the same order, so after a reset we continue where *
+// we left off with only seed and position saved in NVS.                                           *
 //**************************************************************************************************
-String getSDfilename(int inx)
+void shuffleBuild(int16_t dir, uint32_t seed)
 {
-  String        res;                                    // function result
-  int           x, rnd;
-  //const char*   p = "/";                              // points to directory/file
-  mp3node_t     mp3node;
+  int16_t  inx;
+  uint32_t r = seed ? seed : 1;                          // xorshift state, must not be 0
 
-  if (inx == 0) {                                       // random playing ?
-    dbgprint("getSDfilename(0) -> random choice");
-    rnd = random(SD_mp3fileCount);                      // choose a random index
-    int i = 0, ii = 0;
-    while (true) {
-      if (mp3nodeList[ii].isDirectory == false) i++;
-      if (i > rnd) break;
-      ii++;
+  shuffleList.clear();
+  if (dir < 0) {                                         // whole card
+    shuffleList.reserve(SD_mp3fileCount);
+    for (inx = 1; inx < mp3nodeList.size(); inx++) {
+      if (!mp3nodeList[inx].isDirectory) shuffleList.push_back(inx);
     }
-    inx = ii;
-  }
-  dbgprint("getSDfilename requested index is %d", inx);  // show requeste node ID
-  currentIndex = inx;                                    // save current node
-
-  if (inx < 0 || inx > mp3nodeList.size()) {
-    dbgprint("getSDfilename returns error: inx=%d > mp3nodeList.size()=%d or inx=-1", inx, mp3nodeList.size());
-    return "error";
   }
-  mp3node = mp3nodeList[inx];
-  if (mp3node.isDirectory == true) {
-    dbgprint("getSDfilename error: requested file index %d is a directory", inx);
-    return "error";
+  else if (dir < mp3nodeList.size() && (inx = mp3nodeList[dir].firstFile) >= 0) {
+    do {                                                 // circular file list of directory
+      shuffleList.push_back(inx);
+      inx = mp3nodeList[inx].nextFile;
+    } while (inx != mp3nodeList[dir].firstFile);
   }
-  // Building file name (including path): we start with the end and work our way upwards
-  res = String("/") + mp3node.name;
-  while ((x = mp3node.parentDir) != 0) {
-    mp3node = mp3nodeList[x];
-    res = String("/") + mp3node.name + res;
+  for (int i = shuffleList.size() - 1; i > 0; i--) {
+    r ^= r << 13;                                        // xorshift32
+    r ^= r >> 17;
+    r ^= r << 5;
+    std::swap(shuffleList[i], shuffleList[r % (i + 1)]);
   }
-
-  res = String("sdcard") + res;
-  dbgprint("getSDfilename returns: %s", res.c_str());
-  return res;                                             // return full station spec
+  shuffleSeed = seed;
+  shuffleDir = dir;
+  shuffleCount = shuffleList.size();
 }
 
 //**************************************************************************************************
-//                                      L I S T S D T R A C K S                                    *
-//**************************************************************************************************
-// Search all MP3 files on directory of SD card.  Return the number of files found.                *
-// A "node" of max. SD_MAXDEPTH levels (the subdirectory level) will be generated for every file.  *
-// The numbers within the node-array is the sequence number of the file/directory in that          *
-// subdirectory.                                                                                   *
-// The list will be stored in sdOutbuf if parameter "send" is true. sdOutbuf can later be send     *
-// to the webinterface if requested.                                                               *
-//**************************************************************************************************
-int listsdtracks(const char *dirname, int level = 0, bool send = true, int parentDirNodeId = 0)
-{
-  static int16_t  fcount, oldfcount;                   // total number of files
-  static int16_t  mp3nodeIndex;
-  File            root, file;                          // handle to root and directory entry
-  String          filename;                            // copy of filename
-  String          tmpstr, tmpstr1;
-  String          lastDir;
-  bool            lastEntryWasDir;
-  static bool     delimiterJustAdded = true;
-  int16_t         x, mp3nodeIndexThis;
-  int             inx;
-  mp3node_t       mp3node;
-
-  if (strstr(dirname, "System Volume Information")) {
-    // we skip unwanted system directories
-    return fcount;
-  }
-
-  if (strcmp(dirname, "/") == 0) {                     // are we at root ?
-    mp3nodeIndex = 0;
-    mp3nodeList.clear();                               // reset node list
-    fcount = 0;                                        // reset count
-    sdOutbuf = String();                               // reset output buffer
-    if (!SD_okay) {                                    // SD card detected & ok ?
-      return 0;
-    }
-  }
-  oldfcount = fcount;
-  dbgprint("current SD directory is now %s", dirname);
-  claimSPI("sdopen2");
-  root = SD.open(dirname);                             // open current directory level
-  releaseSPI();
-
-  claimSPI("listsdtr");
-  if (!root || !root.isDirectory()) {
-    dbgprint("%s is not a directory (error: %s)", dirname, !root ? "!root" : "!root.isDirectory()");
-    if (root) {
-      root.close();
-    }
-    releaseSPI();
-    return fcount;
-  }
-  releaseSPI();
-  mp3node.isDirectory = true;
-  mp3node.parentDir = parentDirNodeId;
-  mp3node.name = root.name();
-  mp3nodeList.push_back(mp3node);
-  //dbgprint("mp3node added: inx=%d, isDir=%d, parId=%d, name=%s",
-  //           mp3nodeIndex, mp3node.isDirectory, mp3node.parentDir, mp3node.name.c_str());
-  mp3nodeIndexThis = mp3nodeIndex++;
-
-  if (send) {
-    if (strcmp (dirname, "/") == 0) {                  // root
-      //lastDir = String("-1/Rootdirectory ---->\n");
-    }
-    else {                                             // not root
-      lastDir = String("-1") +
-                String(dirname) +
-                String(" ---->\n");
-      for (int i = 5; i < lastDir.length();) {
-        if ((inx = lastDir.indexOf("/", i)) >= i) {    // web interface doesn't like "/"
-          lastDir.setCharAt (inx, '-');
-          i = inx + 1;
-        }
-        else {
-          break;
-        }
-      }
-    }
-    lastEntryWasDir = true;
-  }
-  while (true) {                                       // find all mp3 files
-    claimSPI("opennextf");
-    file = root.openNextFile();                        // get next file (if any)
-    releaseSPI();
-    if (!file) {
-      break;                                           // end of list
-    }
-    const char *p = file.name();
-    if ((p[0] == '.') ||                               // skip hidden directories
-        (p[1] == 'S' && p[2] == 'y' && p[3] == 's')) { // and System Volume Directories 
-      claimSPI("close3");
-      file.close();
-      releaseSPI();
-      continue;
-    }
-    if (file.isDirectory()) {                          // item is directory ?
-      if (level < SD_MAXDEPTH - 1 && fcount < SD_MAXFILES) {  // digging deeper ?
-        //listsdtracks(file.name(), level + 1, send, mp3nodeIndexThis); // recurse
-        // required modification for espressif32 platform >= 4.2.x
-        listsdtracks(file.path(), level + 1, send, mp3nodeIndexThis); // recurse
-      }
-    }
-    else {
-      if (fcount >= SD_MAXFILES) {
-        claimSPI("close4");
-        file.close();
-        releaseSPI();
-        break;
-      }
-      filename = String(file.name());
-      if ((inx = filename.indexOf(".mp3")) > 0 ||
-          (inx = filename.indexOf(".MP3")) > 0) {      // neglect non-MP3 files
-        mp3node.isDirectory = false;
-        mp3node.parentDir = mp3nodeIndexThis;
-        mp3node.name = filename;
-        mp3nodeList.push_back(mp3node);
-        //dbgprint("mp3node added: inx=%d, isDir=%d, parId=%d, name=%s",
-        //           mp3nodeIndex, mp3node.isDirectory, mp3node.parentDir, mp3node.name.c_str());
-        mp3nodeIndex++;
-        fcount++;                                      // count total number of MP3 files
-        tmpstr1 = "";
-
-        if (send) {
-          if (lastEntryWasDir) {
-            if (!delimiterJustAdded) {
-              sdOutbuf += String("-1/ \n");            // add spacing in list
-              delimiterJustAdded = true;
-            }
-            sdOutbuf += lastDir;
-            lastEntryWasDir = false;
-          }
-          tmpstr = filename.substring(0, inx);         // extract file name without extension
-          tmpstr1 += String(mp3nodeIndex - 1);
-          tmpstr1 += "/";
-          if (strcmp(dirname, "/") == 0) {
-            tmpstr1 += String("Root-");
-          }
-          tmpstr1 += utf8ascii(tmpstr.c_str());
-          tmpstr1 += "\n";
-          sdOutbuf += tmpstr1;                         // update file list
-                                                       // will fail silently when max alloc heap gets too small !
-                                                       // (~17kB, ESP.getMaxAllocHeap() will tell)
-          delimiterJustAdded = false;
-        }
-        dbgprint("Index+File: %d \"%s\"", mp3nodeIndex - 1, file.name());
-      }
+//                                      S H U F F L E R E S E T                                    *
+//**************************************************************************************************
+// Forget the RANDOM mode order, the node indices are about to change.  With "check" seed and      *
+// position are kept if the new node table has the same tracks, so shuffleNext() builds the same   *
+// order again.  That way the order restored by "shuffle_state" survives mounting the card.        *
+//**************************************************************************************************
+void shuffleReset(bool check = false)
+{
+  bool same = false;                                     // same track set as before?
+
+  if (check && shuffleSeed) {
+    if (shuffleDir < 0) {                                // whole card
+      same = (shuffleCount == SD_mp3fileCount);
     }
-    if (send) {
-      //mp3loop();                                     // commented out, stop playing while indexing SD card
+    else {                                               // shuffleNext() checks the file count
+      same = (shuffleDir < mp3nodeList.size()) && mp3nodeList[shuffleDir].isDirectory;
     }
-    claimSPI("close5");
-    file.close();
-    releaseSPI();
   }
-  if (send) {
-    if (fcount != oldfcount && !delimiterJustAdded) {  // files in this directory?
-      sdOutbuf += String("-1/ \n");                    // add spacing in list
-      delimiterJustAdded = true;
+  shuffleList.clear();
+  shuffleList.shrink_to_fit();                           // give memory back
+  if (!same) {
+    shuffleSeed = 0;
+    shufflePos = -1;
+  }
+}
+
+//**************************************************************************************************
+//                                      S H U F F L E N E X T                                      *
+//**************************************************************************************************
+// Next (delta +1) or previous (delta -1) track in RANDOM mode.  Every track is played once before *
+// a new order is made.  With "shuffle_dir" only the directory of the current track is shuffled.   *
+// Returns the node index of the track, 0 if there is none.                                        *
+//**************************************************************************************************
+int16_t shuffleNext(int16_t delta)
+{
+  int16_t  dir = -1;                                     // directory to shuffle, -1 = whole card
+  int16_t  last = -1;                                    // track played last
+  bool     fresh;                                        // new order needed
+
+  if (currentIndex > 0 && currentIndex < mp3nodeList.size()) {
+    last = currentIndex;
+    if (shufflePerDir) dir = mp3nodeList[currentIndex].parentDir;
+  }
+  fresh = shuffleList.empty() || dir != shuffleDir;
+  if (fresh && shuffleSeed && dir == shuffleDir) {       // order saved before reset?
+    uint16_t count = shuffleCount;
+    shuffleBuild(dir, shuffleSeed);                      // yes, same seed gives same order
+    fresh = (shuffleCount != count);                     // unless the tracks have changed
+    dbgprint("shuffleNext: order restored, %s", fresh ? "tracks changed" : "okay");
+  }
+  if (!fresh) {
+    shufflePos += delta;
+    if (shufflePos < 0) shufflePos = 0;                  // no way back into the former order
+    fresh = (shufflePos >= (int)shuffleList.size());     // all played, time for a new order
+  }
+  if (fresh) {
+    for (int i = 0; i < 3; i++) {                        // don't start with the last track again
+      shuffleBuild(dir, esp_random() | 1);
+      if (shuffleList.size() < 2 || shuffleList[0] != last) break;
     }
+    shufflePos = 0;
+    dbgprint("shuffleNext: new order of %d tracks", shuffleCount);
   }
-  claimSPI("close6");
-  root.close();
-  releaseSPI();
-  if (strcmp(dirname, "/") == 0) {                     // are we back at root directory?
-    dbgprint("mp3nodeList contains now %d entries", mp3nodeList.size());
-    dbgprint("sdOutbuf.length() = %d", sdOutbuf.length());
+  if (shuffleList.empty()) {
+    return 0;
   }
-  //esp_task_wdt_reset();                              // does not help against "task_wdt:  - IDLE0 (CPU 0)"
-  delay(1);                                            // this does: allows task switching
-
-  return fcount;                                       // return number of registered MP3 files (so far)
+  dbgprint("shuffleNext: position %d of %d", shufflePos, shuffleCount);
+  return shuffleList[shufflePos];
 }
 
 //**************************************************************************************************
-//                                     G E T E N C R Y P T I O N T Y P E                           *
+//                                    S D P A T H R E S E T                                        *
 //**************************************************************************************************
-// Read the encryption type of the network and return as a 4 byte name                             *
+// Forgets the cached directory paths.  Called by loop() whenever mp3nodeList gets other nodes,    *
+// never from mp3nodetable::clear(), as spfTask clears sdLoadList while loop() uses the cache.     *
 //**************************************************************************************************
-#ifndef USE_ETHERNET
-const char* getEncryptionType (wifi_auth_mode_t thisType)
+void sdPathReset()
 {
-  switch (thisType) {
-    case WIFI_AUTH_OPEN:
-      return "OPEN";
-    case WIFI_AUTH_WEP:
-      return "WEP";
-    case WIFI_AUTH_WPA_PSK:
-      return "WPA_PSK";
-    case WIFI_AUTH_WPA2_PSK:
-      return "WPA2_PSK";
-    case WIFI_AUTH_WPA_WPA2_PSK:
-      return "WPA_WPA2_PSK";
-    case WIFI_AUTH_MAX:
-      return "MAX";
-    default:
-      break;
+  for (uint8_t i = 0; i < SDPATH_CACHE; i++) {
+    sdPathCache[i].dir = -1;
+    sdPathCache[i].used = 0;                           // Replaced first
   }
-  return "????";
 }
 
 //**************************************************************************************************
-//                                        L I S T N E T W O R K S                                  *
+//                                       S D P A T H D I R                                         *
 //**************************************************************************************************
-// List the available networks.                                                                    *
-// Acceptable networks are those who have an entry in the preferences.                             *
-// SSIDs of available networks will be saved for use in webinterface.                              *
+// Returns the cache entry with the path of directory node dir.  If it isn't cached the entry used *
+// least recently is filled: the names are copied from the end of the buffer to the front while    *
+// walking up to the root, so there is only one pass.  NULL if the path is too long.               *
 //**************************************************************************************************
-void listNetworks()
+sdpath_cache_t* sdPathDir(int16_t dir)
 {
-  WifiInfo_t        winfo;            // Entry from wifilist
-  wifi_auth_mode_t  encryption;       // TKIP(WPA), WEP, etc.
-  const char       *p;                // Netwerk is acceptable for connection
-  int               i, j;             // Loop control
+  sdpath_cache_t* c = &sdPathCache[0];
+  const char*     name;
+  size_t          nl;
+  size_t          pos = SDPATH_MAX;                    // Start of path in c->path
+  int16_t         x;
 
-  p = dbgprint("Scan for WiFi Networks");            // Scan for nearby networks
-  tftlog(p);
-  numSsid = WiFi.scanNetworks();
-  dbgprint("Scan completed");
-  if (numSsid <= 0) {
-    dbgprint("Couldn't get a wifi connection");
-    return;
+  sdPathTick++;
+  for (uint8_t i = 0; i < SDPATH_CACHE; i++) {
+    if (sdPathCache[i].dir == dir) {                   // Cached?
+      sdPathCache[i].used = sdPathTick;
+      return &sdPathCache[i];
+    }
+    if (sdPathCache[i].used < c->used) {
+      c = &sdPathCache[i];                             // Older or unused, replace this one
+    }
   }
-  // print the list of networks seen:
-  dbgprint("Number of available networks: %d", numSsid);
-  // Print the network number and name for each network found and
-  for (i = 0; i < numSsid; i++) {
-    p = "";                                          // Assume not acceptable
-    for (j = 0; j < wifilist.size(); j++) {          // Search in wifilist
-      winfo = wifilist[j];                           // Get one entry
-      if (WiFi.SSID(i).indexOf(winfo.ssid) == 0) {   // Is this SSID acceptable?
-        p = "Acceptable";
-        break;
-      }
+  c->dir = -1;                                         // Invalid while filling
+  c->used = 0;
+  for (x = dir; x > 0; x = mp3nodeList[x].parentDir) {
+    name = mp3nodeList.name(x);
+    nl = strlen(name);
+    if (nl + 1 >= pos) {
+      return NULL;                                     // Doesn't fit
     }
-    encryption = WiFi.encryptionType(i);
-    dbgprint("%2d - %-25s Signal: %3d dBm, Channel: %d, Encryption %4s, %s",
-               i + 1, WiFi.SSID(i).c_str(), WiFi.RSSI(i), WiFi.channel(i),
-               getEncryptionType(encryption), p);
-    // Remember this network for later use
-    networks += WiFi.SSID(i) + String("|");
+    pos -= nl;
+    memcpy(c->path + pos, name, nl);
+    c->path[--pos] = '/';
   }
-  dbgprint("End of list");
+  c->len = SDPATH_MAX - pos;
+  memmove(c->path, c->path + pos, c->len);
+  c->path[c->len] = '\0';
+  c->dir = dir;
+  c->used = sdPathTick;
+  return c;
 }
-#endif  // USE_ETHERNET
 
 //**************************************************************************************************
-//                                          T I M E R 5 S E C                                      *
+//                                          S D P A T H                                            *
 //**************************************************************************************************
-// Extra watchdog.  Called every 5 seconds.                                                        *
-// If totalCount has not been changed, there is a problem and playing will stop.                   *
-// Note that calling timely procedures within this routine or in called functions will             *
-// cause a crash!                                                                                  *
+// Writes the full path of node inx to buf, "/" for the root.  The path of its directory comes     *
+// from sdPathCache, so the next track of the same directory costs two copies and no heap.         *
+// Returns the length of the path, -1 if it doesn't fit in size bytes.                             *
 //**************************************************************************************************
-void IRAM_ATTR timer5sec()
+int sdPath(int16_t inx, char* buf, size_t size)
 {
-  static uint32_t oldtotalCount = 7321;          // needed for change detection
-  static uint16_t morethanonce = 0;              // counter for successive fails
-  uint32_t bytesplayed;                          // bytes send to MP3 converter
+  sdpath_cache_t* c;
+  const char*     name;
+  size_t          len = 0;
+  size_t          nl;
 
-  if (dataMode & (INIT | HEADER | DATA |         // test if playing
-                  METADATA | PLAYLISTINIT |
-                  PLAYLISTHEADER |
-                  PLAYLISTDATA)) {
-    if (currentSource == SDCARD && mp3filePause) {
-      mbitrate = 0;
-      return;
-    }
-    bytesplayed = totalCount - oldtotalCount;    // number of bytes played in the last 5 seconds
-    oldtotalCount = totalCount;                  // save for comparison in next cycle
-    if (bytesplayed < 5000) {                    // still properly playing?
-      //if (morethanonce > 10) {                 // happened too many times?
-      //  ESP.restart();                           // reset the CPU
-      //}
-      if (dataMode & (PLAYLISTDATA |             // in playlist mode?
-                      PLAYLISTINIT |
-                      PLAYLISTHEADER)) {
-        playlist_num = 0;                        // yes, end of playlist
-      }
-      goto error_handling;
-    }
-    else {
-      //                                         // data has been sent to MP3 decoder
-      // Bitrate in kbits/s is bytesplayed / sec / 1000 * 8
-      mbitrate = (bytesplayed + 312) / 625;      // measured bitrate (5s)
-      morethanonce = 0;                          // data seen, reset failcounter
-#ifdef USE_ETHERNET
-      reInitEthernet = false;
-#endif
-    }
+  if (inx <= 0) {
+    return (size > 1) ? strlcpy(buf, "/", size) : -1;  // Root
   }
-  else if (dataMode & CONNECTERROR) {
-error_handling:    
-    if (((morethanonce > 5) && (morethanonce < 10)) ||  // happened more than 5x?
-          (playlist_num > 0)) {                 // or playlist active?
-      dataMode = STOPREQD;                      // stop player
-      ini_block.newpreset++;                    // yes, try next channel
-      if (ini_block.newpreset > highestPreset)
-        ini_block.newpreset = 0;
-    }
-    else if (morethanonce <= 5 && currentSource == STATION) {
-      dataMode = STOPREQD;                      // stop player
-      currentPreset = -1;                       // attempt to reconnect to same station
-#ifdef USE_ETHERNET
-      if (morethanonce == 0 || morethanonce == 2) // re-init ethernet chip might help 
-        reInitEthernet = true;
-#endif
+  if (mp3nodeList[inx].parentDir > 0) {
+    c = sdPathDir(mp3nodeList[inx].parentDir);
+    if (c == NULL || c->len >= size) {
+      return -1;
     }
-    morethanonce++;                            // count the fails
+    len = c->len;
+    memcpy(buf, c->path, len);
+  }
+  name = mp3nodeList.name(inx);
+  nl = strlen(name);
+  if (len + 1 + nl >= size) {
+    return -1;
   }
+  buf[len++] = '/';
+  memcpy(buf + len, name, nl + 1);                     // Including the '\0'
+  return len + nl;
 }
 
 //**************************************************************************************************
-//                                          T I M E R 1 0 0                                        *
+//                                      G E T S D F I L E N A M E                                  *
 //**************************************************************************************************
-// Called every 100 msec on interrupt level, so must be in IRAM and no lengthy operations          *
-// allowed.                                                                                        *
+// Translate the mp3fileIndex of a track to the full filename that can be used as a station.       *
+// If index is 0 choose the next track of the RANDOM mode order.  The result is in a static buffer *
+// that is overwritten by the next call.                                                           *
 //**************************************************************************************************
-void IRAM_ATTR timer100()
+const char* getSDfilename(int inx)
 {
-  sv int16_t count5sec = 0;                      // counter for activating 5 seconds process
-  sv int16_t eqcount = 0;
-  sv int16_t oldclickcount = 0;                  // for detecting difference
+  static char   res[SDPATH_MAX + 6] = "sdcard";         // function result
 
-  if (++count5sec == 50 ) {                      // 5 seconds passed?
-    timer5sec();                                 // do 5 second procedure
-    count5sec = 0;                               // reset count
+  if (inx == 0) {                                       // random playing ?
+    dbgprint("getSDfilename(0) -> random choice");
+    inx = shuffleNext(+1);                              // next one of the shuffled tracks
   }
-  if ((count5sec % 10) == 0) {                   // one second over?
-    if (++timeinfo.tm_sec >= 60) {               // update number of seconds
-      timeinfo.tm_sec = 0;                       // wrap after 60 seconds
-      time_req = true;                           // show current time request
-      if (++timeinfo.tm_min >= 60) {
-        timeinfo.tm_min = 0;                     // wrap after 60 minutes
-        if (++timeinfo.tm_hour >= 24) {
-          timeinfo.tm_hour = 0;                  // wrap after 24 hours
-        }
-      }
-    }
+  dbgprint("getSDfilename requested index is %d", inx);  // show requeste node ID
+  currentIndex = inx;                                    // save current node
+
+  if (inx < 0 || inx >= mp3nodeList.size()) {
+    dbgprint("getSDfilename returns error: inx=%d > mp3nodeList.size()=%d or inx=-1", inx, mp3nodeList.size());
+    return "error";
   }
-  // handle rotary encoder, inactivity counter will be reset by encoder interrupt
-  if (++enc_inactivity == 36000) {               // count inactivity time
-    enc_inactivity = 1000;                       // prevent wrap
+  if (mp3nodeList[inx].isDirectory == true) {
+    dbgprint("getSDfilename error: requested file index %d is a directory", inx);
+    return "error";
   }
-  // now detection of single/double click of rotary encoder switch
-  if (clickcount) {                              // any click?
-    if (oldclickcount == clickcount) {           // stable situation?
-      if (++eqcount == 5) {                      // long time stable?
-        eqcount = 0;
-        if (clickcount > 2) {                    // triple click?
-          //tripleclick = true;
-        }
-        else if (clickcount > 1) {               // double click?
-          doubleClick = true;
-        }
-        else {
-          singleClick = true;
-        }
-        clickcount = 0;
-      }
-    }
-    else {
-      oldclickcount = clickcount;                // for detecting change
-      eqcount = 0;                               // not stable yet, reset count
-    }
+  if (sdPath(inx, res + 6, SDPATH_MAX) < 0) {            // file name including path
+    dbgprint("getSDfilename error: path of file index %d is too long", inx);
+    return "error";
   }
+  dbgprint("getSDfilename returns: %s", res);
+  return res;                                             // return full station spec
 }
 
-#ifdef ENABLE_INFRARED
 //**************************************************************************************************
-//                                          I S R _ I R                                            *
+//                                    P S R A M R E A L L O C                                      *
 //**************************************************************************************************
-// Interrupts received from VS1838B on every change of the signal.                                 *
-// Intervals are 640 or 1640 microseconds for data,  sync pulses are 3400 micros or longer.        *
-// Input is complete after 65 level changes.                                                       *
-// Only the last 32 level changes are significant and will be handed over to common data.          *
-// Important: This is only valid for a certain China 21-button remote control model from Ali.      *
+// Resizes the block *p, in PSRAM if there is any.  On failure *p stays valid and false is         *
+// returned.  Used for the big tables of the SD card.                                              *
 //**************************************************************************************************
-void IRAM_ATTR isr_IR()
+bool psramRealloc(void** p, size_t size)
 {
-  sv uint32_t t0 = 0;                               // To get the interval
-  sv uint32_t ir_locvalue = 0;                      // IR code
-  sv int      ir_loccount = 0;                      // Length of code
-  uint32_t    t1, intval;                           // Current time and interval since last change
-  uint32_t    mask_in = 2;                          // Mask input for conversion
-  uint16_t    mask_out = 1;                         // Mask output for conversion
+  void* np;
 
-  t1 = micros();                                    // Get current time
-  intval = t1 - t0;                                 // Compute interval
-  t0 = t1;                                          // Save for next compare
-  if ((intval > 300) && (intval < 800)) {           // Short pulse?
-    ir_locvalue = ir_locvalue << 1;                 // Shift in a "zero" bit
-    ir_loccount++;                                  // Count number of received bits
-    ir_0 = (ir_0 * 3 + intval) / 4;                 // Compute average durartion of a short pulse
-  }
-  else if ((intval > 1400) && (intval < 1900)) {    // Long pulse?
-    ir_locvalue = (ir_locvalue << 1) + 1;           // Shift in a "one" bit
-    ir_loccount++;                                  // Count number of received bits
-    ir_1 = (ir_1 * 3 + intval) / 4;                 // Compute average durartion of a short pulse
-  }
-  else if (ir_loccount == 65) {                     // Value is correct after 65 level changes
-    while (mask_in) {                               // Convert 32 bits to 16 bits
-      if (ir_locvalue & mask_in) {                  // Bit set in pattern?
-        ir_value |= mask_out;                       // Set bit in result
-      }
-      mask_in <<= 2;                                // Shift input mask 2 positions
-      mask_out <<= 1;                               // Shift output mask 1 position
-    }
-    ir_loccount = 0;                                // Ready for next input
+  if (psramFound()) {
+    np = heap_caps_realloc(*p, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
   }
   else {
-    ir_locvalue = 0;                                // Reset decoding
-    ir_loccount = 0;
+    np = realloc(*p, size);
   }
+  if (np == NULL) {
+    return false;                                      // Old block is still valid
+  }
+  *p = np;
+  return true;
 }
-#endif
 
 //**************************************************************************************************
-//                                          I S R _ E N C _ S W I T C H                            *
+//                                    M P 3 N O D E T A B L E                                      *
 //**************************************************************************************************
-// Interrupts received from rotary encoder switch.                                                 *
+// Node table of the SD card.  Nodes are 24 byte records, names are stored one after another in a  *
+// single arena.  Both grow in steps and live in PSRAM if there is any.  The entries and the mp3   *
+// files of a directory form circular lists, so every navigation step is a single lookup and       *
+// wrapping around at the end of a directory is free.  Node 0 is the root directory.               *
 //**************************************************************************************************
-void IRAM_ATTR isr_enc_switch()
+
+void mp3nodetable::link(int16_t& first, int16_t inx, int16_t mp3node_t::*next,
+                        int16_t mp3node_t::*prev)
 {
-  sv uint32_t     oldtime = 0;                            // time in millis previous interrupt
-  sv bool         sw_state;                               // true is pushed (LOW)
-  bool            newstate;                               // current state of input signal
-  uint32_t        newtime;                                // current timestamp
+  int16_t last;
 
-  // Read current state of SW pin
-  newstate = (digitalRead (ini_block.enc_sw_pin) == LOW);
-  newtime = millis();
-  if (newtime < (oldtime + 10)) {                         // debounce
-    return;
+  if (first < 0) {                                     // Empty list
+    first = inx;
+    nodes[inx].*next = inx;
+    nodes[inx].*prev = inx;
   }
-  if (newstate != sw_state) {                             // state changed ?
-    sw_state = newstate;                                  // yes, set current (new) state
-    if (!sw_state) {                                      // switch released ?
-      if ((newtime - oldtime) > 3000) {                   // more than 1 second ?
-        longClick = true;                                 // yes, register longClick
-      }
-      else {
-        clickcount++;                                     // yes, click detected
+  else {                                               // Insert before first = append
+    last = nodes[first].*prev;
+    nodes[inx].*prev = last;
+    nodes[inx].*next = first;
+    nodes[last].*next = inx;
+    nodes[first].*prev = inx;
+  }
+}
+
+int16_t mp3nodetable::add(bool isDirectory, int16_t parentDir, const char* name)
+{
+  size_t     len = strlen(name) + 1;                   // Name including delimiter
+  mp3node_t* node;
+
+  if (count == INT16_MAX || (count && (parentDir < 0 || parentDir >= count))) {
+    return -1;                                         // Full or parent unknown
+  }
+  if (count == maxCount) {                             // Table full?
+    if (!psramRealloc((void**)&nodes, (maxCount + 256) * sizeof(mp3node_t))) {
+      return -1;
+    }
+    maxCount += 256;
+  }
+  if (arenaLen + len > arenaMax) {                     // Arena full?
+    if (!psramRealloc((void**)&arena, arenaMax + 4096)) {      // Names are max. SDNAME_MAX bytes
+      return -1;
+    }
+    arenaMax += 4096;
+  }
+  node = &nodes[count];
+  memset(node, 0, sizeof(mp3node_t));
+  node->isDirectory = isDirectory;
+  node->parentDir = parentDir;
+  node->firstChild = node->firstFile = -1;
+  node->nextSibling = node->prevSibling = count;       // Alone in its lists
+  node->nextFile = node->prevFile = count;
+  node->nameOfs = arenaLen;
+  memcpy(arena + arenaLen, name, len);
+  arenaLen += len;
+  if (count) {                                         // Root has no parent
+    link(nodes[parentDir].firstChild, count, &mp3node_t::nextSibling, &mp3node_t::prevSibling);
+    if (isDirectory) {
+      nodes[parentDir].dirs++;
+    }
+    else {
+      if (nodes[parentDir].firstFile < 0) {            // First file, directory joins the list of
+        link(fileDirs, parentDir, &mp3node_t::nextFile, &mp3node_t::prevFile); // file directories
       }
-      enc_inactivity = 0;                                 // not inactive anymore
+      link(nodes[parentDir].firstFile, count, &mp3node_t::nextFile, &mp3node_t::prevFile);
+      nodes[parentDir].files++;
     }
   }
-  oldtime = newtime;                                      // nor next compare
+  return count++;
+}
+
+void mp3nodetable::shrink()
+{
+  if (count && psramRealloc((void**)&nodes, count * sizeof(mp3node_t))) {
+    maxCount = count;
+  }
+  if (arenaLen && psramRealloc((void**)&arena, arenaLen)) {
+    arenaMax = arenaLen;
+  }
+}
+
+void mp3nodetable::clear()
+{
+  free(nodes);                                         // Works for PSRAM as well
+  free(arena);
+  nodes = NULL;
+  arena = NULL;
+  count = maxCount = 0;
+  fileDirs = -1;
+  arenaLen = arenaMax = 0;
+}
+
+void mp3nodetable::take(mp3nodetable& other)
+{
+  clear();
+  nodes = other.nodes;                                 // Only the pointers are moved
+  arena = other.arena;
+  count = other.count;
+  maxCount = other.maxCount;
+  fileDirs = other.fileDirs;
+  arenaLen = other.arenaLen;
+  arenaMax = other.arenaMax;
+  other.nodes = NULL;
+  other.arena = NULL;
+  other.count = other.maxCount = 0;
+  other.fileDirs = -1;
+  other.arenaLen = other.arenaMax = 0;
 }
 
 //**************************************************************************************************
-//                                          I S R _ E N C _ T U R N                                *
+//                                   S D V O L U M E S E R I A L                                   *
 //**************************************************************************************************
-// Interrupts received from rotary encoder (clk signal), debouncing is all done in hardware!       *
+// Returns the volume serial number from the boot sector of the first partition (FAT16, FAT32 or   *
+// exFAT), 0 if it can't be read (always on the SD/MMC bus, the other parts of the signature are   *
+// still compared then).  Cards without partition table start with the boot sector.                *
 //**************************************************************************************************
-void IRAM_ATTR isr_enc_turn()
+uint32_t sdVolumeSerial()
 {
-  if (digitalRead(ini_block.enc_clk_pin) == digitalRead(ini_block.enc_dt_pin)) {
-    rotationcount++;
+  uint8_t  sec[512];                                   // One sector
+  uint32_t lba;                                        // Start of first partition
+  int      off;                                        // Offset of serial in boot sector
+  bool     ok;
+
+  claimSD("sdserial1");
+  ok = sdReadRaw(sec, 0);                              // MBR or boot sector
+  releaseSD();
+  if (ok && sec[0] != 0xEB && sec[0] != 0xE9) {        // No jump instruction: MBR
+    lba = sec[0x1C6] | (sec[0x1C7] << 8) | (sec[0x1C8] << 16) | ((uint32_t)sec[0x1C9] << 24);
+    claimSD("sdserial2");
+    ok = sdReadRaw(sec, lba);                          // Boot sector of 1st partition
+    releaseSD();
+  }
+  if (!ok) {
+    return 0;
+  }
+  if (memcmp(sec + 3, "EXFAT   ", 8) == 0) {
+    off = 100;
+  }
+  else if (sec[22] == 0 && sec[23] == 0) {             // No 16 bit FAT size: FAT32
+    off = 67;
   }
   else {
-    rotationcount--;
+    off = 39;                                          // FAT12/16
   }
-  enc_inactivity = 0;
+  return sec[off] | (sec[off + 1] << 8) | (sec[off + 2] << 16) | ((uint32_t)sec[off + 3] << 24);
 }
 
-
 //**************************************************************************************************
-//                                S H O W S T R E A M T I T L E                                    *
+//                                     S D S I G N A T U R E                                       *
 //**************************************************************************************************
-// Show artist and songtitle if present in metadata.                                               *
-// Show always if full=true.                                                                       *
+// Fills sig with what identifies the current content of the card: volume serial, used bytes and   *
+// entry count plus newest write time of the root directory.  Hidden entries (like SDINDEX_FILE)   *
+// are skipped, the same way sdScanStep() does.  Cheap compared to a full scan.                    *
 //**************************************************************************************************
-void showStreamTitle(const char *ml, bool full)
+bool sdSignature(sdsig_struct* sig)
 {
-  char *p1, *p2;
-  char  streamtitle[150];                      // streamtitle from metadata
+  File root, file;
 
-  if (strstr(ml, "StreamTitle=")) {
-    dbgprint(ml);
-    p1 = (char*)ml + 12;                       // begin of artist and title
-    if ((p2 = strstr(ml, "';"))) {             // search for end of title
-      if (*p1 == '\'') {                       // surrounded by quotes?
-        p1++;
-        //p2--;
+  memset(sig, 0, sizeof(*sig));                        // Padding has to compare equal too
+  sig->serial = sdVolumeSerial();
+  claimSD("sdsig1");
+  sig->used = sdUsedBytes();
+  root = sdfs->open("/");
+  releaseSD();
+  if (!root) {
+    return false;
+  }
+  while (true) {
+    claimSD("sdsig2");
+    file = root.openNextFile();
+    releaseSD();
+    if (!file) {
+      break;
+    }
+    if (file.name()[0] != '.') {
+      sig->rootEntries++;
+      if ((uint32_t)file.getLastWrite() > sig->rootTime) {
+        sig->rootTime = file.getLastWrite();
       }
-      *p2 = '\0';                              // strip the rest of the line
     }
-    // save last part of string as streamtitle.  Protect against buffer overflow
-    strncpy(streamtitle, p1, sizeof(streamtitle));
-    streamtitle[sizeof(streamtitle) - 1] = '\0';
-  }
-  else if (full) {
-    // info probably from playlist or mp3 file
-    strncpy(streamtitle, ml, sizeof (streamtitle));
-    streamtitle[sizeof (streamtitle) - 1] = '\0';
+    claimSD("sdsig3");
+    file.close();
+    releaseSD();
   }
-  else {
-    icystreamtitle = "";                       // Unknown type
-    return;                                    // Do not show
+  claimSD("sdsig4");
+  root.close();
+  releaseSD();
+  sig->version = SDINDEX_VERSION;
+  sig->maxFiles = SD_MAXFILES;
+  sig->maxDepth = sdMaxDepth;
+  return true;
+}
+
+//**************************************************************************************************
+//                                 S D I N D E X R E A D / W R I T E                               *
+//**************************************************************************************************
+// Buffered sequential access to SDINDEX_FILE, one SPI claim per 512 bytes.  The checksum covers   *
+// all bytes after the header.  Buffer and checksum are kept by the caller, so spfTask (loading)   *
+// and loop() (saving) can use an index file at the same time.                                     *
+//**************************************************************************************************
+void sdIndexReset(sdix_struct& x)
+{
+  x.len = x.pos = 0;
+  x.sum = 2166136261UL;                                // FNV-1a offset basis
+}
+
+void sdIndexSum(sdix_struct& x, const uint8_t* p, size_t n)
+{
+  while (n--) {
+    x.sum = (x.sum ^ *p++) * 16777619UL;               // FNV-1a prime
   }
-  utf8ascii(streamtitle);
-  if (currentSource == STATION && *streamtitle == '\0' && lastArtistSong.length() == 0) {
-    strcpy(streamtitle, "...waiting for text...");
-  }
-  if (*streamtitle != '\0') {
-    icystreamtitle = streamtitle;                // save for status request from browser
-    if (!full) {
-      if ((p1 = strstr(streamtitle, " - ")) ||
-          (p1 = strstr(streamtitle, " / "))) {   // look for artist/title separator
-        *p1++ = '\n';                            // found: replace 3 characters by newline
-        p2 = p1 + 2;
-        if (*p2 == ' ') {                        // leading space in title?
-          p2++;
-        }                                        // shift 2nd part of title 2 or 3 places
-        strcpy (p1, p2);                         // before: ".. - ..", after: "..\n.."
+}
+
+bool sdIndexRead(sdix_struct& x, File& f, void* data, size_t n)
+{
+  uint8_t* p = (uint8_t*)data;
+  size_t   k;
+
+  while (n) {
+    if (x.pos == x.len) {                              // Buffer empty?
+      claimSD("sdixread");
+      x.len = f.read(x.buf, sizeof(x.buf));
+      releaseSD();
+      x.pos = 0;
+      if (x.len == 0) {
+        return false;                                  // Truncated file
       }
-      // skip [xxx] if exists (comes only with some radio stations, e.g. 1FM)
-      if ((p1 = strstr(streamtitle, "[")) &&
-          (p2 = strstr(streamtitle, "]")) &&
-          p1 < p2) {
-        *p1 = '\0';
-        if (*(p1 - 1) == ' ') *(p1 - 1) = '\0';
+    }
+    k = min(n, (size_t)(x.len - x.pos));
+    memcpy(p, x.buf + x.pos, k);
+    x.pos += k;
+    p += k;
+    n -= k;
+  }
+  return true;
+}
+
+bool sdIndexFlush(sdix_struct& x, File& f)
+{
+  size_t res;
+
+  claimSD("sdixflush");
+  res = f.write(x.buf, x.len);
+  releaseSD();
+  if (res != x.len) {
+    return false;
+  }
+  x.len = 0;
+  return true;
+}
+
+bool sdIndexWrite(sdix_struct& x, File& f, const void* data, size_t n)
+{
+  const uint8_t* p = (const uint8_t*)data;
+  size_t         k;
+
+  sdIndexSum(x, p, n);
+  while (n) {
+    if (x.len == sizeof(x.buf) && !sdIndexFlush(x, f)) {
+      return false;
+    }
+    k = min(n, sizeof(x.buf) - x.len);
+    memcpy(x.buf + x.len, p, k);
+    x.len += k;
+    p += k;
+    n -= k;
+  }
+  return true;
+}
+
+//**************************************************************************************************
+//                                      L O A D S D I N D E X                                      *
+//**************************************************************************************************
+// Loads sdLoadList from SDINDEX_FILE in one sequential read.  Runs on spfTask while loop() may    *
+// use mp3nodeList, so the new table is only handed over (sdLoadDone) when it is complete and      *
+// loop() takes it in sdLoadPublish().  Returns false if the file is missing, damaged or belongs   *
+// to another card content; a rescan is needed then.                                               *
+//**************************************************************************************************
+bool loadSDindex()
+{
+  HEAP_TAG("loadSDindex");
+  sdindex_head_struct head;                            // Header from file
+  sdsig_struct        sig;                             // Current card content
+  sdix_struct         ix;                              // Read buffer and checksum
+  uint8_t             nodehead[5];                     // isDirectory, parentDir (2), name length (2)
+  static char         tmp[SDNAME_MAX + 1];             // Name of node
+  uint16_t            len;
+  uint32_t            n;
+  uint32_t            t0 = millis();
+  File                f;
+  bool                ok;
+
+  claimSD("sdixopen1");
+  f = sdfs->open(SDINDEX_FILE);
+  releaseSD();
+  if (!f) {
+    dbgprint("No SD index file");
+    return false;
+  }
+  sdIndexReset(ix);
+  ok = sdIndexRead(ix, f, &head, sizeof(head)) &&
+       memcmp(head.magic, "SDIX", 4) == 0 &&
+       sdSignature(&sig) &&
+       memcmp(&head.sig, &sig, sizeof(sig)) == 0;
+  if (!ok) {
+    dbgprint("SD index outdated");
+  }
+  else {
+    sdLoadList.clear();
+    for (n = 0; ok && n < head.nodes; n++) {
+      ok = sdIndexRead(ix, f, nodehead, sizeof(nodehead));
+      len = nodehead[3] | (nodehead[4] << 8);
+      ok = ok && len <= SDNAME_MAX && sdIndexRead(ix, f, tmp, len);
+      if (!ok) {
+        break;
       }
+      sdIndexSum(ix, nodehead, sizeof(nodehead));
+      sdIndexSum(ix, (uint8_t*)tmp, len);
+      tmp[len] = '\0';
+      ok = sdLoadList.add(nodehead[0], nodehead[1] | (nodehead[2] << 8), tmp) >= 0;
     }
-    if (encoderMode != SELECT) {                 // don't disturb selecting SD tracks or stations
-      tftset(1, streamtitle);                    // set screen segment text middle part
+    sdLoadList.shrink();
+    if (ok && ix.sum != head.checksum) {
+      ok = false;
     }
-    lastArtistSong = streamtitle;
-  }  
+    if (!ok) {
+      dbgprint("SD index damaged");
+      sdLoadList.clear();
+    }
+  }
+  claimSD("sdixclose1");
+  f.close();
+  releaseSD();
+  if (ok) {
+    sdLoadFiles = head.files;
+    sdLoadId = head.checksum;                          // SDLIB_FILE refers to this one
+    dbgprint("SD index loaded, %d nodes, %d files in %d ms", head.nodes, head.files, millis() - t0);
+    sdLoadDone = true;                                 // loop() may take it now
+    wakeLoop();
+  }
+  return ok;
 }
 
 //**************************************************************************************************
-//                                    S T O P _ M P 3 C L I E N T                                  *
+//                                      S A V E S D I N D E X                                      *
 //**************************************************************************************************
-// Disconnect from radio station.                                                                  *
+// Writes mp3nodeList to SDINDEX_FILE.  The header is written last, with the signature taken after *
+// the file has been closed, as the file itself changes the used bytes.                            *
 //**************************************************************************************************
-void stopMp3client()
+void saveSDindex()
 {
-P1SMP3:  
-  _claimSPI("stpmp3cl1");                               // claim SPI bus
-  uint8_t erg = mp3client.connected();
-  _releaseSPI();                                        // release SPI bus
-  while (erg) {
-    dbgprint("stopMp3client(): mp3client still connected. Try to disconnect.");  // Stop connection to host
-    _claimSPI("stpmp3cl2");                             // claim SPI bus
-    //mp3client.flush();                                // hangs quite often !
-    mp3client.stop();
-    _releaseSPI();                                      // release SPI bus
-    delay(300);
-    goto P1SMP3;
+  sdindex_head_struct head;
+  sdix_struct         ix;                              // Write buffer and checksum
+  uint8_t             nodehead[5];                     // isDirectory, parentDir (2), name length (2)
+  File                f;
+  bool                ok;
+
+  memset(&head, 0, sizeof(head));
+  claimSD("sdixopen2");
+  f = sdfs->open(SDINDEX_FILE, FILE_WRITE);
+  releaseSD();
+  if (!f) {
+    dbgprint("SD index not written, card write protected?");
+    return;
   }
-  delay(50);
-  _claimSPI("stpmp3cl3");                               // claim SPI bus
-  //mp3client.flush();                                  // hangs quite often !
-  mp3client.stop();                                     // Stop stream client
-  _releaseSPI();                                        // release SPI bus
-  delay(100);
+  claimSD("sdixplace");
+  ok = (f.write((uint8_t*)&head, sizeof(head)) == sizeof(head)); // Placeholder for header
+  releaseSD();
+  sdIndexReset(ix);                                    // Checksum starts after header
+  for (int16_t i = 0; ok && i < mp3nodeList.size(); i++) {
+    size_t len = strlen(mp3nodeList.name(i));          // Full name, UTF-8 may exceed 255 bytes
+    nodehead[0] = mp3nodeList[i].isDirectory;
+    nodehead[1] = mp3nodeList[i].parentDir & 0xFF;
+    nodehead[2] = mp3nodeList[i].parentDir >> 8;
+    nodehead[3] = len & 0xFF;
+    nodehead[4] = len >> 8;
+    ok = sdIndexWrite(ix, f, nodehead, sizeof(nodehead)) &&
+         sdIndexWrite(ix, f, mp3nodeList.name(i), len);
+  }
+  ok = ok && sdIndexFlush(ix, f);
+  claimSD("sdixclose2");
+  f.close();
+  releaseSD();
+  memcpy(head.magic, "SDIX", 4);
+  head.nodes = mp3nodeList.size();
+  head.files = SD_mp3fileCount;
+  head.checksum = ix.sum;
+  if (ok && sdSignature(&head.sig)) {
+    claimSD("sdixopen3");
+    f = sdfs->open(SDINDEX_FILE, "r+");                // Overwrite header, size stays
+    releaseSD();
+    if (f) {
+      claimSD("sdixhead");
+      ok = (f.write((uint8_t*)&head, sizeof(head)) == sizeof(head));
+      f.close();
+      releaseSD();
+      if (ok) {
+        dbgprint("SD index written, %d nodes", head.nodes);
+        sdIndexId = head.checksum;
+        return;
+      }
+    }
+  }
+  dbgprint("SD index not written");
+  claimSD("sdixremove");
+  sdfs->remove(SDINDEX_FILE);                          // No half written index
+  releaseSD();
 }
 
 //**************************************************************************************************
-//                                    C O N N E C T T O H O S T                                    *
+//                                    S D I N D E X R E S I G N                                    *
 //**************************************************************************************************
-// Connect to the Internet radio server specified by newpreset.                                    *
+// Other files of ours (SDLIB_FILE) change the used bytes of the card.  Puts the new signature     *
+// into the header of SDINDEX_FILE, so the index is still taken on the next mount.                 *
 //**************************************************************************************************
-bool connectToHost()
+void sdIndexResign()
 {
-  int      inx;                                    // Position of ":" in hostname
-  uint16_t port = 80;                              // Port number for host
-  char     buf[100];                               // temp buffer
-  String   extension = "/";                        // May be like "/mp3" in "skonto.ls.lv:8002/mp3"
-  String   hostwoext = host;                       // Host without extension and portnumber
-  String   tmp;
+  sdindex_head_struct head;
+  File                f;
+  bool                ok = false;
 
-  stopMp3client();                                 // Disconnect if still connected
-  dbgprint("Connect to host %s", host.c_str());
-  tftset(0, "ESP32 Radio");                        // Set screen segment text top line
-  displayTime("");                                 // Clear time on TFT screen
-  dataMode = INIT;                                 // can be changed further down
-  chunked = false;                                 // Assume not chunked
-  if (host.endsWith(".m3u")) {                     // Is it an m3u playlist?
-    playlist = host;                               // Save copy of playlist URL
-    dataMode = PLAYLISTINIT;                       // Yes, start in PLAYLIST mode
-    if (playlist_num == 0) {                       // First entry to play?
-      playlist_num = 1;                            // Yes, set index
-    }
-    dbgprint("Playlist request, entry %d", playlist_num);
+  claimSD("sdixresign1");
+  f = sdfs->open(SDINDEX_FILE);
+  if (f) {
+    ok = (f.read((uint8_t*)&head, sizeof(head)) == sizeof(head));
+    f.close();
   }
-  // In the URL there may be an extension, like noisefm.ru:8000/play.m3u&t=.m3u
-  inx = host.indexOf("/");                         // Search for begin of extension
-  if (inx > 0) {                                   // Is there an extension?
-    extension = host.substring(inx);               // Yes, change the default
-    hostwoext = host.substring(0, inx);            // Host without extension
+  releaseSD();
+  if (!ok || memcmp(head.magic, "SDIX", 4) != 0 ||     // Not the index we are using?
+      head.checksum != sdIndexId || !sdSignature(&head.sig)) {
+    return;
   }
-  // In the host there may be a portnumber
-  inx = hostwoext.indexOf(":");                    // Search for separator
-  if (inx >= 0) {                                  // Portnumber available?
-    port = host.substring(inx + 1).toInt();        // Get portnumber as integer
-    hostwoext = host.substring(0, inx);            // Host without portnumber
+  claimSD("sdixresign2");
+  f = sdfs->open(SDINDEX_FILE, "r+");                  // Overwrite header, size stays
+  if (f) {
+    f.write((uint8_t*)&head, sizeof(head));
+    f.close();
   }
-  dbgprint("Server %s, port %d, extension %s",
-             hostwoext.c_str(), port, extension.c_str());
-  _claimSPI("connecttohost1");                     // claim SPI bus
-  int16_t erg = mp3client.connect(hostwoext.c_str(), port);
-  _releaseSPI();                                   // release SPI bus
+  releaseSD();
+}
 
-  if (erg == 1) {
-    dbgprint("Successfully connected to server");
-    // send request to server and request metadata.
-    _claimSPI("connecttohost2");                   // claim SPI bus
-    mp3client.print(String("GET ") +
-                    extension +
-                    String(" HTTP/1.1\r\n") +
-                    String("Host: ") +
-                    hostwoext +
-                    String("\r\n") +
-                    String("Icy-MetaData:1\r\n") +
-                    String("Connection: close\r\n\r\n"));
-    _releaseSPI();                                // release SPI bus
-    return true;
-  }
+//**************************************************************************************************
+//                                      S D S C A N O P E N                                        *
+//**************************************************************************************************
+// Opens the next directory from the scan stack.  Returns false if it can't be opened.             *
+//**************************************************************************************************
+bool sdScanOpen()
+{
+  char path[SDPATH_MAX];
 
-  // error connecting to host
-  dbgprint("Request %s failed!", host.c_str());
-#ifdef USE_ETHERNET
-  _claimSPI("connecttohost3");                    // claim SPI bus
-  lstat = Ethernet.linkStatus();                  // Get physical ethernet link status
-  _releaseSPI();                                  // release SPI bus
-  if (lstat == LinkOFF) dbgprint("Ethernet link status: down !!");
-#endif
-  tmp = host;
-  if (tmp.length() > 65) {                        // line limiting
-    tmp.remove(63);
-    tmp += "...";
+  sdScanCur = sdScanStack.back();                      // directory to do next
+  sdScanStack.pop_back();
+  if (sdPath(sdScanCur.node, path, sizeof(path)) < 0) {
+    dbgprint("SD directory %s skipped, path too long", mp3nodeList.name(sdScanCur.node));
+    return false;
   }
-#ifdef USE_ETHERNET
-  if (lstat == LinkOFF) {                         // if ethernet link is down than show it
-    if (tmp.length() > 55) {
-      tmp.remove(53);
-      tmp += "...";
-    }
-    tmp += " [Eth Link down!]";
+  dbgprint("current SD directory is now %s", path);
+  claimSD("sdopen2");
+  sdScanDir = sdfs->open(path);                        // open directory
+  releaseSD();
+  if (!sdScanDir || !sdScanDir.isDirectory()) {
+    dbgprint("%s is not a directory (error: %s)", path,
+             !sdScanDir ? "!root" : "!root.isDirectory()");
+    sdScanClose();
+    return false;
   }
-#endif
-  sprintf(buf, "Can't connect to: %s", tmp.c_str());
-  tftset(1, buf);
-  tftset(3, " ");
-  icyname = "Couldn't connect to host";
-  icystreamtitle = host;
-  dataMode = CONNECTERROR;
-  return false;
+  sdScanMark = sdScanStack.size();                     // subdirectories are pushed from here
+  return true;
 }
 
 //**************************************************************************************************
-//                                      S S C O N V                                                *
+//                                      S D S C A N C L O S E                                      *
 //**************************************************************************************************
-// Convert an array with 4 "synchsafe integers" to a number.                                       *
-// There are 7 bits used per byte.                                                                 *
+// Closes the directory being scanned.  Its subdirectories are on top of the stack in reverse      *
+// order, so they are done first and in the order of the card (depth first).                       *
 //**************************************************************************************************
-uint32_t ssconv(const uint8_t* bytes)
+void sdScanClose()
 {
-  uint32_t res = 0;                                      // Result of conversion
-  uint8_t  i;                                            // Counter number of bytes to convert
+  if (sdScanDir) {
+    claimSD("close5");
+    sdScanDir.close();
+    releaseSD();
+  }
+  if (sdScanMark < sdScanStack.size()) {
+    std::reverse(sdScanStack.begin() + sdScanMark, sdScanStack.end());
+  }
+  sdScanMark = sdScanStack.size();
+}
 
-  for (i = 0; i < 4; i++) {                              // Handle 4 bytes
-    res = res * 128 + bytes[i];                          // Convert next 7 bits
+//**************************************************************************************************
+//                                      S D S C A N S T A R T                                      *
+//**************************************************************************************************
+// Starts a new scan of all MP3 files on the SD card.  The scan itself is done in slices by        *
+// sdScanStep() from loop(), so playing goes on and the files found so far can be selected.        *
+// Directories are read one at a time.  Only the node numbers of directories still to do are kept, *
+// so memory does not depend on the nesting depth.                                                 *
+//**************************************************************************************************
+void sdScanStart()
+{
+  sdScanAbort();                                       // a running scan is obsolete
+#ifdef SD_LIBRARY
+  sdLibAbort();                                        // library refers to the old nodes
+#endif
+  sdIndexId = 0;                                       // index on card is obsolete as well
+  mp3nodeList.clear();                                 // reset node list
+  sdPathReset();                                       // cached paths are of the old nodes
+  shuffleList.clear();                                 // order is rebuilt when the scan is done
+  sdSearchReset();                                     // search index as well
+  SD_mp3fileCount = 0;
+  sdScanFiles = 0;
+  sdScanSkipped = 0;
+  sdScanTime = millis();
+  if (SD_okay && mp3nodeList.add(true, 0, "/") == 0) { // root is node 0
+    sdScanStack.push_back({ 0, 0 });
+    sdScanActive = sdScanOpen();
   }
-  return res;                                            // Return the result
 }
 
 //**************************************************************************************************
-//                                  Q U I C K S D C H E C K                                        *
+//                                      S D S C A N A B O R T                                      *
 //**************************************************************************************************
-// If we have files in our list try to open the first one. If not successful clear SD_okay.        *
-// Don't check if mp3-file is currently open.                                                      *
+// Stops a running scan.                                                                           *
 //**************************************************************************************************
-void quickSdCheck()
+void sdScanAbort()
 {
-  uint8_t c;
-  int index = 0;
-  
-  if (SD_okay && SD_mp3fileCount > 0 && !mp3file) {
-    for (int i=1; i < mp3nodeList.size(); i++) {        // 0 is root index, so we start with 1
-      if (!mp3nodeList[i].isDirectory) {
-        index = i;
-        break;
+  sdScanClose();
+  sdScanStack.clear();
+  sdScanMark = 0;
+  sdScanActive = false;
+}
+
+//**************************************************************************************************
+//                                      S D S C A N S T E P                                        *
+//**************************************************************************************************
+// Handles max. SDSCAN_SLICE directory entries of a running scan.  Called from loop().  Playing    *
+// has priority: nothing is done while the data queue is low.  The SPI bus is released after every *
+// entry.  A "node" will be generated for every directory of max. sdMaxDepth levels and every MP3  *
+// file.                                                                                           *
+//**************************************************************************************************
+void sdScanStep()
+{
+  HEAP_TAG("sdScan");
+  File                 file;                           // handle to directory entry
+  String               filename;                       // copy of filename
+  const char*          p;
+  int                  inx;
+  int16_t              node;
+
+  if (sdLoadDone) {                                    // index loaded by handle_spec()?
+    sdLoadPublish();
+  }
+  if (sdScanReq) {                                     // new scan requested by handle_spec()?
+    sdScanReq = false;
+    sdScanStart();
+  }
+  if (!sdScanActive) {
+    return;
+  }
+  if ((dataMode & DATA) && uxQueueMessagesWaiting(dataQueue) < (QSIZ / 4)) {
+    return;                                            // feed the decoder first
+  }
+  for (int n = 0; n < SDSCAN_SLICE && sdScanActive; n++) {
+    if (!sdScanDir) {                                  // directory done
+      if (sdScanStack.empty()) {
+        sdScanFinish();
+      }
+      else {
+        sdScanOpen();
       }
+      continue;
     }
-    if (!index) return;                                 // no file found...weird...
-    String path = getSDfilename(index);                 // returns path with "sdcard" in front
-    path = path.substring(6);                           // we need path, so skip the "sdcard" part
-    claimSPI("qusdchk1");                               // claim SPI bus
-    mp3file = SD.open(path);                            // Open the file
-    releaseSPI();
-    if (!mp3file) {
-      SD_okay = false;
-      dbgprint("quickSdCheck: error SD.open(%s) -> SD_okay = false", path.c_str());
-      return;
+    claimSD("opennextf");
+    file = sdScanDir.openNextFile();                   // get next file (if any)
+    releaseSD();
+    if (!file) {                                       // end of directory
+      sdScanClose();
+      continue;
     }
-    claimSPI("qusdchk2");                               // claim SPI bus
-    int i = mp3file.read(&c, 1);                        // read only 1 byte
-    mp3file.close();
-    releaseSPI();
-    if (i != 1) {
-      SD_okay = false;
-      dbgprint("quickSdCheck: error mp3file.read(1) -> SD_okay = false");
-      return;
+    p = file.name();
+    if ((p[0] == '.') ||                               // skip hidden directories
+        (p[1] == 'S' && p[2] == 'y' && p[3] == 's')) { // and System Volume Directories
+      claimSD("close3");
+      file.close();
+      releaseSD();
+      continue;
     }
-    dbgprint("quickSdCheck: All ok.");
+    if (file.isDirectory()) {                          // item is directory ?
+      if (sdScanCur.depth + 1 >= sdMaxDepth || sdScanFiles >= SD_MAXFILES) {
+        sdScanSkipped++;                               // too deep or list full
+        dbgprint("Skipped SD directory %s (%s)", file.path(),
+                 sdScanFiles >= SD_MAXFILES ? "too many files" : "too deep");
+      }
+      else if ((node = mp3nodeList.add(true, sdScanCur.node, p)) < 0) {
+        sdScanSkipped++;
+        dbgprint("No memory for SD directory %s", file.path());
+      }
+      else {
+        sdScanStack.push_back({ node, (uint8_t)(sdScanCur.depth + 1) }); // digging deeper later
+      }
+    }
+    else if (sdScanFiles >= SD_MAXFILES) {             // list full, stop here
+      sdScanAbort();
+      sdScanFinish();
+    }
+    else {
+      filename = String(p);
+      if ((inx = filename.indexOf(".mp3")) > 0 ||
+          (inx = filename.indexOf(".MP3")) > 0) {      // neglect non-MP3 files
+        node = mp3nodeList.add(false, sdScanCur.node, filename.c_str());
+        if (node < 0) {
+          dbgprint("No memory for SD file %s", filename.c_str());
+          sdScanAbort();
+          sdScanFinish();
+        }
+        else {
+          SD_mp3fileCount = ++sdScanFiles;             // files found so far can be played
+          dbgprint("Index+File: %d \"%s\"", node, p);
+          if (sdScanFiles == 1 && encoderMode != SELECT) {
+            buttonSD = true;                           // first file found, offer selection
+          }
+        }
+      }
+    }
+    claimSD("close4");
+    file.close();
+    releaseSD();
   }
 }
 
 //**************************************************************************************************
-//                                  H A N D L E I D 3                                              *
+//                                      S D S C A N F I N I S H                                    *
 //**************************************************************************************************
-// Check file on SD card for ID3 tags and use them to display some info.                           *
-// Extended headers are not parsed. Parameter must be "soap/....." or "sdcard/......."             *
+// Called when all directories are done.  Saves the index for a quick start next time.             *
 //**************************************************************************************************
-bool handleID3 (String& path)
+void sdScanFinish()
 {
-  const char*  p;                                          // Pointer to filename
-  struct ID3head_t                                         // First part of ID3 info
-  {
-    char    fid[3];                                        // Should be filled with "ID3"
-    uint8_t majV, minV;                                    // Major and minor version
-    uint8_t hflags;                                        // Headerflags
-    uint8_t ttagsize[4];                                   // Total tag size
-  } ID3head;
-  uint8_t  exthsiz[4];                                     // Extended header size
-  uint32_t stx;                                            // Ext header size converted
-  uint32_t sttg;                                           // Total tagsize converted
-  uint32_t stg;                                            // Size of a single tag
-  struct ID3tag_t                                           // Tag in ID3 info
-  {
-    char    tagid[4];                                      // Things like "TCON", "TYER", ...
-    uint8_t tagsize[4];                                    // Size of the tag
-    uint8_t tagflags[2];                                   // Tag flags
-  } ID3tag;
-  uint8_t  tmpbuf[4];                                      // Scratch buffer
-  uint8_t  tenc;                                           // Text encoding
-  String   artttl;                                         // Artist and title
-  enum_selection source = (path.indexOf("sdcard") == 0) ? SDCARD : MEDIASERVER;
+  const char* p;
 
-  if (source == SDCARD && !SD_okay) {
-    dbgprint("handleID3: SD_okay is false");
-    return false;
-  }
-  if (encoderMode != SELECT) {                           // Don't disturb selecting SD tracks
-    // just for the case we won't find an ID3 tag
-    if (source == SDCARD) {
-      tftset(3, "Playing from local file");
-      lastAlbumStation = "Playing from local file";
-    }
-    else {
-      lastAlbumStation = "Playing from media server";      // album info can be missing
-    }  
-  }  
-  dbgprint("handleID3: Looking for ID3 tags in %s", 
-    (char*)path/*substring((source==SDCARD)?6:4)*/.c_str());
-  p = path.substring(path.lastIndexOf("/") + 1).c_str();   // Point just to filename
-  showStreamTitle(p, true);                                // filename as title (lastArtistSong), but will 
-                                                           // be overridden if mp3 tags found 
-  if (source == SDCARD) {                                                           
-    claimSPI("id30");
-    mp3file = SD.open(path.substring(6));                  // Open the file
-    releaseSPI();
-    if (!mp3file) {
-      SD_okay = false;
-      currentIndex = -1;
-      dbgprint("handleID3: error SD.open()");
-      return false;
-    }
-    // scan ID3 tag if found
-    claimSPI("id31");
-    mp3file.read((uint8_t*)&ID3head, sizeof(ID3head));     // Read first part of ID3 info
-    releaseSPI();
-    if (strncmp(ID3head.fid, "ID3", 3) == 0) {
-      // file contains ID3 tag
-      sttg = ssconv(ID3head.ttagsize);                       // Convert tagsize
-      dbgprint("Found ID3 info, total tagsize = %d", sttg);
-      if (ID3head.hflags & 0x40) {                           // Extended header?
-        claimSPI("id32");
-        mp3file.read((uint8_t*)exthsiz, 4);
-        releaseSPI();
-        stx = ssconv(exthsiz);                               // Yes, get size of extended header
-        stx -= 4;
-        while (stx--) {
-          claimSPI("id32");
-          mp3file.read();                                    // Skip next byte of extended header
-          releaseSPI();
-        }
-      }
-      while (sttg > 10) {                                    // Now handle the tags
-        claimSPI("id33");
-        sttg -= mp3file.read((uint8_t*)&ID3tag,
-                            sizeof(ID3tag));                // Read first part of a tag
-        releaseSPI();
-        if (ID3tag.tagid[0] == 0) {                          // Reached the end of the list?
-          break;                                             // Yes, quit the loop
-        }
-        stg = ssconv(ID3tag.tagsize);                        // Convert size of tag
-        claimSPI("id34");
-        if (ID3tag.tagflags[1] & 0x08) {                     // Compressed?
-          sttg -= mp3file.read(tmpbuf, 4);                   // Yes, ignore 4 bytes
-          stg -= 4;                                          // Reduce tag size
-        }
-        if (ID3tag.tagflags[1] & 0x044) {                    // Encrypted or grouped?
-          sttg -= mp3file.read(tmpbuf, 1);                   // Yes, ignore 1 byte
-          stg--;                                             // Reduce tagsize by 1
-        }
-        releaseSPI();
-        if (stg > (sizeof(metalinebf) + 2)) {                // Room for tag?
-          break;                                             // No, skip this and further tags
-        }
-        claimSPI("id36");                                    // claim SPI bus
-        sttg -= mp3file.read((uint8_t*)metalinebf, stg);     // Read tag contents
-        releaseSPI();
-        metalinebf[stg] = '\0';                              // Add delimeter
-        tenc = metalinebf[0];                                // First byte is encoding type
-        if (tenc == 0x01 || tenc == 0x02) {                  // UTF-16 string (Little Endian or Big Endian)
-          utf16ascii(metalinebf + 1, stg - 1);
-        }
-        if ((strncmp(ID3tag.tagid, "TPE1", 4) == 0) ||       // artist
-            (strncmp(ID3tag.tagid, "TIT2", 4) == 0)) {       // song title
-          dbgprint("ID3 %s = %s", ID3tag.tagid, metalinebf + 1);
-          artttl += String(metalinebf + 1);                  // add to string
-          artttl += String("\n");                            // add newline
-        }
-        if (strncmp(ID3tag.tagid, "TALB", 4) == 0) {         // album
-          dbgprint("ID3 %s = %s", ID3tag.tagid, metalinebf + 1);
-          lastAlbumStation = metalinebf + 1;
-        }
-      }
-    }
+  sdScanActive = false;
+  mp3nodeList.shrink();                                // build finished, give back spare memory
+  SD_mp3fileCount = sdScanFiles;
+  shuffleReset(true);                                  // shuffle all tracks, not only those found
+  sdSearchBuild();                                     // all files known now
+  dbgprint("mp3nodeList contains now %d entries, %d bytes, scan took %d ms", mp3nodeList.size(),
+           mp3nodeList.memUsage(), millis() - sdScanTime);
+  if (sdScanSkipped) {
+    dbgprint("%d SD directories skipped, depth limit is %d", sdScanSkipped, sdMaxDepth);
+  }
+  if (SD_mp3fileCount) {
+    saveSDindex();                                     // quick start next time
+  }
+#ifdef SD_LIBRARY
+  sdLibReq = true;                                     // library may have to be built now
+#endif
+  if (sdScanSkipped) {
+    p = dbgprint("%d mp3 tracks on SD, %d directories skipped", SD_mp3fileCount, sdScanSkipped);
   }
-#ifdef ENABLE_SOAP  
   else {
-    // no need to scan for ID3 tags, we get it from mediaserver
-    if (soapList[currentIndex].artist.length()) {            // artist can be missing
-      artttl = soapList[currentIndex].artist;
-      artttl += String("\n");                                // add newline
-      dbgprint("SOAP TPE1 = %s", soapList[currentIndex].artist.c_str());
-    }
-    artttl += soapList[currentIndex].name;
-    dbgprint("SOAP TIT2 = %s", soapList[currentIndex].name.c_str());
-    if (soapList[currentIndex].album.length()) {             // album can be missing
-      lastAlbumStation = soapList[currentIndex].album;
-      dbgprint("SOAP TALB = %s", soapList[currentIndex].album.c_str());
-    }
+    p = dbgprint("%d mp3 tracks on SD", SD_mp3fileCount);
+  }
+  if (encoderMode != SELECT) {                         // don't disturb selecting tracks
+    tftset(4, p);                                      // show number of tracks on TFT
+  }
+  if (!SD_mp3fileCount) {
+    tftset(1, "SD Card is empty !");
   }
-#endif  
-
-  if (artttl.length()) lastArtistSong = artttl;
-  if (encoderMode != SELECT) {                               // don't disturb selecting SD tracks
-    tftset(1, lastArtistSong);                               // Show artist and title
-    tftset(3, lastAlbumStation  );                           // show album
-  }    
-  return true;
 }
 
 //**************************************************************************************************
-//                                       C O N N E C T T O F I L E                                 *
+//                                     S D L O A D P U B L I S H                                   *
 //**************************************************************************************************
-// Open the local mp3-file.                                                                        *
+// Called from loop() when loadSDindex() has filled sdLoadList.  Replaces mp3nodeList by it, so    *
+// nothing in loop() ever sees a half loaded table.                                                *
 //**************************************************************************************************
-bool connecttofile()
+void sdLoadPublish()
 {
-  tftset(0, "ESP32 MP3Player");                          // set screen segment top line
-  displayTime("");                                       // Clear time on TFT screen
-  if (mp3file) {                                         // close old mp3 file if still open
-    dbgprint("connecttofile: close mp3file");
-    claimSPI("close7");                                  // claim SPI bus
-    mp3file.close();                                     // Close file
-    releaseSPI();                                        // release SPI bus
-  }
-  // See if there are ID3 tags in this file
-  if (!handleID3(host)) {
-    dbgprint("connecttofile: Error reading file %s", host.substring(6).c_str());  // No luck
-    return false;
-  }
-  claimSPI("sdavail5");                                  // claim SPI bus
-  mp3file.seek(0);
-  mp3fileLength = mp3fileBytesLeft = mp3file.available();  // Get file length
-  releaseSPI();                                          // release SPI bus
-  icyname = "";                                          // No icy name yet
-  chunked = false;                                       // File not chunked
-  metaint = 0;                                           // No metadata
+  const char* p;
 
-  return true;
+  sdScanAbort();                                       // a running scan is obsolete
+#ifdef SD_LIBRARY
+  sdLibAbort();                                        // library refers to the old nodes
+#endif
+  sdSearchReset();                                     // search index as well
+  mp3nodeList.take(sdLoadList);
+  sdPathReset();                                       // cached paths are of the old nodes
+  SD_mp3fileCount = sdLoadFiles;
+  shuffleReset(true);                                  // keep RANDOM order if same tracks
+  sdIndexId = sdLoadId;
+  sdSearchBuild();
+  sdLoadDone = false;
+  p = dbgprint("%d mp3 tracks on SD", SD_mp3fileCount);
+  tftset(4, p);                                        // show number of tracks on TFT
+  if (SD_okay && SD_mp3fileCount) {
+    buttonSD = true;
+  }
+#ifdef SD_LIBRARY
+  sdLibReq = true;                                     // loop() loads or builds the library
+#endif
 }
 
 //**************************************************************************************************
-//                                       C O N N E C T W I F I                                     *
+//                                     S D S E A R C H B U I L D                                   *
 //**************************************************************************************************
-// Connect to WiFi using the SSID's available in wifiMulti.                                        *
-// If only one AP if found in preferences (i.e. wifi_00) the connection is made without            *
-// using wifiMulti.                                                                                *
-// If connection fails the function returns false.                                                 *
+// Builds the index for "search": the node numbers of all mp3 files, sorted by name ignoring case. *
+// Only 2 bytes per file, the names stay in mp3nodeList.  Names with a common prefix are           *
+// neighbours in the index, so all files starting with a text are found by a binary search.        *
 //**************************************************************************************************
-#ifndef USE_ETHERNET
-bool connectwifi()
+void sdSearchBuild()
 {
-  char*      pfs;                                        // Pointer to formatted string
-  bool       res = false;                                // Result
-
-  WifiInfo_t winfo;                                      // Entry from wifilist
+  uint32_t t0 = millis();
+  int16_t  n = 0;
 
-  for (int ii = 0; ii < 2; ii++) {
-    WiFi.disconnect();                                   // After restart the router could
-    WiFi.softAPdisconnect(true);                         // still keep the old connection
-    if (wifilist.size()) {                               // Any AP defined?
-      if (wifilist.size() == 1) {                        // Just one AP defined in preferences?
-        winfo = wifilist[0];                             // Get this entry
-        WiFi.begin(winfo.ssid, winfo.passphrase);        // Connect to single SSID found in wifi_xx
-        dbgprint("Try WiFi %s", winfo.ssid);             // Message to show during WiFi connect
-      }
-      else {                                             // More AP to try
-        wifiMulti.run();                                 // Connect to best network
-      }
-      if (WiFi.waitForConnectResult() != WL_CONNECTED) { // Try to connect
-        dbgprint("WiFi Failed! Can't connect. Attempt %d.", ii + 1);
-      }
-      else {
-        pfs = dbgprint("Connected to %s", WiFi.SSID().c_str());
-        tftlog(pfs);
-        res = true;                                      // Return result of connection
-        break;
-      }
-    }
-    else {
-      dbgprint("WiFi Failed! No SSID/Password defined.");
-      break;
+  sdSearchReset();
+  if (SD_mp3fileCount <= 0 ||
+      !psramRealloc((void**)&sdSearchIndex, SD_mp3fileCount * sizeof(int16_t))) {
+    return;
+  }
+  for (int16_t i = 0; i < mp3nodeList.size() && n < SD_mp3fileCount; i++) {
+    if (!mp3nodeList[i].isDirectory) {
+      sdSearchIndex[n++] = i;
     }
   }
-  return res;
+  std::sort(sdSearchIndex, sdSearchIndex + n, [](int16_t x, int16_t y) {
+    return strcasecmp(mp3nodeList.name(x), mp3nodeList.name(y)) < 0;
+  });
+  sdSearchCount = n;
+  dbgprint("Search index of %d files built in %d ms", n, millis() - t0);
 }
 
 //**************************************************************************************************
-//                                           O T A S T A R T                                       *
+//                                     S D S E A R C H R E S E T                                   *
 //**************************************************************************************************
-// Update via WiFi has been started by Arduino IDE.                                                *
+// Forgets the search index, it refers to the nodes of mp3nodeList.                                *
 //**************************************************************************************************
-void otastart()
+void sdSearchReset()
 {
-  char* p;
-
-  p = dbgprint("OTA update Started");
-  tftset(3, p);                                   // Set screen segment bottom part
+  free(sdSearchIndex);                                 // Works for PSRAM as well
+  sdSearchIndex = NULL;
+  sdSearchCount = 0;
 }
-#endif  // USE_ETHERNET
 
 //**************************************************************************************************
-//                                  R E A D H O S T F R O M P R E F                                *
+//                                     S D S E A R C H P A R S E                                   *
 //**************************************************************************************************
-// Read the mp3 host from the preferences specified by the parameter.                              *
-// The host will be returned.                                                                      *
+// Splits "<text>[,<offset>]" of the "search" command.  The text is URL decoded (web interface),   *
+// put in lower case without extra spaces and stored in key (SDSEARCH_TEXTMAX bytes).  Returns the *
+// offset, 0 if none given.                                                                        *
 //**************************************************************************************************
-String readhostfrompref(int8_t preset)
+int sdSearchParse(const String& what, char* key)
 {
-  char tkey[12];                                   // Key as an array of chars
+  const char* p = what.c_str();
+  const char* end = p + what.length();                 // End of text
+  int         inx = what.lastIndexOf(',');
+  int         offset = 0;
+  int         n = 0;
+  char        c;
+  char        hex[3] = { 0, 0, 0 };
 
-  sprintf(tkey, "preset_%02d", preset);            // Form the search key
-  if (nvsSearch(tkey)) {                           // Does it exists?
-    // Get the contents
-    return nvsgetstr(tkey);                        // Get the station (or empty string)
+  if (inx >= 0 && inx < (int)what.length() - 1 &&
+      strspn(p + inx + 1, "0123456789") == what.length() - inx - 1) {
+    offset = atoi(p + inx + 1);                        // Ends with ",<offset>"
+    end = p + inx;
   }
-  else {
-    return String("");                             // Not found
+  for (; p < end && n < SDSEARCH_TEXTMAX - 1; p++) {
+    c = *p;
+    if (c == '%' && isxdigit(p[1]) && isxdigit(p[2])) {
+      hex[0] = p[1];                                   // Like "%20" for a space
+      hex[1] = p[2];
+      c = strtol(hex, NULL, 16);
+      p += 2;
+    }
+    if (c == ' ' && (n == 0 || key[n - 1] == ' ')) {
+      continue;                                        // Skip leading and double spaces
+    }
+    key[n++] = tolower((uint8_t)c);
   }
+  while (n && key[n - 1] == ' ') {
+    n--;                                               // Remove trailing space
+  }
+  key[n] = '\0';
+  return offset;
 }
 
 //**************************************************************************************************
-//                                  R E A D H O S T F R O M P R E F                                *
+//                                     S D S E A R C H M A T C H                                   *
 //**************************************************************************************************
-// Search for the next mp3 host in preferences specified newpreset.                                *
-// The host will be returned.  newpreset will be updated                                           *
+// True if name contains all words of key (lower case, single spaces), ignoring case.              *
 //**************************************************************************************************
-String readhostfrompref()
+bool sdSearchMatch(const char* name, const char* key)
 {
-  String contents = "";                                // Result of search
-  int    maxtry = 0;                                   // Limit number of tries
+  const char* w = key;                                 // Word of key to find
+  const char* p;
+  size_t      len;
+  char        lc, uc;                                  // First character of word in both cases
 
-  while ((contents = readhostfrompref (ini_block.newpreset)) == "") {
-    if (++maxtry > 99) {
-      return "";
+  while (*w) {
+    len = strcspn(w, " ");
+    lc = *w;
+    uc = toupper((uint8_t)lc);
+    for (p = name; *p; p++) {
+      if ((*p == lc || *p == uc) && strncasecmp(p, w, len) == 0) {
+        break;                                         // Word found
+      }
     }
-    if (++ini_block.newpreset > 99) {                  // Next or wrap to 0
-      ini_block.newpreset = 0;
+    if (*p == '\0') {
+      return false;
+    }
+    w += len;
+    if (*w == ' ') {
+      w++;
     }
   }
-  // Get the contents
-  return contents;                                     // return the station
+  return true;
 }
 
 //**************************************************************************************************
-//                             F I N D H I G H E S T P R E S E T                                   *
+//                                         S D S E A R C H                                         *
 //**************************************************************************************************
-// Search for the highest preset_xx number                                                         *
+// Looks up key (from sdSearchParse()) in the search index.  Files whose name starts with key come *
+// first, then all other files containing every word of key, both in name order.  Max. max node    *
+// numbers from match offset on are stored in result.  Returns the total number of matches.  No    *
+// heap is used, a search on 10000 files takes a few ms.                                           *
 //**************************************************************************************************
-uint8_t findHighestPreset()
+int sdSearch(const char* key, int offset, int max, int16_t* result)
 {
-  uint8_t erg = 0, i = 0;
+  size_t len = strlen(key);
+  int    lo = 0, hi = sdSearchCount, mid;              // Binary search
+  int    first, last;                                  // Files starting with key
+  int    total = 0;                                    // Matches so far
 
-  while (true) {
-    if (readhostfrompref (i) != "") {
-      erg = i++;
+  if (len == 0) {
+    return 0;
+  }
+  while (lo < hi) {                                    // Find first name >= key
+    mid = (lo + hi) / 2;
+    if (strncasecmp(mp3nodeList.name(sdSearchIndex[mid]), key, len) < 0) {
+      lo = mid + 1;
     }
     else {
-      break;
+      hi = mid;
     }
   }
-  dbgprint("findHighestPreset(): erg = %d", erg);
-  return erg;
+  first = lo;
+  hi = sdSearchCount;
+  while (lo < hi) {                                    // Find first name > key
+    mid = (lo + hi) / 2;
+    if (strncasecmp(mp3nodeList.name(sdSearchIndex[mid]), key, len) <= 0) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  last = lo;
+  for (int i = first; i < last; i++, total++) {
+    if (total >= offset && total < offset + max) {
+      result[total - offset] = sdSearchIndex[i];
+    }
+  }
+  for (int i = 0; i < sdSearchCount; i++) {
+    if ((i < first || i >= last) && sdSearchMatch(mp3nodeList.name(sdSearchIndex[i]), key)) {
+      if (total >= offset && total < offset + max) {
+        result[total - offset] = sdSearchIndex[i];
+      }
+      total++;
+    }
+  }
+  return total;
 }
 
 //**************************************************************************************************
-//                                       R E A D P R O G B U T T O N S                             *
+//                                        S D L I S T P A T H                                      *
 //**************************************************************************************************
-// Read the preferences for the programmable input pins and the touch pins.                        *
+// Appends the path of directory node dir to buf, names joined with "-" as the web interface       *
+// doesn't like "/" in a track list.  Nothing for the root.                                        *
 //**************************************************************************************************
-#ifdef ENABLE_DIGITAL_INPUTS
-void readProgButtons()
+void sdListPath(char* buf, size_t size, int16_t dir)
 {
-  char   mykey[20];                                      // For numerated key
-  int8_t pinnr;                                          // GPIO pinnumber to fill
-  int    i;                                              // Loop control
-  String val;                                            // Contents of preference entry
-
-  for (i = 0; (pinnr = progpin[i].gpio) >= 0; i++) {     // Scan for all programmable pins
-    sprintf(mykey, "gpio_%02d", pinnr);                 // Form key in preferences
-    if (nvsSearch(mykey)) {
-      val = nvsgetstr(mykey);                            // Get the contents
-      if (val.length()) {                                // Does it exists?
-        if (!progpin[i].reserved) {                      // Do not use reserved pins
-          progpin[i].avail = true;                       // This one is active now
-          progpin[i].command = val;                      // Set command
-          dbgprint("gpio_%02d will execute %s",          // Show result
-                     pinnr, val.c_str());
-        }
-      }
-    }
-  }
-  // Now for the touch pins 0..9, identified by their GPIO pin number
-  for (i = 0; (pinnr = touchpin[i].gpio) >= 0; i++) {    // Scan for all programmable pins
-    sprintf(mykey, "touch_%02d", pinnr);                 // Form key in preferences
-    if (nvsSearch(mykey)) {
-      val = nvsgetstr(mykey);                            // Get the contents
-      if (val.length()) {                                // Does it exists?
-        if (!touchpin[i].reserved) {                     // Do not use reserved pins
-          touchpin[i].avail = true;                      // This one is active now
-          touchpin[i].command = val;                     // Set command
-          //pinMode (touchpin[i].gpio,  INPUT);          // Free floating input
-          dbgprint("touch_%02d will execute %s",         // Show result
-                   pinnr, val.c_str());
-        }
-        else {
-          dbgprint("touch_%02d pin (GPIO%02d) is reserved for I/O!", pinnr, pinnr);
-        }
-      }
+  if (dir > 0) {
+    sdListPath(buf, size, mp3nodeList[dir].parentDir); // Parents first
+    if (buf[0]) {
+      strlcat(buf, "-", size);
     }
+    strlcat(buf, mp3nodeList.name(dir), size);
   }
 }
-#endif
 
 //**************************************************************************************************
-//                                       R E S E R V E P I N                                       *
+//                                        S D L I S T A D D                                        *
 //**************************************************************************************************
-// Set I/O pin to "reserved".                                                                      *
-// The pin is than not available for a programmable function.                                      *
+// Adds a line to the output buffer of sdListPage(), which is sent to the web client when full.    *
 //**************************************************************************************************
-#ifdef ENABLE_DIGITAL_INPUTS
-void reservepin(int8_t rpinnr)
+void sdListAdd(char* buf, size_t* len, const char* line)
 {
-  uint8_t i = 0;                                           // Index in progpin/touchpin array
-  int8_t  pin;                                             // Pin number in progpin array
+  size_t n = strlen(line);
 
-  while ((pin = progpin[i].gpio) >= 0) {                   // Find entry for requested pin
-    if (pin == rpinnr) {                                   // Entry found?
-      //dbgprint("GPIO%02d unavailabe for 'gpio_'-command", pin);
-      progpin[i].reserved = true;                          // Yes, pin is reserved now
-      break;                                               // No need to continue
-    }
-    i++;                                                   // Next entry
-  }
-  // Also reserve touchpin numbers
-  i = 0;
-  while ((pin = touchpin[i].gpio) >= 0) {                  // Find entry for requested pin
-    if (pin == rpinnr) {                                   // Entry found?
-      //dbgprint("GPIO%02d unavailabe for 'touch'-command", pin);
-      touchpin[i].reserved = true;                         // Yes, pin is reserved now
-      break;                                               // No need to continue
-    }
-    i++;                                                   // Next entry
+  if (*len + n > SDLIST_BUFSIZE) {                     // No room left?
+    _claimSPI("sdlist1");                              // claim SPI bus
+    cmdclient.write((uint8_t*)buf, *len);              // Send what we have
+    _releaseSPI();                                     // release SPI bus
+    *len = 0;
   }
+  memcpy(buf + *len, line, n);                         // Lines are much shorter than buf
+  *len += n;
 }
-#endif
 
 //**************************************************************************************************
-//                                       R E A D I O P R E F S                                     *
+//                                        S D L I S T P A G E                                      *
 //**************************************************************************************************
-// Scan the preferences for IO-pin definitions.                                                    *
+// Sends the SD track list ("mp3list") to the web client, straight from mp3nodeList.  The files    *
+// are in the order of the scan, the files of a directory follow a "-1/<path> ---->" line and      *
+// groups are separated by a "-1/ " line.  Root files start with "Root-".  Only count files from   *
+// file number offset on are sent, followed by a "more,<offset>/..." line if there are more.       *
+// Lines are sent from a small buffer on the stack, so a list of any size needs no heap.           *
 //**************************************************************************************************
-void readIOprefs()
+void sdListPage(int offset, int count)
 {
-  struct iosetting
-  {
-    const char* gname;                                   // Name in preferences
-    int8_t*     gnr;                                     // GPIO pin number
-    int8_t      pdefault;                                // Default pin
-  };
-  struct iosetting klist[] = {                           // List of I/O related keys
-#ifdef ENABLE_INFRARED
-    { "pin_ir",       &ini_block.ir_pin,          35 },  // use 35 if needed
-#endif
-    { "pin_enc_clk",  &ini_block.enc_clk_pin,     25 },
-    { "pin_enc_dt",   &ini_block.enc_dt_pin,      26 },
-    { "pin_enc_sw",   &ini_block.enc_sw_pin,      27 },
-    { "pin_tft_cs",   &ini_block.tft_cs_pin,      15 },  // Display SPI version
-    { "pin_tft_dc",   &ini_block.tft_dc_pin,       2 },  // Display SPI version
-    //{ "pin_tft_scl",  &ini_block.tft_scl_pin,     -1 },  // Display I2C version
-    //{ "pin_tft_sda",  &ini_block.tft_sda_pin,     -1 },  // Display I2C version
-    { "pin_sd_cs",    &ini_block.sd_cs_pin,       17 },
-    { "pin_vs_cs",    &ini_block.vs_cs_pin,        5 },
-    { "pin_vs_dcs",   &ini_block.vs_dcs_pin,      16 },
-    { "pin_vs_dreq",  &ini_block.vs_dreq_pin,      4 },
-    { "pin_shutdown", &ini_block.vs_shutdown_pin, -1 },
-    { "pin_spi_sck",  &ini_block.spi_sck_pin,     18 },
-    { "pin_spi_miso", &ini_block.spi_miso_pin,    19 },
-    { "pin_spi_mosi", &ini_block.spi_mosi_pin,    23 },
-    { NULL,           NULL,                        0 }   // End of list
-  };
-  int         i;                                         // Loop control
-  int         count = 0;                                 // Number of keys found
-  String      val;                                       // Contents of preference entry
-  int8_t      ival;                                      // Value converted to integer
-  int8_t*     p;                                         // Points to variable
+  char    buf[SDLIST_BUFSIZE];                         // Lines not sent yet
+  char    line[300];                                   // Line to add
+  char    name[256];                                   // Copy of name for utf8ascii()
+  char*   p;
+  size_t  len = 0;                                     // Bytes used in buf
+  int16_t dir = -1;                                    // Directory of previous file
+  int16_t parent;
+  int     files = 0;                                   // Files passed so far
 
-  for (i = 0; klist[i].gname; i++) {                     // Loop trough all I/O related keys
-    p = klist[i].gnr;                                    // Point to target variable
-    ival = klist[i].pdefault;                            // Assume pin number to be the default
-    if (nvsSearch (klist[i].gname)) {                    // Does it exist?
-      val = nvsgetstr(klist[i].gname);                   // Read value of key
-      if (val.length()) {                                // Parameter in preference?
-        count++;                                         // Yes, count number of filled keys
-        ival = val.toInt();                              // Convert value to integer pinnumber
+  for (int16_t i = 0; i < mp3nodeList.size() && files < offset + count; i++) {
+    if (mp3nodeList[i].isDirectory) {
+      continue;
+    }
+    parent = mp3nodeList[i].parentDir;
+    if (files++ < offset) {                            // Not on this page
+      dir = parent;
+      continue;
+    }
+    if (parent != dir) {                               // First file of a directory?
+      if (dir >= 0) {
+        sdListAdd(buf, &len, "-1/ \n");                // Add spacing in list
+      }
+      if (parent != 0) {
+        strcpy(line, "-1/");
+        sdListPath(line + 3, sizeof(line) - 10, parent); // Leave room for " ---->"
+        strcat(line, " ---->\n");
+        sdListAdd(buf, &len, line);
       }
+      dir = parent;
     }
-#ifdef ENABLE_DIGITAL_INPUTS        
-    reservepin(ival);                                    // Set pin to "reserved"
-#endif        
-    *p = ival;                                           // Set pinnumber in ini_block
-    dbgprint("%s set to %d", klist[i].gname, ival);      // Show result
+    strlcpy(name, mp3nodeList.name(i), sizeof(name));
+    if ((p = strstr(name, ".mp3")) || (p = strstr(name, ".MP3"))) {
+      *p = '\0';                                       // File name without extension
+    }
+    utf8ascii(name);                                   // Web interface is ISO-8859-1
+    snprintf(line, sizeof(line), "%d/%s%s\n", i, parent ? "" : "Root-", name);
+    sdListAdd(buf, &len, line);
   }
+  if (files < SD_mp3fileCount) {                       // Another page to come?
+    snprintf(line, sizeof(line), "more,%d/... %d more tracks\n", files, SD_mp3fileCount - files);
+    sdListAdd(buf, &len, line);
+  }
+  _claimSPI("sdlist2");                                // claim SPI bus
+  cmdclient.write((uint8_t*)buf, len);
+  _releaseSPI();                                       // release SPI bus
 }
 
 //**************************************************************************************************
-//                                       R E A D P R E F S                                         *
+//                                     S D S E A R C H L I S T                                     *
 //**************************************************************************************************
-// Read the preferences and interpret the commands.                                                *
-// If output == true, the key / value pairs are returned to the caller as a String.                *
+// Sends one page of "search" matches to the web client, "<node>/<name>" lines like "mp3list".     *
+// If there are more matches, the last line is "more,<offset>/..." with the offset of the next     *
+// page.  Parameter is "<text>[,<offset>]".  Lines go through sdListAdd() like those of            *
+// sdListPage(), so no heap is needed.                                                             *
 //**************************************************************************************************
-String readPrefs(bool output)
+void sdSearchList(const String& what)
 {
-  uint16_t    i;                                           // Loop control
-  String      val;                                         // Contents of preference entry
-  String      cmd;                                         // Command for analyzCmd
-  String      outstr = "";                                 // Outputstring
-  char*       key;                                         // Point to nvskeys[i]
-  uint8_t     winx;                                        // Index in wifilist
-  uint16_t    last2char = 0;                               // To detect paragraphs
+  char    key[SDSEARCH_TEXTMAX];                       // Text to search for
+  char    buf[SDLIST_BUFSIZE];                         // Lines not sent yet
+  char    line[300];                                   // Line to add
+  char    name[256];                                   // Copy of name for utf8ascii()
+  int16_t result[SDSEARCH_PAGE];                       // Nodes found
+  int     offset = sdSearchParse(what, key);
+  int     total = 0, n = 0;
+  size_t  len = 0;                                     // Bytes used in buf
 
-  i = 0;
-  while (*(key = nvskeys[i])) {                            // Loop trough all available keys
-    val = nvsgetstr(key);                                  // Read value of this key
-    cmd = String(key) +                                    // Yes, form command
-          String(" = ") +
-          val;
-    if (strstr(key, "wifi_")) {                            // Is it a wifi ssid/password?
-      if ((winx = val.indexOf("/")) > 0) {
-        val.remove(winx + 1);
-        val +=  String("*******");                         // Yes, hide password
-      }
-      cmd = String("");                                    // Do not analyze this
-    }
-    if (output) {
-      if ((i > 0) &&
-          (*(uint16_t*)key != last2char)) {                // New paragraph?
-        outstr += String("#\n");                           // Yes, add separator
-      }
-      last2char = *(uint16_t*)key;                         // Save 2 chars for next compare
-      outstr += String(key) +                              // Add to outstr
-                String(" = ") +
-                val +
-                String("\n");                              // Add newline
-    }
-    else {
-      analyzeCmd(cmd.c_str());                             // Analyze it
-    }
-    i++;                                                   // Next key
+  if (sdSearchCount) {
+    total = sdSearch(key, offset, SDSEARCH_PAGE, result);
+    n = constrain(total - offset, 0, SDSEARCH_PAGE);
   }
-  if (i == 0) {
-    outstr = String("No preferences found.\n"
-                    "Use defaults or run Esp32_radio_init first.\n");
+  for (int i = 0; i < n; i++) {
+    strlcpy(name, mp3nodeList.name(result[i]), sizeof(name));
+    utf8ascii(name);                                   // Web interface is ISO-8859-1
+    snprintf(line, sizeof(line), "%d/%s\n", result[i], name);
+    sdListAdd(buf, &len, line);
   }
-  return outstr;
+  if (offset + n < total) {
+    snprintf(line, sizeof(line), "more,%d/... %d more\n", offset + n, total - offset - n);
+    sdListAdd(buf, &len, line);
+  }
+  else if (total == 0) {
+    sdListAdd(buf, &len, sdSearchCount ? "-1/No tracks found.\n" : "-1/Search not ready.\n");
+  }
+  _claimSPI("sdsearch");                               // claim SPI bus
+  cmdclient.write((uint8_t*)buf, len);
+  _releaseSPI();                                       // release SPI bus
 }
 
+#ifdef SD_LIBRARY
 //**************************************************************************************************
-//                                     S C A N S E R I A L                                         *
+//                                      S D L I B S T R I N G                                      *
 //**************************************************************************************************
-// Listen to commands on the Serial inputline.                                                     *
+// Puts string s into sdLibPool and returns its offset in *ofs.  Tracks of an album mostly follow  *
+// each other, so s is not stored again if it is the same as the string at offset same.            *
 //**************************************************************************************************
-void scanserial()
+bool sdLibString(const char* s, uint32_t same, uint32_t* ofs)
 {
-  static String serialcmd;                        // Command from Serial input
-  //char          c;                              // Input character
-  //const char*   reply;                          // Reply string froma analyzeCmd
-  //uint16_t      len;                            // Length of input string
+  size_t len = strlen(s) + 1;                          // Including delimiter
 
-  while (Serial.available()) {                    // Any input seen?
-    /*c =  (char)*/Serial.read();                 // Yes, read the next input character
-    // TEST
-    //Serial.write(c);                            // Echo
-    /* 
-      len = serialcmd.length();                   // Get the length of the current string
-      if ((c == '\n') || (c == '\r')) {
-        if (len) {
-          strncpy(cmd, serialcmd.c_str(), sizeof(cmd));
-          reply = analyzeCmd(cmd);                // Analyze command and handle it
-          dbgprint(reply);                        // Result for debugging
-          serialcmd = "";                         // Prepare for new command
-        }
-      }
-      if (c >= ' ') {                             // Only accept useful characters
-        serialcmd += c;                           // Add to the command
-      }
-      if (len >= (sizeof(cmd) - 2)) {             // Check for excessive length
-        serialcmd = "";                           // Too long, reset
-      }
-    */
+  if (same < sdLibPoolLen && strcmp(sdLibPool + same, s) == 0) {
+    *ofs = same;
+    return true;
+  }
+  if (sdLibPoolLen + len > sdLibPoolMax) {             // Pool full?
+    if (!psramRealloc((void**)&sdLibPool, sdLibPoolMax + 4096)) {
+      return false;
+    }
+    sdLibPoolMax += 4096;
   }
+  memcpy(sdLibPool + sdLibPoolLen, s, len);
+  *ofs = sdLibPoolLen;
+  sdLibPoolLen += len;
+  return true;
 }
 
 //**************************************************************************************************
-//                                     S C A N D I G I T A L                                       *
+//                                      S D L I B A D D                                            *
 //**************************************************************************************************
-// Scan digital inputs.                                                                            *
+// Adds the tags of file node to the library being built.  Missing texts are replaced, the title   *
+// by the file name.  Returns false if there is no memory left.                                    *
 //**************************************************************************************************
-#ifdef ENABLE_DIGITAL_INPUTS
-void  scandigital()
+bool sdLibAdd(int16_t node, char tag[][SDLIB_TEXTMAX])
 {
-  static uint32_t oldmillis = 5000;                        // To compare with current time
-  int             i;                                       // Loop control
-  int8_t          pinnr;                                   // Pin number to check
-  bool            level;                                   // Input level
-  const char*     reply;                                   // Result of analyzeCmd
-  int16_t         tlevel;                                  // Level found by touch pin
-  const int16_t   THRESHOLD = 30;                          // Threshold or touch pins
+  sdlib_tags_t* t;
+  uint32_t      none = UINT32_MAX;                     // No string to compare with
+  const char*   ext;
 
-  if ((millis() - oldmillis) < 100) {                      // Debounce
-    return;
-  }
-  oldmillis = millis();                                    // 100 msec over
-  for (i = 0; (pinnr = progpin[i].gpio) >= 0; i++) {       // Scan all inputs
-    if (!progpin[i].avail || progpin[i].reserved) {        // Skip unused and reserved pins
-      continue;
-    }
-    level = (digitalRead(pinnr) == HIGH);                  // Sample the pin
-    if (level != progpin[i].cur) {                         // Change seen?
-      progpin[i].cur = level;                              // And the new level
-      if (!level) {                                        // HIGH to LOW change?
-        dbgprint("GPIO_%02d is now LOW, execute %s",
-                   pinnr, progpin[i].command.c_str());
-        reply = analyzeCmd(progpin[i].command.c_str());    // Analyze command and handle it
-        dbgprint(reply);                                   // Result for debugging
-      }
+  if (sdLibCount == sdLibMax) {                        // Table full?
+    if (!psramRealloc((void**)&sdLibTags, (sdLibMax + 256) * sizeof(sdlib_tags_t))) {
+      return false;
     }
+    sdLibMax += 256;
+  }
+  if (!tag[0][0]) strcpy(tag[0], "Unknown artist");
+  if (!tag[1][0]) strcpy(tag[1], "Unknown album");
+  if (!tag[3][0]) strcpy(tag[3], "Unknown genre");
+  if (!tag[2][0]) {                                    // No title, take file name
+    ext = strrchr(mp3nodeList.name(node), '.');
+    id3Copy(tag[2], SDLIB_TEXTMAX, (const uint8_t*)mp3nodeList.name(node),
+            ext ? ext - mp3nodeList.name(node) : SDLIB_TEXTMAX);
+  }
+  t = &sdLibTags[sdLibCount];
+  t->node = node;
+  t->trackNo = min(atoi(tag[4]), 255);                 // "3/12" is track 3
+  t->year = atoi(tag[5]);                              // "2004-05-01" is 2004
+  if (sdLibCount) {                                    // Compare with track before
+    t->artist = sdLibTags[sdLibCount - 1].artist;
+    t->album = sdLibTags[sdLibCount - 1].album;
+    t->genre = sdLibTags[sdLibCount - 1].genre;
   }
-  // Now for the touch pins
-  for (i = 0; (pinnr = touchpin[i].gpio) >= 0; i++) {      // Scan all inputs
-    if (!touchpin[i].avail || touchpin[i].reserved) {      // Skip unused and reserved pins
-      continue;
-    }
-    tlevel = (touchRead(pinnr));                           // Sample the pin
-    level = (tlevel >= 30);                                // True if below threshold
-    if (level) {                                           // Level HIGH?
-      touchpin[i].count = 0;                               // Reset count number of times
-    }
-    else {
-      if (++touchpin[i].count < 3) {                       // Count number of times LOW
-        level = true;                                      // Not long enough: handle as HIGH
-      }
-    }
-    if (level != touchpin[i].cur) {                        // Change seen?
-      touchpin[i].cur = level;                             // And the new level
-      if (!level) {                                        // HIGH to LOW change?
-        dbgprint("TOUCH_%02d is now %d (< %d), execute %s",
-                   pinnr, tlevel, THRESHOLD,
-                   touchpin[i].command.c_str());
-        reply = analyzeCmd(touchpin[i].command.c_str());   // Analyze command and handle it
-        dbgprint(reply);                                   // Result for debugging
-      }
-    }
+  else {
+    t->artist = t->album = t->genre = none;
+  }
+  if (!sdLibString(tag[0], t->artist, &t->artist) ||
+      !sdLibString(tag[1], t->album, &t->album) ||
+      !sdLibString(tag[2], none, &t->title) ||
+      !sdLibString(tag[3], t->genre, &t->genre)) {
+    return false;
   }
+  sdLibCount++;
+  return true;
 }
-#endif
 
-#ifdef ENABLE_INFRARED
 //**************************************************************************************************
-//                                     S C A N I R                                                 *
+//                                      S D L I B F R E E                                          *
 //**************************************************************************************************
-// See if IR input is available.  Execute the programmed command.                                  *
+// Gives back the memory used while building the library.                                          *
 //**************************************************************************************************
-void scanIR()
+void sdLibFree()
 {
-  char        mykey[20];                                   // For numerated key
-  String      val;                                         // Contents of preference entry
-  const char* reply;                                       // Result of analyzeCmd
-
-  if (ir_value) {                                          // Any input?
-    sprintf(mykey, "ir_%04X", ir_value);                   // Form key in preferences
-    if (nvsSearch (mykey)) {
-      val = nvsgetstr(mykey);                              // Get the contents
-      dbgprint("IR code %04X received. Will execute %s",
-                 ir_value, val.c_str());
-      reply = analyzeCmd(val.c_str());                     // Analyze command and handle it
-      dbgprint(reply);                                     // Result for debugging
-    }
-    else {
-      dbgprint("IR code %04X received, but not found in preferences! Timing %d/%d",
-               ir_value, ir_0, ir_1);
-    }
-    ir_value = 0;                                          // Reset IR code received
-  }
+  free(sdLibTags);                                     // Works for PSRAM as well
+  free(sdLibPool);
+  sdLibTags = NULL;
+  sdLibPool = NULL;
+  sdLibCount = sdLibMax = 0;
+  sdLibPoolLen = sdLibPoolMax = 0;
 }
-#endif
 
-#ifndef USE_ETHERNET
 //**************************************************************************************************
-//                                           M K _ L S A N                                         *
+//                                      S D L I B L E S S                                          *
 //**************************************************************************************************
-// Make al list of acceptable networks in preferences.                                             *
-// Will be called only once by setup().                                                            *
-// The result will be stored in wifilist.                                                          *
-// Not that the last found SSID and password are kept in common data.  If only one SSID is         *
-// defined, the connect is made without using wifiMulti.  In this case a connection will           *
-// be made even if the SSID is hidden.                                                             *
+// Order of the tracks in the library: artist, album, track number, title.  Case is ignored.       *
 //**************************************************************************************************
-void  mk_lsan()
+bool sdLibLess(uint16_t a, uint16_t b)
 {
-  uint8_t     i;                                        // Loop control
-  char        key[10];                                  // For example: "wifi_03"
-  String      buf;                                      // "SSID/password"
-  String      lssid, lpw;                               // Last read SSID and password from nvs
-  int         inx;                                      // Place of "/"
-  WifiInfo_t  winfo;                                    // Element to store in list
+  const sdlib_tags_t& x = sdLibTags[a];
+  const sdlib_tags_t& y = sdLibTags[b];
+  int                 res;
 
-  dbgprint("Create list with acceptable WiFi networks");
-  for (i = 0; i < 100; i++) {                           // Examine wifi_00 .. wifi_99
-    sprintf(key, "wifi_%02d", i);                       // Form key in preferences
-    if (nvsSearch(key)) {                               // Does it exists?
-      buf = nvsgetstr(key);                             // Get the contents
-      inx = buf.indexOf("/");                           // Find separator between ssid and password
-      if (inx > 0) {                                    // Separator found?
-        lpw = buf.substring(inx + 1);                   // Isolate password
-        lssid = buf.substring(0, inx);                  // Holds SSID now
-        dbgprint("Added %s to list of networks", lssid.c_str());
-        winfo.inx = i;                                  // Create new element for wifilist;
-        winfo.ssid = strdup(lssid.c_str());             // Set ssid of element
-        winfo.passphrase = strdup(lpw.c_str());
-        // fall back
-        if (strcmp(winfo.ssid, "MySSID") == 0 &&
-            *winfo.passphrase == '*') {
-          winfo.passphrase = strdup("MyPassword");
-        }
-        wifilist.push_back(winfo);                      // Add to list
-        wifiMulti.addAP(winfo.ssid, winfo.passphrase);  // Add to wifi acceptable network list
-      }
-    }
+  if ((res = strcasecmp(sdLibPool + x.artist, sdLibPool + y.artist)) != 0) return res < 0;
+  if ((res = strcasecmp(sdLibPool + x.album, sdLibPool + y.album)) != 0) return res < 0;
+  if (x.trackNo != y.trackNo) return x.trackNo < y.trackNo;
+  return strcasecmp(sdLibPool + x.title, sdLibPool + y.title) < 0;
+}
+
+//**************************************************************************************************
+//                                      S D L I B S A V E                                          *
+//**************************************************************************************************
+// Sorts the tags read and writes SDLIB_FILE.  Sections are fixed size records, so every entry can *
+// be read with a single seek while browsing:                                                      *
+//   artists by name, albums by artist and name, tracks by album and track number, genres by name, *
+//   genre list (track records per genre, uint16_t) and the text section with all strings.         *
+//**************************************************************************************************
+bool sdLibSave()
+{
+  HEAP_TAG("sdLibSave");
+  sdlib_head_struct           head;
+  std::vector<uint16_t>       order(sdLibCount);       // Tags in library order = track records
+  std::vector<uint16_t>       glist(sdLibCount);       // Track records in genre order
+  std::vector<uint16_t>       tgenre(sdLibCount);      // Genre record of a track record
+  std::vector<sdlib_list_t>   artists;
+  std::vector<sdlib_album_t>  albums;
+  std::vector<sdlib_list_t>   genres;
+  sdlib_track_t               track;
+  sdix_struct                 ix;                      // Write buffer and checksum
+  const char*                 pool = sdLibPool;
+  uint16_t                    t, a = 0;
+  File                        f;
+  bool                        ok;
+
+  for (t = 0; t < sdLibCount; t++) {
+    order[t] = glist[t] = t;
+  }
+  std::sort(order.begin(), order.end(), sdLibLess);
+  for (t = 0; t < sdLibCount; t++) {                   // Group tracks into albums and artists
+    const sdlib_tags_t& x = sdLibTags[order[t]];
+    bool newArtist = (t == 0) ||
+                     strcasecmp(pool + x.artist, pool + sdLibTags[order[t - 1]].artist) != 0;
+    if (newArtist) {
+      artists.push_back({ x.artist, (uint16_t)albums.size(), 0 });
+    }
+    if (newArtist || strcasecmp(pool + x.album, pool + sdLibTags[order[t - 1]].album) != 0) {
+      albums.push_back({ x.album, t, 0, (uint16_t)(artists.size() - 1), x.year });
+      artists.back().count++;
+    }
+    albums.back().count++;
+    if (albums.back().year == 0) {
+      albums.back().year = x.year;
+    }
+  }
+  std::sort(glist.begin(), glist.end(), [&](uint16_t x, uint16_t y) {
+    int res = strcasecmp(pool + sdLibTags[order[x]].genre, pool + sdLibTags[order[y]].genre);
+    return res ? res < 0 : x < y;                      // Same genre: library order
+  });
+  for (t = 0; t < sdLibCount; t++) {                   // Group genre list into genres
+    uint32_t name = sdLibTags[order[glist[t]]].genre;
+    if (t == 0 || strcasecmp(pool + name, pool + genres.back().name) != 0) {
+      genres.push_back({ name, t, 0 });
+    }
+    genres.back().count++;
+    tgenre[glist[t]] = genres.size() - 1;
+  }
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, "SDLB", 4);
+  head.version = SDLIB_VERSION;
+  head.nodes = mp3nodeList.size();
+  head.indexId = sdIndexId;
+  head.artists = artists.size();
+  head.albums = albums.size();
+  head.tracks = sdLibCount;
+  head.genres = genres.size();
+  head.artistOfs = sizeof(head);
+  head.albumOfs = head.artistOfs + head.artists * sizeof(sdlib_list_t);
+  head.trackOfs = head.albumOfs + head.albums * sizeof(sdlib_album_t);
+  head.genreOfs = head.trackOfs + head.tracks * sizeof(sdlib_track_t);
+  head.genreListOfs = head.genreOfs + head.genres * sizeof(sdlib_list_t);
+  head.textOfs = head.genreListOfs + head.tracks * sizeof(uint16_t);
+  head.size = head.textOfs + sdLibPoolLen;
+  claimSD("sdlibopen1");
+  f = sdfs->open(SDLIB_FILE, FILE_WRITE);
+  releaseSD();
+  if (!f) {
+    dbgprint("Music library not written, card write protected?");
+    return false;
   }
-  dbgprint("End adding networks"); ////
+  claimSD("sdlibplace");
+  ok = (f.write((uint8_t*)&head, sizeof(head)) == sizeof(head)); // Placeholder for header
+  releaseSD();
+  sdIndexReset(ix);
+  ok = ok && sdIndexWrite(ix, f, artists.data(), head.artists * sizeof(sdlib_list_t)) &&
+       sdIndexWrite(ix, f, albums.data(), head.albums * sizeof(sdlib_album_t));
+  memset(&track, 0, sizeof(track));
+  for (t = 0; ok && t < sdLibCount; t++) {
+    const sdlib_tags_t& x = sdLibTags[order[t]];
+    while (a + 1 < head.albums && albums[a + 1].first <= t) {
+      a++;                                             // Track belongs to next album
+    }
+    track.title = x.title;
+    track.node = x.node;
+    track.album = a;
+    track.genre = tgenre[t];
+    track.year = x.year;
+    track.trackNo = x.trackNo;
+    ok = sdIndexWrite(ix, f, &track, sizeof(track));
+  }
+  ok = ok && sdIndexWrite(ix, f, genres.data(), head.genres * sizeof(sdlib_list_t)) &&
+       sdIndexWrite(ix, f, glist.data(), head.tracks * sizeof(uint16_t)) &&
+       sdIndexWrite(ix, f, sdLibPool, sdLibPoolLen) &&
+       sdIndexFlush(ix, f);
+  claimSD("sdlibclose1");
+  f.close();
+  releaseSD();
+  if (ok) {
+    claimSD("sdlibopen2");
+    f = sdfs->open(SDLIB_FILE, "r+");                  // Overwrite header, size stays
+    releaseSD();
+    if (f) {
+      claimSD("sdlibhead");
+      ok = (f.write((uint8_t*)&head, sizeof(head)) == sizeof(head));
+      f.close();
+      releaseSD();
+      if (ok) {
+        sdIndexResign();                               // Keep SD index valid
+        sdLibHead = head;
+        dbgprint("Music library written: %d artists, %d albums, %d tracks, %d genres, %d bytes",
+                 head.artists, head.albums, head.tracks, head.genres, head.size);
+        return true;
+      }
+    }
+  }
+  dbgprint("Music library not written");
+  claimSD("sdlibremove");
+  sdfs->remove(SDLIB_FILE);                            // No half written library
+  releaseSD();
+  return false;
 }
-#endif  // USE_ETHERNET
 
 //**************************************************************************************************
-//                                 C H K _ S T A T I C I P S                                       *
+//                                      S D L I B L O A D                                          *
 //**************************************************************************************************
-// Check if we are supposed to use DHCP or fixed IPs, found in preferences                         *
-//                                                                                                 *
+// Checks if SDLIB_FILE belongs to the SD index in use.  Only the header is kept in memory, the    *
+// records are read from the card while browsing.                                                  *
 //**************************************************************************************************
-void chk_staticIPs()
+bool sdLibLoad()
 {
-  String    buf;                                     // contains value of key
-  //const char* p;
-  IPAddress addr;
+  File f;
+  bool ok = false;
 
-  dbgprint("Search for local IP in preferences");
-  if (nvsSearch("ip")) {                             // Does it exists?
-    buf = nvsgetstr("ip");                           // Get the contents
-    if (addr.fromString(buf.c_str())) {
-      local_IP = addr;
-      if (!dhcpRequested) staticIPs = true;          // dhcpRequested is only true when rotary encoder is pressed while booting
-      dbgprint("Prefs: ip = %s", buf.c_str());
-    }
+  claimSD("sdlibopen3");
+  f = sdfs->open(SDLIB_FILE);
+  if (f) {
+    ok = (f.read((uint8_t*)&sdLibHead, sizeof(sdLibHead)) == sizeof(sdLibHead)) &&
+         memcmp(sdLibHead.magic, "SDLB", 4) == 0 &&
+         sdLibHead.version == SDLIB_VERSION &&
+         sdLibHead.indexId == sdIndexId &&
+         sdLibHead.nodes == mp3nodeList.size() &&
+         sdLibHead.size == f.size();                   // Not cut off
+    f.close();
   }
-  if (nvsSearch("ip_dns")) {                         // Does it exists?
-    buf = nvsgetstr("ip_dns");                       // Get the contents
-    if (addr.fromString(buf.c_str())) {
-      primaryDNS = addr;
-      dbgprint("Prefs: ip_dns = %s", buf.c_str());
-    }
+  releaseSD();
+  if (ok) {
+    dbgprint("Music library loaded, %d artists, %d albums, %d tracks", sdLibHead.artists,
+             sdLibHead.albums, sdLibHead.tracks);
   }
-  if (nvsSearch("ip_gateway")) {                     // Does it exists?
-    buf = nvsgetstr("ip_gateway");                   // Get the contents
-    if (addr.fromString(buf.c_str())) {
-      gateway = addr;
-      dbgprint("Prefs: ip_gateway = %s", buf.c_str());
-    }
+  return ok;
+}
+
+//**************************************************************************************************
+//                                      S D L I B S T A R T                                        *
+//**************************************************************************************************
+// Takes the library on the card if it is up to date, otherwise starts building a new one.         *
+// Nothing happens if the library is switched off or the SD index is not on the card.              *
+//**************************************************************************************************
+void sdLibStart()
+{
+  sdLibAbort();
+  if (!sdLibEnabled || !SD_okay || sdScanActive || !SD_mp3fileCount || !sdIndexId) {
+    return;
   }
-  if (nvsSearch("ip_subnet")) {                      // Does it exists?
-    buf = nvsgetstr("ip_subnet");                    // Get the contents
-    if (addr.fromString(buf.c_str())) {
-      subnet = addr;
-      dbgprint("Prefs: ip_subnet = %s", buf.c_str());
-    }
+  if ((sdLibReady = sdLibLoad())) {
+    return;
   }
+  dbgprint("Build music library of %d tracks", SD_mp3fileCount);
+  sdLibNode = 1;                                       // Root is node 0
+  sdLibStartTime = millis();
+  sdLibActive = true;
 }
 
-#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
 //**************************************************************************************************
-//                                     G E T R A D I O S T A T U S                                 *
+//                                      S D L I B A B O R T                                        *
 //**************************************************************************************************
-// Return preset-, tone- and volume status.                                                        *
-// Included are the presets, the current station, the volume and the tone settings.                *
+// Stops a running library build.  The library can't be used until sdLibStart() is called again.   *
 //**************************************************************************************************
-String getradiostatus()
+void sdLibAbort()
 {
-  char pnr[3];                                         // Preset as 2 character, i.e. "03"
-
-  sprintf(pnr, "%02d", ini_block.newpreset);           // Current preset
-  return String("preset=") +                           // Add preset setting
-         String(pnr) +
-         //         String("\nvolume=") +                        // Add volume setting
-         //         String(String(ini_block.reqvol)) +
-         String("\ntoneha=") +                         // Add tone setting HA
-         String(ini_block.rtone[0]) +
-         String("\ntonehf=") +                         // Add tone setting HF
-         String(ini_block.rtone[1]) +
-         String("\ntonela=") +                         // Add tone setting LA
-         String(ini_block.rtone[2]) +
-         String("\ntonelf=") +                         // Add tone setting LF
-         String(ini_block.rtone[3]);
+  sdLibActive = false;
+  sdLibReady = false;
+  sdLibFree();
 }
 
 //**************************************************************************************************
-//                                     G E T S E T T I N G S                                       *
+//                                      S D L I B S T E P                                          *
 //**************************************************************************************************
-// Send some settings to the webserver.                                                            *
-// Included are the presets, the current station, the volume and the tone settings.                *
+// Reads the tags of the next mp3 file while the library is built.  Called from loop().  While     *
+// playing, a file is read only if the data queue is at least half full and SDLIB_PAUSE ms have    *
+// passed, so the player always gets the SD card first.                                            *
 //**************************************************************************************************
-void getsettings()
+void sdLibStep()
 {
-  String val;                                         // Result to send
-  String statstr;                                     // Station string
-  int    inx;                                         // Position of search char in line
-  int    i;                                           // Loop control, preset number
-  char   tkey[12];                                    // Key for preset preference
+  HEAP_TAG("sdLibStep");
+  char tag[6][SDLIB_TEXTMAX];                          // Artist, album, title, genre, track, year
+  char path[SDPATH_MAX];                               // Full path of the file
+  File f;
 
-  for (i = 0; i < 100; i++) {                         // Max 99 presets
-    sprintf(tkey, "preset_%02d", i);                  // Preset plus number
-    if (nvsSearch(tkey)) {                            // Does it exists?
-      // Get the contents
-      statstr = nvsgetstr(tkey);                      // Get the station
-      // Show just comment if available.  Otherwise the preset itself.
-      inx = statstr.indexOf("#");                     // Get position of "#"
-      if (inx > 0) {                                  // Hash sign present?
-        statstr.remove(0, inx + 1);                   // Yes, remove non-comment part
-      }
-      chomp(statstr);                                 // Remove garbage from description
-      val += String(tkey) +
-             String("=") +
-             statstr +
-             String("\n");                            // Add delimeter
-      if (val.length() > 1000) {                      // Time to flush?
-        _claimSPI("getsettings1");                    // claim SPI bus
-        cmdclient.print(val);                         // Yes, send
-        _releaseSPI();                                // release SPI bus
-        val = "";                                     // Start new string
-      }
-    }
+  if (sdLibReq) {                                      // Library (re)started by command or mount
+    sdLibReq = false;
+    sdLibStart();
   }
-  val += getradiostatus() +                           // Add radio setting
-         String("\n\n");                             // End of reply
-  _claimSPI("getsettings2");                          // claim SPI bus
-  cmdclient.print(val);                               // And send
-  _releaseSPI();                                      // release SPI bus
+  if (!sdLibActive || sdScanActive) {
+    return;
+  }
+  if ((dataMode & DATA) &&
+      (uxQueueMessagesWaiting(dataQueue) < (QSIZ / 2) || (millis() - sdLibTime) < SDLIB_PAUSE)) {
+    return;                                            // Player needs the card
+  }
+  sdLibTime = millis();
+  while (sdLibNode < mp3nodeList.size() && mp3nodeList[sdLibNode].isDirectory) {
+    sdLibNode++;                                       // Skip directories
+  }
+  if (sdLibNode >= mp3nodeList.size()) {               // All files done?
+    sdLibActive = false;
+    dbgprint("Tags of %d tracks read in %d s", sdLibCount, (millis() - sdLibStartTime) / 1000);
+    sdLibReady = sdLibSave();
+    sdLibFree();
+    return;
+  }
+  if (sdPath(sdLibNode, path, sizeof(path)) < 0) {
+    sdLibNode++;                                       // Path too long, skip the file
+    return;
+  }
+  claimSD("sdlibopen4");
+  f = sdfs->open(path);
+  releaseSD();
+  if (!f) {
+    dbgprint("Music library: can't open %s", path);
+    SD_rescanReq = true;                               // Card removed or index outdated
+    sdLibAbort();
+    return;
+  }
+  id3ReadTags(f, tag[0], SDLIB_TEXTMAX);
+  claimSD("sdlibclose2");
+  f.close();
+  releaseSD();
+  if (!sdLibAdd(sdLibNode, tag)) {
+    dbgprint("No memory for music library after %d tracks", sdLibCount);
+    sdLibAbort();
+    return;
+  }
+  sdLibNode++;
 }
-#endif
 
 //**************************************************************************************************
-//                                           T F T L O G                                           *
+//                                      S D L I B E N T R Y                                        *
 //**************************************************************************************************
-// Log to TFT if enabled.                                                                          *
+// Reads entry inx of a library section from the open SDLIB_FILE.  Level 0 are artists, 1 albums,  *
+// 2 tracks and 3 genres.  Returns its name and the range of its albums, tracks or genre list      *
+// entries.  For a track, first is its file node and count its track number.                       *
 //**************************************************************************************************
-void tftlog(const char *str, uint16_t textColor)
+bool sdLibEntry(File& f, uint8_t level, uint16_t inx, char* name, uint16_t* first,
+                uint16_t* count)
 {
-  if (tft) {                                           // TFT configured?
-    if (textColor != (WHITE)) dsp_setTextColor(textColor);
-    dsp_println(str);                                  // Yes, show info on TFT
-    dsp_update();                                      // To physical screen
-    if (textColor != (WHITE)) dsp_setTextColor(WHITE);
+  const uint32_t ofs[] = { sdLibHead.artistOfs, sdLibHead.albumOfs,
+                           sdLibHead.trackOfs, sdLibHead.genreOfs };
+  const uint16_t num[] = { sdLibHead.artists, sdLibHead.albums,
+                           sdLibHead.tracks, sdLibHead.genres };
+  const uint8_t  siz[] = { sizeof(sdlib_list_t), sizeof(sdlib_album_t),
+                           sizeof(sdlib_track_t), sizeof(sdlib_list_t) };
+  union {                                              // One record of any section
+    sdlib_list_t  list;
+    sdlib_album_t album;
+    sdlib_track_t track;
+  } rec;
+  int n = 0;
+  bool ok;
+
+  if (level > 3 || inx >= num[level]) {
+    return false;
+  }
+  claimSD("sdlibentry");
+  ok = f.seek(ofs[level] + inx * siz[level]) && (f.read((uint8_t*)&rec, siz[level]) == siz[level]) &&
+       f.seek(sdLibHead.textOfs + rec.list.name);      // Name is first in every record
+  if (ok) {
+    n = f.read((uint8_t*)name, SDLIB_TEXTMAX);         // Strings are max. SDLIB_TEXTMAX
+  }
+  releaseSD();
+  name[(n > 0) ? n - 1 : 0] = '\0';                    // Delimiter is in there anyway
+  if (level == 2) {
+    *first = rec.track.node;
+    *count = rec.track.trackNo;
   }
+  else {
+    *first = rec.list.first;                           // Same place in album record
+    *count = rec.list.count;
+  }
+  return ok && n > 0;
 }
 
 //**************************************************************************************************
-//                                   F I N D N S I D                                               *
+//                                      S D L I B E N T R Y                                        *
 //**************************************************************************************************
-// Find the namespace ID for the namespace passed as parameter.                                    *
+// Same as above, opens SDLIB_FILE for a single entry.  Used by the encoder menu.                  *
 //**************************************************************************************************
-uint8_t FindNsID (const char* ns)
+bool sdLibEntry(uint8_t level, uint16_t inx, String& name, uint16_t* first, uint16_t* count)
 {
-  esp_err_t                 result = ESP_OK;                 // Result of reading partition
-  uint32_t                  offset = 0;                      // Offset in nvs partition
-  uint8_t                   i;                               // Index in Entry 0..125
-  uint8_t                   bm;                              // Bitmap for an entry
-  uint8_t                   res = 0xFF;                      // Function result
+  char buf[SDLIB_TEXTMAX];
+  File f;
+  bool ok = false;
 
-  while (offset < nvs->size)
-  {
-    result = esp_partition_read(nvs, offset,                 // Read 1 page in nvs partition
-                                &nvsbuf,
-                                sizeof(nvsbuf));
-    if (result != ESP_OK) {
-      dbgprint("Error reading NVS!");
-      break;
-    }
-    i = 0;
-    while (i < 126) {
-      bm = (nvsbuf.Bitmap[i / 4] >> ((i % 4) * 2));          // Get bitmap for this entry,
-      bm &= 0x03;                                            // 2 bits for one entry
-      if ((bm == 2) &&
-          (nvsbuf.Entry[i].Ns == 0) &&
-          (strcmp (ns, nvsbuf.Entry[i].Key) == 0)) {
-        res = nvsbuf.Entry[i].Data & 0xFF;                   // Return the ID
-        offset = nvs->size;                                  // Stop outer loop as well
-        break;
-      }
-      else {
-        if (bm == 2) {
-          i += nvsbuf.Entry[i].Span;                         // Next entry
-        }
-        else {
-          i++;
-        }
-      }
-    }
-    offset += sizeof(nvs_page);                              // Prepare to read next page in nvs
+  if (!sdLibReady) {
+    return false;
   }
-  return res;
+  claimSD("sdlibopen5");
+  f = sdfs->open(SDLIB_FILE);
+  releaseSD();
+  if (f) {
+    ok = sdLibEntry(f, level, inx, buf, first, count);
+    claimSD("sdlibclose3");
+    f.close();
+    releaseSD();
+  }
+  name = ok ? String(buf) : String("Library error !");
+  return ok;
 }
 
 //**************************************************************************************************
-//                            B U B B L E S O R T K E Y S                                          *
+//                                      S D L I B R A N G E                                        *
 //**************************************************************************************************
-// Bubblesort the nvskeys.                                                                         *
+// Range of the entries shown on level 0 (all artists), 1 (albums of artist parent) or 2 (tracks   *
+// of album parent) of the encoder menu.                                                           *
 //**************************************************************************************************
-void bubbleSortKeys(uint16_t n)
+void sdLibRange(uint8_t level, uint16_t parent, uint16_t* first, uint16_t* count)
 {
-  uint16_t i, j;                                             // Indexes in nvskeys
-  char     tmpstr[16];                                       // Temp. storage for a key
+  String name;
 
-  for (i = 0; i < n - 1; i++) {                              // Examine all keys
-    for (j = 0; j < n - i - 1; j++) {                        // Compare to following keys
-      if (strcmp(nvskeys[j], nvskeys[j + 1]) > 0) {          // Next key out of order?
-        strcpy(tmpstr, nvskeys[j]);                          // Save current key a while
-        strcpy(nvskeys[j], nvskeys[j + 1]);                  // Replace current with next key
-        strcpy(nvskeys[j + 1], tmpstr);                      // Replace next with saved current
-      }
-    }
+  *first = *count = 0;
+  if (level == 0) {
+    *count = sdLibHead.artists;
+  }
+  else {
+    sdLibEntry(level - 1, parent, name, first, count);
   }
 }
 
 //**************************************************************************************************
-//                                      F I L L K E Y L I S T                                      *
+//                                      S D L I B S H O W                                          *
 //**************************************************************************************************
-// File the list of all relevant keys in NVS.                                                      *
-// The keys will be sorted.                                                                        *
+// Shows entry inx of level (0 artists, 1 albums, 2 tracks) of the encoder menu on the TFT.        *
+// Artists and albums in yellow like directories, tracks in cyan like files.                       *
 //**************************************************************************************************
-void fillkeylist()
+void sdLibShow(uint8_t level, uint16_t inx)
 {
-  esp_err_t result = ESP_OK;                                   // Result of reading partition
-  uint32_t  offset = 0;                                        // Offset in nvs partition
-  uint16_t  i;                                                 // Index in Entry 0..125.
-  uint8_t   bm;                                                // Bitmap for an entry
-  uint16_t  nvsinx = 0;                                        // Index in nvskey table
+  String   name;
+  uint16_t first, count;
 
-  keynames.clear();                                            // Clear the list
-  while (offset < nvs->size) {
-    result = esp_partition_read(nvs, offset,                   // Read 1 page in nvs partition
-                                &nvsbuf,
-                                sizeof(nvsbuf));
-    if (result != ESP_OK) {
-      dbgprint("Error reading NVS!");
-      break;
-    }
-    i = 0;
-    while (i < 126) {
-      bm = (nvsbuf.Bitmap[i / 4] >> ((i % 4) * 2));            // Get bitmap for this entry,
-      bm &= 0x03;                                              // 2 bits for one entry
-      if (bm == 2) {                                           // Entry is active?
-        if (nvsbuf.Entry[i].Ns == namespaceID) {               // Namespace right?
-          strcpy (nvskeys[nvsinx], nvsbuf.Entry[i].Key);       // Yes, save in table
-          if (++nvsinx == MAXKEYS) {
-            nvsinx--;                                          // Prevent excessive index
-          }
-        }
-        i += nvsbuf.Entry[i].Span;                             // Next entry
+  sdLibEntry(level, inx, name, &first, &count);
+  if (level == 2) {
+    tftset(1, name);
+  }
+  else {
+    tftset(2, name);
+  }
+}
+
+//**************************************************************************************************
+//                                      S D L I B L I S T                                          *
+//**************************************************************************************************
+// Sends a list of the music library to the web client, one "<value>/<text>" line per entry like   *
+// "mp3list".  Parameter is "artists", "albums,<artist>", "tracks,<album>", "genres" or            *
+// "genre,<genre>".  The value of a track is its node for "mp3track".                              *
+//**************************************************************************************************
+void sdLibList(const String& what)
+{
+  char     name[SDLIB_TEXTMAX];
+  String   out;                                        // Lines not sent yet
+  uint16_t first = 0, count = 0;                       // Range of entries to list
+  uint16_t node, trackNo, inx;
+  uint8_t  level = 0;                                  // Section listed
+  bool     viaGenre = false;                           // Entries are in genre list
+  int      arg = what.substring(what.indexOf(',') + 1).toInt();
+  File     f;
+  bool     ok = false;
+
+  if (sdLibReady) {
+    claimSD("sdlibopen6");
+    f = sdfs->open(SDLIB_FILE);
+    releaseSD();
+  }
+  if (f) {
+    ok = true;
+    if (what.startsWith("artists")) {
+      level = 0;
+      count = sdLibHead.artists;
+    }
+    else if (what.startsWith("albums")) {
+      level = 1;
+      ok = sdLibEntry(f, 0, arg, name, &first, &count);
+    }
+    else if (what.startsWith("tracks")) {
+      level = 2;
+      ok = sdLibEntry(f, 1, arg, name, &first, &count);
+    }
+    else if (what.startsWith("genres")) {
+      level = 3;
+      count = sdLibHead.genres;
+    }
+    else {                                             // "genre,<genre>"
+      level = 2;
+      viaGenre = true;
+      ok = sdLibEntry(f, 3, arg, name, &first, &count);
+    }
+    for (uint16_t i = first; ok && i < first + count; i++) {
+      inx = i;
+      if (viaGenre) {                                  // Track record from genre list
+        claimSD("sdlibglist");
+        ok = f.seek(sdLibHead.genreListOfs + i * sizeof(uint16_t)) &&
+             (f.read((uint8_t*)&inx, sizeof(inx)) == sizeof(inx));
+        releaseSD();
+      }
+      if (!ok || !sdLibEntry(f, level, inx, name, &node, &trackNo)) {
+        break;
+      }
+      utf8ascii(name);                                 // Web interface is ISO-8859-1
+      if (level != 2) {
+        out += String(inx) + "/" + String(name) + "\n";
+      }
+      else if (trackNo && !viaGenre) {
+        out += String(node) + "/" + String(trackNo) + ". " + String(name) + "\n";
       }
       else {
-        i++;
+        out += String(node) + "/" + String(name) + "\n";
+      }
+      if (out.length() > 1000) {
+        _claimSPI("sdliblist1");                       // claim SPI bus
+        cmdclient.print(out);                          // Send what we have
+        _releaseSPI();                                 // release SPI bus
+        out = "";
       }
     }
-    offset += sizeof(nvs_page);                                // Prepare to read next page in nvs
+    claimSD("sdlibclose4");
+    f.close();
+    releaseSD();
   }
-  nvskeys[nvsinx][0] = '\0';                                   // Empty key at the end
-  dbgprint("Read %d keys from NVS", nvsinx);
-  bubbleSortKeys(nvsinx);                                      // Sort the keys
+  if (!ok && out.length() == 0) {
+    out = "-1/Music library not ready.\n";
+  }
+  _claimSPI("sdliblist2");                             // claim SPI bus
+  cmdclient.print(out);
+  _releaseSPI();                                       // release SPI bus
 }
+#endif
 
-#ifdef USE_ETHERNET
 //**************************************************************************************************
-//                                    I N I T E T H E R N E T                                      *
+//                                     G E T E N C R Y P T I O N T Y P E                           *
 //**************************************************************************************************
-// Initialization routine in case we use Ethernet card (W5500)                                     *
+// Read the encryption type of the network and return as a 4 byte name                             *
 //**************************************************************************************************
-void initEthernet(bool tftOutput)
+#ifndef USE_ETHERNET
+const char* getEncryptionType (wifi_auth_mode_t thisType)
 {
-  const char* p;
+  switch (thisType) {
+    case WIFI_AUTH_OPEN:
+      return "OPEN";
+    case WIFI_AUTH_WEP:
+      return "WEP";
+    case WIFI_AUTH_WPA_PSK:
+      return "WPA_PSK";
+    case WIFI_AUTH_WPA2_PSK:
+      return "WPA2_PSK";
+    case WIFI_AUTH_WPA_WPA2_PSK:
+      return "WPA_WPA2_PSK";
+    case WIFI_AUTH_MAX:
+      return "MAX";
+    default:
+      break;
+  }
+  return "????";
+}
 
-  dbgprint("initEthernet(%s)", tftOutput ? "true" : "false");
-  Ethernet.init(22);                                      // SPI bus not needed here
-  if (tftOutput) tftlog("Connect to Ethernet/LAN");       // on TFT too
-  delay(100);
-  if (!staticIPs) {                                       // try DHCP if requested
-    dbgprint("We try to obtain IP addresses via DHCP");
-    _claimSPI("initEth1");                                // claim SPI bus
-    int result = Ethernet.begin(mac);
-    _releaseSPI();                                        // release SPI bus
-    if (result == 0) {
-      dbgprint("Failed to configure Ethernet via DHCP --> We use static IPs instead !");
-      staticIPs = true;
-    }  
+//**************************************************************************************************
+//                                        L I S T N E T W O R K S                                  *
+//**************************************************************************************************
+// List the available networks.                                                                    *
+// Acceptable networks are those who have an entry in the preferences.                             *
+// SSIDs of available networks will be saved for use in webinterface.                              *
+//**************************************************************************************************
+void listNetworks()
+{
+  WifiInfo_t        winfo;            // Entry from wifilist
+  wifi_auth_mode_t  encryption;       // TKIP(WPA), WEP, etc.
+  const char       *p;                // Netwerk is acceptable for connection
+  int               i, j;             // Loop control
+
+  p = dbgprint("Scan for WiFi Networks");            // Scan for nearby networks
+  tftlog(p);
+  numSsid = WiFi.scanNetworks();
+  dbgprint("Scan completed");
+  if (numSsid <= 0) {
+    dbgprint("Couldn't get a wifi connection");
+    return;
   }
-  if (staticIPs) {
-    _claimSPI("initEth1");                                // claim SPI bus
-    Ethernet.begin(mac, local_IP, primaryDNS, gateway, subnet);
-    _releaseSPI();                                        // release SPI bus
+  // print the list of networks seen:
+  dbgprint("Number of available networks: %d", numSsid);
+  // Print the network number and name for each network found and
+  for (i = 0; i < numSsid; i++) {
+    p = "";                                          // Assume not acceptable
+    for (j = 0; j < wifilist.size(); j++) {          // Search in wifilist
+      winfo = wifilist[j];                           // Get one entry
+      if (WiFi.SSID(i).indexOf(winfo.ssid) == 0) {   // Is this SSID acceptable?
+        p = "Acceptable";
+        break;
+      }
+    }
+    encryption = WiFi.encryptionType(i);
+    dbgprint("%2d - %-25s Signal: %3d dBm, Channel: %d, Encryption %4s, %s",
+               i + 1, WiFi.SSID(i).c_str(), WiFi.RSSI(i), WiFi.channel(i),
+               getEncryptionType(encryption), p);
+    // Remember this network for later use
+    networks += WiFi.SSID(i) + String("|");
   }
-  //Ethernet.setRetransmissionTimeout(300);                // experimental
-  //Ethernet.setRetransmissionCount(4);                    // experimental
-  _claimSPI("initEth1");                                  // claim SPI bus
-  lstat = Ethernet.linkStatus();
-  _releaseSPI();                                          // release SPI bus
-  p = dbgprint("Ethernet link status: %s", lstat == LinkON ? "up" : "down");
-  if (tftOutput) {
-    tftlog(p, lstat == LinkOFF ? RED : WHITE);
-  }  
-  delay(100);
-  _claimSPI("initEth2");                                  // claim SPI bus
-  IPAddress Ip = Ethernet.localIP();
-  IPAddress Gw = Ethernet.gatewayIP();
-  IPAddress Sm = Ethernet.subnetMask();
-  IPAddress Dn = Ethernet.dnsServerIP();
-  _releaseSPI();                                          // release SPI bus
+  dbgprint("End of list");
+}
+#endif  // USE_ETHERNET
 
-  p = dbgprint("Local IP = %s", Ip.toString().c_str());
-  if (tftOutput) tftlog(p);                               // On TFT too
-  dbgprint("Gateway = %s, Subnet Mask = %s, DNS = %s",
-           Gw.toString().c_str(), Sm.toString().c_str(), Dn.toString().c_str());
+//**************************************************************************************************
+//                                         W A K E L O O P                                         *
+//**************************************************************************************************
+// Wakes up loop() which may be waiting for work in waitForWork().  Wakeups are counted by the     *
+// task notification, so a wakeup while loop() is busy makes the next wait return at once.         *
+//**************************************************************************************************
+void wakeLoop()
+{
+  if (mainTask) {
+    xTaskNotifyGive(mainTask);
+  }
+}
+
+//**************************************************************************************************
+//                               W A K E L O O P F R O M I S R                                     *
+//**************************************************************************************************
+// Same as wakeLoop() but for use on interrupt level.                                              *
+//**************************************************************************************************
+void IRAM_ATTR wakeLoopFromISR()
+{
+  BaseType_t woken = pdFALSE;                    // set if mainTask has a higher priority
 
+  if (mainTask) {
+    vTaskNotifyGiveFromISR(mainTask, &woken);
+    if (woken) {
+      portYIELD_FROM_ISR();
+    }
+  }
 }
-#endif
 
-#ifdef SD_UPDATES
 //**************************************************************************************************
-//                                 C H E C K F O R S D U P D A T E                                 *
+//                                          T I M E R 5 S E C                                      *
 //**************************************************************************************************
-// If SD card exists and contains update file "firmware.bin" then perform program update           *
+// Extra watchdog.  Called every 5 seconds.                                                        *
+// If totalCount has not been changed, there is a problem and playing will stop.                   *
+// Note that calling timely procedures within this routine or in called functions will             *
+// cause a crash!                                                                                  *
 //**************************************************************************************************
-void checkForSDUpdate()
+void IRAM_ATTR timer5sec()
 {
-  const char *p;
+  static uint32_t oldtotalCount = 7321;          // needed for change detection
+  static uint16_t morethanonce = 0;              // counter for successive fails
+  uint32_t bytesplayed;                          // bytes send to MP3 converter
 
-  if (ini_block.sd_cs_pin < 0) return;                       // SD configured ?
-  if (!SD.begin(ini_block.sd_cs_pin, SPI, SDSPEED)) return;  // SD found ?
-  if (SD.cardType() != CARD_NONE) {                          // SD type ok ?
-    dbgprint("Found SD-Card. Update file on SD-Card ???");
-    File myUpdateFile = SD.open(UPDATE_FILE_NAME);
-    if (myUpdateFile) {
-      dbgprint("Ok. Found entry with name %s", UPDATE_FILE_NAME);
-      size_t updateSize = myUpdateFile.size();
-      bool isDir = myUpdateFile.isDirectory();
-      if (isDir || 0 == updateSize) {
-        dbgprint("Error: %s is a directory or file is empty. We remove it.", UPDATE_FILE_NAME);
-        myUpdateFile.close();
-        if (isDir) SD.rmdir(UPDATE_FILE_NAME);               // No reason to keep it
-        else SD.remove(UPDATE_FILE_NAME);
-        SD.end();
-        return;
-      }
-      // check if SD-Card is writable (to prevent a loop when trying to delete firmware.bin)
-      dbgprint("Test writability of SD card");
-      File myTestFile = SD.open(TEST_FILE_NAME, FILE_WRITE);
-      if (myTestFile) {
-        myTestFile.close();
-        if (SD.exists(TEST_FILE_NAME)) {
-          SD.remove(TEST_FILE_NAME);
-          if (SD.exists(TEST_FILE_NAME)) {
-            dbgprint("Error deleting test file. Abort update.");
-          }
-          else {
-            dbgprint("Ok. SD-Card is writable. Continue with update."); // Thats requirement for deleting upgrade file afterwards!
-                                                                        // Otherwise we run into a neverending update loop...
-            goto START_UPDATE;
-          }
-        }    
-      }
-      myUpdateFile.close();
-      SD.end();
+  if (dataMode & (INIT | HEADER | DATA |         // test if playing
+                  METADATA | PLAYLISTINIT |
+                  PLAYLISTHEADER |
+                  PLAYLISTDATA)) {
+    if (currentSource == SDCARD && mp3filePause) {
+      mbitrate = 0;
       return;
-
-      // all ok for update
-START_UPDATE:
-      dbgprint("Starting firmware update...");
-      tftlog("Found update file on SD.", GREEN);
-      tftlog("Please wait...", GREEN);
-      if (Update.begin(updateSize)) {  
-        size_t written = Update.writeStream(myUpdateFile);
-        if (written == updateSize) {
-          dbgprint("All %d bytes written successfully.", written);
-        }
-        else {
-          dbgprint("Error: Only %d/%d bytes written.", written, updateSize);
-          tftlog("Error writing to flash.", RED);
-        }
-        if (Update.end()) {
-          if (Update.isFinished()) {
-            dbgprint("OTA FIRMWARE UPDATE COMPLETED SUCCESSFULLY.");
-            tftlog("OTA update completed OK", GREEN);
-          }
-          else {
-            p = dbgprint("OTA update error.");
-            tftlog(p, RED);
-          }
-        }
-        else {
-          p = dbgprint("OTA update error: %d.", Update.getError());
-          tftlog(p, RED);
-        }
-      }
-      else {
-        p = dbgprint("Error: No space for OTA!");
-        tftlog(p, RED);
-      }
-      myUpdateFile.close();
-      // we finished, now remove the binary from SD card to prevent update loop
-      SD.remove(UPDATE_FILE_NAME);  
-      delay(100);
-      if (SD.exists(UPDATE_FILE_NAME)) {
-        dbgprint("Error: Couldn't delete update file on SD.");
-        tftlog("Error deleting file.", RED); 
+    }
+    bytesplayed = totalCount - oldtotalCount;    // number of bytes played in the last 5 seconds
+    oldtotalCount = totalCount;                  // save for comparison in next cycle
+    if (bytesplayed < 5000) {                    // still properly playing?
+      //if (morethanonce > 10) {                 // happened too many times?
+      //  ESP.restart();                           // reset the CPU
+      //}
+      if (dataMode & (PLAYLISTDATA |             // in playlist mode?
+                      PLAYLISTINIT |
+                      PLAYLISTHEADER)) {
+        playlist_num = 0;                        // yes, end of playlist
       }
-      else {  
-        dbgprint("Update file on SD successfully deleted.");
-        tftlog("Update file deleted.", GREEN);
-      }  
-      SD.end();
-      delay(4000);
-      dsp_erase();
-      dsp_setTextSize(2);                                    // Bigger character font
-      dsp_setTextColor(RED);                                 // Info in red
-      dsp_setCursor(12, 55);                                 // Middle of screen
-      dsp_print("SW-Reboot !");
-      dbgprint("System will restart in 3 seconds.\n\n"); 
-      delay(3000);
-      ESP.restart();   
+      goto error_handling;
     }
     else {
-      p = dbgprint("No update file on SD card.");
-      tftlog(p); 
+      //                                         // data has been sent to MP3 decoder
+      // Bitrate in kbits/s is bytesplayed / sec / 1000 * 8
+      mbitrate = (bytesplayed + 312) / 625;      // measured bitrate (5s)
+      morethanonce = 0;                          // data seen, reset failcounter
+#ifdef USE_ETHERNET
+      reInitEthernet = false;
+#endif
     }
   }
-  SD.end();
-}
+  else if (dataMode & CONNECTERROR) {
+error_handling:    
+    if (((morethanonce > 5) && (morethanonce < 10)) ||  // happened more than 5x?
+          (playlist_num > 0)) {                 // or playlist active?
+      dataMode = STOPREQD;                      // stop player
+      ini_block.newpreset++;                    // yes, try next channel
+      if (ini_block.newpreset > highestPreset)
+        ini_block.newpreset = 0;
+    }
+    else if (morethanonce <= 5 && currentSource == STATION) {
+      dataMode = STOPREQD;                      // stop player
+      currentPreset = -1;                       // attempt to reconnect to same station
+#ifdef USE_ETHERNET
+      if (morethanonce == 0 || morethanonce == 2) // re-init ethernet chip might help 
+        reInitEthernet = true;
 #endif
+    }
+    morethanonce++;                            // count the fails
+  }
+}
 
 //**************************************************************************************************
-//                                           S E T U P                                             *
+//                                          T I M E R 1 0 0                                        *
 //**************************************************************************************************
-// Setup for the program.                                                                          *
+// Called every 100 msec on interrupt level, so must be in IRAM and no lengthy operations          *
+// allowed.                                                                                        *
 //**************************************************************************************************
-void setup()
+void IRAM_ATTR timer100()
 {
-  char                      tmpstr[20];                 // for version and Mac address
-  const char               *partname = "nvs";           // Partition with NVS info
-  esp_partition_iterator_t  pi;                         // Iterator for find
-  const char               *wvn = "Include file %s_html has the wrong version number!"
-                                  "Replace header file.";
-#if !defined(USE_ETHERNET) || defined(ENABLE_DIGITAL_INPUTS)                                  
-  char                     *p;       
-#endif                             
+  sv int16_t count5sec = 0;                      // counter for activating 5 seconds process
+  sv int16_t eqcount = 0;
+  sv int16_t oldclickcount = 0;                  // for detecting difference
 
-  vTaskDelay(10 / portTICK_PERIOD_MS);                  // Pause for a short time
-  Serial.begin(115200);                                 // For debug
-  Serial.println();
-  btStop();
-  // Version tests for some vital include files
-  if (about_html_version   < 210201) dbgprint(wvn, "about");
-  if (config_html_version  < 210201) dbgprint(wvn, "config");
-  if (index_html_version   < 210201) dbgprint(wvn, "index");
-  if (mp3play_html_version < 210201) dbgprint(wvn, "mp3play");
-  if (defaultprefs_version < 210201) dbgprint(wvn, "defaultprefs");
-  // print some memory and sketch info
-  dbgprint("Starting ESP32-radio running on CPU %d at %d MHz. Version %s. Total free memory %d Bytes.",
-             xPortGetCoreID(),
-             ESP.getCpuFreqMHz(),
-             VERSION,
-             ESP.getFreeHeap());                        // normally > 170 kB
-  mainTask = xTaskGetCurrentTaskHandle();               // my taskhandle
-  SPIsem = xSemaphoreCreateMutex();                     // Semaphore for SPI bus
-  pi = esp_partition_find(ESP_PARTITION_TYPE_DATA,      // Get partition iterator for
-                          ESP_PARTITION_SUBTYPE_ANY,    // the NVS partition
-                          partname);
-  if (pi) {
-    nvs = esp_partition_get (pi);                       // Get partition struct
-    esp_partition_iterator_release (pi);                // Release the iterator
-    dbgprint("Partition %s found, %d bytes", partname, nvs->size);
+  if (++count5sec == 50 ) {                      // 5 seconds passed?
+    timer5sec();                                 // do 5 second procedure
+    count5sec = 0;                               // reset count
   }
-  else {
-    dbgprint("Partition %s not found!", partname);      // Very unlikely...
-    while (true);                                       // Impossible to continue
+  if ((count5sec % 10) == 0) {                   // one second over?
+    if (++timeinfo.tm_sec >= 60) {               // update number of seconds
+      timeinfo.tm_sec = 0;                       // wrap after 60 seconds
+      time_req = true;                           // show current time request
+      if (++timeinfo.tm_min >= 60) {
+        timeinfo.tm_min = 0;                     // wrap after 60 minutes
+        if (++timeinfo.tm_hour >= 24) {
+          timeinfo.tm_hour = 0;                  // wrap after 24 hours
+        }
+      }
+    }
   }
-  namespaceID = FindNsID(NAME);                         // Find ID of our namespace in NVS
-  fillkeylist();                                        // Fill keynames with all keys
-  memset(&ini_block, 0, sizeof(ini_block));             // Init ini_block
-  ini_block.clk_server = NTP_SERVER_DEFAULT;            // Default server for NTP
-#ifdef USE_ETHERNET
-  ini_block.clk_tzstring = NTP_TZ_STRING_DEFAULT;       // Default TZ string
-#else
-  ini_block.clk_offset = 1;                             // Default MEZ time zone
-  ini_block.clk_dst = 1;                                // DST is +1 hour
-#endif
-  ini_block.reqvol = 92;                                // initial value, can be overridden by prefs
-#ifdef ENABLE_SOAP
-  ini_block.srv_macWOL = MEDIASERVER_DEFAULT_MAC;
-  ini_block.srv_ip = IPAddress(MEDIASERVER_DEFAULT_IP);
-  ini_block.srv_port = MEDIASERVER_DEFAULT_PORT;
-  ini_block.srv_controlUrl = MEDIASERVER_DEFAULT_CONTROL_URL;
-#endif
-  readIOprefs();                                        // read pins used for SPI, TFT, VS1053, IR, Rotary encoder
-#ifdef ENABLE_DIGITAL_INPUTS  
-  int i, pinnr;
-  for (i = 0; (pinnr = progpin[i].gpio) >= 0; i++) {    // Check programmable input pins
-    pinMode(pinnr, INPUT_PULLUP);                       // Input for control button
-    delay(10);
-    // Check if pull-up active
-    if ((progpin[i].cur = digitalRead(pinnr)) == HIGH) {
-      p = "HIGH";
+  // handle rotary encoder, inactivity counter will be reset by encoder interrupt
+  if (++enc_inactivity == 36000) {               // count inactivity time
+    enc_inactivity = 1000;                       // prevent wrap
+  }
+  // now detection of single/double click of rotary encoder switch
+  if (clickcount) {                              // any click?
+    if (oldclickcount == clickcount) {           // stable situation?
+      if (++eqcount == 5) {                      // long time stable?
+        eqcount = 0;
+        if (clickcount > 2) {                    // triple click?
+          //tripleclick = true;
+        }
+        else if (clickcount > 1) {               // double click?
+          doubleClick = true;
+        }
+        else {
+          singleClick = true;
+        }
+        clickcount = 0;
+      }
     }
     else {
-      p = "LOW, probably no PULL-UP";                   // No Pull-up
+      oldclickcount = clickcount;                // for detecting change
+      eqcount = 0;                               // not stable yet, reset count
     }
-    dbgprint("GPIO%d is %s", pinnr, p);
   }
-  readProgButtons();                                    // Program the free input pins
-#endif  
-  if (ini_block.enc_sw_pin >= 0) {
-    if (digitalRead(ini_block.enc_sw_pin) == LOW) {
-      dhcpRequested = true;
-      dbgprint("Rotary encoder switch is LOW -> we use DHCP");
-    }
+  if (singleClick || doubleClick || longClick || // something for loop() to do?
+      time_req || dataMode == STOPREQD) {
+    wakeLoopFromISR();
   }
-  SPI.begin(ini_block.spi_sck_pin,                      // Init VSPI bus with default or modified pins
-            ini_block.spi_miso_pin,
-            ini_block.spi_mosi_pin);
-  vs1053player = new VS1053(ini_block.vs_cs_pin,        // Make instance of player
-                            ini_block.vs_dcs_pin,
-                            ini_block.vs_dreq_pin,
-                            ini_block.vs_shutdown_pin);
+}
+
 #ifdef ENABLE_INFRARED
-  if (ini_block.ir_pin >= 0) {
-    dbgprint("Enable pin %d for IR", ini_block.ir_pin);
-    pinMode(ini_block.ir_pin, INPUT);                   // Pin for IR receiver VS1838B
-    attachInterrupt(ini_block.ir_pin, isr_IR, CHANGE);  // Interrupts will be handle by isr_IR                 
+//**************************************************************************************************
+//                                          I S R _ I R                                            *
+//**************************************************************************************************
+// Interrupts received from VS1838B on every change of the signal.                                 *
+// Intervals are 640 or 1640 microseconds for data,  sync pulses are 3400 micros or longer.        *
+// Input is complete after 65 level changes.                                                       *
+// Only the last 32 level changes are significant and will be handed over to common data.          *
+// Important: This is only valid for a certain China 21-button remote control model from Ali.      *
+//**************************************************************************************************
+void IRAM_ATTR isr_IR()
+{
+  sv uint32_t t0 = 0;                               // To get the interval
+  sv uint32_t ir_locvalue = 0;                      // IR code
+  sv int      ir_loccount = 0;                      // Length of code
+  uint32_t    t1, intval;                           // Current time and interval since last change
+  uint32_t    mask_in = 2;                          // Mask input for conversion
+  uint16_t    mask_out = 1;                         // Mask output for conversion
+
+  t1 = micros();                                    // Get current time
+  intval = t1 - t0;                                 // Compute interval
+  t0 = t1;                                          // Save for next compare
+  if ((intval > 300) && (intval < 800)) {           // Short pulse?
+    ir_locvalue = ir_locvalue << 1;                 // Shift in a "zero" bit
+    ir_loccount++;                                  // Count number of received bits
+    ir_0 = (ir_0 * 3 + intval) / 4;                 // Compute average durartion of a short pulse
   }
-#endif
-  if (ini_block.tft_cs_pin >= 0 ) {                    // TFT Display configured?
-    dbgprint("Start display");
-    if (dsp_begin()) {                                 // Init display
-      dsp_setRotation();                               // Use landscape format
-      dsp_erase();                                     // Clear screen
-      dsp_setTextSize(1);                              // Small character font
-      dsp_setTextColor(WHITE);                         // Info in white
-      dsp_setCursor(0, 0);                             // Top of screen
-      dsp_print("Starting..." "\n" "Version:");
-      strncpy(tmpstr, VERSION, 18);                    // Limit version length
-      tmpstr[18] = 0;
-      dsp_println(tmpstr);
-      dsp_update();                                    // Show on physical screen
+  else if ((intval > 1400) && (intval < 1900)) {    // Long pulse?
+    ir_locvalue = (ir_locvalue << 1) + 1;           // Shift in a "one" bit
+    ir_loccount++;                                  // Count number of received bits
+    ir_1 = (ir_1 * 3 + intval) / 4;                 // Compute average durartion of a short pulse
+  }
+  else if (ir_loccount == 65) {                     // Value is correct after 65 level changes
+    while (mask_in) {                               // Convert 32 bits to 16 bits
+      if (ir_locvalue & mask_in) {                  // Bit set in pattern?
+        ir_value |= mask_out;                       // Set bit in result
+      }
+      mask_in <<= 2;                                // Shift input mask 2 positions
+      mask_out <<= 1;                               // Shift output mask 1 position
     }
+    ir_loccount = 0;                                // Ready for next input
+    wakeLoopFromISR();                              // Let scanIR() handle the code
   }
-#ifdef SD_UPDATES
-  checkForSDUpdate();
+  else {
+    ir_locvalue = 0;                                // Reset decoding
+    ir_loccount = 0;
+  }
+}
 #endif
-  /* SD-Card will be scanned when SD button is pressed by user for first time.
-   * We mostly want to listen to internet radio after switching on the device and
-   * always waiting for the time consuming SD-scan to be finished really sucks
 
-  if (ini_block.sd_cs_pin >= 0) {                      // SD configured?
-    currentIndex = -1;
-    if (!SD.begin(ini_block.sd_cs_pin, SPI, SDSPEED)) { // Yes, try to init SD card driver
-      p = dbgprint("SD Card Mount Failed!");           // No success, check formatting (FAT)
-      tftlog(p);                                       // Show error on TFT as well
-    }
-    else {
-      SD_okay = (SD.cardType() != CARD_NONE);          // See if known card
-      if (!SD_okay) {
-        p = dbgprint("No SD card attached");           // Card not readable
-        tftlog(p);                                     // Show error on TFT as well
+//**************************************************************************************************
+//                                          I S R _ E N C _ S W I T C H                            *
+//**************************************************************************************************
+// Interrupts received from rotary encoder switch.                                                 *
+//**************************************************************************************************
+void IRAM_ATTR isr_enc_switch()
+{
+  sv uint32_t     oldtime = 0;                            // time in millis previous interrupt
+  sv bool         sw_state;                               // true is pushed (LOW)
+  bool            newstate;                               // current state of input signal
+  uint32_t        newtime;                                // current timestamp
+
+  // Read current state of SW pin
+  newstate = (digitalRead (ini_block.enc_sw_pin) == LOW);
+  newtime = millis();
+  if (newtime < (oldtime + 10)) {                         // debounce
+    return;
+  }
+  if (newstate != sw_state) {                             // state changed ?
+    sw_state = newstate;                                  // yes, set current (new) state
+    if (!sw_state) {                                      // switch released ?
+      if ((newtime - oldtime) > 3000) {                   // more than 1 second ?
+        longClick = true;                                 // yes, register longClick
       }
       else {
-        dbgprint("Locate mp3 files on SD, may take a while...");
-        tftlog("Read SD card");
-        SD_mp3fileCount = listsdtracks("/", 0, true);  // Build file list
-        p = dbgprint("%d mp3 tracks on SD", SD_mp3fileCount);
-        tftlog(p);                                     // Show number of tracks on TFT
+        clickcount++;                                     // yes, click detected
       }
+      enc_inactivity = 0;                                 // not inactive anymore
+      wakeLoopFromISR();                                  // timer100 decodes clicks, wake anyway
     }
-  }*/
-  chk_staticIPs();
-  tftlog (staticIPs ? "We use static IPs" : "We try DHCP first");
-#ifndef USE_ETHERNET
-  mk_lsan();                                            // Make a list of acceptable networks
-  // in preferences
-  if (staticIPs && !WiFi.config(local_IP, gateway, subnet, primaryDNS, secondaryDNS)) {
-    dbgprint("Wifi failed to configure static IPs");
   }
-  WiFi.mode(WIFI_STA);                                 // This ESP is a station
-  WiFi.persistent(false);                              // Do not save SSID and password
-  WiFi.disconnect();                                   // After restart router could still
-  delay(100);                                          // keep old connection
-  listNetworks();                                      // Search for WiFi networks
-  tcpip_adapter_set_hostname(TCPIP_ADAPTER_IF_STA, NAME);
-  p = dbgprint("Connect to WiFi");                     // Show progress
-  tftlog(p);                                           // On TFT too
-  delay(100);
-  NetworkFound = connectwifi();
-  if (NetworkFound) {                                  // Connect to WiFi network
-    p = dbgprint("Local IP = %s", WiFi.localIP().toString().c_str());     // String to dispay on TFT
-    tftlog(p);                                         // Show IP
-    dbgprint("Gateway = %s, DNS #1 = %s, DNS #2 = %s",
-             WiFi.gatewayIP().toString().c_str(), WiFi.dnsIP().toString().c_str(), WiFi.dnsIP(1).toString().c_str());
+  oldtime = newtime;                                      // nor next compare
+}
+
+//**************************************************************************************************
+//                                          I S R _ E N C _ T U R N                                *
+//**************************************************************************************************
+// Interrupts received from rotary encoder (clk signal), debouncing is all done in hardware!       *
+//**************************************************************************************************
+void IRAM_ATTR isr_enc_turn()
+{
+  if (digitalRead(ini_block.enc_clk_pin) == digitalRead(ini_block.enc_dt_pin)) {
+    rotationcount++;
   }
   else {
-    p = dbgprint("No Network found !");                // String to dispay on TFT
-    tftlog(p);                                         // Show IP
+    rotationcount--;
   }
-  delay(3000);                                         // Allow user to read this
-#else   // Use Ethernet
-  WiFi.mode(WIFI_OFF);
-  initEthernet(true);
-  NetworkFound = true;
-#endif
-  readPrefs(false);                                    // read preferences
-#ifdef ENABLE_SOAP
-  dbgprint("Media server settings: mac=\"%s\", ip=%s, port=%d, controlUrl=\"%s\"", 
-           ini_block.srv_macWOL.c_str(), ini_block.srv_ip.toString().c_str(), ini_block.srv_port, ini_block.srv_controlUrl.c_str());
-  soap.addServer(ini_block.srv_ip, ini_block.srv_port, ini_block.srv_controlUrl.c_str(), "Media Server");         
-#endif
-  highestPreset = findHighestPreset();
-  vs1053player->begin();                               // initialize VS1053 player
-  delay(10);
-#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
-  dbgprint("Start server for commands on port 80");
-#endif
-#ifdef PORT23_ACTIVE
-  dbgprint("Start server for debug output on port 23");
-  tftlog("Debug port 23 active!", GREEN);
-#endif
-  delay(3000);                                         // time to read boot messages
-  _claimSPI("setup3");                                 // claim SPI bus
-#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
-  cmdserver.begin();                                   // start http server on port 80
-#endif  
-#ifdef PORT23_ACTIVE
-  dbgserver.begin();                                   // start debug server on port 23
-#endif
-  _releaseSPI();                                       // release SPI bus
-#ifndef USE_ETHERNET
-#ifdef PORT23_ACTIVE
-  dbgserver.setNoDelay(true);                          // doesn't exist in Wiznet W5500 library
-#endif
-  if (NetworkFound) {                                  // OTA only if Wifi network found
-    dbgprint("Network found. Starting OTA");
-    ArduinoOTA.setHostname(NAME);                      // set the hostname
-    ArduinoOTA.onStart(otastart);
-    ArduinoOTA.begin();                                // allow update over the air
-    if (MDNS.begin(NAME)) {                            // start MDNS transponder
-      dbgprint("MDNS responder started");
-    }
-    else {
-      dbgprint("Error setting up MDNS responder!");
-    }
-  }
-  else {
-    currentPreset = ini_block.newpreset;               // No network: do not start radio
-    dbgprint("No Network found !!");
-  }
-#endif
-  timer = timerBegin(0, 80, true);                     // Use 1st timer, prescaler 80, counting upwards (true)
-  timerAttachInterrupt(timer, &timer100, true);        // Call timer100() on timer alarm, generated on edge (true)
-  timerAlarmWrite(timer, 100000, true);                // Alarm every 100 msec, timer to reload (true)
-  timerAlarmEnable(timer);                             // Enable the timer
-#ifndef USE_ETHERNET
-  configTime (ini_block.clk_offset * 3600,
-              ini_block.clk_dst * 3600,
-              ini_block.clk_server.c_str());           // GMT offset, daylight offset in seconds
-#endif
-  timeinfo.tm_year = 0;                                // Set TOD to illegal
-  // Init settings for rotary switch (if existing).
-  if ((ini_block.enc_clk_pin + ini_block.enc_dt_pin + ini_block.enc_sw_pin) > 2) {
-    pinMode(ini_block.enc_clk_pin, INPUT);             // CLK pin for encoder 
-    pinMode(ini_block.enc_dt_pin, INPUT);              // DT pin for encoder 
-    pinMode(ini_block.enc_sw_pin, INPUT);              // SW pin for encoder 
-    attachInterrupt(ini_block.enc_clk_pin, isr_enc_turn, CHANGE);
-    attachInterrupt(ini_block.enc_sw_pin, isr_enc_switch, CHANGE);
-    dbgprint("Rotary encoder is enabled (clk:%d,dt:%d,sw:%d)",
-             ini_block.enc_clk_pin, ini_block.enc_dt_pin, ini_block.enc_sw_pin);
-  }
-  else {
-    dbgprint("Rotary encoder is disabled (clk:%d,dt:%d,sw:%d)",
-             ini_block.enc_clk_pin, ini_block.enc_dt_pin, ini_block.enc_sw_pin);
-  }
-
-  if (NetworkFound) {
-    getTime();                                          // Sync time
-    if (timeinfo.tm_year) time_req = true;              // Legal time found?  
-  }
-  if (tft) {
-    //dbgprint("setup(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
-    //           0, 8, dsp_getwidth(), dsp_getheight() - 8);
-    dsp_fillRect(0, 8,                                  // Clear most of the screen
-                 dsp_getwidth(),                        // x
-                 dsp_getheight() - 8, BLACK);           // y, color
-  }
-  outchunk.datatyp = QDATA;                             // This chunk dedicated to QDATA
-  dataQueue = xQueueCreate(QSIZ, sizeof (qdata_struct));// Create queue for communication
-                             
-  xTaskCreatePinnedToCore(
-    playTask,                                            // Task to play data in dataQueue.
-    "playTask",                                          // name of task.
-    1500,                                                // stack size of task
-    NULL,                                                // parameter of the task
-    2,                                                   // priority of the task
-    &xplayTask,                                          // Task handle to keep track of created task
-    0);                                                  // Run on CPU 0
-  xTaskCreate(
-    spfTask,                                             // Task to handle special functions.
-    "spfTask",                                           // name of task.
-    6144,                                                // stack size of task: scanning SD card needs big stack
-    NULL,                                                // parameter of the task
-    1,                                                   // priority of the task
-    &xspfTask);                                          // Task handle to keep track of created task
-#ifdef FRONT_PANEL_BUTTONS  														
-  xTaskCreate(
-    extenderTask,                                        // Task for communication with PCF8574 ICs
-    "extenderTask",                                      // name of task.
-    2048,                                                // stack size of task
-    NULL,                                                // parameter of the task
-    1,                                                   // priority of the task
-    &xextenderTask);                                     // Task handle to keep track of created task
-#endif			
-#if defined VU_METER && defined LOAD_VS1053_PATCH																								 
-  xTaskCreate(
-    vumeterTask,                                         // Task for displaying the vu-meter value
-    "vumeterTask",                                       // name of task.
-    2048,                                                // stack size of task
-    NULL,                                                // parameter of the task
-    1,                                                   // priority of the task
-    &xvumeterTask);                                      // Task handle to keep track of created task
-#endif			
-#ifdef ENABLE_ESP32_HW_WDT
-  esp_task_wdt_init(WDT_TIMEOUT, true);                 // enable panic so ESP32 restarts
-  esp_task_wdt_add(NULL);                               // add current thread to WDT watch  
-  esp_task_wdt_reset();
-#endif    
+  enc_inactivity = 0;
+  wakeLoopFromISR();
 }
 
-#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
+
 //**************************************************************************************************
-//                                        R I N B Y T                                              *
+//                                S H O W S T R E A M T I T L E                                    *
 //**************************************************************************************************
-// Read next byte from http inputbuffer.  Buffered for speed reasons.                              *
+// Show artist and songtitle if present in metadata.                                               *
+// Show always if full=true.                                                                       *
 //**************************************************************************************************
-uint8_t rinbyt(bool forcestart)
+void showStreamTitle(const char *ml, bool full)
 {
-  static uint8_t  buf[1024];                           // Inputbuffer
-  static uint16_t i;                                   // Pointer in inputbuffer
-  static uint16_t len;                                 // Number of bytes in buf
-  uint16_t        tlen;                                // Number of available bytes
-  uint16_t        trycount = 0;                        // Limit max. time to read
+  char *p1, *p2;
+  char  streamtitle[150];                      // streamtitle from metadata
 
-  if (forcestart || (i == len)) {                      // Time to read new buffer
-P1RIB:
-    _claimSPI("rinbyt1");                              // claim SPI bus
-    uint8_t erg = cmdclient.connected();
-    _releaseSPI();                                     // release SPI bus
-    while (erg) {                                      // Loop while the client's connected
-      _claimSPI("rinbyt2");                            // claim SPI bus
-      tlen = cmdclient.available();                    // Number of bytes to read from the client
-      _releaseSPI();                                   // release SPI bus
-      len = tlen;                                      // Try to read whole input
-      if (len == 0) {                                  // Any input available?
-        if (++trycount > 3) {                          // Not for a long time?
-          dbgprint("HTTP input shorter than expected");
-          return '\n';                                 // Error! No input
-        }
-        delay(10);                                     // Give communication some time
-        //continue;                                    // Next loop of no input yet
-        goto P1RIB;
-      }
-      if (len > sizeof(buf)) {                         // Limit number of bytes
-        len = sizeof(buf);
+  if (strstr(ml, "StreamTitle=")) {
+    dbgprint(ml);
+    p1 = (char*)ml + 12;                       // begin of artist and title
+    if ((p2 = strstr(ml, "';"))) {             // search for end of title
+      if (*p1 == '\'') {                       // surrounded by quotes?
+        p1++;
+        //p2--;
       }
-      _claimSPI("rinbyt3");                            // claim SPI bus
-      len = cmdclient.read(buf, len);                  // Read a number of bytes from the stream
-      _releaseSPI();                                   // release SPI bus
-      i = 0;                                           // Pointer to begin of buffer
-      break;
+      *p2 = '\0';                              // strip the rest of the line
     }
+    // save last part of string as streamtitle.  Protect against buffer overflow
+    strncpy(streamtitle, p1, sizeof(streamtitle));
+    streamtitle[sizeof(streamtitle) - 1] = '\0';
   }
-  return buf[i++];
+  else if (full) {
+    // info probably from playlist or mp3 file
+    strncpy(streamtitle, ml, sizeof (streamtitle));
+    streamtitle[sizeof (streamtitle) - 1] = '\0';
+  }
+  else {
+    icystreamtitle = "";                       // Unknown type
+    return;                                    // Do not show
+  }
+  utf8ascii(streamtitle);
+  if (currentSource == STATION && *streamtitle == '\0' && lastArtistSong.length() == 0) {
+    strcpy(streamtitle, "...waiting for text...");
+  }
+  if (*streamtitle != '\0') {
+    icystreamtitle = streamtitle;                // save for status request from browser
+    if (!full) {
+      if ((p1 = strstr(streamtitle, " - ")) ||
+          (p1 = strstr(streamtitle, " / "))) {   // look for artist/title separator
+        *p1++ = '\n';                            // found: replace 3 characters by newline
+        p2 = p1 + 2;
+        if (*p2 == ' ') {                        // leading space in title?
+          p2++;
+        }                                        // shift 2nd part of title 2 or 3 places
+        strcpy (p1, p2);                         // before: ".. - ..", after: "..\n.."
+      }
+      // skip [xxx] if exists (comes only with some radio stations, e.g. 1FM)
+      if ((p1 = strstr(streamtitle, "[")) &&
+          (p2 = strstr(streamtitle, "]")) &&
+          p1 < p2) {
+        *p1 = '\0';
+        if (*(p1 - 1) == ' ') *(p1 - 1) = '\0';
+      }
+    }
+    if (encoderMode != SELECT) {                 // don't disturb selecting SD tracks or stations
+      tftset(1, streamtitle);                    // set screen segment text middle part
+    }
+    lastArtistSong = streamtitle;
+  }  
 }
 
 //**************************************************************************************************
-//                                        W R I T E P R E F S                                      *
+//                                    S T O P _ M P 3 C L I E N T                                  *
 //**************************************************************************************************
-// Update the preferences.  Called from the web interface.                                         *
+// Disconnect from radio station.                                                                  *
 //**************************************************************************************************
-void writePrefs()
+void stopMp3client()
 {
-  int        inx;                                            // Position in inputstr
-#ifndef USE_ETHERNET
-  uint8_t    winx;                                           // Index in wifilist
-#endif  
-  char       c;                                              // Input character
-  String     inputstr = "";                                  // Input regel
-  String     key, contents;                                  // Pair for Preferences entry
-  String     dstr;                                           // Contents for debug
-
-  dbgprint("writePrefs() entered");
-  timerAlarmDisable(timer);                                  // Disable the timer
-  nvsclear();                                                // Remove all preferences
-  while (true) {
-    c = rinbyt(false);                                       // Get next inputcharacter
-    if (c == '\n') {                                         // Newline?
-      if (inputstr.length() == 0) {
-        dbgprint("writePrefs(): end of writing preferences");
-        break;                                               // End of contents
-      }
-      if (!inputstr.startsWith("#")) {                       // Skip pure comment lines
-        inx = inputstr.indexOf("=");
-        if (inx >= 0) {                                      // Line with "="?
-          key = inputstr.substring(0, inx);                  // Yes, isolate the key
-          key.trim();
-          contents = inputstr.substring(inx + 1);            // and contents
-          contents.trim();
-          dstr = contents;                                   // Copy for debug
-#ifndef USE_ETHERNET
-          if ((key.indexOf("wifi_") == 0)) {                 // Sensitive info?
-            winx = key.substring(5).toInt();                 // Get index in wifilist
-            if ((winx < wifilist.size()) &&                  // Existing wifi spec in wifilist?
-                (contents.indexOf(wifilist[winx].ssid) == 0) &&
-                (contents.indexOf("/****") > 0)) {           // Hidden password?
-              contents = String(wifilist[winx].ssid) +       // Retrieve ssid and password
-                         String("/") + String(wifilist[winx].passphrase);
-              dstr = String(wifilist[winx].ssid) +
-                     String("/*******");                     // Hide in debug line
-            }
-          }
-#endif
-          //dbgprint("writeprefs setstr %s = %s", key.c_str(), dstr.c_str());
-          nvssetstr (key.c_str(), contents);                 // Save new pair
-        }
-      }
-      inputstr = "";
-    }
-    else {
-      if (c != '\r') {                                       // Not newline.  Is is a CR?
-        inputstr += String(c);                              // No, normal char, add to string
-      }
-    }
+P1SMP3:  
+  _claimSPI("stpmp3cl1");                               // claim SPI bus
+  uint8_t erg = mp3client.connected();
+  _releaseSPI();                                        // release SPI bus
+  while (erg) {
+    dbgprint("stopMp3client(): mp3client still connected. Try to disconnect.");  // Stop connection to host
+    _claimSPI("stpmp3cl2");                             // claim SPI bus
+    //mp3client.flush();                                // hangs quite often !
+    mp3client.stop();
+    _releaseSPI();                                      // release SPI bus
+    delay(300);
+    goto P1SMP3;
   }
-  timerAlarmEnable(timer);                                   // Enable the timer
-  fillkeylist();                                             // Update list with keys
+  delay(50);
+  _claimSPI("stpmp3cl3");                               // claim SPI bus
+  //mp3client.flush();                                  // hangs quite often !
+  mp3client.stop();                                     // Stop stream client
+  _releaseSPI();                                        // release SPI bus
+  delay(100);
 }
 
 //**************************************************************************************************
-//                                        H A N D L E H T T P R E P L Y                            *
+//                                    C O N N E C T T O H O S T                                    *
 //**************************************************************************************************
-// Handle the output after an http request.                                                        *
+// Connect to the Internet radio server specified by newpreset.                                    *
 //**************************************************************************************************
-void handlehttpreply()
+bool connectToHost()
 {
-  const char* p;                                          // Pointer to reply if command
-  String      sndstr = "";                                // String to send
-  //int        n;                                         // Number of files on SD card
-  bool        appendLines = true;
+  int      inx;                                    // Position of ":" in hostname
+  uint16_t port = 80;                              // Port number for host
+  char     buf[100];                               // temp buffer
+  String   extension = "/";                        // May be like "/mp3" in "skonto.ls.lv:8002/mp3"
+  String   hostwoext = host;                       // Host without extension and portnumber
+  String   tmp;
 
-  if (!http_reponse_flag) return;                         // Nothing to do           
+  stopMp3client();                                 // Disconnect if still connected
+  dbgprint("Connect to host %s", host.c_str());
+  tftset(0, "ESP32 Radio");                        // Set screen segment text top line
+  displayTime("");                                 // Clear time on TFT screen
+  dataMode = INIT;                                 // can be changed further down
+  chunked = false;                                 // Assume not chunked
+  if (host.endsWith(".m3u")) {                     // Is it an m3u playlist?
+    playlist = host;                               // Save copy of playlist URL
+    dataMode = PLAYLISTINIT;                       // Yes, start in PLAYLIST mode
+    if (playlist_num == 0) {                       // First entry to play?
+      playlist_num = 1;                            // Yes, set index
+    }
+    dbgprint("Playlist request, entry %d", playlist_num);
+  }
+  // In the URL there may be an extension, like noisefm.ru:8000/play.m3u&t=.m3u
+  inx = host.indexOf("/");                         // Search for begin of extension
+  if (inx > 0) {                                   // Is there an extension?
+    extension = host.substring(inx);               // Yes, change the default
+    hostwoext = host.substring(0, inx);            // Host without extension
+  }
+  // In the host there may be a portnumber
+  inx = hostwoext.indexOf(":");                    // Search for separator
+  if (inx >= 0) {                                  // Portnumber available?
+    port = host.substring(inx + 1).toInt();        // Get portnumber as integer
+    hostwoext = host.substring(0, inx);            // Host without portnumber
+  }
+  dbgprint("Server %s, port %d, extension %s",
+             hostwoext.c_str(), port, extension.c_str());
+  _claimSPI("connecttohost1");                     // claim SPI bus
+  int16_t erg = mp3client.connect(hostwoext.c_str(), port);
+  _releaseSPI();                                   // release SPI bus
 
-  http_reponse_flag = false;
-  _claimSPI("httpreply1");                                // claim SPI bus
-  uint8_t erg = cmdclient.connected(); 
-  _releaseSPI();                                          // release SPI bus
-  if (!erg) {
-    dbgprint("handlehttpreply(): error - lost connection to cmdclient");
-    return;                                       // return if connection lost
+  if (erg == 1) {
+    dbgprint("Successfully connected to server");
+    // send request to server and request metadata.
+    _claimSPI("connecttohost2");                   // claim SPI bus
+    mp3client.print(String("GET ") +
+                    extension +
+                    String(" HTTP/1.1\r\n") +
+                    String("Host: ") +
+                    hostwoext +
+                    String("\r\n") +
+                    String("Icy-MetaData:1\r\n") +
+                    String("Connection: close\r\n\r\n"));
+    _releaseSPI();                                // release SPI bus
+    return true;
   }
 
-  if (http_rqfile.length() == 0 &&
-      http_getcmd.length() == 0) {
-    // empty GET received
-    if (NetworkFound) {                                   // Yes, check network
-      handleFSf(String("index.html"));                    // Okay, send the startpage
-    }
-    else {
-      handleFSf(String("config.html"));                   // Or the configuration page if in AP mode
-    }
+  // error connecting to host
+  dbgprint("Request %s failed!", host.c_str());
+#ifdef USE_ETHERNET
+  _claimSPI("connecttohost3");                    // claim SPI bus
+  lstat = Ethernet.linkStatus();                  // Get physical ethernet link status
+  _releaseSPI();                                  // release SPI bus
+  if (lstat == LinkOFF) dbgprint("Ethernet link status: down !!");
+#endif
+  tmp = host;
+  if (tmp.length() > 65) {                        // line limiting
+    tmp.remove(63);
+    tmp += "...";
   }
-  else if (http_getcmd.length()) {  
-    // command received
-    sndstr = httpHeader(String("text/html"));             // Set header
-    if (http_getcmd.startsWith("getprefs")) {             // Is it a "Get preferences"?
-      if (dataMode != STOPPED) {                          // Still playing?
-        dbgprint("STOP (command getprefs)");
-        dataMode = STOPREQD;                              // Stop playing
-      }
-      sndstr += readPrefs(true);                          // Read and send
+#ifdef USE_ETHERNET
+  if (lstat == LinkOFF) {                         // if ethernet link is down than show it
+    if (tmp.length() > 55) {
+      tmp.remove(53);
+      tmp += "...";
     }
-    else if (http_getcmd.startsWith("getdefs")) {         // is it a "Get default preferences"?
-      sndstr += String(defprefs_txt + 1);                 // read initial values
+    tmp += " [Eth Link down!]";
+  }
+#endif
+  sprintf(buf, "Can't connect to: %s", tmp.c_str());
+  tftset(1, buf);
+  tftset(3, " ");
+  icyname = "Couldn't connect to host";
+  icystreamtitle = host;
+  dataMode = CONNECTERROR;
+  return false;
+}
+
+//**************************************************************************************************
+//                                      S S C O N V                                                *
+//**************************************************************************************************
+// Convert an array with 4 "synchsafe integers" to a number.                                       *
+// There are 7 bits used per byte.                                                                 *
+//**************************************************************************************************
+uint32_t ssconv(const uint8_t* bytes)
+{
+  uint32_t res = 0;                                      // Result of conversion
+  uint8_t  i;                                            // Counter number of bytes to convert
+
+  for (i = 0; i < 4; i++) {                              // Handle 4 bytes
+    res = res * 128 + bytes[i];                          // Convert next 7 bits
+  }
+  return res;                                            // Return the result
+}
+
+//**************************************************************************************************
+//                                          I D 3 C O P Y                                          *
+//**************************************************************************************************
+// Copies max. n bytes of text up to the first '\0' to dst (size bytes) and removes trailing       *
+// blanks, as ID3v1 fills its fields with them.                                                    *
+//**************************************************************************************************
+void id3Copy(char* dst, size_t size, const uint8_t* src, int n)
+{
+  int k = 0;
+
+  while (k < n && k < (int)size - 1 && src[k]) {
+    dst[k] = src[k];
+    k++;
+  }
+  while (k && dst[k - 1] == ' ') {
+    k--;
+  }
+  dst[k] = '\0';
+}
+
+//**************************************************************************************************
+//                                          I D 3 T E X T                                          *
+//**************************************************************************************************
+// Copies the first string of an ID3v2 text frame (encoding byte first) to dst (size bytes).       *
+// UTF-16 is reduced to its low bytes, the other encodings are taken as they are.                  *
+//**************************************************************************************************
+void id3Text(char* dst, size_t size, const uint8_t* src, int len)
+{
+  int     i = 1, k = 0;                                  // Skip encoding byte
+  bool    le = false;                                    // UTF-16 little endian
+  uint8_t lo, hi;
+
+  if (len > 0 && (src[0] == 1 || src[0] == 2)) {        // UTF-16 with BOM or big endian
+    if (src[0] == 1 && len >= 3) {
+      le = (src[1] == 0xFF);                             // BOM FF FE is little endian
+      i = 3;
     }
-    else if (http_getcmd.startsWith("saveprefs")) {       // is it a "Save preferences"
-      writePrefs();                                       // handle it
-      highestPreset = findHighestPreset();                // highest preset might have been changed
+    for (; i + 1 < len && k < (int)size - 1; i += 2) {
+      lo = le ? src[i] : src[i + 1];
+      hi = le ? src[i + 1] : src[i];
+      if (lo == 0 && hi == 0) {                          // End of first string
+        break;
+      }
+      dst[k++] = hi ? '?' : lo;
     }
-    else if (http_getcmd.startsWith("mp3list")) {         // is it a "Get SD MP3 tracklist"?
-      _claimSPI("httpreply2");                            // claim SPI bus
-      cmdclient.print(sndstr);                            // send header
-      _releaseSPI();                                      // release SPI bus
-      if (!SD_okay) {                                     // See if known card
-        _claimSPI("httpreply3");                          // claim SPI bus
-        cmdclient.println("0/No tracks found.");          // No SD card, empty list
-        _releaseSPI();                                    // release SPI bus
+    dst[k] = '\0';
+  }
+  else if (len > 1) {
+    id3Copy(dst, size, src + 1, len - 1);                // ISO-8859-1 or UTF-8
+  }
+  else {
+    dst[0] = '\0';
+  }
+}
+
+//**************************************************************************************************
+//                                           I D 3 G E T                                           *
+//**************************************************************************************************
+// Delivers the next n bytes of the file from id3Block, which is refilled with one read of         *
+// ID3_BLOCK bytes when the position is outside.  With unsync set the 0x00 that unsynchronisation  *
+// put after every 0xFF is dropped.  dst may be NULL to skip bytes.  False at the end of the file. *
+//**************************************************************************************************
+bool id3Get(id3src_t* s, uint8_t* dst, uint32_t n)
+{
+  uint32_t k;
+  uint8_t  b;
+  int      res;
+
+  while (n) {
+    if (s->pos < s->bufPos || s->pos >= s->bufPos + s->bufLen) {
+      claimSD("id3get");                                 // claim SPI bus or SD card
+      res = s->f->seek(s->pos) ? s->f->read(id3Block, ID3_BLOCK) : -1;
+      releaseSD();                                       // release SPI bus or SD card
+      s->bufPos = s->pos;
+      s->bufLen = (res > 0) ? res : 0;
+      s->reads++;
+      if (res <= 0) {
+        return false;
       }
-      else {
-        int bytesLeft, start = 0;
-        String tmp;
-        if ((bytesLeft = sdOutbuf.length()) > 0) {  // list empty ?
-          while (bytesLeft) {
-            if (bytesLeft > 1000) {
-              tmp = sdOutbuf.substring(start, start + 1000);
-              bytesLeft -= 1000;
-              start += 1000;
-            }
-            else {
-              tmp = sdOutbuf.substring(start);
-              bytesLeft = 0;
-            }
-            _claimSPI("httpreply4");               // claim SPI bus
-            cmdclient.print(tmp);                  // Filled, send it
-            _releaseSPI();                         // release SPI bus
-          }
-        }
+    }
+    if (!s->unsync) {                                    // Copy what the block has
+      k = min(n, s->bufPos + s->bufLen - s->pos);
+      if (dst) {
+        memcpy(dst, id3Block + (s->pos - s->bufPos), k);
+        dst += k;
       }
-      appendLines = false;
+      s->pos += k;
+      n -= k;
+      continue;
     }
-    else if (http_getcmd.startsWith("settings")) { // Is it a "Get settings" (like presets and tone)?
-      _claimSPI("httpreply6");                     // claim SPI bus
-      cmdclient.print(sndstr);                     // Yes, send header
-      _releaseSPI();                               // release SPI bus
-      getsettings();                               // Handle settings request
-      appendLines = false;
+    b = id3Block[s->pos++ - s->bufPos];
+    if (s->last == 0xFF && b == 0x00) {                  // Inserted by unsynchronisation
+      s->last = 0;
+      continue;
     }
-    else {
-      p = analyzeCmd(http_getcmd.c_str());         // Yes, do so
-      sndstr += String(p);                         // Content of HTTP response follows the header
+    s->last = b;
+    if (dst) {
+      *dst++ = b;
     }
-    if (appendLines) {
-      sndstr += String("\n");                        // The HTTP response ends with a blank line
-      int bytesLeft, start = 0;
-      String tmp;
-      if ((bytesLeft = sndstr.length()) > 0) {       // string empty ?
-        while (bytesLeft) {
-          if (bytesLeft > 1000) {
-            tmp = sndstr.substring(start, start + 1000);
-            bytesLeft -= 1000;
-            start += 1000;
-          }
-          else {
-            tmp = sndstr.substring(start);
-            bytesLeft = 0;
-          }
-          _claimSPI("httpreply8");                   // claim SPI bus
-          cmdclient.print(tmp);                      // Filled, send it
-          _releaseSPI();                             // release SPI bus
-        }
-      }
-    }  
+    n--;
   }
-  else if (http_rqfile.length()) {                 // File requested?
-    dbgprint("start file reply for %s", http_rqfile.c_str());
-    handleFSf(http_rqfile);                        // Yes, send it
+  return true;
+}
+
+//**************************************************************************************************
+//                                          I D 3 S K I P                                          *
+//**************************************************************************************************
+// Skips n bytes of tag data.  Without unsynchronisation that's a seek at the next id3Get(), so    *
+// big frames like cover art are never read.                                                       *
+//**************************************************************************************************
+bool id3Skip(id3src_t* s, uint32_t n)
+{
+  if (s->unsync) {
+    return id3Get(s, NULL, n);                           // Byte positions known only by reading
   }
-  else {
-    httpHeader(String("text/html"));               // send header
-    // the content of the HTTP response follows the header:
-    _claimSPI("httpreply10");                      // claim SPI bus
-    cmdclient.println("dummy response\n");         // text ending with double newline
-    _releaseSPI();                                 // release SPI bus
-    dbgprint("dummy response sent");
+  s->pos += n;
+  return true;
+}
+
+//**************************************************************************************************
+//                                        I D 3 U N S Y N C                                        *
+//**************************************************************************************************
+// Undoes the unsynchronisation of a v2.4 frame in place.  Returns the new length.                 *
+//**************************************************************************************************
+uint32_t id3Unsync(uint8_t* buf, uint32_t len)
+{
+  uint32_t i, k = 0;
+
+  for (i = 0; i < len; i++) {
+    if (i && buf[i - 1] == 0xFF && buf[i] == 0x00) {
+      continue;                                          // Inserted byte
+    }
+    buf[k++] = buf[i];
   }
-#ifdef USE_ETHERNET
-  _claimSPI("httpreply5");                         // claim SPI bus
-  cmdclient.flush();
-  cmdclient.stop();
-  _releaseSPI();                                   // release SPI bus
-  dbgprint("handlehttpreply(): cmdclient.stop() and return");
-#endif
+  return k;
 }
 
 //**************************************************************************************************
-//                                        H A N D L E H T T P                                      *
+//                                         I D 3 R E A D V 2                                       *
 //**************************************************************************************************
-// Handle the input of an http request.                                                            *
+// Reads artist, album, title, genre, track and year (in this order, width bytes each) from an     *
+// ID3v2.2, v2.3 or v2.4 tag at the start of the file.  Tags of v2.2/v2.3 are unsynchronised as a  *
+// whole, v2.4 frames each on their own and with synchsafe sizes.  Frames we don't need and frames *
+// that are compressed or encrypted are skipped.  Returns the size of the tag, 0 if there is none. *
 //**************************************************************************************************
-void handlehttp()
+uint32_t id3ReadV2(id3src_t* s, char* tag, size_t width)
 {
-  bool        first = true;                                 // First call to rinbyt()
-  char        c;                                            // Next character from http input
-  int         inx0, inx;                                    // Pos. of search string in currenLine
-  String      currentLine = "";                             // Build up to complete line
-  bool        reqseen = false;                              // No GET seen yet
+  static const char id22[] = "TP1TALTT2TCOTRKTYE";       // Frame ids v2.2, same order as tag
+  static const char id23[] = "TPE1TALBTIT2TCONTRCKTYER"; // Frame ids v2.3 and v2.4
+  uint8_t           hd[10];                              // Tag header, then frame header
+  uint8_t           txt[ID3_TEXTMAX * 2 + 8];            // Frame contents (UTF-16 twice the size)
+  uint32_t          end, fsize, n;                       // End of tag, frame size, bytes read
+  uint8_t           ver, flags, idlen, hlen, extra;      // Version, tag flags, frame id/header length
+  int               i, k, found = 0;                     // Frame found, number of fields found
 
-  _claimSPI("http1");                                       // claim SPI bus
-  uint8_t erg = cmdclient.connected();
-  _releaseSPI();                                            // release SPI bus
-  if (!erg) {                                               // Action only if client is connected
-    return;                                                 // No client active
+  if (!id3Get(s, hd, 10) || memcmp(hd, "ID3", 3) || hd[3] < 2 || hd[3] > 4 ||
+      ((hd[6] | hd[7] | hd[8] | hd[9]) & 0x80)) {
+    return 0;                                            // No ID3v2 tag
   }
-  dbgprint("handlehttp(): command client detected");
-  while (true) {                                            // Loop till command/file seen
-    c = rinbyt (first);                                     // Get a byte
-    first = false;                                          // No more first call
-    if (c == '\n') {
-      // If the current line is blank, you got two newline characters in a row.
-      // that's the end of the client HTTP request, so send a response:
-      if (currentLine.length() == 0) {
-        http_reponse_flag = reqseen;                        // Response required or not
-        break;
+  ver = hd[3];
+  flags = hd[5];
+  idlen = (ver == 2) ? 3 : 4;
+  hlen = (ver == 2) ? 6 : 10;
+  end = 10 + ssconv(hd + 6);                             // Tag size excludes the header
+  s->unsync = (ver < 4) && (flags & 0x80);               // Whole tag unsynchronised?
+  if (ver == 2 && (flags & 0x40)) {                      // v2.2 compression, never defined
+    return end;
+  }
+  if (ver >= 3 && (flags & 0x40)) {                      // Extended header?
+    if (!id3Get(s, txt, 4)) {
+      return end;
+    }
+    if (ver == 3) {                                      // v2.3: size without size field
+      id3Skip(s, ((uint32_t)txt[0] << 24) | (txt[1] << 16) | (txt[2] << 8) | txt[3]);
+    }
+    else if (ssconv(txt) >= 4) {                         // v2.4: synchsafe, complete header
+      id3Skip(s, ssconv(txt) - 4);
+    }
+  }
+  while (found < 6 && s->pos + hlen <= end) {
+    if (!id3Get(s, hd, hlen)) {
+      break;
+    }
+    for (i = 0; i < idlen && (isupper(hd[i]) || isdigit(hd[i])); i++);
+    if (i < idlen) {                                     // Padding or garbage: end of frames
+      break;
+    }
+    extra = 0;
+    if (ver == 2) {
+      fsize = (hd[3] << 16) | (hd[4] << 8) | hd[5];
+      for (k = 0; k < 6 && memcmp(hd, id22 + k * 3, 3); k++);
+    }
+    else {
+      fsize = ((uint32_t)hd[4] << 24) | (hd[5] << 16) | (hd[6] << 8) | hd[7];
+      if (ver == 4 && !((hd[4] | hd[5] | hd[6] | hd[7]) & 0x80)) {
+        fsize = ssconv(hd + 4);                          // v2.4 synchsafe, some writers use plain
+      }
+      for (k = 0; k < 6 && memcmp(hd, id23 + k * 4, 4); k++);
+      if (ver == 4 && memcmp(hd, "TDRC", 4) == 0) {      // Recording time instead of TYER
+        k = 5;
+      }
+      if (ver == 3) {
+        k = (hd[9] & 0xC0) ? 6 : k;                      // Compressed or encrypted: skip
+        extra = (hd[9] & 0x20) ? 1 : 0;                  // Group id
       }
       else {
-        // Newline seen, remember if it is like "GET /xxx?y=2&b=9 HTTP/1.1"
-        if (currentLine.startsWith("GET /")) {              // GET request?
-          inx0 = 5;                                         // Start search at pos 5
-        }
-        else if (currentLine.startsWith("POST /")) {        // POST request?
-          inx0 = 6;
-        }
-        else {
-          inx0 = 0;                                         // Not GET nor POST
-        }
-        if (inx0) {                                         // GET or POST request?
-          reqseen = true;                                   // Request seen
-          inx = currentLine.indexOf("&");                   // Search for 2nd parameter
-          if (inx < 0) {
-            inx = currentLine.indexOf(" HTTP");             // Search for end of GET command
-          }
-          // Isolate the command
-          http_getcmd = currentLine.substring(inx0, inx);
-          inx = http_getcmd.indexOf("?");                   // Search for command
-          if (inx == 0) {                                   // Arguments only?
-            http_getcmd = http_getcmd.substring(1);         // Yes, get rid of question mark
-            http_rqfile = "";                               // No file
-          }
-          else if (inx > 0) {                               // Filename present?
-            http_rqfile = http_getcmd.substring(0, inx);    // Remember filename
-            http_getcmd = http_getcmd.substring(inx + 1);   // Remove filename from GET command
-          }
-          else {
-            http_rqfile = http_getcmd;                      // No parameters, set filename
-            http_getcmd = "";
-          }
-          if (http_getcmd.length()) {
-            dbgprint("Get command is: %s", http_getcmd.c_str()); // Show result
-          }
-          if (http_rqfile.length()) {
-            dbgprint("Filename is: %s", http_rqfile.c_str()); // Show requested file
-          }
-        }
-        currentLine = "";
+        k = (hd[9] & 0x0C) ? 6 : k;
+        extra = ((hd[9] & 0x40) ? 1 : 0) + ((hd[9] & 0x01) ? 4 : 0); // Group id, data length
       }
     }
-    else if (c != '\r') {                                   // drop CR
-      currentLine += c;                                     // add normal char to currentLine
+    if (fsize > end - s->pos) {                          // Broken tag
+      break;
+    }
+    n = 0;
+    if (k < 6 && !tag[k * width] && fsize > extra + 1u) {
+      n = min(fsize, (uint32_t)sizeof(txt));
+      if (!id3Get(s, txt, n)) {
+        break;
+      }
+      fsize -= n;
+      if (ver == 4 && ((hd[9] & 0x02) || (flags & 0x80))) {
+        n = id3Unsync(txt, n);                           // Frame unsynchronised
+      }
+      if (n > extra) {
+        id3Text(tag + k * width, width, txt + extra, n - extra);
+        found += (tag[k * width] != '\0');
+      }
     }
+    id3Skip(s, fsize);                                   // Next frame, big ones are not read
   }
+  s->unsync = false;
+  return end;
 }
-#endif
 
 //**************************************************************************************************
-//                                          X M L P A R S E                                        *
+//                                        I D 3 R E A D T A I L                                    *
 //**************************************************************************************************
-// Parses line with XML data and put result in variable specified by parameter.                    *
+// Fills the fields still empty from an APEv2 or ID3v1 tag at the end of the file.  The last       *
+// ID3_BLOCK bytes are read at once, that holds both tags unless the APE tag carries cover art.    *
 //**************************************************************************************************
-void xmlparse(String &line, const char *selstr, String &res)
+void id3ReadTail(id3src_t* s, char* tag, size_t width)
 {
-  String sel = "</";                                  // Will be like "</status-code"
-  int    inx;                                         // Position of "</..." in line
+  static const char* apekey[6] = { "Artist", "Album", "Title", "Genre", "Track", "Year" };
+  uint8_t            v1[128];                            // ID3v1 tag
+  uint8_t            buf[128];                           // APE footer or item value
+  char               key[16];                            // APE item key, longer ones don't match
+  uint32_t           size = s->f->size();
+  uint32_t           end = size;                         // End of APE tag
+  uint32_t           count, vlen, flags;                 // APE items, value length and flags
+  uint8_t            b;
+  int                i, k;
+  bool               hasv1 = false;
 
-  sel += selstr;                                      // Form searchstring
-  if (line.endsWith(sel)) {                           // Is this the line we are looking for?
-    inx = line.indexOf(sel);                          // Get position of end tag
-    res = line.substring(0, inx);                     // Set result
-    dbgprint("xmlparse: %s = %s", selstr, res.c_str());
+  s->pos = (size > ID3_BLOCK) ? size - ID3_BLOCK : 0;
+  if (size < 32 || !id3Get(s, NULL, 1)) {               // Read the tail at once
+    return;
+  }
+  if (size >= 128) {
+    s->pos = size - 128;
+    hasv1 = id3Get(s, v1, 128) && memcmp(v1, "TAG", 3) == 0;
+    if (hasv1) {
+      end = size - 128;                                  // APE tag comes before ID3v1
+    }
+  }
+  s->pos = end - 32;
+  if (end >= 32 && id3Get(s, buf, 32) && memcmp(buf, "APETAGEX", 8) == 0) {
+    vlen = buf[12] | (buf[13] << 8) | (buf[14] << 16) | ((uint32_t)buf[15] << 24); // Tag size
+    count = buf[16] | (buf[17] << 8) | (buf[18] << 16) | ((uint32_t)buf[19] << 24);
+    if (vlen >= 32 && vlen <= end) {
+      end -= 32;                                         // End of items
+      s->pos = end + 32 - vlen;                          // First item
+      while (count-- && s->pos + 9 <= end && id3Get(s, buf, 8)) {
+        vlen = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+        flags = buf[4];                                  // Item type in bits 1 and 2
+        for (i = 0; s->pos < end && id3Get(s, &b, 1) && b; i++) {
+          if (i < (int)sizeof(key) - 1) {
+            key[i] = b;                                  // Key up to its '\0'
+          }
+        }
+        key[min(i, (int)sizeof(key) - 1)] = '\0';
+        if (vlen > end - s->pos) {
+          break;                                         // Broken tag
+        }
+        for (k = 0; k < 6 && strcasecmp(key, apekey[k]); k++);
+        if (k < 6 && !tag[k * width] && (flags & 0x06) == 0) { // Text item we need?
+          i = min(vlen, (uint32_t)sizeof(buf));
+          if (!id3Get(s, buf, i)) {
+            break;
+          }
+          id3Copy(tag + k * width, width, buf, i);       // UTF-8, first value only
+          vlen -= i;
+        }
+        id3Skip(s, vlen);                                // Binary items like cover art
+      }
+    }
+  }
+  if (hasv1) {
+    if (!tag[2 * width]) id3Copy(tag + 2 * width, width, v1 + 3, 30);    // Title
+    if (!tag[0])         id3Copy(tag,             width, v1 + 33, 30);   // Artist
+    if (!tag[width])     id3Copy(tag + width,     width, v1 + 63, 30);   // Album
+    if (!tag[5 * width]) id3Copy(tag + 5 * width, width, v1 + 93, 4);    // Year
+    if (!tag[4 * width] && v1[125] == 0 && v1[126]) {                    // ID3v1.1 track number
+      snprintf(tag + 4 * width, width, "%d", v1[126]);
+    }
+    if (!tag[3 * width] && v1[127] != 0xFF) {                            // Genre number
+      snprintf(tag + 3 * width, width, "(%d)", v1[127]);
+    }
   }
 }
- 
+
 //**************************************************************************************************
-//                                          X M L G E T H O S T                                    *
+//                                        I D 3 R E A D T A G S                                    *
 //**************************************************************************************************
-// Parses streams from XML data.                                                                   *
-// Example URL for XML Data Stream:                                                                *
-// http://playerservices.streamtheworld.com/api/livestream?version=1.5&mount=IHR_TRANAAC&lang=en   *
+// Reads artist, album, title, genre, track and year (in this order, width bytes each) of the open *
+// file f from its ID3v2 tag.  If title or artist are missing, APEv2 and ID3v1 tags at the end of  *
+// the file fill the gaps.  Returns the number of blocks read.                                     *
 //**************************************************************************************************
-String xmlgethost(String mount)
+int id3ReadTags(File& f, char* tag, size_t width)
 {
-  const char* xmlhost = "playerservices.streamtheworld.com";  // XML data source
-  const char* xmlget = "GET /api/livestream"                  // XML get parameters
-                       "?version=1.5"                         // API Version of IHeartRadio
-                       "&mount=%sAAC"                         // MountPoint with Station Callsign
-                       "&lang=en";                            // Language
-
-  String   stationServer = "";                                // Radio stream server
-  String   stationPort = "";                                  // Radio stream port
-  String   stationMount = "";                                 // Radio stream Callsign
-  uint16_t timeout = 0;                                       // To detect time-out
-  String   sreply = "";                                       // Reply from playerservices.streamtheworld.com
-  String   statuscode = "200";                                // Assume good reply
-  char     tmpstr[200];                                       // Full GET command, later stream URL
-  String   urlout;                                            // Result URL
-  int      erg;
-
-  stopMp3client();                                            // Stop any current client connections.
-  dbgprint("Try to find iHeartRadio station: %s", mount.c_str());
-  dataMode = INIT;                                            // Start default in metamode
-  chunked = false;                                            // Assume not chunked
-  sprintf(tmpstr, xmlget, mount.c_str());                     // Create a GET commmand for the request
-  dbgprint("%s", tmpstr);
-  _claimSPI("xml1");                                          // claim SPI bus
-  erg = mp3client.connect(xmlhost, 80);
-  _releaseSPI();                                              // release SPI bus
-  if (erg) {                                                  // Connect to XML stream
-    dbgprint("Connected to XML host %s", xmlhost);
-    _claimSPI("xml2");                            // claim SPI bus
-    mp3client.print(String(tmpstr) + " HTTP/1.1\r\n"
-                    "Host: " + xmlhost + "\r\n"
-                    "User-Agent: Mozilla/5.0\r\n"
-                    "Connection: close\r\n\r\n");
-    _releaseSPI();                                            // release SPI bus
-    sprintf(tmpstr, "%s", mount.c_str());                     // assume error
+  id3src_t s = { &f, 0, 0, 0, false, 0, 0 };
 
-P1XGH:
-    _claimSPI("xml3");                                        // claim SPI bus
-    erg = mp3client.available();
-    _releaseSPI();                                            // release SPI bus
-    while (erg == 0) {
-      delay (200);                                            // Give server some time
-      if (++timeout > 25) {                                   // No answer in 5 seconds?
-        dbgprint("Client Timeout !");
-      }
-      goto P1XGH;
-    }
-    dbgprint("XML parser processing...");
-P2XGH:
-    _claimSPI("xml4");                                        // claim SPI bus
-    erg = mp3client.available();
-    _releaseSPI();                                            // release SPI bus
-    while (erg) {
-      _claimSPI("xml5");                                      // claim SPI bus
-      sreply = mp3client.readStringUntil ('>');
-      _releaseSPI();                                          // release SPI bus
-      sreply.trim();
-      // Search for relevant info in in reply and store in variable
-      xmlparse(sreply, "status-code", statuscode);
-      if (stationServer == "")                                // skip if found already
-        xmlparse(sreply, "ip", stationServer);
-      if (stationPort == "")                                  // skip if found already
-        xmlparse(sreply, "port", stationPort);
-      if (stationMount == "")                                 // skip if found already
-        xmlparse(sreply, "mount", stationMount);
-      if (statuscode != "200") {                              // Good result sofar?
-        dbgprint("Bad xml status-code %s. Unable to retrieve final host.", // No, show and stop interpreting
-                   statuscode.c_str());
-        //tmpstr[0] = '\0';                                   // Clear result
-        sprintf(tmpstr, "%s", mount.c_str());
-        break;
-      }
-      goto P2XGH;
-    }
-    if ((stationServer != "") &&                              // Check if all station values are stored
-         (stationPort != "") &&
-         (stationMount != "")) {
-      sprintf(tmpstr, "%s:%s/%s_SC",                          // Build URL for ESP-Radio to stream.
-                stationServer.c_str(),
-                stationPort.c_str(),
-                stationMount.c_str());
-      dbgprint("Found: %s", tmpstr);
-    }
+  for (int k = 0; k < 6; k++) {
+    tag[k * width] = '\0';
   }
-  else {
-    dbgprint("Can't connect to XML host %s!", xmlhost);       // Connection failed
-    //tmpstr[0] = '\0';
-    sprintf(tmpstr, "%s", mount.c_str());
+  id3ReadV2(&s, tag, width);
+  if (!tag[0] || !tag[2 * width]) {
+    id3ReadTail(&s, tag, width);
   }
-  _claimSPI("xml5");                                          // claim SPI bus
-  mp3client.stop();
-  _releaseSPI();                                              // release SPI bus
-  return String(tmpstr);                                      // Return final streaming URL.
+  return s.reads;
 }
 
 //**************************************************************************************************
-//                                      H A N D L E S A V E R E Q                                  *
+//                                  Q U I C K S D C H E C K                                        *
 //**************************************************************************************************
-// Handle save volume/preset/tone.  This will save current settings every 15 minutes to            *
-// the preferences.  On the next restart these values will be loaded.                              *
-// Note that saving prefences will only take place if contents has changed.                        *
+// If we have files in our list try to open the first one. If not successful clear SD_okay.        *
+// Don't check if mp3-file is currently open.                                                      *
 //**************************************************************************************************
-void handleSaveReq()
+void quickSdCheck()
 {
-  static uint32_t savetime = 0;                          // Limit save to once per 15 minutes
-
-  if ((millis() - savetime) < 900000) {                  // 900 sec is 15 minutes
-    return;
+  uint8_t c;
+  int index = 0;
+  
+  if (SD_okay && SD_mp3fileCount > 0 && !mp3file) {
+    for (int i=1; i < mp3nodeList.size(); i++) {        // 0 is root index, so we start with 1
+      if (!mp3nodeList[i].isDirectory) {
+        index = i;
+        break;
+      }
+    }
+    if (!index) return;                                 // no file found...weird...
+    const char* path = getSDfilename(index);            // returns path with "sdcard" in front
+    if (strncmp(path, "sdcard", 6) != 0) return;        // "error"
+    path += 6;                                          // we need path, so skip the "sdcard" part
+    claimSD("qusdchk1");                                // claim SPI bus or SD card
+    mp3file = sdfs->open(path);                         // Open the file
+    releaseSD();
+    if (!mp3file) {
+      SD_okay = false;
+      SD_rescanReq = true;                              // index may be outdated
+      dbgprint("quickSdCheck: error SD.open(%s) -> SD_okay = false", path);
+      return;
+    }
+    claimSD("qusdchk2");                                // claim SPI bus or SD card
+    int i = mp3file.read(&c, 1);                        // read only 1 byte
+    mp3file.close();
+    releaseSD();
+    if (i != 1) {
+      SD_okay = false;
+      dbgprint("quickSdCheck: error mp3file.read(1) -> SD_okay = false");
+      return;
+    }
+    dbgprint("quickSdCheck: All ok.");
   }
-  savetime = millis();                                   // Set time of last save
-  nvssetstr("preset", String(currentPreset));            // Save current preset
-  nvssetstr("volume", String(ini_block.reqvol));         // Save current volume
-  nvssetstr("toneha", String(ini_block.rtone[0]));       // Save current toneha
-  nvssetstr("tonehf", String(ini_block.rtone[1]));       // Save current tonehf
-  nvssetstr("tonela", String(ini_block.rtone[2]));       // Save current tonela
-  nvssetstr("tonelf", String(ini_block.rtone[3]));       // Save current tonelf
 }
 
 //**************************************************************************************************
-//                        C H E C K E N C O D E R A N D B U T T O N S                              *
+//                                  H A N D L E I D 3                                              *
 //**************************************************************************************************
-// Check if rotary encoder or front buttons are used.                                              *
+// Check file on SD card for ID3 tags and use them to display some info.                           *
+// Parameter must be "soap/....." or "sdcard/......."                                              *
 //**************************************************************************************************
-void checkEncoderAndButtons()
+bool handleID3 (String& path)
 {
-  static int8_t  enc_preset;                                 // Selected preset
-  static int16_t enc_nodeIndex;                              // index of selected track
-  static int16_t enc_dirIndex;                               // directory we are in
-  static String  enc_filename;                               // Filename of selected track
-  String         tmp, dir;                                   // Temporary strings
-  int16_t        inx;                                        // index
-  const char*    reply;
+  HEAP_TAG("handleID3");
+  const char*  p;                                          // Pointer to filename
+  char     tag[6][ID3_TEXTMAX];                            // Artist, album, title, genre, track, year
+  uint32_t t0;                                             // To time reading the tags
+  int      n;                                              // Blocks read
+  String   artttl;                                         // Artist and title
+  enum_selection source = (path.indexOf("sdcard") == 0) ? SDCARD : MEDIASERVER;
 
-  if (encoderMode != IDLING &&                               // In default mode
-      enc_inactivity > 100) {                                // and more than 10 seconds inactive
-    enc_inactivity = 0;
-    // TEST
-    //dbgprint("dataMode=%d, playMode=%d, totalCount=%d, currentSource=%d, currentPreset=%d, enc_preset=%d, encoderMode=%d",
-    //            dataMode, playMode, totalCount, currentSource, currentPreset, enc_preset, encoderMode);
-    if (playMode == SDCARD) {
-      if (!SD_okay) { 
-        // No SD card present or defect
-        tftset(1, "SD-Card Error !");
-        encoderMode = IDLING;                               // Return to IDLE mode
-      }
-      else {
-        if (dataMode != STOPPED && dataMode != STOPREQD) {
-          tftset(1, lastArtistSong);
-          tftset(3, lastAlbumStation);
-          if (currentSource == SDCARD) 
-            forceProgressBar = true;                        // got to be painted AFTER section 3 or 4 is done
-          encoderMode = IDLING;                             // return to IDLE mode
-        }
-      }
+  if (source == SDCARD && !SD_okay) {
+    dbgprint("handleID3: SD_okay is false");
+    return false;
+  }
+  if (encoderMode != SELECT) {                           // Don't disturb selecting SD tracks
+    // just for the case we won't find an ID3 tag
+    if (source == SDCARD) {
+      tftset(3, "Playing from local file");
+      lastAlbumStation = "Playing from local file";
     }
-    else if (playMode == STATION) {
-      if (dataMode == STOPPED || dataMode == STOPREQD) {
-        currentPreset = -1;                                 // Make sure current is different
-        ini_block.newpreset = enc_preset;                   // Make a definite choice
-      }
-      else {
-        tftset(1, (char*)NULL);                             // Restore original text in middle section
-        tftset(3, (char*)NULL);                             // Restore original text at bottom
-      }
-      encoderMode = IDLING;                                 // Return to IDLE mode
+    else {
+      lastAlbumStation = "Playing from media server";      // album info can be missing
+    }  
+  }  
+  dbgprint("handleID3: Looking for ID3 tags in %s", 
+    (char*)path/*substring((source==SDCARD)?6:4)*/.c_str());
+  p = path.c_str() + path.lastIndexOf("/") + 1;            // Point just to filename
+  showStreamTitle(p, true);                                // filename as title (lastArtistSong), but will 
+                                                           // be overridden if mp3 tags found 
+  if (source == SDCARD) {                                                           
+    claimSD("id30");
+    mp3file = sdfs->open(path.c_str() + 6);                // Open the file
+    releaseSD();
+    if (!mp3file) {
+      SD_okay = false;
+      SD_rescanReq = true;                                 // index may be outdated
+      currentIndex = -1;
+      dbgprint("handleID3: error SD.open()");
+      return false;
     }
-    else { // playMode == MEDIASERVER
-      if (dataMode != STOPPED && dataMode != STOPREQD) {
-        tftset(1, lastArtistSong);
-        tftset(3, lastAlbumStation);
-        if (currentSource == MEDIASERVER) 
-          forceProgressBar = true;                          // Got to be painted >>after<< section 3 or 4 is done
-        encoderMode = IDLING;                                  // Return to IDLE mode
-      }
+    t0 = micros();
+    n = id3ReadTags(mp3file, tag[0], ID3_TEXTMAX);         // ID3v2, APEv2 or ID3v1 tags
+    dbgprint("ID3 tags read in %d us, %d block reads", micros() - t0, n);
+    if (tag[0][0]) {                                       // artist
+      dbgprint("ID3 TPE1 = %s", tag[0]);
+      artttl += String(tag[0]);                            // add to string
+      artttl += String("\n");                              // add newline
+    }
+    if (tag[2][0]) {                                       // song title
+      dbgprint("ID3 TIT2 = %s", tag[2]);
+      artttl += String(tag[2]);
+      artttl += String("\n");
+    }
+    if (tag[1][0]) {                                       // album
+      dbgprint("ID3 TALB = %s", tag[1]);
+      lastAlbumStation = tag[1];
     }
-    if (encoderMode == IDLING)
-      dbgprint("Encoder mode back to IDLING");
   }
-  if (buttonReturn) {                                            // First handle return button
-    dbgprint("Return Button");
-    buttonReturn = false;
-    if (encoderMode == SELECT) {
-      if (playMode == SDCARD) { // want to leave the current directory
-        if (enc_dirIndex != 0) { // we are not in root
-          enc_nodeIndex = mp3nodeList[enc_nodeIndex].parentDir;  // get parent directory of current file/directory
-          enc_dirIndex = mp3nodeList[enc_nodeIndex].parentDir;   // and parent of parent directory
-          tmp = mp3nodeList[enc_nodeIndex].name;
-          if (mp3nodeList[enc_nodeIndex].isDirectory)
-            tftset(2, tmp);
-          else
-            tftset(1, tmp);
+#ifdef ENABLE_SOAP  
+  else {
+    // no need to scan for ID3 tags, we get it from mediaserver
+    if (soapList[currentIndex].artist.length()) {            // artist can be missing
+      artttl = soapList[currentIndex].artist;
+      artttl += String("\n");                                // add newline
+      dbgprint("SOAP TPE1 = %s", soapList[currentIndex].artist.c_str());
+    }
+    artttl += soapList[currentIndex].name;
+    dbgprint("SOAP TIT2 = %s", soapList[currentIndex].name.c_str());
+    if (soapList[currentIndex].album.length()) {             // album can be missing
+      lastAlbumStation = soapList[currentIndex].album;
+      dbgprint("SOAP TALB = %s", soapList[currentIndex].album.c_str());
+    }
+  }
+#endif  
+
+  if (artttl.length()) lastArtistSong = artttl;
+  if (encoderMode != SELECT) {                               // don't disturb selecting SD tracks
+    tftset(1, lastArtistSong);                               // Show artist and title
+    tftset(3, lastAlbumStation  );                           // show album
+  }    
+  return true;
+}
+
+#ifdef SD_READER
+//**************************************************************************************************
+//                                       S D R E A D B E G I N                                     *
+//**************************************************************************************************
+// Allocates the two buffers of sdReadTask in DMA capable memory, so the SD driver reads right     *
+// into them.  Without them tracks are read by mp3loop() itself.                                   *
+//**************************************************************************************************
+void sdReadBegin()
+{
+  sdReadFull = xQueueCreate(2, sizeof(uint8_t));
+  sdReadFree = xQueueCreate(2, sizeof(uint8_t));
+  for (uint8_t i = 0; i < 2; i++) {
+    sdReadBuf[i].data = (uint8_t*)heap_caps_malloc(SDREAD_BLOCK, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+  }
+  if (!sdReadFull || !sdReadFree || !sdReadBuf[0].data || !sdReadBuf[1].data) {
+    dbgprint("No memory to read SD tracks ahead");
+    free(sdReadBuf[0].data);
+    free(sdReadBuf[1].data);
+    return;
+  }
+  for (uint8_t i = 0; i < 2; i++) {
+    xQueueSend(sdReadFree, &i, 0);                     // Both buffers can be filled
+  }
+  sdReadOn = true;
+}
+
+//**************************************************************************************************
+//                                       S D R E A D T A S K                                       *
+//**************************************************************************************************
+// Reads the open mp3file ahead into the buffer that mp3loop() is not taking data from.  A buffer  *
+// is filled in reads of SDREAD_CHUNK bytes starting on a chunk boundary, so the SD driver does    *
+// multi-block reads of whole sectors.  The SD card is released after every chunk.  A buffer that  *
+// was filled while sdReadFlush() changed the file or position is thrown away by mp3loop().        *
+//**************************************************************************************************
+void sdReadTask(void * parameter)
+{
+  sdread_buf_t* b;
+  uint8_t       inx;                                   // Buffer to fill
+  uint32_t      want, t0;
+  int           n;
+  bool          eof;
+
+  if (!sdReadOn) {
+    vTaskDelete(NULL);                                 // No buffers, mp3loop() reads itself
+  }
+  while (true) {
+    xQueueReceive(sdReadFree, &inx, portMAX_DELAY);    // Wait for an empty buffer
+    b = &sdReadBuf[inx];
+    b->len = 0;
+    b->used = 0;
+    while (true) {
+      claimSD("sdreadtask");                           // claim SPI bus or SD card
+      if (b->len <= 0 || b->gen != sdReadGen) {
+        b->len = 0;                                    // (Re)start filling for this position
+        b->gen = sdReadGen;
+      }
+      want = 0;
+      if (!sdReadEof) {
+        want = SDREAD_CHUNK - mp3file.position() % SDREAD_CHUNK;
+        want = min(want, (uint32_t)(SDREAD_BLOCK - b->len));
+        want = min(want, (uint32_t)mp3file.available());
+        if (want == 0) {
+          sdReadEof = true;                            // Whole file read
         }
         else {
-          if (currentSource == SDCARD && SD_okay &&
-              dataMode != STOPPED && dataMode != STOPREQD) {
-            encoderMode = IDLING;                                // Back to default mode
-            tftset(1, lastArtistSong);
-            tftset(3, lastAlbumStation);
-            forceProgressBar = true;                             // Got to be painted >>after<< section 3 or 4 is done
-          }
-        }
-      }
-      else if (playMode == STATION) {
-        if (dataMode != STOPPED && dataMode != STOPREQD) {
-          encoderMode = IDLING;                                // Back to default mode
-          tftset(1, lastArtistSong);
-          tftset(3, lastAlbumStation);
-        }
-      }
-#ifdef ENABLE_SOAP
-      else { // playMode == MEDIASERVER
-        if (soapChain.size() > 1) {                              // no action if we are in root
-          soapChain.pop_back();                                  // delete last element in chain (current level)
-          soapChain.back().startingIndex = 0;                    // start displaying items at position 0
-          soapChain_t up = soapChain.back();                     // retrieve last element in chain (one level higher)
-          dbgprint("Search in media server container \"%s\" (child count: %d)", 
-                   up.name.c_str(), up.size);
-          bool ret = soap.browseServer(0, up.id.c_str(), &soapList);
-          if (ret) {                                             // browsing mediaserver one level higher
-            if (soapList.size() > 0) {
-              tftset(4, "Turn to select directory  or track.\n"  // Show current option
-                        "Press to confirm.");
-              enc_nodeIndex = 0;                                 // first entry on that level 
-              tmp = soapList[enc_nodeIndex].name;
-              if (soapList[enc_nodeIndex].isDirectory) {
-                tftset(2, tmp);
-              }
-              else {
-                String uriLc = soapList[enc_nodeIndex].uri;
-                uriLc.toLowerCase();
-                if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
-                    !uriLc.endsWith(".mp3"))
-                  tmp += " [not mp3]";
-                tftset(1, tmp);
-              }
-            }
+          t0 = micros();
+          n = mp3file.read(b->data + b->len, want);
+          sdReadTime += micros() - t0;
+          sdReadCalls++;
+          if (n > 0) {
+            sdReadBytes += n;
+            b->len += n;
           }
           else {
-            // error accessing media server
-            encoderMode = IDLING;
-            playMode = NONE;
-            dbgprint("buttonReturn: error accessing media server");
-            if (dataMode != STOPPED && dataMode != STOPREQD) {
-              dbgprint("STOP (error accessing DLNA media server)");
-              dataMode = STOPREQD;                               // Request STOP
-            }
-            tftset(1, "Error accessing      media server !");
-            tftset(4, "Error");
+            b->len = -1;                               // Read error, mp3loop() stops
+            sdReadEof = true;
           }
         }
       }
-#endif
-    }
-#ifdef ENABLE_SOAP
-    else { // IDLING
-      if (playMode == MEDIASERVER) { 
-        // we want to stop the song and show the current directory
-        if (dataMode != STOPPED && dataMode != STOPREQD) {
-            dbgprint("STOP (return button while playing from media server)");
-            dataMode = STOPREQD;                               // Request STOP
-            muteFlag = 30;
-        }
-        soap.readStop();
-        delay(200);
-        if (soapChain.size() > 1) {                              // no action if we are in root
-          soapChain_t up = soapChain.back();                     // retrieve last element in chain (current level)
-          dbgprint("Search in media server container \"%s\" (child count: %d)", 
-                   up.name.c_str(), up.size);
-          bool ret = soap.browseServer(0, up.id.c_str(), &soapList);
-          if (ret) {                                             // browsing mediaserver one level higher
-            encoderMode = SELECT;
-            if (soapList.size() > 0) {
-              tftset(4, "Turn to select directory  or track.\n"  // Show current option
-                        "Press to confirm.");
-              enc_nodeIndex = 0;                                 // first entry on that level 
-              tmp = soapList[enc_nodeIndex].name;
-              if (soapList[enc_nodeIndex].isDirectory) {
-                tftset(2, tmp);
-              }
-              else {
-                String uriLc = soapList[enc_nodeIndex].uri;
-                uriLc.toLowerCase();
-                if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
-                    !uriLc.endsWith(".mp3"))
-                  tmp += " [not mp3]";
-                tftset(1, tmp);
-              }
-            }
-            else {
-              // oops very unprobable error ..... to be handled ?
-            }
-          }
-          else {
-            // error accessing media server
-            encoderMode = IDLING;
-            playMode = NONE;
-            dbgprint("buttonReturn: error accessing media server");
-            tftset(1, "Error accessing      media server !");
-            tftset(4, "Error");
-          }
-        }
+      eof = sdReadEof;
+      releaseSD();                                     // release SPI bus or SD card
+      if (b->len < 0 || b->len == SDREAD_BLOCK || (eof && b->len)) {
+        break;                                         // Buffer ready
+      }
+      if (want == 0) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);       // Wait for sdReadFlush()
       }
     }
-#endif    
-    return;
+    xQueueSend(sdReadFull, &inx, portMAX_DELAY);       // Hand it to mp3loop()
+    wakeLoop();                                        // which may be waiting for it
   }
-  if (buttonRepeatMode) {
-    //dbgprint("Repeat Mode");
-    buttonRepeatMode = false;
-    reply = analyzeCmd("repeat");
-    dbgprint(reply);
-    return;
+}
+
+//**************************************************************************************************
+//                                     S D R E A D R E L E A S E                                   *
+//**************************************************************************************************
+// Gives the buffer mp3loop() took data from back to sdReadTask.                                   *
+//**************************************************************************************************
+void sdReadRelease()
+{
+  uint8_t inx = sdReadCur;
+
+  if (sdReadCur >= 0) {
+    xQueueSend(sdReadFree, &inx, 0);
+    sdReadCur = -1;
   }
-  if (buttonSkipBack) {
-    buttonSkipBack = false;
-    if (playMode == SDCARD && encoderMode == SELECT) {
-      return;                                              // skip button inactive when selecting tracks
-    }
-    analyzeCmd("previous");
+}
+#endif
+
+//**************************************************************************************************
+//                                       S D R E A D F L U S H                                     *
+//**************************************************************************************************
+// Must be called after mp3file has been opened, closed or positioned, with the SD card still      *
+// claimed.  Data read ahead is thrown away.  With more set reading goes on at the new position.   *
+//**************************************************************************************************
+void sdReadFlush(bool more)
+{
+#ifdef SD_READER
+  uint8_t inx;
+
+  if (!sdReadOn) {
     return;
   }
-  if (buttonSkipForward) {
-    buttonSkipForward = false;
-    if (playMode == SDCARD && encoderMode == SELECT) {
-      return;                                              // skip button inactive when selecting tracks
-    }
-    analyzeCmd ("next");
-    return;
+  sdReadGen++;                                         // Blocks being read are obsolete
+  sdReadEof = !more;
+  sdReadRelease();
+  while (xQueueReceive(sdReadFull, &inx, 0) == pdTRUE) {
+    xQueueSend(sdReadFree, &inx, 0);
   }
-  if (buttonPreset > -1) {
-    if (readhostfrompref(buttonPreset) != "") {
-      playMode = STATION;
-      encoderMode = IDLING;                                // Back to default mode
-      currentPreset = -1;                                  // Make sure current is different
-      ini_block.newpreset = buttonPreset;
-      //tftset(4, "");                                  // Clear text
-      dbgprint("ini_block.newpreset=%d", ini_block.newpreset);
-      muteFlag = 30;                                       // ca. 3 sec.
-      mp3fileRepeatFlag = NOREPEAT;
+  xTaskNotifyGive(xsdReadTask);                        // Wake up sdReadTask
+#endif
+}
+
+//**************************************************************************************************
+//                                          S D R E A D                                            *
+//**************************************************************************************************
+// Delivers max. size bytes of mp3file for playing.  With SD_READER they are copied from a block   *
+// read ahead by sdReadTask, 0 means that the next block is not there yet.  Otherwise the file is  *
+// read directly.  Returns -1 on a read error.                                                     *
+//**************************************************************************************************
+int sdRead(uint8_t* buf, uint32_t size)
+{
+  int           res;
+  uint32_t      t0;
+#ifdef SD_READER
+  sdread_buf_t* b;
+  uint8_t       inx;
+
+  if (sdReadOn) {
+    while (true) {
+      if (sdReadCur < 0) {
+        if (xQueueReceive(sdReadFull, &inx, 0) != pdTRUE) {
+          return 0;                                    // Nothing read ahead yet
+        }
+        sdReadCur = inx;
+      }
+      b = &sdReadBuf[sdReadCur];
+      if (b->gen == sdReadGen && b->len < 0) {
+        sdReadRelease();
+        return -1;                                     // Read error
+      }
+      if (b->gen == sdReadGen && b->used < (uint32_t)b->len) {
+        break;                                         // Data left in this block
+      }
+      sdReadRelease();                                 // Drained or obsolete
     }
-    else {
-      dbgprint("No radio station for preset %d configured !", buttonPreset);
+    res = min(size, b->len - b->used);
+    memcpy(buf, b->data + b->used, res);
+    b->used += res;
+    if (b->used == (uint32_t)b->len) {
+      sdReadRelease();                                 // Can be filled again
     }
-    buttonPreset = -1;
-    return;
+    return res;
   }
-  if (longClick) {
-    dbgprint("Long click ---> Resetting CPU");
-    dsp_erase();
-    dsp_setTextSize(2);                                   // Bigger character font
-    dsp_setTextColor(RED);                                // Info in red
-    dsp_setCursor(12, 55);                                // Middle of screen
-    dsp_print("SW-Reboot !");
-    dataMode = STOPREQD;                                  // stop player
-    delay(1800);                                          // Pause for a short time
-    ESP.restart();                                        // Reset the CPU, no return
+#endif
+  claimSD("sdread3");                                  // claim SPI bus or SD card
+  t0 = micros();
+  res = mp3file.read(buf, size);                       // Read a block of data
+  sdReadTime += micros() - t0;
+  releaseSD();                                         // release SPI bus or SD card
+  sdReadCalls++;
+  if (res <= 0) {
+    return -1;
   }
-  if (doubleClick) {                                      // Double click switches between Station/SD/DLNA modes
-    dbgprint("Double click");
-    doubleClick = false;
-    if (playMode == SDCARD) 
-      buttonStation = true;
-#ifdef ENABLE_SOAP     
-    else if (playMode == STATION) 
-      buttonMediaserver = true;
-#endif      
-    else // playMode == MEDIASERVER
-      buttonSD = true;
-    // no return ... will be handled immediately
+  sdReadBytes += res;
+  return res;
+}
+
+//**************************************************************************************************
+//                                     S D R E A D S T A T S                                       *
+//**************************************************************************************************
+// Puts a line with the SD read statistics of playing into line.                                   *
+//**************************************************************************************************
+void sdReadStats(char* line, size_t size)
+{
+  uint32_t ms = sdReadTime / 1000;                     // SD bus time
+
+  snprintf(line, size, "SD reads for playing: %u, %u KB, bus time %u ms, %u KB/s, %u reads per MB",
+           sdReadCalls, sdReadBytes / 1024, ms,
+           ms ? (uint32_t)((uint64_t)sdReadBytes * 1000 / 1024 / ms) : 0,
+           sdReadBytes ? (uint32_t)((uint64_t)sdReadCalls * 1048576 / sdReadBytes) : 0);
+}
+
+//**************************************************************************************************
+//                                        S K I P L E A D I N                                      *
+//**************************************************************************************************
+// Returns the position of the first audio frame in the open mp3file.  Skips the ID3v2 tag (cover  *
+// art can be big) and the Xing/Info frame written by LAME, which would decode to 1152 samples of  *
+// silence.  LAME encoder delay and padding are only reported, the VS1053 can't trim samples.      *
+//**************************************************************************************************
+uint32_t skipLeadIn()
+{
+  static const uint16_t brtab[2][15] = {                 // Bitrates layer III in kbps
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },   // MPEG1
+    { 0,  8, 16, 24, 32, 40, 48, 56,  64,  80,  96, 112, 128, 144, 160 } }; // MPEG2 and 2.5
+  static const uint16_t srtab[3] = { 44100, 48000, 32000 }; // MPEG1, MPEG2 half, MPEG2.5 quarter
+  uint8_t  buf[192];                                     // Frame header, Xing and LAME tag
+  uint32_t pos = 0;                                      // Start of first frame
+  uint32_t sr, flen;                                     // Sample rate, frame length
+  uint8_t  ver, bri, sri, xoff, lame;
+  int      n;
+
+  claimSD("leadin1");                                    // claim SPI bus or SD card
+  mp3file.seek(0);
+  n = mp3file.read(buf, 10);                             // Room for ID3v2 header
+  releaseSD();                                           // release SPI bus or SD card
+  if (n == 10 && memcmp(buf, "ID3", 3) == 0) {
+    pos = 10 + ssconv(buf + 6);                          // Skip header and tags
+    if (buf[5] & 0x10) {                                 // Footer present?
+      pos += 10;
+    }
+  }
+  claimSD("leadin2");                                    // claim SPI bus or SD card
+  mp3file.seek(pos);
+  n = mp3file.read(buf, sizeof(buf));                    // Read first frame
+  releaseSD();                                           // release SPI bus or SD card
+  if (n < 4 || buf[0] != 0xFF || (buf[1] & 0xE0) != 0xE0 ||
+      ((buf[1] >> 1) & 3) != 1) {                        // No layer III frame header?
+    return pos;
+  }
+  ver = (buf[1] >> 3) & 3;                               // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+  bri = buf[2] >> 4;                                     // Bitrate index
+  sri = (buf[2] >> 2) & 3;                               // Sample rate index
+  if (ver == 1 || bri == 0 || bri == 15 || sri == 3) {   // Reserved or free format
+    return pos;
+  }
+  sr = srtab[sri] >> ((ver == 3) ? 0 : ((ver == 2) ? 1 : 2));
+  if (ver == 3) {
+    flen = 144000UL * brtab[0][bri] / sr;
+    xoff = ((buf[3] >> 6) == 3) ? 21 : 36;               // Xing header after side info
   }
-  if (buttonSD) {                                           // Handle button requesting SD mode
-    dbgprint("SD mode requested");
-    buttonSD = false;
-#ifdef ENABLE_SOAP    
-    soapList.clear();                                       // Free memory space
-    soapChain.clear();
-#endif    
-    if (ini_block.sd_cs_pin < 0) {                          // no SD configured ?
-      return;
-    }
-    if (playMode != SDCARD) {
-      tftset(0, "ESP32 MP3Player");                         // Set screen segment top line
-      //displaytime ("");                                   // Time to be refreshed
-      if (dataMode != STOPPED) {
-        dbgprint("STOP (buttonSD)");
-        dataMode = STOPREQD;                                // Request STOP
+  else {
+    flen = 72000UL * brtab[1][bri] / sr;
+    xoff = ((buf[3] >> 6) == 3) ? 13 : 21;
+  }
+  flen += (buf[2] >> 1) & 1;                             // Padding slot
+  if (n < xoff + 8 ||
+      (memcmp(buf + xoff, "Xing", 4) && memcmp(buf + xoff, "Info", 4))) {
+    return pos;                                          // First frame is music
+  }
+  lame = xoff + 8;                                       // LAME tag follows the optional Xing fields
+  lame += (buf[xoff + 7] & 1) ? 4 : 0;                   // Frames
+  lame += (buf[xoff + 7] & 2) ? 4 : 0;                   // Bytes
+  lame += (buf[xoff + 7] & 4) ? 100 : 0;                 // TOC
+  lame += (buf[xoff + 7] & 8) ? 4 : 0;                   // Quality
+  if (n >= lame + 24 && memcmp(buf + lame, "LAME", 4) == 0) {
+    dbgprint("skipLeadIn: LAME encoder delay %d, padding %d samples",
+             (buf[lame + 21] << 4) | (buf[lame + 22] >> 4),
+             ((buf[lame + 22] & 0x0F) << 8) | buf[lame + 23]);
+  }
+  dbgprint("skipLeadIn: skip %d bytes ID3 and %d bytes Xing/Info frame", pos, flen);
+  return pos + flen;
+}
+
+//**************************************************************************************************
+//                                       C O N N E C T T O F I L E                                 *
+//**************************************************************************************************
+// Open the local mp3-file.  Also used for gapless transitions while the decoder is still playing  *
+// the end of the last file from the queue.                                                        *
+//**************************************************************************************************
+bool connecttofile()
+{
+  tftset(0, TOPLINE_MP3);                                // set screen segment top line
+  displayTime("");                                       // Clear time on TFT screen
+  if (mp3file) {                                         // close old mp3 file if still open
+    dbgprint("connecttofile: close mp3file");
+    claimSD("close7");                                   // claim SPI bus or SD card
+    mp3file.close();                                     // Close file
+    sdReadFlush(false);                                  // nothing to read ahead
+    releaseSD();                                         // release SPI bus or SD card
+  }
+  // See if there are ID3 tags in this file
+  if (!handleID3(host)) {
+    dbgprint("connecttofile: Error reading file %s", host.substring(6).c_str());  // No luck
+    return false;
+  }
+  uint32_t start = skipLeadIn();                         // Position of first audio frame
+  claimSD("sdavail5");                                   // claim SPI bus or SD card
+  mp3file.seek(start);
+  mp3fileLength = mp3fileBytesLeft = mp3file.available();  // Get length of audio data
+  sdReadFlush(true);                                     // start reading ahead
+  releaseSD();                                           // release SPI bus or SD card
+  icyname = "";                                          // No icy name yet
+  chunked = false;                                       // File not chunked
+  metaint = 0;                                           // No metadata
+
+  return true;
+}
+
+#ifdef ENABLE_SOAP
+//**************************************************************************************************
+//                            C O N N E C T T O M E D I A S E R V E R                              *
+//**************************************************************************************************
+// Request the file in hostObject from the media server and show its info.                         *
+//**************************************************************************************************
+bool connecttomediaserver()
+{
+  #define MAX_DLNA_RETRIES 3
+  int i;
+
+  for (i = 0; i < MAX_DLNA_RETRIES; i++) {
+    if (soap.readStart(&hostObject, &mp3fileLength)) break;  // request media server file
+    delay(200);
+  }
+  if (i == MAX_DLNA_RETRIES) {
+    // error requesting file from media server
+    tftset(4, "Error retrieving file.");
+    dbgprint("readStart(%s:%d/%s) returned error", 
+             hostObject.downloadIp.toString().c_str(), hostObject.downloadPort, hostObject.uri.c_str());
+    return false;
+  }
+  mp3fileBytesLeft = mp3fileLength;                      // file length as reported from media server
+  dbgprint("readStart(%s:%d/%s) successful", 
+           hostObject.downloadIp.toString().c_str(), hostObject.downloadPort, hostObject.uri.c_str());
+  if (!handleID3(host)) {                                // check for ID3 tags
+    // error reading from media server
+    tftset(4, "Error reading file from media server.");
+    dbgprint("handleID3(\"%s\") returned error", host.c_str());          
+    return false;
+  }
+  icyname = "";                                          // No icy name yet
+  chunked = false;                                       // File not chunked
+  metaint = 0;                                           // no meta data
+  return true;
+}
+#endif
+
+//**************************************************************************************************
+//                                      S A M E F O R M A T                                        *
+//**************************************************************************************************
+// True if both files have the same extension, so the decoder can go on without stopSong().        *
+//**************************************************************************************************
+bool sameFormat(const char* a, const char* b)
+{
+  const char* exta = strrchr(a, '.');
+  const char* extb = strrchr(b, '.');
+
+  return strcasecmp(exta ? exta + 1 : a, extb ? extb + 1 : b) == 0;
+}
+
+//**************************************************************************************************
+//                                       C O N N E C T W I F I                                     *
+//**************************************************************************************************
+// Connect to WiFi using the SSID's available in wifiMulti.                                        *
+// If only one AP if found in preferences (i.e. wifi_00) the connection is made without            *
+// using wifiMulti.                                                                                *
+// If connection fails the function returns false.                                                 *
+//**************************************************************************************************
+#ifndef USE_ETHERNET
+bool connectwifi()
+{
+  char*      pfs;                                        // Pointer to formatted string
+  bool       res = false;                                // Result
+
+  WifiInfo_t winfo;                                      // Entry from wifilist
+
+  for (int ii = 0; ii < 2; ii++) {
+    WiFi.disconnect();                                   // After restart the router could
+    WiFi.softAPdisconnect(true);                         // still keep the old connection
+    if (wifilist.size()) {                               // Any AP defined?
+      if (wifilist.size() == 1) {                        // Just one AP defined in preferences?
+        winfo = wifilist[0];                             // Get this entry
+        WiFi.begin(winfo.ssid, winfo.passphrase);        // Connect to single SSID found in wifi_xx
+        dbgprint("Try WiFi %s", winfo.ssid);             // Message to show during WiFi connect
       }
-      playMode = SDCARD;
-      encoderMode = IDLING;
-      mp3fileRepeatFlag = NOREPEAT;
-    }
-    if (encoderMode != SELECT) {                          // do nothing if already selecting tracks
-      // we are not in SELECT mode yet 
-      quickSdCheck();                                     // It cleares SD_okay if check is negativ
-      if (SD_mp3fileCount && SD_okay) {                   // mp3-tracks on SD & SD ok ?
-        encoderMode = SELECT;                             // Swich to SELECT mode
-        dbgprint("Encoder mode set to SELECT");
-        tftset(4, "Turn to select directory  or track.\n" // Show current option
-                  "Press to confirm.");
-        enc_nodeIndex = 1;                                // first entry under root (root is 0)
-        enc_dirIndex = 0;                                 // parent dir is root (0)
-        tmp = mp3nodeList[enc_nodeIndex].name;
-        if (mp3nodeList[enc_nodeIndex].isDirectory)
-          tftset(2, tmp);
-        else
-          tftset(1, tmp);
+      else {                                             // More AP to try
+        wifiMulti.run();                                 // Connect to best network
       }
-      else { 
-        // error acessing SD card or re-scan needed
-        encoderMode = IDLING;
-        tryToMountSD = true;
-        //xQueueReset (dataQueue);
-        if (dataMode != STOPPED && dataMode != STOPREQD) {
-          dbgprint("STOP (tryToMountSD = true)");
-          dataMode = STOPREQD;                              // Request STOP
-        }
-        //tftset(1, "");
+      if (WiFi.waitForConnectResult() != WL_CONNECTED) { // Try to connect
+        dbgprint("WiFi Failed! Can't connect. Attempt %d.", ii + 1);
       }
-    }
-    return;
-  }
-  if (buttonStation) {                                      // Handle button requesting Station mode
-    dbgprint("Station mode requested");
-    buttonStation = false;
-    if (playMode != STATION) {
-      tftset(0, "ESP32 Radio");                             // Set screen segment top line
-      //displaytime ("");                                   // Time to be refreshed
-      if (dataMode != STOPPED) {
-        dbgprint("STOP (buttonStation)");
-        dataMode = STOPREQD;                                // Request STOP
+      else {
+        pfs = dbgprint("Connected to %s", WiFi.SSID().c_str());
+        tftlog(pfs);
+        res = true;                                      // Return result of connection
+        break;
       }
-      playMode = STATION;
-      mp3fileRepeatFlag = NOREPEAT;
-      encoderMode = IDLING;                                 // Back to default mode
-      currentPreset = -1;                                   // Make sure current is different
-      //tftset(4, "");                                      // Clear text
-      muteFlag = 30;                                        // ca. 3 sec.
     }
-    return;
-  }
-#ifdef ENABLE_SOAP     
-  if (buttonMediaserver) {                                  // Handle button requesting Mediaserver mode
-    dbgprint("Mediaserver mode requested");
-    buttonMediaserver = false;
-    mp3nodeList.clear();                                    // Free memory space
-    SD_mp3fileCount = 0;
-    if (playMode != MEDIASERVER) {
-      tftset(0, "ESP32 DLNA");                              // Set screen segment top line
-      //displaytime ("");                                   // Time to be refreshed
-      if (dataMode != STOPPED) {
-        dbgprint("STOP (buttonMediaserver)");
-        dataMode = STOPREQD;                                // Request STOP
-        muteFlag = 30;                                      // 3 secs muted
-      }
-      if (playMode == STATION)
-        stopMp3client();                                    // Sockets are sparse, so we need to close it here already
-      playMode = MEDIASERVER;
-      encoderMode = IDLING;
-      mp3fileRepeatFlag = NOREPEAT;
-      xQueueReset(dataQueue);
+    else {
+      dbgprint("WiFi Failed! No SSID/Password defined.");
+      break;
     }
-    if (encoderMode != SELECT) {                            // do nothing if already selecting tracks
-      // we are not in SELECT mode yet 
-      soapChain.clear();
-      soapChain_t tmpId = { .id = "0", .name = "Root", .size = 0, .startingIndex = 0 };
-      soapChain.push_back(tmpId);                           // first entry always represents root = "0"
-      dbgprint("Search in media server container \"0\" (Root)");
-      bool ret = soap.browseServer(0, "0", &soapList);
-      if (ret) {           
-        // browsing root of mediaserver was successful
-        if (soapList.size() > 0) {
-          tftset(4, "Turn to select directory  or track.\n" // Show current option
-                    "Press to confirm.");
-          enc_nodeIndex = 0;                                // first entry on that level 
-        //enc_dirIndex = 0;                                 // parent dir is root (0)
-          tmp = soapList[enc_nodeIndex].name;
-          encoderMode = SELECT;                             // Swich to SELECT mode
-          dbgprint("Encoder mode set to SELECT");
-        }
-        else {
-          encoderMode = IDLING;                             // Swich to SELECT mode
-          tmp = "No media server content !";
-          //tftset(4, "");
-        }
-        if (soapList.size() == 0 || soapList[enc_nodeIndex].isDirectory)
-          tftset(2, tmp);
-        else
-          tftset(1, tmp);
+  }
+  return res;
+}
+
+//**************************************************************************************************
+//                                           O T A S T A R T                                       *
+//**************************************************************************************************
+// Update via WiFi has been started by Arduino IDE.                                                *
+//**************************************************************************************************
+void otastart()
+{
+  char* p;
+
+  p = dbgprint("OTA update Started");
+  tftset(3, p);                                   // Set screen segment bottom part
+}
+#endif  // USE_ETHERNET
+
+//**************************************************************************************************
+//                                  R E A D H O S T F R O M P R E F                                *
+//**************************************************************************************************
+// Read the mp3 host from the preferences specified by the parameter.                              *
+// The host will be returned.                                                                      *
+//**************************************************************************************************
+String readhostfrompref(int8_t preset)
+{
+  char tkey[12];                                   // Key as an array of chars
+
+  sprintf(tkey, "preset_%02d", preset);            // Form the search key
+  if (nvsSearch(tkey)) {                           // Does it exists?
+    // Get the contents
+    return nvsgetstr(tkey);                        // Get the station (or empty string)
+  }
+  else {
+    return String("");                             // Not found
+  }
+}
+
+//**************************************************************************************************
+//                                  R E A D H O S T F R O M P R E F                                *
+//**************************************************************************************************
+// Search for the next mp3 host in preferences specified newpreset.                                *
+// The host will be returned.  newpreset will be updated                                           *
+//**************************************************************************************************
+String readhostfrompref()
+{
+  String contents = "";                                // Result of search
+  int    maxtry = 0;                                   // Limit number of tries
+
+  while ((contents = readhostfrompref (ini_block.newpreset)) == "") {
+    if (++maxtry > 99) {
+      return "";
+    }
+    if (++ini_block.newpreset > 99) {                  // Next or wrap to 0
+      ini_block.newpreset = 0;
+    }
+  }
+  // Get the contents
+  return contents;                                     // return the station
+}
+
+//**************************************************************************************************
+//                             F I N D H I G H E S T P R E S E T                                   *
+//**************************************************************************************************
+// Search for the highest preset_xx number                                                         *
+//**************************************************************************************************
+uint8_t findHighestPreset()
+{
+  uint8_t erg = 0, i = 0;
+
+  while (true) {
+    if (readhostfrompref (i) != "") {
+      erg = i++;
+    }
+    else {
+      break;
+    }
+  }
+  dbgprint("findHighestPreset(): erg = %d", erg);
+  return erg;
+}
+
+//**************************************************************************************************
+//                                       R E A D P R O G B U T T O N S                             *
+//**************************************************************************************************
+// Read the preferences for the programmable input pins and the touch pins.                        *
+//**************************************************************************************************
+#ifdef ENABLE_DIGITAL_INPUTS
+void readProgButtons()
+{
+  char   mykey[20];                                      // For numerated key
+  int8_t pinnr;                                          // GPIO pinnumber to fill
+  int    i;                                              // Loop control
+  String val;                                            // Contents of preference entry
+
+  for (i = 0; (pinnr = progpin[i].gpio) >= 0; i++) {     // Scan for all programmable pins
+    sprintf(mykey, "gpio_%02d", pinnr);                 // Form key in preferences
+    if (nvsSearch(mykey)) {
+      val = nvsgetstr(mykey);                            // Get the contents
+      if (val.length()) {                                // Does it exists?
+        if (!progpin[i].reserved) {                      // Do not use reserved pins
+          progpin[i].avail = true;                       // This one is active now
+          progpin[i].command = val;                      // Set command
+          dbgprint("gpio_%02d will execute %s",          // Show result
+                     pinnr, val.c_str());
+        }
+      }
+    }
+  }
+  // Now for the touch pins 0..9, identified by their GPIO pin number
+  for (i = 0; (pinnr = touchpin[i].gpio) >= 0; i++) {    // Scan for all programmable pins
+    sprintf(mykey, "touch_%02d", pinnr);                 // Form key in preferences
+    if (nvsSearch(mykey)) {
+      val = nvsgetstr(mykey);                            // Get the contents
+      if (val.length()) {                                // Does it exists?
+        if (!touchpin[i].reserved) {                     // Do not use reserved pins
+          touchpin[i].avail = true;                      // This one is active now
+          touchpin[i].command = val;                     // Set command
+          //pinMode (touchpin[i].gpio,  INPUT);          // Free floating input
+          dbgprint("touch_%02d will execute %s",         // Show result
+                   pinnr, val.c_str());
+        }
+        else {
+          dbgprint("touch_%02d pin (GPIO%02d) is reserved for I/O!", pinnr, pinnr);
+        }
+      }
+    }
+  }
+}
+#endif
+
+//**************************************************************************************************
+//                                       R E S E R V E P I N                                       *
+//**************************************************************************************************
+// Set I/O pin to "reserved".                                                                      *
+// The pin is than not available for a programmable function.                                      *
+//**************************************************************************************************
+#ifdef ENABLE_DIGITAL_INPUTS
+void reservepin(int8_t rpinnr)
+{
+  uint8_t i = 0;                                           // Index in progpin/touchpin array
+  int8_t  pin;                                             // Pin number in progpin array
+
+  while ((pin = progpin[i].gpio) >= 0) {                   // Find entry for requested pin
+    if (pin == rpinnr) {                                   // Entry found?
+      //dbgprint("GPIO%02d unavailabe for 'gpio_'-command", pin);
+      progpin[i].reserved = true;                          // Yes, pin is reserved now
+      break;                                               // No need to continue
+    }
+    i++;                                                   // Next entry
+  }
+  // Also reserve touchpin numbers
+  i = 0;
+  while ((pin = touchpin[i].gpio) >= 0) {                  // Find entry for requested pin
+    if (pin == rpinnr) {                                   // Entry found?
+      //dbgprint("GPIO%02d unavailabe for 'touch'-command", pin);
+      touchpin[i].reserved = true;                         // Yes, pin is reserved now
+      break;                                               // No need to continue
+    }
+    i++;                                                   // Next entry
+  }
+}
+#endif
+
+//**************************************************************************************************
+//                                       R E A D I O P R E F S                                     *
+//**************************************************************************************************
+// Scan the preferences for IO-pin definitions and the bus the SD card is on.                      *
+//**************************************************************************************************
+void readIOprefs()
+{
+  struct iosetting
+  {
+    const char* gname;                                   // Name in preferences
+    int8_t*     gnr;                                     // GPIO pin number
+    int8_t      pdefault;                                // Default pin
+  };
+  struct iosetting klist[] = {                           // List of I/O related keys
+#ifdef ENABLE_INFRARED
+    { "pin_ir",       &ini_block.ir_pin,          35 },  // use 35 if needed
+#endif
+    { "pin_enc_clk",  &ini_block.enc_clk_pin,     25 },
+    { "pin_enc_dt",   &ini_block.enc_dt_pin,      26 },
+    { "pin_enc_sw",   &ini_block.enc_sw_pin,      27 },
+    { "pin_tft_cs",   &ini_block.tft_cs_pin,      15 },  // Display SPI version
+    { "pin_tft_dc",   &ini_block.tft_dc_pin,       2 },  // Display SPI version
+    //{ "pin_tft_scl",  &ini_block.tft_scl_pin,     -1 },  // Display I2C version
+    //{ "pin_tft_sda",  &ini_block.tft_sda_pin,     -1 },  // Display I2C version
+    { "pin_sd_cs",    &ini_block.sd_cs_pin,       17 },
+    { "pin_vs_cs",    &ini_block.vs_cs_pin,        5 },
+    { "pin_vs_dcs",   &ini_block.vs_dcs_pin,      16 },
+    { "pin_vs_dreq",  &ini_block.vs_dreq_pin,      4 },
+    { "pin_shutdown", &ini_block.vs_shutdown_pin, -1 },
+    { "pin_spi_sck",  &ini_block.spi_sck_pin,     18 },
+    { "pin_spi_miso", &ini_block.spi_miso_pin,    19 },
+    { "pin_spi_mosi", &ini_block.spi_mosi_pin,    23 },
+    { NULL,           NULL,                        0 }   // End of list
+  };
+  int         i;                                         // Loop control
+  int         count = 0;                                 // Number of keys found
+  String      val;                                       // Contents of preference entry
+  int8_t      ival;                                      // Value converted to integer
+  int8_t*     p;                                         // Points to variable
+
+  for (i = 0; klist[i].gname; i++) {                     // Loop trough all I/O related keys
+    p = klist[i].gnr;                                    // Point to target variable
+    ival = klist[i].pdefault;                            // Assume pin number to be the default
+    if (nvsSearch (klist[i].gname)) {                    // Does it exist?
+      val = nvsgetstr(klist[i].gname);                   // Read value of key
+      if (val.length()) {                                // Parameter in preference?
+        count++;                                         // Yes, count number of filled keys
+        ival = val.toInt();                              // Convert value to integer pinnumber
+      }
+    }
+#ifdef ENABLE_DIGITAL_INPUTS        
+    reservepin(ival);                                    // Set pin to "reserved"
+#endif        
+    *p = ival;                                           // Set pinnumber in ini_block
+    dbgprint("%s set to %d", klist[i].gname, ival);      // Show result
+  }
+#ifdef SD_MMC_BUS
+  if (nvsSearch("sd_mmc")) {                             // SD card on SD/MMC bus?
+    ival = nvsgetstr("sd_mmc").toInt();
+    sdMmc = (ival == 1 || ival == 4) ? ival : 0;         // Bus width, 0 = SPI bus
+  }
+  if (sdMmc) {
+#ifdef ENABLE_DIGITAL_INPUTS
+    const int8_t mmcpins[] = { 14, 15, 2, 4, 12, 13 };   // CLK, CMD, D0..D3
+    for (i = 0; i < ((sdMmc == 1) ? 3 : 6); i++) {
+      reservepin(mmcpins[i]);                            // Set pin to "reserved"
+    }
+#endif
+    dbgprint("sd_mmc set to %d", sdMmc);                 // SD card not on SPI bus
+  }
+#endif
+}
+
+//**************************************************************************************************
+//                                       R E A D P R E F S                                         *
+//**************************************************************************************************
+// Read the preferences and interpret the commands.                                                *
+// If output == true, the key / value pairs are returned to the caller as a String.                *
+//**************************************************************************************************
+String readPrefs(bool output)
+{
+  HEAP_TAG("readPrefs");
+  uint16_t    i;                                           // Loop control
+  String      val;                                         // Contents of preference entry
+  String      cmd;                                         // Command for analyzCmd
+  String      outstr = "";                                 // Outputstring
+  char*       key;                                         // Point to nvskeys[i]
+  uint8_t     winx;                                        // Index in wifilist
+  uint16_t    last2char = 0;                               // To detect paragraphs
+
+  i = 0;
+  while (*(key = nvskeys[i])) {                            // Loop trough all available keys
+    val = nvsgetstr(key);                                  // Read value of this key
+    cmd = String(key) +                                    // Yes, form command
+          String(" = ") +
+          val;
+    if (strstr(key, "wifi_")) {                            // Is it a wifi ssid/password?
+      if ((winx = val.indexOf("/")) > 0) {
+        val.remove(winx + 1);
+        val +=  String("*******");                         // Yes, hide password
+      }
+      cmd = String("");                                    // Do not analyze this
+    }
+    if (output) {
+      if ((i > 0) &&
+          (*(uint16_t*)key != last2char)) {                // New paragraph?
+        outstr += String("#\n");                           // Yes, add separator
+      }
+      last2char = *(uint16_t*)key;                         // Save 2 chars for next compare
+      outstr += String(key) +                              // Add to outstr
+                String(" = ") +
+                val +
+                String("\n");                              // Add newline
+    }
+    else {
+      analyzeCmd(cmd.c_str());                             // Analyze it
+    }
+    i++;                                                   // Next key
+  }
+  if (i == 0) {
+    outstr = String("No preferences found.\n"
+                    "Use defaults or run Esp32_radio_init first.\n");
+  }
+  return outstr;
+}
+
+//**************************************************************************************************
+//                                     S C A N S E R I A L                                         *
+//**************************************************************************************************
+// Listen to commands on the Serial inputline.                                                     *
+//**************************************************************************************************
+void scanserial()
+{
+  static String serialcmd;                        // Command from Serial input
+  //char          c;                              // Input character
+  //const char*   reply;                          // Reply string froma analyzeCmd
+  //uint16_t      len;                            // Length of input string
+
+  while (Serial.available()) {                    // Any input seen?
+    /*c =  (char)*/Serial.read();                 // Yes, read the next input character
+    // TEST
+    //Serial.write(c);                            // Echo
+    /* 
+      len = serialcmd.length();                   // Get the length of the current string
+      if ((c == '\n') || (c == '\r')) {
+        if (len) {
+          strncpy(cmd, serialcmd.c_str(), sizeof(cmd));
+          reply = analyzeCmd(cmd);                // Analyze command and handle it
+          dbgprint(reply);                        // Result for debugging
+          serialcmd = "";                         // Prepare for new command
+        }
+      }
+      if (c >= ' ') {                             // Only accept useful characters
+        serialcmd += c;                           // Add to the command
+      }
+      if (len >= (sizeof(cmd) - 2)) {             // Check for excessive length
+        serialcmd = "";                           // Too long, reset
+      }
+    */
+  }
+}
+
+//**************************************************************************************************
+//                                     S C A N D I G I T A L                                       *
+//**************************************************************************************************
+// Scan digital inputs.                                                                            *
+//**************************************************************************************************
+#ifdef ENABLE_DIGITAL_INPUTS
+void  scandigital()
+{
+  static uint32_t oldmillis = 5000;                        // To compare with current time
+  int             i;                                       // Loop control
+  int8_t          pinnr;                                   // Pin number to check
+  bool            level;                                   // Input level
+  const char*     reply;                                   // Result of analyzeCmd
+  int16_t         tlevel;                                  // Level found by touch pin
+  const int16_t   THRESHOLD = 30;                          // Threshold or touch pins
+
+  if ((millis() - oldmillis) < 100) {                      // Debounce
+    return;
+  }
+  oldmillis = millis();                                    // 100 msec over
+  for (i = 0; (pinnr = progpin[i].gpio) >= 0; i++) {       // Scan all inputs
+    if (!progpin[i].avail || progpin[i].reserved) {        // Skip unused and reserved pins
+      continue;
+    }
+    level = (digitalRead(pinnr) == HIGH);                  // Sample the pin
+    if (level != progpin[i].cur) {                         // Change seen?
+      progpin[i].cur = level;                              // And the new level
+      if (!level) {                                        // HIGH to LOW change?
+        dbgprint("GPIO_%02d is now LOW, execute %s",
+                   pinnr, progpin[i].command.c_str());
+        reply = analyzeCmd(progpin[i].command.c_str());    // Analyze command and handle it
+        dbgprint(reply);                                   // Result for debugging
+      }
+    }
+  }
+  // Now for the touch pins
+  for (i = 0; (pinnr = touchpin[i].gpio) >= 0; i++) {      // Scan all inputs
+    if (!touchpin[i].avail || touchpin[i].reserved) {      // Skip unused and reserved pins
+      continue;
+    }
+    tlevel = (touchRead(pinnr));                           // Sample the pin
+    level = (tlevel >= 30);                                // True if below threshold
+    if (level) {                                           // Level HIGH?
+      touchpin[i].count = 0;                               // Reset count number of times
+    }
+    else {
+      if (++touchpin[i].count < 3) {                       // Count number of times LOW
+        level = true;                                      // Not long enough: handle as HIGH
+      }
+    }
+    if (level != touchpin[i].cur) {                        // Change seen?
+      touchpin[i].cur = level;                             // And the new level
+      if (!level) {                                        // HIGH to LOW change?
+        dbgprint("TOUCH_%02d is now %d (< %d), execute %s",
+                   pinnr, tlevel, THRESHOLD,
+                   touchpin[i].command.c_str());
+        reply = analyzeCmd(touchpin[i].command.c_str());   // Analyze command and handle it
+        dbgprint(reply);                                   // Result for debugging
+      }
+    }
+  }
+}
+#endif
+
+#ifdef ENABLE_INFRARED
+//**************************************************************************************************
+//                                     S C A N I R                                                 *
+//**************************************************************************************************
+// See if IR input is available.  Execute the programmed command.                                  *
+//**************************************************************************************************
+void scanIR()
+{
+  char        mykey[20];                                   // For numerated key
+  String      val;                                         // Contents of preference entry
+  const char* reply;                                       // Result of analyzeCmd
+
+  if (ir_value) {                                          // Any input?
+    sprintf(mykey, "ir_%04X", ir_value);                   // Form key in preferences
+    if (nvsSearch (mykey)) {
+      val = nvsgetstr(mykey);                              // Get the contents
+      dbgprint("IR code %04X received. Will execute %s",
+                 ir_value, val.c_str());
+      reply = analyzeCmd(val.c_str());                     // Analyze command and handle it
+      dbgprint(reply);                                     // Result for debugging
+    }
+    else {
+      dbgprint("IR code %04X received, but not found in preferences! Timing %d/%d",
+               ir_value, ir_0, ir_1);
+    }
+    ir_value = 0;                                          // Reset IR code received
+  }
+}
+#endif
+
+#ifndef USE_ETHERNET
+//**************************************************************************************************
+//                                           M K _ L S A N                                         *
+//**************************************************************************************************
+// Make al list of acceptable networks in preferences.                                             *
+// Will be called only once by setup().                                                            *
+// The result will be stored in wifilist.                                                          *
+// Not that the last found SSID and password are kept in common data.  If only one SSID is         *
+// defined, the connect is made without using wifiMulti.  In this case a connection will           *
+// be made even if the SSID is hidden.                                                             *
+//**************************************************************************************************
+void  mk_lsan()
+{
+  uint8_t     i;                                        // Loop control
+  char        key[10];                                  // For example: "wifi_03"
+  String      buf;                                      // "SSID/password"
+  String      lssid, lpw;                               // Last read SSID and password from nvs
+  int         inx;                                      // Place of "/"
+  WifiInfo_t  winfo;                                    // Element to store in list
+
+  dbgprint("Create list with acceptable WiFi networks");
+  for (i = 0; i < 100; i++) {                           // Examine wifi_00 .. wifi_99
+    sprintf(key, "wifi_%02d", i);                       // Form key in preferences
+    if (nvsSearch(key)) {                               // Does it exists?
+      buf = nvsgetstr(key);                             // Get the contents
+      inx = buf.indexOf("/");                           // Find separator between ssid and password
+      if (inx > 0) {                                    // Separator found?
+        lpw = buf.substring(inx + 1);                   // Isolate password
+        lssid = buf.substring(0, inx);                  // Holds SSID now
+        dbgprint("Added %s to list of networks", lssid.c_str());
+        winfo.inx = i;                                  // Create new element for wifilist;
+        winfo.ssid = strdup(lssid.c_str());             // Set ssid of element
+        winfo.passphrase = strdup(lpw.c_str());
+        // fall back
+        if (strcmp(winfo.ssid, "MySSID") == 0 &&
+            *winfo.passphrase == '*') {
+          winfo.passphrase = strdup("MyPassword");
+        }
+        wifilist.push_back(winfo);                      // Add to list
+        wifiMulti.addAP(winfo.ssid, winfo.passphrase);  // Add to wifi acceptable network list
+      }
+    }
+  }
+  dbgprint("End adding networks"); ////
+}
+#endif  // USE_ETHERNET
+
+//**************************************************************************************************
+//                                 C H K _ S T A T I C I P S                                       *
+//**************************************************************************************************
+// Check if we are supposed to use DHCP or fixed IPs, found in preferences                         *
+//                                                                                                 *
+//**************************************************************************************************
+void chk_staticIPs()
+{
+  String    buf;                                     // contains value of key
+  //const char* p;
+  IPAddress addr;
+
+  dbgprint("Search for local IP in preferences");
+  if (nvsSearch("ip")) {                             // Does it exists?
+    buf = nvsgetstr("ip");                           // Get the contents
+    if (addr.fromString(buf.c_str())) {
+      local_IP = addr;
+      if (!dhcpRequested) staticIPs = true;          // dhcpRequested is only true when rotary encoder is pressed while booting
+      dbgprint("Prefs: ip = %s", buf.c_str());
+    }
+  }
+  if (nvsSearch("ip_dns")) {                         // Does it exists?
+    buf = nvsgetstr("ip_dns");                       // Get the contents
+    if (addr.fromString(buf.c_str())) {
+      primaryDNS = addr;
+      dbgprint("Prefs: ip_dns = %s", buf.c_str());
+    }
+  }
+  if (nvsSearch("ip_gateway")) {                     // Does it exists?
+    buf = nvsgetstr("ip_gateway");                   // Get the contents
+    if (addr.fromString(buf.c_str())) {
+      gateway = addr;
+      dbgprint("Prefs: ip_gateway = %s", buf.c_str());
+    }
+  }
+  if (nvsSearch("ip_subnet")) {                      // Does it exists?
+    buf = nvsgetstr("ip_subnet");                    // Get the contents
+    if (addr.fromString(buf.c_str())) {
+      subnet = addr;
+      dbgprint("Prefs: ip_subnet = %s", buf.c_str());
+    }
+  }
+}
+
+#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
+//**************************************************************************************************
+//                                     G E T R A D I O S T A T U S                                 *
+//**************************************************************************************************
+// Return preset-, tone- and volume status.                                                        *
+// Included are the presets, the current station, the volume and the tone settings.                *
+//**************************************************************************************************
+String getradiostatus()
+{
+  HEAP_TAG("radiostatus");
+  char pnr[3];                                         // Preset as 2 character, i.e. "03"
+
+  sprintf(pnr, "%02d", ini_block.newpreset);           // Current preset
+  return String("preset=") +                           // Add preset setting
+         String(pnr) +
+         //         String("\nvolume=") +                        // Add volume setting
+         //         String(String(ini_block.reqvol)) +
+         String("\ntoneha=") +                         // Add tone setting HA
+         String(ini_block.rtone[0]) +
+         String("\ntonehf=") +                         // Add tone setting HF
+         String(ini_block.rtone[1]) +
+         String("\ntonela=") +                         // Add tone setting LA
+         String(ini_block.rtone[2]) +
+         String("\ntonelf=") +                         // Add tone setting LF
+         String(ini_block.rtone[3]);
+}
+
+//**************************************************************************************************
+//                                     G E T S E T T I N G S                                       *
+//**************************************************************************************************
+// Send some settings to the webserver.                                                            *
+// Included are the presets, the current station, the volume and the tone settings.                *
+//**************************************************************************************************
+void getsettings()
+{
+  HEAP_TAG("getsettings");
+  String val;                                         // Result to send
+  String statstr;                                     // Station string
+  int    inx;                                         // Position of search char in line
+  int    i;                                           // Loop control, preset number
+  char   tkey[12];                                    // Key for preset preference
+
+  for (i = 0; i < 100; i++) {                         // Max 99 presets
+    sprintf(tkey, "preset_%02d", i);                  // Preset plus number
+    if (nvsSearch(tkey)) {                            // Does it exists?
+      // Get the contents
+      statstr = nvsgetstr(tkey);                      // Get the station
+      // Show just comment if available.  Otherwise the preset itself.
+      inx = statstr.indexOf("#");                     // Get position of "#"
+      if (inx > 0) {                                  // Hash sign present?
+        statstr.remove(0, inx + 1);                   // Yes, remove non-comment part
+      }
+      chomp(statstr);                                 // Remove garbage from description
+      val += String(tkey) +
+             String("=") +
+             statstr +
+             String("\n");                            // Add delimeter
+      if (val.length() > 1000) {                      // Time to flush?
+        _claimSPI("getsettings1");                    // claim SPI bus
+        cmdclient.print(val);                         // Yes, send
+        _releaseSPI();                                // release SPI bus
+        val = "";                                     // Start new string
+      }
+    }
+  }
+  val += getradiostatus() +                           // Add radio setting
+         String("\n\n");                             // End of reply
+  _claimSPI("getsettings2");                          // claim SPI bus
+  cmdclient.print(val);                               // And send
+  _releaseSPI();                                      // release SPI bus
+}
+#endif
+
+//**************************************************************************************************
+//                                           T F T L O G                                           *
+//**************************************************************************************************
+// Log to TFT if enabled.                                                                          *
+//**************************************************************************************************
+void tftlog(const char *str, uint16_t textColor)
+{
+  if (tft) {                                           // TFT configured?
+    if (textColor != (WHITE)) dsp_setTextColor(textColor);
+    dsp_println(str);                                  // Yes, show info on TFT
+    dsp_update();                                      // To physical screen
+    if (textColor != (WHITE)) dsp_setTextColor(WHITE);
+  }
+}
+
+//**************************************************************************************************
+//                                   F I N D N S I D                                               *
+//**************************************************************************************************
+// Find the namespace ID for the namespace passed as parameter.                                    *
+//**************************************************************************************************
+uint8_t FindNsID (const char* ns)
+{
+  esp_err_t                 result = ESP_OK;                 // Result of reading partition
+  uint32_t                  offset = 0;                      // Offset in nvs partition
+  uint8_t                   i;                               // Index in Entry 0..125
+  uint8_t                   bm;                              // Bitmap for an entry
+  uint8_t                   res = 0xFF;                      // Function result
+
+  while (offset < nvs->size)
+  {
+    result = esp_partition_read(nvs, offset,                 // Read 1 page in nvs partition
+                                &nvsbuf,
+                                sizeof(nvsbuf));
+    if (result != ESP_OK) {
+      dbgprint("Error reading NVS!");
+      break;
+    }
+    i = 0;
+    while (i < 126) {
+      bm = (nvsbuf.Bitmap[i / 4] >> ((i % 4) * 2));          // Get bitmap for this entry,
+      bm &= 0x03;                                            // 2 bits for one entry
+      if ((bm == 2) &&
+          (nvsbuf.Entry[i].Ns == 0) &&
+          (strcmp (ns, nvsbuf.Entry[i].Key) == 0)) {
+        res = nvsbuf.Entry[i].Data & 0xFF;                   // Return the ID
+        offset = nvs->size;                                  // Stop outer loop as well
+        break;
+      }
+      else {
+        if (bm == 2) {
+          i += nvsbuf.Entry[i].Span;                         // Next entry
+        }
+        else {
+          i++;
+        }
+      }
+    }
+    offset += sizeof(nvs_page);                              // Prepare to read next page in nvs
+  }
+  return res;
+}
+
+//**************************************************************************************************
+//                            B U B B L E S O R T K E Y S                                          *
+//**************************************************************************************************
+// Bubblesort the nvskeys.                                                                         *
+//**************************************************************************************************
+void bubbleSortKeys(uint16_t n)
+{
+  uint16_t i, j;                                             // Indexes in nvskeys
+  char     tmpstr[16];                                       // Temp. storage for a key
+
+  for (i = 0; i < n - 1; i++) {                              // Examine all keys
+    for (j = 0; j < n - i - 1; j++) {                        // Compare to following keys
+      if (strcmp(nvskeys[j], nvskeys[j + 1]) > 0) {          // Next key out of order?
+        strcpy(tmpstr, nvskeys[j]);                          // Save current key a while
+        strcpy(nvskeys[j], nvskeys[j + 1]);                  // Replace current with next key
+        strcpy(nvskeys[j + 1], tmpstr);                      // Replace next with saved current
+      }
+    }
+  }
+}
+
+//**************************************************************************************************
+//                                      F I L L K E Y L I S T                                      *
+//**************************************************************************************************
+// File the list of all relevant keys in NVS.                                                      *
+// The keys will be sorted.                                                                        *
+//**************************************************************************************************
+void fillkeylist()
+{
+  esp_err_t result = ESP_OK;                                   // Result of reading partition
+  uint32_t  offset = 0;                                        // Offset in nvs partition
+  uint16_t  i;                                                 // Index in Entry 0..125.
+  uint8_t   bm;                                                // Bitmap for an entry
+  uint16_t  nvsinx = 0;                                        // Index in nvskey table
+
+  keynames.clear();                                            // Clear the list
+  while (offset < nvs->size) {
+    result = esp_partition_read(nvs, offset,                   // Read 1 page in nvs partition
+                                &nvsbuf,
+                                sizeof(nvsbuf));
+    if (result != ESP_OK) {
+      dbgprint("Error reading NVS!");
+      break;
+    }
+    i = 0;
+    while (i < 126) {
+      bm = (nvsbuf.Bitmap[i / 4] >> ((i % 4) * 2));            // Get bitmap for this entry,
+      bm &= 0x03;                                              // 2 bits for one entry
+      if (bm == 2) {                                           // Entry is active?
+        if (nvsbuf.Entry[i].Ns == namespaceID) {               // Namespace right?
+          strcpy (nvskeys[nvsinx], nvsbuf.Entry[i].Key);       // Yes, save in table
+          if (++nvsinx == MAXKEYS) {
+            nvsinx--;                                          // Prevent excessive index
+          }
+        }
+        i += nvsbuf.Entry[i].Span;                             // Next entry
+      }
+      else {
+        i++;
+      }
+    }
+    offset += sizeof(nvs_page);                                // Prepare to read next page in nvs
+  }
+  nvskeys[nvsinx][0] = '\0';                                   // Empty key at the end
+  dbgprint("Read %d keys from NVS", nvsinx);
+  bubbleSortKeys(nvsinx);                                      // Sort the keys
+}
+
+#ifdef USE_ETHERNET
+//**************************************************************************************************
+//                                    I N I T E T H E R N E T                                      *
+//**************************************************************************************************
+// Initialization routine in case we use Ethernet card (W5500)                                     *
+//**************************************************************************************************
+void initEthernet(bool tftOutput)
+{
+  const char* p;
+
+  dbgprint("initEthernet(%s)", tftOutput ? "true" : "false");
+  Ethernet.init(22);                                      // SPI bus not needed here
+  if (tftOutput) tftlog("Connect to Ethernet/LAN");       // on TFT too
+  delay(100);
+  if (!staticIPs) {                                       // try DHCP if requested
+    dbgprint("We try to obtain IP addresses via DHCP");
+    _claimSPI("initEth1");                                // claim SPI bus
+    int result = Ethernet.begin(mac);
+    _releaseSPI();                                        // release SPI bus
+    if (result == 0) {
+      dbgprint("Failed to configure Ethernet via DHCP --> We use static IPs instead !");
+      staticIPs = true;
+    }  
+  }
+  if (staticIPs) {
+    _claimSPI("initEth1");                                // claim SPI bus
+    Ethernet.begin(mac, local_IP, primaryDNS, gateway, subnet);
+    _releaseSPI();                                        // release SPI bus
+  }
+  //Ethernet.setRetransmissionTimeout(300);                // experimental
+  //Ethernet.setRetransmissionCount(4);                    // experimental
+  _claimSPI("initEth1");                                  // claim SPI bus
+  lstat = Ethernet.linkStatus();
+  _releaseSPI();                                          // release SPI bus
+  p = dbgprint("Ethernet link status: %s", lstat == LinkON ? "up" : "down");
+  if (tftOutput) {
+    tftlog(p, lstat == LinkOFF ? RED : WHITE);
+  }  
+  delay(100);
+  _claimSPI("initEth2");                                  // claim SPI bus
+  IPAddress Ip = Ethernet.localIP();
+  IPAddress Gw = Ethernet.gatewayIP();
+  IPAddress Sm = Ethernet.subnetMask();
+  IPAddress Dn = Ethernet.dnsServerIP();
+  _releaseSPI();                                          // release SPI bus
+
+  p = dbgprint("Local IP = %s", Ip.toString().c_str());
+  if (tftOutput) tftlog(p);                               // On TFT too
+  dbgprint("Gateway = %s, Subnet Mask = %s, DNS = %s",
+           Gw.toString().c_str(), Sm.toString().c_str(), Dn.toString().c_str());
+
+}
+#endif
+
+#ifdef SD_UPDATES
+//**************************************************************************************************
+//                                 C H E C K F O R S D U P D A T E                                 *
+//**************************************************************************************************
+// If SD card exists and contains update file "firmware.bin" then perform program update           *
+//**************************************************************************************************
+void checkForSDUpdate()
+{
+  const char *p;
+
+  if (!sdConfigured()) return;                               // SD configured ?
+  if (!sdBegin()) return;                                    // SD found ?
+  if (sdCardType() != CARD_NONE) {                           // SD type ok ?
+    dbgprint("Found SD-Card. Update file on SD-Card ???");
+    File myUpdateFile = sdfs->open(UPDATE_FILE_NAME);
+    if (myUpdateFile) {
+      dbgprint("Ok. Found entry with name %s", UPDATE_FILE_NAME);
+      size_t updateSize = myUpdateFile.size();
+      bool isDir = myUpdateFile.isDirectory();
+      if (isDir || 0 == updateSize) {
+        dbgprint("Error: %s is a directory or file is empty. We remove it.", UPDATE_FILE_NAME);
+        myUpdateFile.close();
+        if (isDir) sdfs->rmdir(UPDATE_FILE_NAME);            // No reason to keep it
+        else sdfs->remove(UPDATE_FILE_NAME);
+        sdEnd();
+        return;
+      }
+      // check if SD-Card is writable (to prevent a loop when trying to delete firmware.bin)
+      dbgprint("Test writability of SD card");
+      File myTestFile = sdfs->open(TEST_FILE_NAME, FILE_WRITE);
+      if (myTestFile) {
+        myTestFile.close();
+        if (sdfs->exists(TEST_FILE_NAME)) {
+          sdfs->remove(TEST_FILE_NAME);
+          if (sdfs->exists(TEST_FILE_NAME)) {
+            dbgprint("Error deleting test file. Abort update.");
+          }
+          else {
+            dbgprint("Ok. SD-Card is writable. Continue with update."); // Thats requirement for deleting upgrade file afterwards!
+                                                                        // Otherwise we run into a neverending update loop...
+            goto START_UPDATE;
+          }
+        }    
+      }
+      myUpdateFile.close();
+      sdEnd();
+      return;
+
+      // all ok for update
+START_UPDATE:
+      dbgprint("Starting firmware update...");
+      tftlog("Found update file on SD.", GREEN);
+      tftlog("Please wait...", GREEN);
+      if (Update.begin(updateSize)) {  
+        size_t written = Update.writeStream(myUpdateFile);
+        if (written == updateSize) {
+          dbgprint("All %d bytes written successfully.", written);
+        }
+        else {
+          dbgprint("Error: Only %d/%d bytes written.", written, updateSize);
+          tftlog("Error writing to flash.", RED);
+        }
+        if (Update.end()) {
+          if (Update.isFinished()) {
+            dbgprint("OTA FIRMWARE UPDATE COMPLETED SUCCESSFULLY.");
+            tftlog("OTA update completed OK", GREEN);
+          }
+          else {
+            p = dbgprint("OTA update error.");
+            tftlog(p, RED);
+          }
+        }
+        else {
+          p = dbgprint("OTA update error: %d.", Update.getError());
+          tftlog(p, RED);
+        }
+      }
+      else {
+        p = dbgprint("Error: No space for OTA!");
+        tftlog(p, RED);
+      }
+      myUpdateFile.close();
+      // we finished, now remove the binary from SD card to prevent update loop
+      sdfs->remove(UPDATE_FILE_NAME);
+      delay(100);
+      if (sdfs->exists(UPDATE_FILE_NAME)) {
+        dbgprint("Error: Couldn't delete update file on SD.");
+        tftlog("Error deleting file.", RED); 
+      }
+      else {  
+        dbgprint("Update file on SD successfully deleted.");
+        tftlog("Update file deleted.", GREEN);
+      }  
+      sdEnd();
+      delay(4000);
+      dsp_erase();
+      dsp_setTextSize(2);                                    // Bigger character font
+      dsp_setTextColor(RED);                                 // Info in red
+      dsp_setCursor(12, 55);                                 // Middle of screen
+      dsp_print("SW-Reboot !");
+      dbgprint("System will restart in 3 seconds.\n\n"); 
+      delay(3000);
+      ESP.restart();   
+    }
+    else {
+      p = dbgprint("No update file on SD card.");
+      tftlog(p); 
+    }
+  }
+  sdEnd();
+}
+#endif
+
+//**************************************************************************************************
+//                                           S E T U P                                             *
+//**************************************************************************************************
+// Setup for the program.                                                                          *
+//**************************************************************************************************
+void setup()
+{
+  char                      tmpstr[20];                 // for version and Mac address
+  const char               *partname = "nvs";           // Partition with NVS info
+  esp_partition_iterator_t  pi;                         // Iterator for find
+  const char               *wvn = "Include file %s_html has the wrong version number!"
+                                  "Replace header file.";
+#if !defined(USE_ETHERNET) || defined(ENABLE_DIGITAL_INPUTS)                                  
+  char                     *p;       
+#endif                             
+
+  vTaskDelay(10 / portTICK_PERIOD_MS);                  // Pause for a short time
+  Serial.begin(115200);                                 // For debug
+  Serial.println();
+  btStop();
+  // Version tests for some vital include files
+  if (about_html_version   < 210201) dbgprint(wvn, "about");
+  if (config_html_version  < 210201) dbgprint(wvn, "config");
+  if (index_html_version   < 210201) dbgprint(wvn, "index");
+  if (mp3play_html_version < 210201) dbgprint(wvn, "mp3play");
+  if (defaultprefs_version < 210201) dbgprint(wvn, "defaultprefs");
+  // print some memory and sketch info
+  dbgprint("Starting ESP32-radio running on CPU %d at %d MHz. Version %s. Total free memory %d Bytes.",
+             xPortGetCoreID(),
+             ESP.getCpuFreqMHz(),
+             VERSION,
+             ESP.getFreeHeap());                        // normally > 170 kB
+  mainTask = xTaskGetCurrentTaskHandle();               // my taskhandle
+  SPIsem = xSemaphoreCreateMutex();                     // Semaphore for SPI bus
+  SDsem = xSemaphoreCreateMutex();                      // Semaphore for SD card on SD/MMC bus
+#ifdef FRONT_PANEL_BUTTONS
+  I2Csem = xSemaphoreCreateMutex();                     // Semaphore for port extenders on I2C bus
+#endif
+  pi = esp_partition_find(ESP_PARTITION_TYPE_DATA,      // Get partition iterator for
+                          ESP_PARTITION_SUBTYPE_ANY,    // the NVS partition
+                          partname);
+  if (pi) {
+    nvs = esp_partition_get (pi);                       // Get partition struct
+    esp_partition_iterator_release (pi);                // Release the iterator
+    dbgprint("Partition %s found, %d bytes", partname, nvs->size);
+  }
+  else {
+    dbgprint("Partition %s not found!", partname);      // Very unlikely...
+    while (true);                                       // Impossible to continue
+  }
+  namespaceID = FindNsID(NAME);                         // Find ID of our namespace in NVS
+  fillkeylist();                                        // Fill keynames with all keys
+  memset(&ini_block, 0, sizeof(ini_block));             // Init ini_block
+  ini_block.clk_server = NTP_SERVER_DEFAULT;            // Default server for NTP
+#ifdef USE_ETHERNET
+  ini_block.clk_tzstring = NTP_TZ_STRING_DEFAULT;       // Default TZ string
+#else
+  ini_block.clk_offset = 1;                             // Default MEZ time zone
+  ini_block.clk_dst = 1;                                // DST is +1 hour
+#endif
+  ini_block.reqvol = 92;                                // initial value, can be overridden by prefs
+#ifdef ENABLE_SOAP
+  ini_block.srv_macWOL = MEDIASERVER_DEFAULT_MAC;
+  ini_block.srv_ip = IPAddress(MEDIASERVER_DEFAULT_IP);
+  ini_block.srv_port = MEDIASERVER_DEFAULT_PORT;
+  ini_block.srv_controlUrl = MEDIASERVER_DEFAULT_CONTROL_URL;
+#endif
+  readIOprefs();                                        // read pins used for SPI, TFT, VS1053, IR, Rotary encoder
+#ifdef ENABLE_DIGITAL_INPUTS  
+  int i, pinnr;
+  for (i = 0; (pinnr = progpin[i].gpio) >= 0; i++) {    // Check programmable input pins
+    pinMode(pinnr, INPUT_PULLUP);                       // Input for control button
+    delay(10);
+    // Check if pull-up active
+    if ((progpin[i].cur = digitalRead(pinnr)) == HIGH) {
+      p = "HIGH";
+    }
+    else {
+      p = "LOW, probably no PULL-UP";                   // No Pull-up
+    }
+    dbgprint("GPIO%d is %s", pinnr, p);
+  }
+  readProgButtons();                                    // Program the free input pins
+#endif  
+  if (ini_block.enc_sw_pin >= 0) {
+    if (digitalRead(ini_block.enc_sw_pin) == LOW) {
+      dhcpRequested = true;
+      dbgprint("Rotary encoder switch is LOW -> we use DHCP");
+    }
+  }
+  SPI.begin(ini_block.spi_sck_pin,                      // Init VSPI bus with default or modified pins
+            ini_block.spi_miso_pin,
+            ini_block.spi_mosi_pin);
+  vs1053player = new VS1053(ini_block.vs_cs_pin,        // Make instance of player
+                            ini_block.vs_dcs_pin,
+                            ini_block.vs_dreq_pin,
+                            ini_block.vs_shutdown_pin);
+#ifdef ENABLE_INFRARED
+  if (ini_block.ir_pin >= 0) {
+    dbgprint("Enable pin %d for IR", ini_block.ir_pin);
+    pinMode(ini_block.ir_pin, INPUT);                   // Pin for IR receiver VS1838B
+    attachInterrupt(ini_block.ir_pin, isr_IR, CHANGE);  // Interrupts will be handle by isr_IR                 
+  }
+#endif
+  if (ini_block.tft_cs_pin >= 0 ) {                    // TFT Display configured?
+    dbgprint("Start display");
+    if (dsp_begin()) {                                 // Init display
+      dsp_setRotation();                               // Use landscape format
+      dsp_erase();                                     // Clear screen
+      dsp_setTextSize(1);                              // Small character font
+      dsp_setTextColor(WHITE);                         // Info in white
+      dsp_setCursor(0, 0);                             // Top of screen
+      dsp_print("Starting..." "\n" "Version:");
+      strncpy(tmpstr, VERSION, 18);                    // Limit version length
+      tmpstr[18] = 0;
+      dsp_println(tmpstr);
+      dsp_update();                                    // Show on physical screen
+    }
+  }
+#ifdef SD_UPDATES
+  checkForSDUpdate();
+#endif
+  /* SD-Card will be scanned when SD button is pressed by user for first time.
+   * We mostly want to listen to internet radio after switching on the device and
+   * always waiting for the time consuming SD-scan to be finished really sucks
+
+  if (sdConfigured()) {                                // SD configured?
+    currentIndex = -1;
+    if (!sdBegin()) {                                  // Yes, try to init SD card driver
+      p = dbgprint("SD Card Mount Failed!");           // No success, check formatting (FAT)
+      tftlog(p);                                       // Show error on TFT as well
+    }
+    else {
+      SD_okay = (sdCardType() != CARD_NONE);           // See if known card
+      if (!SD_okay) {
+        p = dbgprint("No SD card attached");           // Card not readable
+        tftlog(p);                                     // Show error on TFT as well
+      }
+      else {
+        dbgprint("Locate mp3 files on SD, may take a while...");
+        tftlog("Read SD card");
+        SD_mp3fileCount = listsdtracks("/", 0, true);  // Build file list
+        p = dbgprint("%d mp3 tracks on SD", SD_mp3fileCount);
+        tftlog(p);                                     // Show number of tracks on TFT
+      }
+    }
+  }*/
+  chk_staticIPs();
+  tftlog (staticIPs ? "We use static IPs" : "We try DHCP first");
+#ifndef USE_ETHERNET
+  mk_lsan();                                            // Make a list of acceptable networks
+  // in preferences
+  if (staticIPs && !WiFi.config(local_IP, gateway, subnet, primaryDNS, secondaryDNS)) {
+    dbgprint("Wifi failed to configure static IPs");
+  }
+  WiFi.mode(WIFI_STA);                                 // This ESP is a station
+  WiFi.persistent(false);                              // Do not save SSID and password
+  WiFi.disconnect();                                   // After restart router could still
+  delay(100);                                          // keep old connection
+  listNetworks();                                      // Search for WiFi networks
+  tcpip_adapter_set_hostname(TCPIP_ADAPTER_IF_STA, NAME);
+  p = dbgprint("Connect to WiFi");                     // Show progress
+  tftlog(p);                                           // On TFT too
+  delay(100);
+  NetworkFound = connectwifi();
+  if (NetworkFound) {                                  // Connect to WiFi network
+    p = dbgprint("Local IP = %s", WiFi.localIP().toString().c_str());     // String to dispay on TFT
+    tftlog(p);                                         // Show IP
+    dbgprint("Gateway = %s, DNS #1 = %s, DNS #2 = %s",
+             WiFi.gatewayIP().toString().c_str(), WiFi.dnsIP().toString().c_str(), WiFi.dnsIP(1).toString().c_str());
+  }
+  else {
+    p = dbgprint("No Network found !");                // String to dispay on TFT
+    tftlog(p);                                         // Show IP
+  }
+  delay(3000);                                         // Allow user to read this
+#else   // Use Ethernet
+  WiFi.mode(WIFI_OFF);
+  initEthernet(true);
+  NetworkFound = true;
+#endif
+  readPrefs(false);                                    // read preferences
+#ifdef POWER_SAVE
+  pmBegin();                                           // clock scaling with "pm_xxx" settings
+#endif
+#ifdef ENABLE_SOAP
+  dbgprint("Media server settings: mac=\"%s\", ip=%s, port=%d, controlUrl=\"%s\"", 
+           ini_block.srv_macWOL.c_str(), ini_block.srv_ip.toString().c_str(), ini_block.srv_port, ini_block.srv_controlUrl.c_str());
+  soap.addServer(ini_block.srv_ip, ini_block.srv_port, ini_block.srv_controlUrl.c_str(), "Media Server");         
+#endif
+  highestPreset = findHighestPreset();
+  vs1053player->begin();                               // initialize VS1053 player
+  delay(10);
+#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
+  dbgprint("Start server for commands on port 80");
+#endif
+#ifdef PORT23_ACTIVE
+  dbgprint("Start server for debug output on port 23");
+  tftlog("Debug port 23 active!", GREEN);
+#endif
+  delay(3000);                                         // time to read boot messages
+  _claimSPI("setup3");                                 // claim SPI bus
+#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
+  cmdserver.begin();                                   // start http server on port 80
+#endif  
+#ifdef PORT23_ACTIVE
+  dbgserver.begin();                                   // start debug server on port 23
+#endif
+  _releaseSPI();                                       // release SPI bus
+#ifndef USE_ETHERNET
+#ifdef PORT23_ACTIVE
+  dbgserver.setNoDelay(true);                          // doesn't exist in Wiznet W5500 library
+#endif
+  if (NetworkFound) {                                  // OTA only if Wifi network found
+    dbgprint("Network found. Starting OTA");
+    ArduinoOTA.setHostname(NAME);                      // set the hostname
+    ArduinoOTA.onStart(otastart);
+    ArduinoOTA.begin();                                // allow update over the air
+    if (MDNS.begin(NAME)) {                            // start MDNS transponder
+      dbgprint("MDNS responder started");
+    }
+    else {
+      dbgprint("Error setting up MDNS responder!");
+    }
+  }
+  else {
+    currentPreset = ini_block.newpreset;               // No network: do not start radio
+    dbgprint("No Network found !!");
+  }
+#endif
+  timer = timerBegin(0, 80, true);                     // Use 1st timer, prescaler 80, counting upwards (true)
+  timerAttachInterrupt(timer, &timer100, true);        // Call timer100() on timer alarm, generated on edge (true)
+  timerAlarmWrite(timer, 100000, true);                // Alarm every 100 msec, timer to reload (true)
+  timerAlarmEnable(timer);                             // Enable the timer
+#ifndef USE_ETHERNET
+  configTime (ini_block.clk_offset * 3600,
+              ini_block.clk_dst * 3600,
+              ini_block.clk_server.c_str());           // GMT offset, daylight offset in seconds
+#endif
+  timeinfo.tm_year = 0;                                // Set TOD to illegal
+  // Init settings for rotary switch (if existing).
+  if ((ini_block.enc_clk_pin + ini_block.enc_dt_pin + ini_block.enc_sw_pin) > 2) {
+    pinMode(ini_block.enc_clk_pin, INPUT);             // CLK pin for encoder 
+    pinMode(ini_block.enc_dt_pin, INPUT);              // DT pin for encoder 
+    pinMode(ini_block.enc_sw_pin, INPUT);              // SW pin for encoder 
+    attachInterrupt(ini_block.enc_clk_pin, isr_enc_turn, CHANGE);
+    attachInterrupt(ini_block.enc_sw_pin, isr_enc_switch, CHANGE);
+    dbgprint("Rotary encoder is enabled (clk:%d,dt:%d,sw:%d)",
+             ini_block.enc_clk_pin, ini_block.enc_dt_pin, ini_block.enc_sw_pin);
+  }
+  else {
+    dbgprint("Rotary encoder is disabled (clk:%d,dt:%d,sw:%d)",
+             ini_block.enc_clk_pin, ini_block.enc_dt_pin, ini_block.enc_sw_pin);
+  }
+
+  if (NetworkFound) {
+    getTime();                                          // Sync time
+    if (timeinfo.tm_year) time_req = true;              // Legal time found?  
+  }
+  if (tft) {
+    //dbgprint("setup(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
+    //           0, 8, dsp_getwidth(), dsp_getheight() - 8);
+    dsp_fillRect(0, 8,                                  // Clear most of the screen
+                 dsp_getwidth(),                        // x
+                 dsp_getheight() - 8, BLACK);           // y, color
+  }
+  outchunk.datatyp = QDATA;                             // This chunk dedicated to QDATA
+  dataQueue = xQueueCreate(QSIZ, sizeof (qdata_struct));// Create queue for communication
+#ifdef SD_READER
+  sdReadBegin();                                        // Buffers for sdReadTask
+#endif
+#if defined TASK_STATS && !configGENERATE_RUN_TIME_STATS
+  esp_register_freertos_tick_hook_for_cpu(taskTickHook, 0); // Own run time accounting per core
+  esp_register_freertos_tick_hook_for_cpu(taskTickHook, 1);
+#endif
+  for (unsigned int i = 0; i < sizeof(taskdef) / sizeof(taskdef[0]); i++) {
+    if (xTaskCreatePinnedToCore(
+          taskdef[i].func,                               // Task function
+          taskdef[i].name,                               // name of task.
+          taskdef[i].stack,                              // stack size of task
+          NULL,                                          // parameter of the task
+          taskdef[i].prio,                               // priority of the task
+          taskdef[i].handle,                             // Task handle to keep track of created task
+          (taskdef[i].core < 0) ? tskNO_AFFINITY : taskdef[i].core) != pdPASS) { // Run on CPU 0/1 or any
+      *taskdef[i].handle = NULL;                         // Not running, users check the handle
+      dbgprint("Failed to start %s, stack %d (out of memory?)", taskdef[i].name,
+               taskdef[i].stack);
+      continue;
+    }
+    dbgprint("Started %s, stack %d, priority %d, core %d", taskdef[i].name,
+             taskdef[i].stack, taskdef[i].prio, taskdef[i].core);
+  }
+#ifdef SD_READER
+  if (!xsdReadTask) {
+    sdReadOn = false;                                   // No reader task, read SD tracks directly
+  }
+#endif
+  tasksStarted = true;
+#ifdef ENABLE_ESP32_HW_WDT
+  esp_task_wdt_init(WDT_TIMEOUT, true);                 // enable panic so ESP32 restarts
+  esp_task_wdt_add(NULL);                               // add current thread to WDT watch  
+  esp_task_wdt_reset();
+#endif    
+}
+
+#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
+//**************************************************************************************************
+//                                        R I N B Y T                                              *
+//**************************************************************************************************
+// Read next byte from http inputbuffer.  Buffered for speed reasons.                              *
+//**************************************************************************************************
+uint8_t rinbyt(bool forcestart)
+{
+  static uint8_t  buf[1024];                           // Inputbuffer
+  static uint16_t i;                                   // Pointer in inputbuffer
+  static uint16_t len;                                 // Number of bytes in buf
+  uint16_t        tlen;                                // Number of available bytes
+  uint16_t        trycount = 0;                        // Limit max. time to read
+
+  if (forcestart || (i == len)) {                      // Time to read new buffer
+P1RIB:
+    _claimSPI("rinbyt1");                              // claim SPI bus
+    uint8_t erg = cmdclient.connected();
+    _releaseSPI();                                     // release SPI bus
+    while (erg) {                                      // Loop while the client's connected
+      _claimSPI("rinbyt2");                            // claim SPI bus
+      tlen = cmdclient.available();                    // Number of bytes to read from the client
+      _releaseSPI();                                   // release SPI bus
+      len = tlen;                                      // Try to read whole input
+      if (len == 0) {                                  // Any input available?
+        if (++trycount > 3) {                          // Not for a long time?
+          dbgprint("HTTP input shorter than expected");
+          return '\n';                                 // Error! No input
+        }
+        delay(10);                                     // Give communication some time
+        //continue;                                    // Next loop of no input yet
+        goto P1RIB;
+      }
+      if (len > sizeof(buf)) {                         // Limit number of bytes
+        len = sizeof(buf);
+      }
+      _claimSPI("rinbyt3");                            // claim SPI bus
+      len = cmdclient.read(buf, len);                  // Read a number of bytes from the stream
+      _releaseSPI();                                   // release SPI bus
+      i = 0;                                           // Pointer to begin of buffer
+      break;
+    }
+  }
+  return buf[i++];
+}
+
+//**************************************************************************************************
+//                                        W R I T E P R E F S                                      *
+//**************************************************************************************************
+// Update the preferences.  Called from the web interface.                                         *
+//**************************************************************************************************
+void writePrefs()
+{
+  int        inx;                                            // Position in inputstr
+#ifndef USE_ETHERNET
+  uint8_t    winx;                                           // Index in wifilist
+#endif  
+  char       c;                                              // Input character
+  String     inputstr = "";                                  // Input regel
+  String     key, contents;                                  // Pair for Preferences entry
+  String     dstr;                                           // Contents for debug
+
+  dbgprint("writePrefs() entered");
+  timerAlarmDisable(timer);                                  // Disable the timer
+  nvsclear();                                                // Remove all preferences
+  while (true) {
+    c = rinbyt(false);                                       // Get next inputcharacter
+    if (c == '\n') {                                         // Newline?
+      if (inputstr.length() == 0) {
+        dbgprint("writePrefs(): end of writing preferences");
+        break;                                               // End of contents
+      }
+      if (!inputstr.startsWith("#")) {                       // Skip pure comment lines
+        inx = inputstr.indexOf("=");
+        if (inx >= 0) {                                      // Line with "="?
+          key = inputstr.substring(0, inx);                  // Yes, isolate the key
+          key.trim();
+          contents = inputstr.substring(inx + 1);            // and contents
+          contents.trim();
+          dstr = contents;                                   // Copy for debug
+#ifndef USE_ETHERNET
+          if ((key.indexOf("wifi_") == 0)) {                 // Sensitive info?
+            winx = key.substring(5).toInt();                 // Get index in wifilist
+            if ((winx < wifilist.size()) &&                  // Existing wifi spec in wifilist?
+                (contents.indexOf(wifilist[winx].ssid) == 0) &&
+                (contents.indexOf("/****") > 0)) {           // Hidden password?
+              contents = String(wifilist[winx].ssid) +       // Retrieve ssid and password
+                         String("/") + String(wifilist[winx].passphrase);
+              dstr = String(wifilist[winx].ssid) +
+                     String("/*******");                     // Hide in debug line
+            }
+          }
+#endif
+          //dbgprint("writeprefs setstr %s = %s", key.c_str(), dstr.c_str());
+          nvssetstr (key.c_str(), contents);                 // Save new pair
+        }
+      }
+      inputstr = "";
+    }
+    else {
+      if (c != '\r') {                                       // Not newline.  Is is a CR?
+        inputstr += String(c);                              // No, normal char, add to string
+      }
+    }
+  }
+  timerAlarmEnable(timer);                                   // Enable the timer
+  fillkeylist();                                             // Update list with keys
+}
+
+//**************************************************************************************************
+//                                        H A N D L E H T T P R E P L Y                            *
+//**************************************************************************************************
+// Handle the output after an http request.                                                        *
+//**************************************************************************************************
+void handlehttpreply()
+{
+  HEAP_TAG("httpreply");
+  const char* p;                                          // Pointer to reply if command
+  String      sndstr = "";                                // String to send
+  //int        n;                                         // Number of files on SD card
+  bool        appendLines = true;
+
+  if (!http_reponse_flag) return;                         // Nothing to do           
+
+  http_reponse_flag = false;
+  _claimSPI("httpreply1");                                // claim SPI bus
+  uint8_t erg = cmdclient.connected(); 
+  _releaseSPI();                                          // release SPI bus
+  if (!erg) {
+    dbgprint("handlehttpreply(): error - lost connection to cmdclient");
+    return;                                       // return if connection lost
+  }
+
+  if (http_rqfile.length() == 0 &&
+      http_getcmd.length() == 0) {
+    // empty GET received
+    if (NetworkFound) {                                   // Yes, check network
+      handleFSf(String("index.html"));                    // Okay, send the startpage
+    }
+    else {
+      handleFSf(String("config.html"));                   // Or the configuration page if in AP mode
+    }
+  }
+  else if (http_getcmd.length()) {  
+    // command received
+    sndstr = httpHeader(String("text/html"));             // Set header
+    if (http_getcmd.startsWith("getprefs")) {             // Is it a "Get preferences"?
+      if (dataMode != STOPPED) {                          // Still playing?
+        dbgprint("STOP (command getprefs)");
+        dataMode = STOPREQD;                              // Stop playing
+      }
+      sndstr += readPrefs(true);                          // Read and send
+    }
+    else if (http_getcmd.startsWith("getdefs")) {         // is it a "Get default preferences"?
+      sndstr += String(defprefs_txt + 1);                 // read initial values
+    }
+    else if (http_getcmd.startsWith("saveprefs")) {       // is it a "Save preferences"
+      writePrefs();                                       // handle it
+      highestPreset = findHighestPreset();                // highest preset might have been changed
+    }
+    else if (http_getcmd.startsWith("mp3list")) {         // is it a "Get SD MP3 tracklist"?
+      _claimSPI("httpreply2");                            // claim SPI bus
+      cmdclient.print(sndstr);                            // send header
+      _releaseSPI();                                      // release SPI bus
+      if (!SD_okay) {                                     // See if known card
+        _claimSPI("httpreply3");                          // claim SPI bus
+        cmdclient.println("0/No tracks found.");          // No SD card, empty list
+        _releaseSPI();                                    // release SPI bus
+      }
+      else {
+        int offset = 0, count = SD_MAXFILES;              // Whole list if no page given
+        sscanf(http_getcmd.c_str(), "mp3list=%d,%d", &offset, &count);
+        sdListPage(offset, count);                        // "mp3list=<offset>,<count>"
+      }
+      appendLines = false;
+    }
+    else if (http_getcmd.startsWith("search=")) {  // is it a "Search SD tracks"?
+      _claimSPI("httpreply9");                     // claim SPI bus
+      cmdclient.print(sndstr);                     // send header
+      _releaseSPI();                               // release SPI bus
+      sdSearchList(http_getcmd.substring(7));      // one page of matches
+      appendLines = false;
+    }
+#ifdef SD_LIBRARY
+    else if (http_getcmd.startsWith("sdlib=")) {   // is it a "Get music library list"?
+      _claimSPI("httpreply7");                     // claim SPI bus
+      cmdclient.print(sndstr);                     // send header
+      _releaseSPI();                               // release SPI bus
+      sdLibList(http_getcmd.substring(6));         // artists, albums, tracks or genres
+      appendLines = false;
+    }
+#endif
+#ifdef TASK_STATS
+    else if (http_getcmd.startsWith("taskstats")) { // Is it a "Get task statistics"?
+      sndstr += taskStatsText();                   // Table of tasks and core loads
+    }
+#endif
+#ifdef HEAP_STATS
+    else if (http_getcmd.startsWith("heapstats")) { // Is it a "Get heap statistics"?
+      sndstr += heapStatsText();                   // Heap history and allocation counts
+    }
+#endif
+#ifdef POWER_SAVE
+    else if (http_getcmd.startsWith("powerstats")) { // Is it a "Get power statistics"?
+      sndstr += powerStatsText();                  // Time and clock per power mode
+    }
+#endif
+    else if (http_getcmd.startsWith("settings")) { // Is it a "Get settings" (like presets and tone)?
+      _claimSPI("httpreply6");                     // claim SPI bus
+      cmdclient.print(sndstr);                     // Yes, send header
+      _releaseSPI();                               // release SPI bus
+      getsettings();                               // Handle settings request
+      appendLines = false;
+    }
+    else {
+      p = analyzeCmd(http_getcmd.c_str());         // Yes, do so
+      sndstr += String(p);                         // Content of HTTP response follows the header
+    }
+    if (appendLines) {
+      sndstr += String("\n");                        // The HTTP response ends with a blank line
+      int bytesLeft, start = 0;
+      String tmp;
+      if ((bytesLeft = sndstr.length()) > 0) {       // string empty ?
+        while (bytesLeft) {
+          if (bytesLeft > 1000) {
+            tmp = sndstr.substring(start, start + 1000);
+            bytesLeft -= 1000;
+            start += 1000;
+          }
+          else {
+            tmp = sndstr.substring(start);
+            bytesLeft = 0;
+          }
+          _claimSPI("httpreply8");                   // claim SPI bus
+          cmdclient.print(tmp);                      // Filled, send it
+          _releaseSPI();                             // release SPI bus
+        }
+      }
+    }  
+  }
+  else if (http_rqfile.length()) {                 // File requested?
+    dbgprint("start file reply for %s", http_rqfile.c_str());
+    handleFSf(http_rqfile);                        // Yes, send it
+  }
+  else {
+    httpHeader(String("text/html"));               // send header
+    // the content of the HTTP response follows the header:
+    _claimSPI("httpreply10");                      // claim SPI bus
+    cmdclient.println("dummy response\n");         // text ending with double newline
+    _releaseSPI();                                 // release SPI bus
+    dbgprint("dummy response sent");
+  }
+#ifdef USE_ETHERNET
+  _claimSPI("httpreply5");                         // claim SPI bus
+  cmdclient.flush();
+  cmdclient.stop();
+  _releaseSPI();                                   // release SPI bus
+  dbgprint("handlehttpreply(): cmdclient.stop() and return");
+#endif
+}
+
+//**************************************************************************************************
+//                                        H A N D L E H T T P                                      *
+//**************************************************************************************************
+// Handle the input of an http request.                                                            *
+//**************************************************************************************************
+void handlehttp()
+{
+  bool        first = true;                                 // First call to rinbyt()
+  char        c;                                            // Next character from http input
+  int         inx0, inx;                                    // Pos. of search string in currenLine
+  String      currentLine = "";                             // Build up to complete line
+  bool        reqseen = false;                              // No GET seen yet
+
+  _claimSPI("http1");                                       // claim SPI bus
+  uint8_t erg = cmdclient.connected();
+  _releaseSPI();                                            // release SPI bus
+  if (!erg) {                                               // Action only if client is connected
+    return;                                                 // No client active
+  }
+  dbgprint("handlehttp(): command client detected");
+  while (true) {                                            // Loop till command/file seen
+    c = rinbyt (first);                                     // Get a byte
+    first = false;                                          // No more first call
+    if (c == '\n') {
+      // If the current line is blank, you got two newline characters in a row.
+      // that's the end of the client HTTP request, so send a response:
+      if (currentLine.length() == 0) {
+        http_reponse_flag = reqseen;                        // Response required or not
+        break;
+      }
+      else {
+        // Newline seen, remember if it is like "GET /xxx?y=2&b=9 HTTP/1.1"
+        if (currentLine.startsWith("GET /")) {              // GET request?
+          inx0 = 5;                                         // Start search at pos 5
+        }
+        else if (currentLine.startsWith("POST /")) {        // POST request?
+          inx0 = 6;
+        }
+        else {
+          inx0 = 0;                                         // Not GET nor POST
+        }
+        if (inx0) {                                         // GET or POST request?
+          reqseen = true;                                   // Request seen
+          inx = currentLine.indexOf("&");                   // Search for 2nd parameter
+          if (inx < 0) {
+            inx = currentLine.indexOf(" HTTP");             // Search for end of GET command
+          }
+          // Isolate the command
+          http_getcmd = currentLine.substring(inx0, inx);
+          inx = http_getcmd.indexOf("?");                   // Search for command
+          if (inx == 0) {                                   // Arguments only?
+            http_getcmd = http_getcmd.substring(1);         // Yes, get rid of question mark
+            http_rqfile = "";                               // No file
+          }
+          else if (inx > 0) {                               // Filename present?
+            http_rqfile = http_getcmd.substring(0, inx);    // Remember filename
+            http_getcmd = http_getcmd.substring(inx + 1);   // Remove filename from GET command
+          }
+          else {
+            http_rqfile = http_getcmd;                      // No parameters, set filename
+            http_getcmd = "";
+          }
+          if (http_getcmd.length()) {
+            dbgprint("Get command is: %s", http_getcmd.c_str()); // Show result
+          }
+          if (http_rqfile.length()) {
+            dbgprint("Filename is: %s", http_rqfile.c_str()); // Show requested file
+          }
+        }
+        currentLine = "";
+      }
+    }
+    else if (c != '\r') {                                   // drop CR
+      currentLine += c;                                     // add normal char to currentLine
+    }
+  }
+}
+#endif
+
+//**************************************************************************************************
+//                                          X M L P A R S E                                        *
+//**************************************************************************************************
+// Parses line with XML data and put result in variable specified by parameter.                    *
+//**************************************************************************************************
+void xmlparse(String &line, const char *selstr, String &res)
+{
+  String sel = "</";                                  // Will be like "</status-code"
+  int    inx;                                         // Position of "</..." in line
+
+  sel += selstr;                                      // Form searchstring
+  if (line.endsWith(sel)) {                           // Is this the line we are looking for?
+    inx = line.indexOf(sel);                          // Get position of end tag
+    res = line.substring(0, inx);                     // Set result
+    dbgprint("xmlparse: %s = %s", selstr, res.c_str());
+  }
+}
+ 
+//**************************************************************************************************
+//                                          X M L G E T H O S T                                    *
+//**************************************************************************************************
+// Parses streams from XML data.                                                                   *
+// Example URL for XML Data Stream:                                                                *
+// http://playerservices.streamtheworld.com/api/livestream?version=1.5&mount=IHR_TRANAAC&lang=en   *
+//**************************************************************************************************
+String xmlgethost(String mount)
+{
+  const char* xmlhost = "playerservices.streamtheworld.com";  // XML data source
+  const char* xmlget = "GET /api/livestream"                  // XML get parameters
+                       "?version=1.5"                         // API Version of IHeartRadio
+                       "&mount=%sAAC"                         // MountPoint with Station Callsign
+                       "&lang=en";                            // Language
+
+  String   stationServer = "";                                // Radio stream server
+  String   stationPort = "";                                  // Radio stream port
+  String   stationMount = "";                                 // Radio stream Callsign
+  uint16_t timeout = 0;                                       // To detect time-out
+  String   sreply = "";                                       // Reply from playerservices.streamtheworld.com
+  String   statuscode = "200";                                // Assume good reply
+  char     tmpstr[200];                                       // Full GET command, later stream URL
+  String   urlout;                                            // Result URL
+  int      erg;
+
+  stopMp3client();                                            // Stop any current client connections.
+  dbgprint("Try to find iHeartRadio station: %s", mount.c_str());
+  dataMode = INIT;                                            // Start default in metamode
+  chunked = false;                                            // Assume not chunked
+  sprintf(tmpstr, xmlget, mount.c_str());                     // Create a GET commmand for the request
+  dbgprint("%s", tmpstr);
+  _claimSPI("xml1");                                          // claim SPI bus
+  erg = mp3client.connect(xmlhost, 80);
+  _releaseSPI();                                              // release SPI bus
+  if (erg) {                                                  // Connect to XML stream
+    dbgprint("Connected to XML host %s", xmlhost);
+    _claimSPI("xml2");                            // claim SPI bus
+    mp3client.print(String(tmpstr) + " HTTP/1.1\r\n"
+                    "Host: " + xmlhost + "\r\n"
+                    "User-Agent: Mozilla/5.0\r\n"
+                    "Connection: close\r\n\r\n");
+    _releaseSPI();                                            // release SPI bus
+    sprintf(tmpstr, "%s", mount.c_str());                     // assume error
+
+P1XGH:
+    _claimSPI("xml3");                                        // claim SPI bus
+    erg = mp3client.available();
+    _releaseSPI();                                            // release SPI bus
+    while (erg == 0) {
+      delay (200);                                            // Give server some time
+      if (++timeout > 25) {                                   // No answer in 5 seconds?
+        dbgprint("Client Timeout !");
+      }
+      goto P1XGH;
+    }
+    dbgprint("XML parser processing...");
+P2XGH:
+    _claimSPI("xml4");                                        // claim SPI bus
+    erg = mp3client.available();
+    _releaseSPI();                                            // release SPI bus
+    while (erg) {
+      _claimSPI("xml5");                                      // claim SPI bus
+      sreply = mp3client.readStringUntil ('>');
+      _releaseSPI();                                          // release SPI bus
+      sreply.trim();
+      // Search for relevant info in in reply and store in variable
+      xmlparse(sreply, "status-code", statuscode);
+      if (stationServer == "")                                // skip if found already
+        xmlparse(sreply, "ip", stationServer);
+      if (stationPort == "")                                  // skip if found already
+        xmlparse(sreply, "port", stationPort);
+      if (stationMount == "")                                 // skip if found already
+        xmlparse(sreply, "mount", stationMount);
+      if (statuscode != "200") {                              // Good result sofar?
+        dbgprint("Bad xml status-code %s. Unable to retrieve final host.", // No, show and stop interpreting
+                   statuscode.c_str());
+        //tmpstr[0] = '\0';                                   // Clear result
+        sprintf(tmpstr, "%s", mount.c_str());
+        break;
+      }
+      goto P2XGH;
+    }
+    if ((stationServer != "") &&                              // Check if all station values are stored
+         (stationPort != "") &&
+         (stationMount != "")) {
+      sprintf(tmpstr, "%s:%s/%s_SC",                          // Build URL for ESP-Radio to stream.
+                stationServer.c_str(),
+                stationPort.c_str(),
+                stationMount.c_str());
+      dbgprint("Found: %s", tmpstr);
+    }
+  }
+  else {
+    dbgprint("Can't connect to XML host %s!", xmlhost);       // Connection failed
+    //tmpstr[0] = '\0';
+    sprintf(tmpstr, "%s", mount.c_str());
+  }
+  _claimSPI("xml5");                                          // claim SPI bus
+  mp3client.stop();
+  _releaseSPI();                                              // release SPI bus
+  return String(tmpstr);                                      // Return final streaming URL.
+}
+
+//**************************************************************************************************
+//                                      H A N D L E S A V E R E Q                                  *
+//**************************************************************************************************
+// Handle save volume/preset/tone.  This will save current settings every 15 minutes to            *
+// the preferences.  On the next restart these values will be loaded.                              *
+// Note that saving prefences will only take place if contents has changed.                        *
+//**************************************************************************************************
+void handleSaveReq()
+{
+  static uint32_t savetime = 0;                          // Limit save to once per 15 minutes
+
+  if ((millis() - savetime) < 900000) {                  // 900 sec is 15 minutes
+    return;
+  }
+  savetime = millis();                                   // Set time of last save
+  nvssetstr("preset", String(currentPreset));            // Save current preset
+  nvssetstr("volume", String(ini_block.reqvol));         // Save current volume
+  nvssetstr("toneha", String(ini_block.rtone[0]));       // Save current toneha
+  nvssetstr("tonehf", String(ini_block.rtone[1]));       // Save current tonehf
+  nvssetstr("tonela", String(ini_block.rtone[2]));       // Save current tonela
+  nvssetstr("tonelf", String(ini_block.rtone[3]));       // Save current tonelf
+  if (shuffleSeed) {                                     // RANDOM mode order in use?
+    nvssetstr("shuffle_state", String(shuffleSeed) + "," + // Save order and position
+              String(shufflePos) + "," + String(shuffleDir) + "," + String(shuffleCount));
+  }
+}
+
+//**************************************************************************************************
+//                        C H E C K E N C O D E R A N D B U T T O N S                              *
+//**************************************************************************************************
+// Check if rotary encoder or front buttons are used.                                              *
+//**************************************************************************************************
+void checkEncoderAndButtons()
+{
+  static int8_t  enc_preset;                                 // Selected preset
+  static int16_t enc_nodeIndex;                              // index of selected track
+  static int16_t enc_dirIndex;                               // directory we are in
+  static String  enc_filename;                               // Filename of selected track
+#ifdef SD_LIBRARY
+  static int8_t   enc_libLevel = -1;                         // music library: artists, albums, tracks
+  static uint16_t enc_libPos[3];                             // entry selected on every level
+  uint16_t        first, count;                              // range of entries on a level
+#endif
+  String         tmp, dir;                                   // Temporary strings
+  int16_t        inx;                                        // index
+  const char*    reply;
+
+  if (encoderMode != IDLING &&                               // In default mode
+      enc_inactivity > 100) {                                // and more than 10 seconds inactive
+    enc_inactivity = 0;
+    // TEST
+    //dbgprint("dataMode=%d, playMode=%d, totalCount=%d, currentSource=%d, currentPreset=%d, enc_preset=%d, encoderMode=%d",
+    //            dataMode, playMode, totalCount, currentSource, currentPreset, enc_preset, encoderMode);
+    if (playMode == SDCARD) {
+      if (!SD_okay) { 
+        // No SD card present or defect
+        tftset(1, "SD-Card Error !");
+        encoderMode = IDLING;                               // Return to IDLE mode
+      }
+      else {
+        if (dataMode != STOPPED && dataMode != STOPREQD) {
+          tftset(1, lastArtistSong);
+          tftset(3, lastAlbumStation);
+          if (currentSource == SDCARD) 
+            forceProgressBar = true;                        // got to be painted AFTER section 3 or 4 is done
+          encoderMode = IDLING;                             // return to IDLE mode
+        }
+      }
+    }
+    else if (playMode == STATION) {
+      if (dataMode == STOPPED || dataMode == STOPREQD) {
+        currentPreset = -1;                                 // Make sure current is different
+        ini_block.newpreset = enc_preset;                   // Make a definite choice
+      }
+      else {
+        tftset(1, (char*)NULL);                             // Restore original text in middle section
+        tftset(3, (char*)NULL);                             // Restore original text at bottom
+      }
+      encoderMode = IDLING;                                 // Return to IDLE mode
+    }
+    else { // playMode == MEDIASERVER
+      if (dataMode != STOPPED && dataMode != STOPREQD) {
+        tftset(1, lastArtistSong);
+        tftset(3, lastAlbumStation);
+        if (currentSource == MEDIASERVER) 
+          forceProgressBar = true;                          // Got to be painted >>after<< section 3 or 4 is done
+        encoderMode = IDLING;                                  // Return to IDLE mode
+      }
+    }
+    if (encoderMode == IDLING)
+      dbgprint("Encoder mode back to IDLING");
+  }
+  if (buttonReturn) {                                            // First handle return button
+    dbgprint("Return Button");
+    buttonReturn = false;
+    if (encoderMode == SELECT) {
+#ifdef SD_LIBRARY
+      if (playMode == SDCARD && enc_libLevel > 0) {             // one level up in music library
+        enc_libLevel--;
+        sdLibShow(enc_libLevel, enc_libPos[enc_libLevel]);
+      }
+      else if (playMode == SDCARD && enc_libLevel == 0) {       // leave music library
+        enc_libLevel = -1;
+        tmp = mp3nodeList.name(enc_nodeIndex);
+        if (mp3nodeList[enc_nodeIndex].isDirectory)
+          tftset(2, tmp);
+        else
+          tftset(1, tmp);
+      }
+      else
+#endif
+      if (playMode == SDCARD) { // want to leave the current directory
+        if (enc_dirIndex != 0) { // we are not in root
+          enc_nodeIndex = mp3nodeList[enc_nodeIndex].parentDir;  // get parent directory of current file/directory
+          enc_dirIndex = mp3nodeList[enc_nodeIndex].parentDir;   // and parent of parent directory
+          tmp = mp3nodeList.name(enc_nodeIndex);
+          if (mp3nodeList[enc_nodeIndex].isDirectory)
+            tftset(2, tmp);
+          else
+            tftset(1, tmp);
+        }
+        else {
+          if (currentSource == SDCARD && SD_okay &&
+              dataMode != STOPPED && dataMode != STOPREQD) {
+            encoderMode = IDLING;                                // Back to default mode
+            tftset(1, lastArtistSong);
+            tftset(3, lastAlbumStation);
+            forceProgressBar = true;                             // Got to be painted >>after<< section 3 or 4 is done
+          }
+        }
+      }
+      else if (playMode == STATION) {
+        if (dataMode != STOPPED && dataMode != STOPREQD) {
+          encoderMode = IDLING;                                // Back to default mode
+          tftset(1, lastArtistSong);
+          tftset(3, lastAlbumStation);
+        }
+      }
+#ifdef ENABLE_SOAP
+      else { // playMode == MEDIASERVER
+        if (soapChain.size() > 1) {                              // no action if we are in root
+          soapChain.pop_back();                                  // delete last element in chain (current level)
+          soapChain.back().startingIndex = 0;                    // start displaying items at position 0
+          soapChain_t up = soapChain.back();                     // retrieve last element in chain (one level higher)
+          dbgprint("Search in media server container \"%s\" (child count: %d)", 
+                   up.name.c_str(), up.size);
+          bool ret = soap.browseServer(0, up.id.c_str(), &soapList);
+          if (ret) {                                             // browsing mediaserver one level higher
+            if (soapList.size() > 0) {
+              tftset(4, "Turn to select directory  or track.\n"  // Show current option
+                        "Press to confirm.");
+              enc_nodeIndex = 0;                                 // first entry on that level 
+              tmp = soapList[enc_nodeIndex].name;
+              if (soapList[enc_nodeIndex].isDirectory) {
+                tftset(2, tmp);
+              }
+              else {
+                String uriLc = soapList[enc_nodeIndex].uri;
+                uriLc.toLowerCase();
+                if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
+                    !uriLc.endsWith(".mp3"))
+                  tmp += " [not mp3]";
+                tftset(1, tmp);
+              }
+            }
+          }
+          else {
+            // error accessing media server
+            encoderMode = IDLING;
+            playMode = NONE;
+            dbgprint("buttonReturn: error accessing media server");
+            if (dataMode != STOPPED && dataMode != STOPREQD) {
+              dbgprint("STOP (error accessing DLNA media server)");
+              dataMode = STOPREQD;                               // Request STOP
+            }
+            tftset(1, "Error accessing      media server !");
+            tftset(4, "Error");
+          }
+        }
+      }
+#endif
+    }
+#ifdef ENABLE_SOAP
+    else { // IDLING
+      if (playMode == MEDIASERVER) { 
+        // we want to stop the song and show the current directory
+        if (dataMode != STOPPED && dataMode != STOPREQD) {
+            dbgprint("STOP (return button while playing from media server)");
+            dataMode = STOPREQD;                               // Request STOP
+            volRamp(VR_START);
+        }
+        soap.readStop();
+        delay(200);
+        if (soapChain.size() > 1) {                              // no action if we are in root
+          soapChain_t up = soapChain.back();                     // retrieve last element in chain (current level)
+          dbgprint("Search in media server container \"%s\" (child count: %d)", 
+                   up.name.c_str(), up.size);
+          bool ret = soap.browseServer(0, up.id.c_str(), &soapList);
+          if (ret) {                                             // browsing mediaserver one level higher
+            encoderMode = SELECT;
+            if (soapList.size() > 0) {
+              tftset(4, "Turn to select directory  or track.\n"  // Show current option
+                        "Press to confirm.");
+              enc_nodeIndex = 0;                                 // first entry on that level 
+              tmp = soapList[enc_nodeIndex].name;
+              if (soapList[enc_nodeIndex].isDirectory) {
+                tftset(2, tmp);
+              }
+              else {
+                String uriLc = soapList[enc_nodeIndex].uri;
+                uriLc.toLowerCase();
+                if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
+                    !uriLc.endsWith(".mp3"))
+                  tmp += " [not mp3]";
+                tftset(1, tmp);
+              }
+            }
+            else {
+              // oops very unprobable error ..... to be handled ?
+            }
+          }
+          else {
+            // error accessing media server
+            encoderMode = IDLING;
+            playMode = NONE;
+            dbgprint("buttonReturn: error accessing media server");
+            tftset(1, "Error accessing      media server !");
+            tftset(4, "Error");
+          }
+        }
+      }
+    }
+#endif    
+    return;
+  }
+  if (buttonRepeatMode) {
+    //dbgprint("Repeat Mode");
+    buttonRepeatMode = false;
+    reply = analyzeCmd("repeat");
+    dbgprint(reply);
+    return;
+  }
+  if (buttonSkipBack) {
+    buttonSkipBack = false;
+    if (playMode == SDCARD && encoderMode == SELECT) {
+      return;                                              // skip button inactive when selecting tracks
+    }
+    analyzeCmd("previous");
+    return;
+  }
+  if (buttonSkipForward) {
+    buttonSkipForward = false;
+    if (playMode == SDCARD && encoderMode == SELECT) {
+      return;                                              // skip button inactive when selecting tracks
+    }
+    analyzeCmd ("next");
+    return;
+  }
+  if (buttonPreset > -1) {
+    if (readhostfrompref(buttonPreset) != "") {
+      playMode = STATION;
+      encoderMode = IDLING;                                // Back to default mode
+      currentPreset = -1;                                  // Make sure current is different
+      ini_block.newpreset = buttonPreset;
+      //tftset(4, "");                                  // Clear text
+      dbgprint("ini_block.newpreset=%d", ini_block.newpreset);
+      volRamp(VR_START);                                   // fade out, silence, fade in
+      mp3fileRepeatFlag = NOREPEAT;
+    }
+    else {
+      dbgprint("No radio station for preset %d configured !", buttonPreset);
+    }
+    buttonPreset = -1;
+    return;
+  }
+  if (longClick) {
+    dbgprint("Long click ---> Resetting CPU");
+    dsp_erase();
+    dsp_setTextSize(2);                                   // Bigger character font
+    dsp_setTextColor(RED);                                // Info in red
+    dsp_setCursor(12, 55);                                // Middle of screen
+    dsp_print("SW-Reboot !");
+    dataMode = STOPREQD;                                  // stop player
+    delay(1800);                                          // Pause for a short time
+    ESP.restart();                                        // Reset the CPU, no return
+  }
+  if (doubleClick) {                                      // Double click switches between Station/SD/DLNA modes
+    dbgprint("Double click");
+    doubleClick = false;
+    if (playMode == SDCARD) 
+      buttonStation = true;
+#ifdef ENABLE_SOAP     
+    else if (playMode == STATION) 
+      buttonMediaserver = true;
+#endif      
+    else // playMode == MEDIASERVER
+      buttonSD = true;
+    // no return ... will be handled immediately
+  }
+  if (buttonSD) {                                           // Handle button requesting SD mode
+    dbgprint("SD mode requested");
+    buttonSD = false;
+#ifdef ENABLE_SOAP    
+    soapList.clear();                                       // Free memory space
+    soapChain.clear();
+#endif    
+    if (!sdConfigured()) {                                  // no SD configured ?
+      return;
+    }
+    if (playMode != SDCARD) {
+      tftset(0, TOPLINE_MP3);                               // Set screen segment top line
+      //displaytime ("");                                   // Time to be refreshed
+      if (dataMode != STOPPED) {
+        dbgprint("STOP (buttonSD)");
+        dataMode = STOPREQD;                                // Request STOP
+      }
+      playMode = SDCARD;
+      encoderMode = IDLING;
+      mp3fileRepeatFlag = NOREPEAT;
+    }
+    if (encoderMode != SELECT) {                          // do nothing if already selecting tracks
+      // we are not in SELECT mode yet 
+      quickSdCheck();                                     // It cleares SD_okay if check is negativ
+      if (SD_mp3fileCount && SD_okay) {                   // mp3-tracks on SD & SD ok ?
+        encoderMode = SELECT;                             // Swich to SELECT mode
+        dbgprint("Encoder mode set to SELECT");
+        tftset(4, "Turn to select directory  or track.\n" // Show current option
+                  "Press to confirm.");
+        enc_nodeIndex = 1;                                // first entry under root (root is 0)
+        enc_dirIndex = 0;                                 // parent dir is root (0)
+#ifdef SD_LIBRARY
+        enc_libLevel = -1;                                // start with directories
+#endif
+        tmp = mp3nodeList.name(enc_nodeIndex);
+        if (mp3nodeList[enc_nodeIndex].isDirectory)
+          tftset(2, tmp);
+        else
+          tftset(1, tmp);
+      }
+      else { 
+        // error acessing SD card or re-scan needed
+        encoderMode = IDLING;
+        tryToMountSD = true;
+        //xQueueReset (dataQueue);
+        if (dataMode != STOPPED && dataMode != STOPREQD) {
+          dbgprint("STOP (tryToMountSD = true)");
+          dataMode = STOPREQD;                              // Request STOP
+        }
+        //tftset(1, "");
+      }
+    }
+#ifdef SD_LIBRARY
+    else if (sdLibReady) {                                // selecting: switch directories/library
+      if (enc_libLevel < 0) {
+        enc_libLevel = 0;                                 // all artists
+        enc_libPos[0] = 0;
+        tftset(4, "Turn to select artist, album or track.\n"
+                  "Press to confirm.");
+        sdLibShow(0, 0);
+      }
+      else {
+        enc_libLevel = -1;                                // back to directories
+        tftset(4, "Turn to select directory  or track.\n"
+                  "Press to confirm.");
+        tmp = mp3nodeList.name(enc_nodeIndex);
+        if (mp3nodeList[enc_nodeIndex].isDirectory)
+          tftset(2, tmp);
+        else
+          tftset(1, tmp);
+      }
+    }
+#endif
+    return;
+  }
+  if (buttonStation) {                                      // Handle button requesting Station mode
+    dbgprint("Station mode requested");
+    buttonStation = false;
+    if (playMode != STATION) {
+      tftset(0, "ESP32 Radio");                             // Set screen segment top line
+      //displaytime ("");                                   // Time to be refreshed
+      if (dataMode != STOPPED) {
+        dbgprint("STOP (buttonStation)");
+        dataMode = STOPREQD;                                // Request STOP
+      }
+      playMode = STATION;
+      mp3fileRepeatFlag = NOREPEAT;
+      encoderMode = IDLING;                                 // Back to default mode
+      currentPreset = -1;                                   // Make sure current is different
+      //tftset(4, "");                                      // Clear text
+      volRamp(VR_START);                                    // fade out, silence, fade in
+    }
+    return;
+  }
+#ifdef ENABLE_SOAP     
+  if (buttonMediaserver) {                                  // Handle button requesting Mediaserver mode
+    dbgprint("Mediaserver mode requested");
+    buttonMediaserver = false;
+    sdScanAbort();                                          // No background SD scan
+#ifdef SD_LIBRARY
+    sdLibAbort();                                           // No library without node table
+#endif
+    mp3nodeList.clear();                                    // Free memory space
+    sdPathReset();
+    shuffleReset();
+    sdSearchReset();
+    SD_mp3fileCount = 0;
+    if (playMode != MEDIASERVER) {
+      tftset(0, "ESP32 DLNA");                              // Set screen segment top line
+      //displaytime ("");                                   // Time to be refreshed
+      if (dataMode != STOPPED) {
+        dbgprint("STOP (buttonMediaserver)");
+        dataMode = STOPREQD;                                // Request STOP
+        volRamp(VR_START);                                  // fade out, silence, fade in
+      }
+      if (playMode == STATION)
+        stopMp3client();                                    // Sockets are sparse, so we need to close it here already
+      playMode = MEDIASERVER;
+      encoderMode = IDLING;
+      mp3fileRepeatFlag = NOREPEAT;
+      xQueueReset(dataQueue);
+    }
+    if (encoderMode != SELECT) {                            // do nothing if already selecting tracks
+      // we are not in SELECT mode yet 
+      soapChain.clear();
+      soapChain_t tmpId = { .id = "0", .name = "Root", .size = 0, .startingIndex = 0 };
+      soapChain.push_back(tmpId);                           // first entry always represents root = "0"
+      dbgprint("Search in media server container \"0\" (Root)");
+      bool ret = soap.browseServer(0, "0", &soapList);
+      if (ret) {           
+        // browsing root of mediaserver was successful
+        if (soapList.size() > 0) {
+          tftset(4, "Turn to select directory  or track.\n" // Show current option
+                    "Press to confirm.");
+          enc_nodeIndex = 0;                                // first entry on that level 
+        //enc_dirIndex = 0;                                 // parent dir is root (0)
+          tmp = soapList[enc_nodeIndex].name;
+          encoderMode = SELECT;                             // Swich to SELECT mode
+          dbgprint("Encoder mode set to SELECT");
+        }
+        else {
+          encoderMode = IDLING;                             // Swich to SELECT mode
+          tmp = "No media server content !";
+          //tftset(4, "");
+        }
+        if (soapList.size() == 0 || soapList[enc_nodeIndex].isDirectory)
+          tftset(2, tmp);
+        else
+          tftset(1, tmp);
+      }
+      else { 
+        // error accessing media server
+        dbgprint("buttonMediaserver: error accessing media server");
+        encoderMode = IDLING;
+        playMode = NONE;
+        tftset(1, "Error accessing      media server !");
+        tftset(4, "Error");
+        // probably media server still sleeping, send WOL message
+        if (ini_block.srv_macWOL.length() > 0) {
+          dbgprint("Send wake up message to MAC: %s", ini_block.srv_macWOL.c_str());
+          soap.wakeUpServer(ini_block.srv_macWOL.c_str()); 
+        }
+      }
+    }
+    // TEST
+    dbgprint("Total free memory of all regions=%d (minEver=%d), freeHeap=%d (minEver=%d), minStack=%d (in Bytes)", 
+             ESP.getFreeHeap(), ESP.getMinFreeHeap(), xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL)); 
+    //              
+    return;
+  }  
+#endif  
+  if (singleClick) {
+    dbgprint("Single click");
+    singleClick = false;
+    if (encoderMode == SELECT) {
+      if (playMode == STATION) {
+        encoderMode = IDLING;                                // back to default mode
+        currentPreset = -1;                                  // make sure current preset is different
+        ini_block.newpreset = enc_preset;                    // make a definite choice
+        //tftset(4, "");                                     // clear text
+        dbgprint("ini_block.newpreset=%d", ini_block.newpreset);
+        volRamp(VR_START);                                   // fade out, silence, fade in
+        mp3fileRepeatFlag = NOREPEAT;
+      }
+#ifdef SD_LIBRARY
+      else if (playMode == SDCARD && (enc_libLevel == 0 || enc_libLevel == 1)) {
+        // artist or album selected, show its albums resp. tracks
+        enc_libLevel++;
+        sdLibRange(enc_libLevel, enc_libPos[enc_libLevel - 1], &first, &count);
+        enc_libPos[enc_libLevel] = first;
+        sdLibShow(enc_libLevel, first);
+      }
+#endif
+      else if (playMode == SDCARD) {
+#ifdef SD_LIBRARY
+        if (enc_libLevel == 2) {
+          // track selected in music library, play it like a file selected in its directory
+          enc_libLevel = -1;
+          if (!sdLibEntry(2, enc_libPos[2], tmp, &first, &count) ||
+              (int16_t)first <= 0 || (int16_t)first >= mp3nodeList.size()) {
+            dbgprint("SD problem: music library entry %d unreadable", enc_libPos[2]);
+            tftset(4, "Error");                              // text on bottom in green
+            return;
+          }
+          enc_nodeIndex = first;
+          enc_dirIndex = mp3nodeList[enc_nodeIndex].parentDir;
+        }
+#endif
+        if (!mp3nodeList[enc_nodeIndex].isDirectory) {
+          // regular file
+          if (dataMode != STOPPED) {
+            dbgprint("STOP (singleClick & playMode == SDCARD)");
+            dataMode = STOPREQD;                             // Request STOP, do not touch longClick flag
+          }
+          encoderMode = IDLING;                              // Back to default mode
+          enc_filename = getSDfilename(enc_nodeIndex);       // Set new filename
+          host = enc_filename;                               // Selected track as new host
+          if (host.startsWith("error")) {
+            dbgprint("SD problem: Can't find track");
+            tftset(4, "Error");                              // text on bottom in green
+          }
+          else {
+            dbgprint("Selected host=%s", host.c_str());
+            currentIndex = enc_nodeIndex;
+            hostreq = true;                                   // Request this host
+            mp3fileRepeatFlag = NOREPEAT;
+            mp3filePause = false;
+            volRamp(VR_START);                                // fade out, silence, fade in
+            //xQueueReset (dataQueue);
+            //tftset(4, "");                                  // Clear text
+          }
+        }
+        else {
+          // try to enter selected directory
+          if ((inx = firstSDindexInDir(enc_nodeIndex)) != enc_nodeIndex) {
+            // directory contains entries (files or dirs)
+            enc_dirIndex = enc_nodeIndex;
+            enc_nodeIndex = inx;                               // new current index
+            tmp = mp3nodeList.name(inx);
+            if (mp3nodeList[inx].isDirectory) {
+              tftset(2, tmp);                                // show directories in yellow
+            }  
+            else {
+              if ((inx = tmp.indexOf(".mp3")) > 0 ||
+                  (inx = tmp.indexOf(".MP3")) > 0) {
+                tmp = tmp.substring(0, inx);                 // remove file extension
+              }
+              tftset(1, tmp);                                // show files in cyan
+            }
+          }
+        }
+      }
+#ifdef ENABLE_SOAP      
+      else { // playMode == MEDIASERVER
+        if (soapList[enc_nodeIndex].isDirectory) {
+          // enter directory when searchable and not empty
+          if (soapList[enc_nodeIndex].size > 0 &&                  // container contains elements
+              soapList[enc_nodeIndex].searchable) {                // and is searchable
+            soapChain_t tmpId;
+            tmpId.id = soapList[enc_nodeIndex].id;
+            tmpId.name = soapList[enc_nodeIndex].name;
+            tmpId.size = soapList[enc_nodeIndex].size;
+            tmpId.startingIndex = 0;
+            dbgprint("Search in media server container \"%s\" (child count: %d)", 
+                     soapList[enc_nodeIndex].name.c_str(), soapList[enc_nodeIndex].size);
+            bool ret = soap.browseServer(0, soapList[enc_nodeIndex].id.c_str(), &soapList);
+            if (ret) { 
+              // browsing media server was successful
+              if (soapList.size() > 0) {
+                tftset(4, "Turn to select directory  or track.\n"  // Show current option
+                          "Press to confirm.");
+                soapChain.push_back(tmpId);                        // to find our way back up          
+                enc_nodeIndex = 0;                                 // first entry on that level 
+                tmp = soapList[enc_nodeIndex].name;
+                if (soapList[enc_nodeIndex].isDirectory) {
+                  tftset(2, tmp);                                  // show directories in yellow
+                }
+                else {
+                  if ((inx = tmp.indexOf(".mp3")) > 0 ||
+                      (inx = tmp.indexOf(".MP3")) > 0) {
+                    tmp = tmp.substring(0, inx);                   // remove extension (if any)
+                  }
+                  tftset(1, tmp);                                  // show files in cyan
+                }
+              }
+              else {
+                // strange error: container should contain elements but browse list is empty
+                dbgprint("singleClick: error browsing container on media server - list size: 0 !");
+                //tftset(1, "Error browsing       media server !");
+                tftset(4, "Error: no items returned");
+              }
+            }
+            else {
+              // error accessing media server
+              encoderMode = IDLING;
+              playMode = NONE;
+              dbgprint("singleClick: error accessing media server");
+              tftset(1, "Error accessing      media server !");
+              tftset(4, "Error");
+            }
+          } 
+          else {
+            tftset(4,"Sorry, no content !");
+            delay(1300);
+            tftset(4, "Turn to select directory  or track.\n"        // Show current option
+                      "Press to confirm.");
+          } 
+        }
+        else {
+          // item in list is a file
+          if (dataMode != STOPPED) {
+            dbgprint("STOP (singleClick & playMode == MEDIASERVER)");
+            dataMode = STOPREQD;                                     // Request STOP, do not touch longClick flag
+          } 
+          String uriLc = soapList[enc_nodeIndex].uri;
+          uriLc.toLowerCase();
+          if (soapList[enc_nodeIndex].size == 0 ||
+              soapList[enc_nodeIndex].fileType != fileTypeAudio ||
+              (!uriLc.endsWith(".mp3"))) {
+            dbgprint("error: %s is not a mp3 track", soapList[enc_nodeIndex].name.c_str());
+            tftset(4, "Error: Not a MP3 track !");                   // text on bottom in green
+          }
+          else {
+            host = "soap/" + soapList[enc_nodeIndex].uri;
+            hostObject = soapList[enc_nodeIndex];
+            dbgprint("Selected host=%s", host.c_str());
+            encoderMode = IDLING;                                    // Back to default mode
+            currentIndex = enc_nodeIndex;
+            hostreq = true;                                          // Request this host
+            mp3fileRepeatFlag = DIRECTORY;
+            mp3filePause = false;  
+            volRamp(VR_START);                                       // fade out, silence, fade in
+            //xQueueReset (dataQueue);
+            //tftset(4, "");                                         // Clear text
+          }
+        }
+      }
+#endif      
+    }
+    else { // not in SELECT mode
+      // we mute when in station mode and we pause when in sdcard mode
+      if (SD_okay && playMode == SDCARD &&                       // while playing files from SD
+          currentSource == SDCARD && dataMode == DATA) {
+        mp3filePause = !mp3filePause;
+        dbgprint("Playing mp3 file %s", mp3filePause ? "has paused." : "continues.");
+        if (mp3filePause) {
+          xQueueReset (dataQueue);
+        }
+      }
+      else {
+        muteFlag = !muteFlag;
+        volRamp(VR_MUTE);                                    // fade out resp. in
+        dbgprint("Output is now %s", muteFlag ? "muted" : "unmuted");
+      }
+    }
+    // TEST
+    dbgprint("Total free memory of all regions=%d (minEver=%d), freeHeap=%d (minEver=%d), minStack=%d (in Bytes)", 
+             ESP.getFreeHeap(), ESP.getMinFreeHeap(), xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL)); 
+    //
+    return;
+  }
+  if (rotationcount == 0) return;
+  
+  // Evaluating Encoder turns
+  dbgprint("rotationcount: %d", rotationcount);
+  // TEST
+  //dbgprint("rotationcount=%d, dataMode=%d, playMode=%d, totalCount=%d, currentSource=%d, currentPreset=%d, encoderMode=%d",
+  //            rotationcount, dataMode, playMode, totalCount, currentSource, currentPreset, encoderMode);
+  if (encoderMode == IDLING) {
+    if ((SD_okay && playMode == SDCARD &&                   // while playing files from SD
+         currentSource == SDCARD && dataMode == DATA && !mp3filePause) ||
+        (playMode == MEDIASERVER &&                         // or playing from media server
+         currentSource == MEDIASERVER && dataMode == DATA)) {
+      if (rotationcount > 0) {
+        if (playMode == SDCARD || playMode == MEDIASERVER)
+          mp3fileJumpForward = true;
+      }  
+      else {  
+        if (playMode == SDCARD)
+          mp3fileJumpBack = true;
+      }  
+    }
+    else if (playMode == STATION) {                        // we are in station mode
+      encoderMode = SELECT;                                // Switch to SELECT mode
+      dbgprint("Encoder mode set to SELECT");
+      tftset(4, "Turn to select station.\n"                // Show current option
+               "Press to confirm.");
+      if (currentPreset >= 0 && currentPreset <= highestPreset)
+        enc_preset = currentPreset;
+      else
+        enc_preset = 0;
+      tmp = readhostfrompref(enc_preset);                  // get host spec and possible comment
+      // Show just comment if available.  Otherwise the preset itself.
+      if ((inx = tmp.indexOf("#")) > 0) {                  // hash sign present?
+        tmp.remove(0, inx + 1);                            // remove non-comment part
+      }
+      chomp(tmp);                                          // remove garbage from description
+      dbgprint("Selected station is %d, %s", enc_preset, tmp.c_str());
+      tftset(2, tmp);                                      // Set screen segment
+    }
+#ifdef ENABLE_SOAP      
+    else { // playMode == MEDIASERVER
+      // is handled above in SDCARD branch already
+    }
+#endif
+  }
+  else { // encoderMode == SELECT
+    if (playMode == STATION) {
+      if ((enc_preset + rotationcount) < 0) {
+        enc_preset = highestPreset;                          // from 0 to highest preset
+      }
+      else {
+        enc_preset += rotationcount;                         // next preset
+      }
+      tmp = readhostfrompref (enc_preset);                   // get host spec and possible comment
+      if (tmp == "") {                                       // end of presets?
+        enc_preset = 0;                                      // wrap
+        tmp = readhostfrompref (enc_preset);                 // get host spec and possible comment
+      }
+      // Show just comment if available.  Otherwise the preset itself.
+      if ((inx = tmp.indexOf("#")) > 0) {                    // hash sign present?
+        tmp.remove (0, inx + 1);                             // remove non-comment part
+      }
+      chomp(tmp);                                            // remove garbage from description
+      dbgprint("Selected station is %d, %s", enc_preset, tmp.c_str());
+      tftset(2, tmp);                                        // set screen segment
+    }
+#ifdef SD_LIBRARY
+    else if (playMode == SDCARD && enc_libLevel >= 0) {      // turning through music library
+      sdLibRange(enc_libLevel, enc_libLevel ? enc_libPos[enc_libLevel - 1] : 0, &first, &count);
+      if (count) {                                           // wrap around at both ends
+        enc_libPos[enc_libLevel] = first + ((enc_libPos[enc_libLevel] - first + rotationcount) %
+                                            count + count) % count;
+        sdLibShow(enc_libLevel, enc_libPos[enc_libLevel]);
+      }
+    }
+#endif
+    else if (playMode == SDCARD) {
+      if (!mp3nodeList[enc_nodeIndex].isDirectory && noSubDirInSameDir(enc_nodeIndex))
+        // if knob is turned left we jump from first to last file if necessary
+        enc_nodeIndex = nextSDfileIndexInSameDir (enc_nodeIndex, rotationcount);
+      else
+        // if knob is turned left we do not jump from first to last directory/file
+        enc_nodeIndex = nextSDindexInSameDir (enc_nodeIndex, rotationcount);
+      enc_dirIndex = mp3nodeList[enc_nodeIndex].parentDir;
+      tmp = mp3nodeList.name(enc_nodeIndex);
+      if (mp3nodeList[enc_nodeIndex].isDirectory) {
+        tftset(2, tmp);
+      }
+      else {
+        if ((inx = tmp.indexOf(".mp3")) > 0 ||
+            (inx = tmp.indexOf(".MP3")) > 0) {
+          tmp = tmp.substring(0, inx);
+        }
+        tftset(1, tmp);
+      }
+    }
+#ifdef ENABLE_SOAP      
+    else { // playMode == MEDIASERVER
+      enc_nodeIndex += rotationcount;
+      if (enc_nodeIndex < 0) {
+        // begin of browse list reached
+        if (soapChain.back().startingIndex > 0) {
+          soapChain.back().startingIndex -= SOAP_DEFAULT_BROWSE_MAX_COUNT;
+          if (soapChain.back().startingIndex < 0)
+            soapChain.back().startingIndex = 0;
+          // browse request with new starting index  
+          dbgprint("Search again in media server container \"%s\" (child count: %d, startingIndex: %d)", 
+                   soapChain.back().name.c_str(), soapChain.back().size, soapChain.back().startingIndex);
+          bool ret = soap.browseServer(0, soapChain.back().id.c_str(), &soapList, soapChain.back().startingIndex);
+          if (ret) { 
+            // browsing mediaserver successful
+            enc_nodeIndex = soapList.size() - 1;                 // new index in browse list
+            if (soapList.size() > 0) {
+              tftset(4, "Turn to select directory  or track.\n"  // Show current option
+                        "Press to confirm.");
+              tmp = soapList[enc_nodeIndex].name;
+              if (soapList[enc_nodeIndex].isDirectory) {
+                tftset(2, tmp);
+              }
+              else {
+                String uriLc = soapList[enc_nodeIndex].uri;
+                uriLc.toLowerCase();
+                if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
+                    !uriLc.endsWith(".mp3"))
+                  tmp += " [not mp3]";
+                tftset(1, tmp);
+              }
+            }
+            else {
+              // still to be done (very unlikely error)
+            }
+          }
+          else {
+            // error accessing media server
+            encoderMode = IDLING;
+            playMode = NONE;
+            dbgprint("rotationcount %d: error accessing media server for more items", rotationcount);
+            tftset(1, "Error accessing      media server !");
+            tftset(4, "Error");
+            rotationcount = 0;
+            return;
+          }
+        }
+        else {
+          enc_nodeIndex = 0;                                     // no circling
+          dbgprint("begin of list reached");
+        }
+      }  
+      else if (enc_nodeIndex >= soapList.size()) {
+        // end of browse list reached
+        size_t sizeDir = soapChain.back().size;                  // elements in our current directory 
+        if (sizeDir > (soapList.size() + soapChain.back().startingIndex)) {
+          // items left to be shown
+          size_t more = sizeDir - soapList.size() - soapChain.back().startingIndex;
+          dbgprint("end of this browse list but %d more items to come in this directory", more);
+          size_t newStartingIndex = soapChain.back().startingIndex + soapList.size();
+          // browse request with new starting index  
+           dbgprint("Search again in media server container \"%s\" (child count: %d, startingIndex: %d)", 
+                     soapChain.back().name.c_str(), soapChain.back().size, newStartingIndex);
+          bool ret = soap.browseServer(0, soapChain.back().id.c_str(), &soapList, newStartingIndex);
+          if (ret) { 
+            // browsing root of mediaserver was successful
+            enc_nodeIndex = 0;                                   // new index in browse list
+            soapChain.back().startingIndex = newStartingIndex;
+            if (soapList.size() > 0) {
+              tftset(4, "Turn to select directory  or track.\n"  // Show current option
+                        "Press to confirm.");
+              tmp = soapList[enc_nodeIndex].name;
+              if (soapList[enc_nodeIndex].isDirectory) {
+                tftset(2, tmp);
+              }
+              else {
+                String uriLc = soapList[enc_nodeIndex].uri;
+                uriLc.toLowerCase();
+                if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
+                    !uriLc.endsWith(".mp3"))
+                  tmp += " [not mp3]";
+                tftset(1, tmp);
+              }
+            }
+            else {
+              // still to be done (very unlikely error)
+            }
+          }
+          else {
+            // error accessing media server
+            encoderMode = IDLING;
+            playMode = NONE;
+            dbgprint("rotationcount %d: error accessing media server for more items", rotationcount);
+            tftset(1, "Error accessing      media server !");
+            tftset(4, "Error");
+            rotationcount = 0;
+            soapChain.back().startingIndex = 0;
+            return;
+          }
+        }
+        else {
+          enc_nodeIndex = soapList.size() - 1;
+          dbgprint("no more items in this directory \"%s\" to come - end of list", soapChain.back().name.c_str());
+        }
+      }
+      tmp = soapList[enc_nodeIndex].name;
+      // rudimentary line limiting
+#define MAX_NAME_LENGTH 96
+      if (soapList[enc_nodeIndex].isDirectory) {
+        if (tmp.length() > MAX_NAME_LENGTH) {
+          tmp.remove(MAX_NAME_LENGTH - 3);
+          tmp += "...";
+        }  
+        tftset(2, tmp);
+      }
+      else {
+        String uriLc = soapList[enc_nodeIndex].uri;
+        uriLc.toLowerCase();
+        if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
+            !uriLc.endsWith(".mp3")) {
+          if (tmp.length() > MAX_NAME_LENGTH) {
+            tmp.remove(MAX_NAME_LENGTH - 13);
+            tmp += "...";
+          }  
+          tmp += " [not mp3]";
+        }
+        tftset(1, tmp);
+      }
+    }
+#endif    
+  }
+  rotationcount = 0;
+}
+
+//**************************************************************************************************
+//                                           M P 3 L O O P                                         *
+//**************************************************************************************************
+void mp3loop()
+{
+  static uint8_t  tmpbuff[5000];                        // Input buffer for mp3 stream
+  uint32_t        maxchunk;                             // Max number of bytes to read
+  int             res = 0;                              // Result reading from mp3 stream
+  uint32_t        av = 0;                               // Available in stream
+  int             fileIndex;                            // Next file index of track on SD
+  uint32_t        qspace;                               // Free space in data queue
+  uint32_t        i;
+
+  if (dataMode == STOPREQD) {                           // STOP requested?
+    dbgprint("mp3loop: STOP requested");
+    //if (currentSource != SDCARD && currentSource != MEDIASERVER)
+      xQueueReset (dataQueue);
+    if (currentSource == SDCARD) {
+      dbgprint("mp3loop: close mp3file");
+      claimSD("close");                                 // claim SPI bus or SD card
+      mp3file.close();
+      sdReadFlush(false);                               // nothing to read ahead
+      releaseSD();                                      // release SPI bus or SD card
+      mp3fileLength = mp3fileBytesLeft = 0;
+    }
+    else if (currentSource == STATION) {
+      stopMp3client();                                  // Disconnect if still connected
+    }
+#ifdef ENABLE_SOAP    
+    else { // MEDIASERVER
+      soap.readStop();
+      mp3fileLength = mp3fileBytesLeft = 0;
+      dbgprint("mp3loop: media server data connection closed");
+    }
+#endif    
+    chunked = false;                                    // Not longer chunked
+    datacount = 0;                                      // Reset datacount
+    outqp = outchunk.buf;                               // and pointer
+    newTrackPending = false;                            // queue is empty now
+    //if (currentSource != SDCARD && currentSource != MEDIASERVER)    
+      queuefunc(QSTOPSONG);                             // Queue a request to stop the song
+    metaint = 0;                                        // No metaint known now
+    vstelemetry = { "", 0, 0, 0, 0 };                   // No stream info anymore
+    dataMode = STOPPED;                                 // yes, state becomes STOPPED
+    currentSource = NONE;                               // currently no socket open
+  }
+  // Try to keep the Queue to playTask filled up by adding as much bytes as possible
+  if (dataMode & (INIT | HEADER | DATA |                // Test if playing
+                  METADATA | PLAYLISTINIT |
+                  PLAYLISTHEADER | PLAYLISTDATA)) {
+    maxchunk = sizeof(tmpbuff);                         // Reduce byte count for this mp3loop()
+    qspace = uxQueueSpacesAvailable(dataQueue) *        // Compute free space in data queue
+             sizeof(qdata_struct);
+    if (newTrackPending) {                              // Gapless: QNEWTRACK still to be queued?
+      newTrackPending = !queuefunc(QNEWTRACK, 0);       // yes, before any data of the new track
+      if (newTrackPending) {
+        qspace = 0;                                     // queue still full
+      }
+    }
+    if (currentSource == SDCARD) {                      // Playing file from SD card?
+      if (SD_okay) {
+        if (mp3filePause) {
+          mp3fileJumpForward = false;
+          mp3fileJumpBack = false;
+        }
+        else {
+          if (mp3fileJumpForward) {
+            int jumpSize, pos;
+            volRamp(VR_SEEK);                              // fading out/in helps against chirps
+            mp3fileJumpForward = false;
+            jumpSize = mp3fileLength / 10;
+            jumpSize >>= 2; jumpSize <<= 2;
+            if (mp3fileBytesLeft < jumpSize) {
+              jumpSize = mp3fileBytesLeft;
+            }
+            claimSD("sdread1");                             // claim SPI bus or SD card
+            pos = mp3file.size() - mp3fileBytesLeft;        // data read ahead doesn't count
+            mp3file.seek(pos + jumpSize);
+            sdReadFlush(true);                              // read ahead from here
+            releaseSD();                                    // release SPI bus or SD card
+            mp3fileBytesLeft -= jumpSize;                   // Number of bytes left
+            decodeBase = mp3fileLength - mp3fileBytesLeft;  // decode time counts from here
+            decodeTimeReset = true;
+            decodeResetQueued = false;                      // QNEWTRACK is dropped as well
+            newTrackPending = false;
+            xQueueReset (dataQueue);
+            qspace = uxQueueSpacesAvailable(dataQueue) *    // recalculate free space in data queue
+                     sizeof(qdata_struct);
+            //dbgprint("F mp3fileLength=%d, jumpSize=%d, pos=%d, neu mp3fileBytesLeft=%d",
+            //           mp3fileLength, jumpSize, pos, mp3fileBytesLeft);
+          }
+          else if (mp3fileJumpBack) {
+            int jumpSize, pos;
+            volRamp(VR_SEEK);                               // fading out/in helps against chirps
+            mp3fileJumpBack = false;
+            jumpSize = mp3fileLength / 10;
+            jumpSize >>= 2; jumpSize <<= 2;
+            if (jumpSize > mp3fileLength - mp3fileBytesLeft) {
+              jumpSize = mp3fileLength - mp3fileBytesLeft;
+            }
+            claimSD("sdread2");                             // claim SPI bus or SD card
+            pos = mp3file.size() - mp3fileBytesLeft;        // data read ahead doesn't count
+            mp3file.seek(pos - jumpSize);
+            sdReadFlush(true);                              // read ahead from here
+            releaseSD();                                    // release SPI bus or SD card
+            mp3fileBytesLeft += jumpSize;                   // Number of bytes left
+            decodeBase = mp3fileLength - mp3fileBytesLeft;  // decode time counts from here
+            decodeTimeReset = true;
+            decodeResetQueued = false;                      // QNEWTRACK is dropped as well
+            newTrackPending = false;
+            xQueueReset (dataQueue);
+            qspace = uxQueueSpacesAvailable(dataQueue) *    // recalculate free space in data queue
+                     sizeof(qdata_struct);
+          }
+          av = mp3fileBytesLeft;                            // Bytes left in file
+          if (maxchunk > av) {                              // Reduce byte count for this mp3loop()
+            maxchunk = av;
+          }
+          if (maxchunk > qspace) {                          // Enough space in queue?
+            maxchunk = qspace;                              // No, limit to free queue space
+          }
+          if (maxchunk) {                                   // Anything to read?
+            res = sdRead(tmpbuff, maxchunk);                // Read a block of data, 0 = not yet
+            if (res > 0) {
+              mp3fileBytesLeft -= res;                      // Number of bytes left
+            }
+            else if (res < 0) {
+              dbgprint("mp3loop: STOP (mp3file.read() error)");
+              res = 0;                                      // nothing to handle
+              dataMode = STOPREQD;
+              SD_okay = false;
+              currentIndex = -1;
+              mp3fileLength = mp3fileBytesLeft = 0;
+              tftset(1, "SD-Card Error !");
+              tftset(4, "Error reading SD card");
+              // not needed
+              //claimSPI("sdclose");                        // claim SPI bus
+              //mp3file.close();                            // close file
+              //releaseSPI();                               // release SPI bus
+            }
+          }
+        }
+      }
+    }
+    else if (currentSource == STATION) { // STATION
+      _claimSPI("mp3loop1");                               // claim SPI bus
+      av = mp3client.available();                          // Available from stream
+      _releaseSPI();                                       // release SPI bus
+      if (maxchunk > av) {                                 // Limit read size
+        maxchunk = av;
+      }
+      if (maxchunk > qspace) {                          // Enough space in queue?
+        maxchunk = qspace;                              // No, limit to free queue space
+      }
+      if (maxchunk) {                                   // Anything to read?
+        _claimSPI("mp3loop2");                          // claim SPI bus
+        res = mp3client.read(tmpbuff, maxchunk);        // Read a number of bytes from the stream
+        _releaseSPI();                                  // release SPI bus
+        if (res == 0 || res == -1)
+          dbgprint("res: %d", res); 
+      }
+      else {
+        if (dataMode == PLAYLISTDATA) {                    // End of playlist
+          playlist_num = 0;                                // And reset
+          dbgprint("End of playlist seen");
+          dataMode = STOPPED;
+          ini_block.newpreset++;                           // Go to next preset
+        }
+      }
+    }
+#ifdef ENABLE_SOAP    
+    else { // MEDIASERVER
+      if (mp3fileJumpForward) {
+        mp3fileJumpForward = false;
+        volRamp(VR_SEEK);                                  // fading out/in helps against chirps
+        // LS Mini has problems -> [RST, ACK] in Wireshark from LS Mini ... why ???
+        int jumpSize = mp3fileLength / 10;
+        jumpSize >>= 2; jumpSize <<= 2;
+        if (mp3fileBytesLeft < jumpSize) {
+          jumpSize = mp3fileBytesLeft;
+        }
+        int toRead = jumpSize;
+        for (; toRead > 0;) {
+          int ret = soap.read(tmpbuff, sizeof(tmpbuff) < toRead ? sizeof(tmpbuff) : toRead);
+          if (ret <= 0) {
+            // read error or EOF
+            soap.readStop();
+            break;
+          }  
+          toRead -= ret;
+          //mp3fileBytesLeft -= ret;                         // Number of bytes left
+        }
+        mp3fileBytesLeft = soap.available();               // Bytes left in file
+        decodeBase = mp3fileLength - mp3fileBytesLeft;     // decode time counts from here
+        decodeTimeReset = true;
+        decodeResetQueued = false;                         // QNEWTRACK is dropped as well
+        newTrackPending = false;
+        xQueueReset (dataQueue);
+        qspace = uxQueueSpacesAvailable(dataQueue) *       // recalculate free space in data queue
+                  sizeof(qdata_struct);
+      }
+      av = soap.available();                               // Bytes left in file
+      //av = mp3fileBytesLeft;
+      if (maxchunk > av) {                                 // Reduce byte count for this mp3loop()
+        maxchunk = av;
+      }
+      if (maxchunk > qspace) {                             // Enough space in queue?
+        maxchunk = qspace;                                 // No, limit to free queue space
+      }
+      if (maxchunk) {                                      // Anything to read?
+        res = soap.read(tmpbuff, maxchunk);                // Read a block of data
+        mp3fileBytesLeft -= res;                           // Number of bytes left
+        if (res <= 0) {
+          soap.readStop();
+          dbgprint("mp3loop: STOP (soap.read() error)");
+          dataMode = STOPREQD;
+          mp3fileLength = mp3fileBytesLeft = 0;
+          tftset(1, "Media Server Error !");
+          tftset(4, "Error reading from media server");
+        }
+      }
+    }
+#endif    
+    for (i = 0; i < res; i++) {
+      handlebyte_ch(tmpbuff[i]);                           // Handle one byte
+    }
+  }
+  if (currentSource == SDCARD) {                           // Playing from SD?
+    if (dataMode & DATA && !mp3filePause &&                // Test if playing
+        av == 0) {                                         // End of mp3 data?
+      dbgprint("mp3loop: end of mp3 file -> close mp3file");
+      claimSD("close2");                                   // claim SPI bus or SD card
+      mp3file.close();                                     // Close file
+      sdReadFlush(false);                                  // nothing to read ahead
+      releaseSD();                                         // release SPI bus or SD card
+      dataMode = STOPREQD;                                 // End of local mp3-file detected
+      if (SD_okay && currentIndex > 0) {
+        const char* next;                                  // File to read next
+        bool        same;                                  // Same format as the one finished
+        if (!mp3fileRepeatFlag)
+          fileIndex = nextSDfileIndex(currentIndex, +1);   // Select the next file on SD
+        else if (mp3fileRepeatFlag == SONG)
+          fileIndex = currentIndex;                        // Select the same file
+        else if (mp3fileRepeatFlag == DIRECTORY)
+          fileIndex = nextSDfileIndexInSameDir(currentIndex, +1); // select next file in same directory
+        else
+          fileIndex = shuffleNext(+1);                     // random mode
+        next = getSDfilename(fileIndex);
+        same = sameFormat(host.c_str(), next);
+        host = next;                                       // keeps its buffer if big enough
+        if (host.startsWith("error")) {
+          dbgprint("SD problem: Can't find file with index %d", fileIndex);
+        }
+        else if (mp3fileGapless && same &&
+                 connecttofile()) {                        // open next file while queue still plays
+          dataMode = DATA;                                 // no STOP, decoder keeps running
+          decodeBase = mp3fileLength - mp3fileBytesLeft;   // decode time counts from here
+          queueNewTrack();                                 // once the last track has been played
+          dbgprint("mp3loop: gapless transition to next file");
+        }
+        else {
+          hostreq = true;                                  // Request this host
+        }
+      }
+      if (dataMode == STOPREQD) {
+        delay(100);
+      }
+    }
+  }
+#ifdef ENABLE_SOAP  
+  else if (currentSource == MEDIASERVER) {
+    if (dataMode & DATA && av == 0) {                      // playing and end of mp3 data? 
+      dbgprint("mp3loop: end of file from media server");
+      soap.readStop();
+      dataMode = STOPREQD;                                     // End of local mp3-file detected
+      if (mp3fileRepeatFlag != NOREPEAT) {
+        String lastHost = host;                                // File we finished reading
+        int16_t newIndex;
+        if (mp3fileRepeatFlag == SONG) {
+          newIndex = currentIndex;                             // play same file
+        }
+        else {
+          newIndex = nextSoapFileIndex(currentIndex, +1);      // Select next mp3 file in list
+        }
+        if (newIndex != -1) {
+          dbgprint("Next file soapList[%d]: \"%s\"",newIndex, soapList[newIndex].name.c_str());
+          host = "soap/" + soapList[newIndex].uri;
+          hostObject = soapList[newIndex];
+          currentIndex = newIndex;
+          if (mp3fileGapless && sameFormat(lastHost.c_str(), host.c_str()) &&
+              connecttomediaserver()) {                        // next file while queue still plays
+            dataMode = DATA;                                   // no STOP, decoder keeps running
+            decodeBase = mp3fileLength - mp3fileBytesLeft;     // decode time counts from here
+            queueNewTrack();                                   // once the last track has been played
+            dbgprint("mp3loop: gapless transition to next file");
+          }
+          else {
+            hostreq = true;                                    // Request this host
+          }
+        }
+        else {
+          dbgprint("Soap list problem: Can't find next entry in list");
+        }
+      }
+      else {
+        // stop playing after this file and show directory content
+        String tmp;
+        soapChain_t dir = soapChain.back();                    // retrieve last element in chain
+        dbgprint("Search in media server container \"%s\" (child count: %d)", 
+                 dir.name.c_str(), dir.size);
+        bool ret = soap.browseServer(0, dir.id.c_str(), &soapList);
+        if (ret) {                                             // browsing mediaserver one level higher
+          encoderMode = SELECT;
+          if (soapList.size() > 0) {
+            tftset(4, "Turn to select directory  or track.\n"  // Show current option
+                      "Press to confirm.");
+            currentIndex = 0;                                  // first entry on that level 
+            tmp = soapList[currentIndex].name;
+            if (soapList[currentIndex].isDirectory) {
+              tftset(2, tmp);
+            }
+            else {
+              String uriLc = soapList[currentIndex].uri;
+              uriLc.toLowerCase();
+              if (soapList[currentIndex].fileType != fileTypeAudio ||
+                  !uriLc.endsWith(".mp3"))
+                tmp += " [not mp3]";
+              tftset(1, tmp);
+            }
+          }
+        }
+        else {
+          // error accessing media server
+          encoderMode = IDLING;
+          playMode = NONE;
+          dbgprint("End of file: error re-accessing media server");
+          tftset(1, "End of file.         Error re-accessing   media server !");
+          tftset(4, "Error");
+        }
+      }
+      if (dataMode == STOPREQD) {
+        delay(100);
+      }
+    }
+  }
+#endif  
+  if (ini_block.newpreset != currentPreset) {              // new station or next from playlist requested?
+    dbgprint("mp3loop: ini_block.newpreset[%d] != currentPreset[%d]",
+               ini_block.newpreset, currentPreset);
+    if (dataMode != STOPPED) {                             // Yes, still busy?
+      dbgprint("mp3loop: STOP7 (dataMode != STOPPED)");
+      dataMode = STOPREQD;                                 // Yes, request STOP
+    }
+    else {
+      if (playlist_num) {                                  // Playing from playlist?
+        // Yes, retrieve URL of playlist
+        playlist_num += ini_block.newpreset -
+                        currentPreset;                     // Next entry in playlist
+        ini_block.newpreset = currentPreset;               // Stay at current preset
+      }
+      else {
+        host = readhostfrompref();                         // Lookup preset in preferences
+        chomp (host);                                      // Get rid of part after "#"
+      }
+      dbgprint("mp3loop: New preset/file requested (%d/%d) from %s",
+               ini_block.newpreset, playlist_num, host.c_str());
+      if (host != "") {                                    // Preset in ini-file?
+        hostreq = true;                                    // Force this station as new preset
+      }
+      else {
+        // This preset is not available, return to preset 0, will be handled in next mp3loop()
+        dbgprint("mp3loop: No host for this preset");
+        ini_block.newpreset = 0;                           // Wrap to first station
+      }
+    }
+  }
+  if (hostreq) {                                           // New preset or station?
+    dbgprint("mp3loop: hostreq=true");
+    hostreq = false;
+    mp3filePause = false;
+    currentPreset = ini_block.newpreset;                   // Remember current preset
+
+    // Check source type
+    if (host.indexOf("sdcard/") == 0)
+      currentSource = SDCARD;
+    else if (host.indexOf("soap/") == 0)
+      currentSource = MEDIASERVER;
+    else
+      currentSource = STATION;
+    
+    if (currentSource == SDCARD) {                         // play file from SD card?
+      volRamp(VR_START);
+      playMode = SDCARD;
+      mp3fileJumpForward = false;
+      mp3fileJumpBack = false;
+      if (connecttofile()) {                               // open mp3-file
+        dataMode = DATA;                                   // start in DATA mode
+        decodeBase = mp3fileLength - mp3fileBytesLeft;     // decode time counts from here
+        decodeResetQueued = false;
+        newTrackPending = false;
+        dbgprint("mp3loop: connecttofile() returns ok, dataMode=DATA");
+      }
+      else {
+        SD_okay = false;
+        currentIndex = -1;
+        dataMode = STOPPED;                                // error happened by opening file on SD
+        currentSource = NONE;
+        host = "";
+        dbgprint("mp3loop: connecttofile() returned error");
+        tftset(1, "SD-Card Error !         If SD was swapped, please press SD Button again.");
+        tftset(4, "Error opening file.");
+      }
+    }
+    else if (currentSource == STATION) {
+      volRamp(VR_START);
+      playMode = STATION;
+      if (host.startsWith("ihr/")) {                       // iHeartRadio station requested?
+        host = host.substring(4);                          // Yes, remove "ihr/"
+        host = xmlgethost(host);                           // Parse the xml to get the host
+      }
+      if (host.length() > 0) {                             // Basic check
+#ifdef USE_ETHERNET
+        if (reInitEthernet) {                              // set in timer10sec()
+          reInitEthernet = false;
+          dbgprint("mp3loop: we are requested to re-initialize the ethernet card");
+          initEthernet(false);                             // no TFT output
+        }
+#endif        
+        connectToHost();                                   // Switch to new host
+      }
+      else {
+        dbgprint("mp3loop: host value invalid. Try next preset.");
+        ini_block.newpreset++;
+        if (ini_block.newpreset > highestPreset)
+          ini_block.newpreset = 0;
+      }
+    }
+#ifdef ENABLE_SOAP    
+    else { // MEDIASERVER
+      if (connecttomediaserver()) {                        // request file and check for ID3 tags
+        dataMode = DATA;                                   // Start in DATA mode
+        decodeBase = mp3fileLength - mp3fileBytesLeft;     // decode time counts from here
+        decodeResetQueued = false;
+        newTrackPending = false;
+        dbgprint("mp3loop: connecttomediaserver() returns ok, dataMode=DATA");
+      }
+      else {
+        dataMode = STOPPED;                                // error requesting/reading file
+        currentSource = NONE;
+        host = "";
+      }
+    }
+#endif
+  }
+}
+
+#ifdef PORT23_ACTIVE
+//**************************************************************************************************
+//                          H A N D L E C L I E N T O N P O R T 2 3                                *
+//**************************************************************************************************
+// Handle connect/disconnect of clients on port 23. Debug output gets sent via dbgprint() if open. *
+//**************************************************************************************************
+void handleClientOnPort23()
+{
+  static char dbgTextBuf[MAXSIZE_TELNET_CMD];          //someplace to put received cmd
+  static int  dbgCharsReceived = 0;
+  static bool EOLseen = false;
+  
+  if (!dbgConnectFlag)
+  {
+    _claimSPI("port231");                          // claim SPI bus
+    dbgclient = dbgserver.accept();
+    _releaseSPI();                                   // release SPI bus
+    if (dbgclient)
+    {
+      dbgConnectFlag = true;
+      _claimSPI("port232");                        // claim SPI bus
+      dbgclient.print("\r\nESP32-Radio Debug Server on port 23\r\n");
+#ifdef CHECK_LOOP_TIME
+      dbgclient.print("Press 't'+ENTER to reset loop timer.\r\n");
+#endif
+      dbgclient.print("Press 'q'+ENTER to quit.\r\n\r\n");
+      //dbgclient.println("");
+      _releaseSPI();                                 // release SPI bus
+      dbgprint("Debug Client on port 23 connected.");  // Get's already sent to debug client on port 23
+    }
+  }
+  else { // connect flag still set
+    _claimSPI("port233");                          // claim SPI bus
+    // we don't accept another client, so recline
+    //dbgserver.available().stop();                   // not needed... ?
+    uint8_t con = dbgclient.connected();
+    _releaseSPI();                                   // release SPI bus
+    if (con) {                                        // debug client still connected ?
+      _claimSPI("port234");                        // claim SPI bus
+      int charsWaiting = dbgclient.available();
+      _releaseSPI();                                 // release SPI bus
+      if (charsWaiting) {                            // data available
+        do {
+          _claimSPI("port235");                    // claim SPI bus
+          char c = dbgclient.read();
+          _releaseSPI();                             // release SPI bus
+          dbgTextBuf[dbgCharsReceived++] = c;
+          charsWaiting--;
+          if (c ==  0x0D)                            // end of line (Enter key)
+            EOLseen = true;
+        } while (dbgCharsReceived <= MAXSIZE_TELNET_CMD && charsWaiting > 0);   
+        if (EOLseen) {
+          EOLseen = false;
+          dbgCharsReceived = 0;
+          switch (dbgTextBuf[0]) {
+            case 0x0D: break;                         // ignore empty line
+            case 'q':  
+              _claimSPI("port236");                // claim SPI bus
+              dbgclient.print("\r\nBye bye.\r\n");
+              dbgclient.flush();
+              dbgclient.stop();
+              _releaseSPI();                         // release SPI bus
+              dbgConnectFlag = false;
+              dbgprint("Debug Client on port 23 disconnected on his request.");
+              break;
+            case '?':
+              _claimSPI("port237");                // claim SPI bus
+#ifdef CHECK_LOOP_TIME
+              dbgclient.print("Press 't'+ENTER to reset loop timer.\r\n");
+#endif
+#ifdef TASK_STATS
+              dbgclient.print("Press 's'+ENTER for task statistics.\r\n");
+#endif
+              dbgclient.print("Press 'q'+ENTER to quit.\r\n\r\n");
+              //dbgclient.println("");
+              _releaseSPI();                         // release SPI bus
+              break;            
+#ifdef TASK_STATS
+            case 's':                                  // task statistics
+              dbgprintLines(taskStatsText());
+              break;
+#endif
+#ifdef CHECK_LOOP_TIME
+            case 't':                                  // CTRL-T resets loop timer
+              maxLoopTime = 0;
+              dbgprint("Loop timer resetted.");
+              break;
+#endif
+            default: 
+              _claimSPI("port238");                // claim SPI bus
+              dbgclient.print("\r\nUnrecognized command.  ? for help.\r\n");
+              _releaseSPI();                         // release SPI bus
+              break;
+          }
+        }
+        if (dbgCharsReceived >= MAXSIZE_TELNET_CMD) {
+          dbgCharsReceived = 0;
+          //EOLseen = false;
+          _claimSPI("port239");                    // claim SPI bus
+          dbgclient.print("\r\nUnrecognized command.  ? for help.\r\n");
+          _releaseSPI();                             // release SPI bus
+        }
+      }
+    }
+    else { // connection gone (eg. client has disconnected)
+      _claimSPI("port2310");                       // claim SPI bus
+      dbgclient.flush();
+      dbgclient.stop();
+      _releaseSPI();                                 // release SPI bus
+      dbgConnectFlag = false;                         // remember connection state
+      EOLseen = false;
+      dbgCharsReceived = 0;
+      dbgprint("Debug Client on port 23 has disconnected.");
+    }
+  }
+}
+#endif
+
+//**************************************************************************************************
+//                                    W A I T F O R W O R K                                        *
+//**************************************************************************************************
+// Called at the end of loop().  Instead of polling everything again at once, loop() sleeps until  *
+// an interrupt or task wakes it (encoder, IR, clicks, buttons, queue drained) or a timeout ends.  *
+// Sockets and serial input have no event, so they are polled every LOOP_NET_WAIT ms while a       *
+// stream is read and every LOOP_IDLE_WAIT ms otherwise.                                           *
+//**************************************************************************************************
+void waitForWork()
+{
+  TickType_t wait = LOOP_IDLE_WAIT;                     // default: nothing urgent
+
+  if (hostreq || resetreq || http_reponse_flag ||       // pending work from this round?
+      (dataMode == STOPREQD) || sdScanReq || sdScanActive || sdLoadDone ||
+      (ini_block.newpreset != currentPreset)) {
+    return;                                             // yes, no sleep
+  }
+#ifdef SD_LIBRARY
+  if (sdLibReq || (sdLibActive && !(dataMode & DATA))) { // library to be built, nothing plays?
+    return;                                             // yes, next track right away
+  }
+#endif
+  if ((dataMode & (INIT | HEADER | DATA | METADATA |    // reading input?
+                   PLAYLISTINIT | PLAYLISTHEADER |
+                   PLAYLISTDATA)) &&
+      uxQueueSpacesAvailable(dataQueue)) {              // and room in the queue?
+    if (currentSource == SDCARD) {
+#ifdef SD_READER
+      if (sdReadOn && sdReadCur < 0 && uxQueueMessagesWaiting(sdReadFull) == 0) {
+        wait = LOOP_NET_WAIT;                           // sdReadTask wakes us with the next block
+      }
+      else if (!mp3filePause) return;                   // data read ahead is available
+#else
+      if (!mp3filePause) return;                        // file data is always available
+#endif
+    }
+    else {
+      wait = LOOP_NET_WAIT;                             // poll the socket more often
+    }
+  }
+  ulTaskNotifyTake(pdTRUE, wait / portTICK_PERIOD_MS);  // sleep until woken or timeout
+}
+
+//**************************************************************************************************
+//                                           L O O P                                               *
+//**************************************************************************************************
+// Main loop of the program.                                                                       *
+//**************************************************************************************************
+void loop()
+{
+  //delay(1);                                             // resets task switcher watchdog, just in case it's needed
+#ifdef ENABLE_ESP32_HW_WDT
+  esp_task_wdt_reset();                                 // avoid panic and subsequent ESP32 restart
+#endif   
+#ifdef CHECK_LOOP_TIME
+  uint32_t timing;                                      // for calculation of loop() round times
+  timing = millis();
+#endif
+  mp3loop();                                            // Do mp3 related actions
+  if (resetreq) {                                       // Reset requested?
+    delay(1000);                                        // Yes, wait some time
+    ESP.restart();                                      // Reboot
+  }
+  scanserial();                                         // Handle serial input
+#ifdef ENABLE_DIGITAL_INPUTS  
+  scandigital();                                        // Scan digital inputs
+#endif  
+#ifdef ENABLE_INFRARED
+  scanIR();                                             // See if IR input
+#endif
+#ifndef USE_ETHERNET
+  ArduinoOTA.handle();                                  // Check for OTA
+#endif
+  mp3loop();                                            // Do more mp3 related actions
+  sdScanStep();                                         // Scan SD card in the background
+  taskPlayPrio();                                       // Task priorities for playing or not
+#ifdef SD_LIBRARY
+  sdLibStep();                                          // Read ID3 tags for the music library
+#endif
+#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
+  handlehttpreply();
+  _claimSPI("loop");                                    // claim SPI bus
+  cmdclient = cmdserver.available();                    // Check Input from client
+  _releaseSPI();                                        // release SPI bus
+  if (cmdclient) {                                      // Client connected ?
+    dbgprint("loop(): command client available");
+    handlehttp();
+  }
+#endif  
+  //
+  handleSaveReq();                                      // See if time to save settings
+  checkEncoderAndButtons();                             // check rotary encoder & button functions
+#ifdef POWER_SAVE
+  pmUpdate();                                           // CPU clock according to audio flow
+#endif
+#ifdef PORT23_ACTIVE
+  handleClientOnPort23();                               // check possible debug client requests
+#endif
+#ifdef CHECK_LOOP_TIME
+  timing = millis() - timing;
+  if (timing > maxLoopTime) {                           // new maximum found?
+    maxLoopTime = timing;                               // yes, set new maximum
+    dbgprint("Max duration loop() = %d ms", timing);    // and report it
+  }
+#endif
+  waitForWork();                                        // sleep until there is something to do
+}
+
+//**************************************************************************************************
+//                                   T A S K P L A Y P R I O                                       *
+//**************************************************************************************************
+// Tasks with a playback priority in taskdef[] get it as long as dataMode is DATA, and their       *
+// normal priority again when playing stops.  That keeps the SD read ahead going while spfTask or  *
+// the extender are busy, without taking time from them while the radio is idle.                   *
+//**************************************************************************************************
+void taskPlayPrio()
+{
+  static bool  playing = false;                         // Playback priorities active
+  bool         now = tasksStarted && (dataMode & DATA);
+  unsigned int i;
+
+  if (now == playing) {                                 // Any change?
+    return;                                             // No, nothing to do
+  }
+  playing = now;
+  for (i = 0; i < sizeof(taskdef) / sizeof(taskdef[0]); i++) {
+    if (taskdef[i].playprio && *taskdef[i].handle) {
+      vTaskPrioritySet(*taskdef[i].handle, playing ? taskdef[i].playprio : taskdef[i].prio);
+    }
+  }
+}
+
+//**************************************************************************************************
+//                                    C H K H D R L I N E                                          *
+//**************************************************************************************************
+// Check if a line in the header is a reasonable headerline.                                       *
+// Normally it should contain something like "icy-xxxx:abcdef".                                    *
+//**************************************************************************************************
+bool chkhdrline(const char* str)
+{
+  char b;                                             // Byte examined
+  int  len = 0;                                       // Length of string
+
+  while ((b = *str++)) {                              // Search to end of string
+    len++;                                            // Update string length
+    if (!isalpha(b)) {                                // Alpha (a-z, A-Z)
+      if (b != '-') {                                 // Minus sign is allowed
+        if (b == ':') {                               // Found a colon?
+          return ((len > 5) && (len < 50));           // Yes, okay if length is okay
+        }
+        else {
+          return false;                               // Not a legal character
+        }
+      }
+    }
+  }
+  return false;                                       // End of string without colon
+}
+
+//**************************************************************************************************
+//                            S C A N _ C O N T E N T _ L E N G T H                                *
+//**************************************************************************************************
+// If the line contains content-length information: set clength (content length counter).          *
+//**************************************************************************************************
+void scan_content_length(const char* metalinebf)
+{
+  if (strstr(metalinebf, "Content-Length")) {        // Line contains content length
+    clength = atoi(metalinebf + 15);                 // Yes, set clength
+    dbgprint("Content-Length is %d", clength);       // Show for debugging purposes
+  }
+}
+
+//**************************************************************************************************
+//                                   H A N D L E B Y T E _ C H                                     *
+//**************************************************************************************************
+// Handle the next byte of data from server or mp3 file.                                           *
+// Chunked transfer encoding aware. Chunk extensions are not supported.                            *
+//**************************************************************************************************
+void handlebyte_ch(uint8_t b)
+{
+  static int       chunksize = 0;                      // Chunkcount read from stream
+  static uint16_t  playlistcnt;                        // Counter to find right entry in playlist
+  static int       LFcount;                            // Detection of end of header
+  static bool      ctseen = false;                     // First line of header seen or not
+  static bool      nameseen = false;                   // Name of station seen
+  static bool      brseen = false;                     // Bitrate of station seen
+
+  if (chunked &&
+       (dataMode & (DATA |                             // Test op DATA handling
+                    METADATA |
+                    PLAYLISTDATA))) {
+    if (chunkcount == 0) {                             // Expecting a new chunkcount?
+      if (b == '\r') {                                 // Skip CR
+        return;
       }
-      else { 
-        // error accessing media server
-        dbgprint("buttonMediaserver: error accessing media server");
-        encoderMode = IDLING;
-        playMode = NONE;
-        tftset(1, "Error accessing      media server !");
-        tftset(4, "Error");
-        // probably media server still sleeping, send WOL message
-        if (ini_block.srv_macWOL.length() > 0) {
-          dbgprint("Send wake up message to MAC: %s", ini_block.srv_macWOL.c_str());
-          soap.wakeUpServer(ini_block.srv_macWOL.c_str()); 
-        }
+      else if (b == '\n') {                            // LF ?
+        chunkcount = chunksize;                        // Yes, set new count
+        chunksize = 0;                                 // For next decode
+        return;
+      }
+      // We have received a hexadecimal character.  Decode it and add to the result.
+      b = toupper(b) - '0';                            // Be sure we have uppercase
+      if (b > 9) {
+        b = b - 7;                                     // Translate A..F to 10..15
       }
+      chunksize = (chunksize << 4) + b;
+      return;
     }
-    // TEST
-    dbgprint("Total free memory of all regions=%d (minEver=%d), freeHeap=%d (minEver=%d), minStack=%d (in Bytes)", 
-             ESP.getFreeHeap(), ESP.getMinFreeHeap(), xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL)); 
-    //              
-    return;
-  }  
-#endif  
-  if (singleClick) {
-    dbgprint("Single click");
-    singleClick = false;
-    if (encoderMode == SELECT) {
-      if (playMode == STATION) {
-        encoderMode = IDLING;                                // back to default mode
-        currentPreset = -1;                                  // make sure current preset is different
-        ini_block.newpreset = enc_preset;                    // make a definite choice
-        //tftset(4, "");                                     // clear text
-        dbgprint("ini_block.newpreset=%d", ini_block.newpreset);
-        muteFlag = 30;                                       // ca. 3 sec.
-        mp3fileRepeatFlag = NOREPEAT;
+    chunkcount--;                                      // Update count to next chunksize block
+  }
+  if (dataMode == DATA) {                              // Handle next byte of MP3/Ogg data
+    *outqp++ = b;
+    if (outqp == (outchunk.buf + sizeof(outchunk.buf))) { // Buffer full?
+      outchunk.datatyp = QDATA;                        // This chunk dedicated to QDATA
+      // Send data to playTask queue.  If the buffer cannot be placed within 200 ticks,
+      // the queue is full, while the sender tries to send more.  The chunk will be dis-
+      // carded in that case.
+      xQueueSend(dataQueue, &outchunk, 200);           // send to queue (wait max 200 ticks [resp. 200ms])
+      outqp = outchunk.buf;                            // item empty now
+    }
+    //*/
+    if (metaint) {                                     // No METADATA on Ogg streams or mp3 files
+      if (--datacount == 0) {                          // End of datablock?
+        dataMode = METADATA;
+        metalinebfx = -1;                              // Expecting first metabyte (counter)
       }
-      else if (playMode == SDCARD) {
-        if (!mp3nodeList[enc_nodeIndex].isDirectory) {
-          // regular file
-          if (dataMode != STOPPED) {
-            dbgprint("STOP (singleClick & playMode == SDCARD)");
-            dataMode = STOPREQD;                             // Request STOP, do not touch longClick flag
-          }
-          encoderMode = IDLING;                              // Back to default mode
-          enc_filename = getSDfilename(enc_nodeIndex);       // Set new filename
-          host = enc_filename;                               // Selected track as new host
-          if (host.startsWith("error")) {
-            dbgprint("SD problem: Can't find track");
-            tftset(4, "Error");                              // text on bottom in green
-          }
-          else {
-            dbgprint("Selected host=%s", host.c_str());
-            currentIndex = enc_nodeIndex;
-            hostreq = true;                                   // Request this host
-            mp3fileRepeatFlag = NOREPEAT;
-            mp3filePause = false;
-            muteFlag = 10;                                    // ca. 1 sec.
-            //xQueueReset (dataQueue);
-            //tftset(4, "");                                  // Clear text
-          }
+    }
+    return;
+  }
+  if (dataMode == INIT) {                              // Initialize for header receive
+    ctseen = false;                                    // Contents type not seen yet
+    nameseen = false;                                  // Name of station not seen yet
+    brseen = false;                                    // Bitrate of station not seen yet
+    metaint = 0;                                       // No metaint found
+    LFcount = 0;                                       // For detection end of header
+    bitrate = 0;                                       // Bitrate still unknown
+    dbgprint("Switch to HEADER"); 
+    dataMode = HEADER;                                 // Handle header
+    totalCount = 0;                                    // Reset totalCount
+    metalinebfx = 0;                                   // No metadata yet
+    metalinebf[0] = '\0';
+    volRamp(VR_START);                                 // fade out, silence, fade in
+  }
+  if (dataMode == HEADER) {                            // Handle next byte of MP3 header
+    b = utf8ascii(b);
+    if ((b > 0x7F) ||                                  // Ignore unprintable characters
+        (b == '\r') ||                                 // Ignore CR
+        (b == '\0')) {                                 // Ignore NULL
+      // Yes, ignore
+    }
+    else if (b == '\n') {                              // Linefeed ?
+      LFcount++;                                       // Count linefeeds
+      metalinebf[metalinebfx] = '\0';                  // Take care of delimiter
+      if (chkhdrline(metalinebf)) {                    // Reasonable input?
+        dbgprint("Headerline: %s", metalinebf);        // Show headerline
+        String metaline = String(metalinebf);          // Convert to string
+        String lcml = metaline;                        // Use lower case for compare
+        lcml.toLowerCase();
+        if (lcml.startsWith("location: http://")) {    // Redirection?
+          host = metaline.substring(17);               // Yes, get new URL
+          hostreq = true;                              // And request this one
+          dbgprint("Redirection to new host");
         }
-        else {
-          // try to enter selected directory
-          if ((inx = firstSDindexInDir(enc_nodeIndex)) != enc_nodeIndex) {
-            // directory contains entries (files or dirs)
-            enc_dirIndex = enc_nodeIndex;
-            enc_nodeIndex = inx;                               // new current index
-            tmp = mp3nodeList[inx].name;
-            if (mp3nodeList[inx].isDirectory) {
-              tftset(2, tmp);                                // show directories in yellow
-            }  
-            else {
-              if ((inx = tmp.indexOf(".mp3")) > 0 ||
-                  (inx = tmp.indexOf(".MP3")) > 0) {
-                tmp = tmp.substring(0, inx);                 // remove file extension
-              }
-              tftset(1, tmp);                                // show files in cyan
-            }
+        else if (lcml.indexOf("content-type") == 0) {  // Line beginning with "Content-Type: xxxx/yyy"
+          ctseen = true;                               // Yes, remember seeing this
+          //String ct = metaline.substring(13);        // Set contentstype. Not used yet
+          //ct.trim();
+          //dbgprint("%s seen.", ct.c_str());
+        }
+        else if (lcml.startsWith("icy-br:")) {
+          brseen = true;
+          bitrate = metaline.substring(7).toInt();     // Found bitrate tag, read the bitrate
+          if (bitrate == 0) {                          // For Ogg br is like "Quality 2"
+            bitrate = 87;                              // Dummy bitrate
           }
         }
-      }
-#ifdef ENABLE_SOAP      
-      else { // playMode == MEDIASERVER
-        if (soapList[enc_nodeIndex].isDirectory) {
-          // enter directory when searchable and not empty
-          if (soapList[enc_nodeIndex].size > 0 &&                  // container contains elements
-              soapList[enc_nodeIndex].searchable) {                // and is searchable
-            soapChain_t tmpId;
-            tmpId.id = soapList[enc_nodeIndex].id;
-            tmpId.name = soapList[enc_nodeIndex].name;
-            tmpId.size = soapList[enc_nodeIndex].size;
-            tmpId.startingIndex = 0;
-            dbgprint("Search in media server container \"%s\" (child count: %d)", 
-                     soapList[enc_nodeIndex].name.c_str(), soapList[enc_nodeIndex].size);
-            bool ret = soap.browseServer(0, soapList[enc_nodeIndex].id.c_str(), &soapList);
-            if (ret) { 
-              // browsing media server was successful
-              if (soapList.size() > 0) {
-                tftset(4, "Turn to select directory  or track.\n"  // Show current option
-                          "Press to confirm.");
-                soapChain.push_back(tmpId);                        // to find our way back up          
-                enc_nodeIndex = 0;                                 // first entry on that level 
-                tmp = soapList[enc_nodeIndex].name;
-                if (soapList[enc_nodeIndex].isDirectory) {
-                  tftset(2, tmp);                                  // show directories in yellow
-                }
-                else {
-                  if ((inx = tmp.indexOf(".mp3")) > 0 ||
-                      (inx = tmp.indexOf(".MP3")) > 0) {
-                    tmp = tmp.substring(0, inx);                   // remove extension (if any)
-                  }
-                  tftset(1, tmp);                                  // show files in cyan
-                }
-              }
-              else {
-                // strange error: container should contain elements but browse list is empty
-                dbgprint("singleClick: error browsing container on media server - list size: 0 !");
-                //tftset(1, "Error browsing       media server !");
-                tftset(4, "Error: no items returned");
-              }
-            }
-            else {
-              // error accessing media server
-              encoderMode = IDLING;
-              playMode = NONE;
-              dbgprint("singleClick: error accessing media server");
-              tftset(1, "Error accessing      media server !");
-              tftset(4, "Error");
+        else if (lcml.startsWith("icy-metaint:")) {
+          metaint = metaline.substring(12).toInt();    // Found metaint tag, read the value
+        }
+        else if (lcml.startsWith("icy-name:")) {
+          icyname = metaline.substring(9);             // Get station name
+          icyname.trim();                              // Remove leading and trailing spaces
+          if (icyname.length() > 0) {
+            nameseen = true;
+            if (icyname.length() > 62) {               // line limiting
+              icyname.remove(59);
+              icyname += "...";
             }
-          } 
-          else {
-            tftset(4,"Sorry, no content !");
-            delay(1300);
-            tftset(4, "Turn to select directory  or track.\n"        // Show current option
-                      "Press to confirm.");
-          } 
+          }
         }
-        else {
-          // item in list is a file
-          if (dataMode != STOPPED) {
-            dbgprint("STOP (singleClick & playMode == MEDIASERVER)");
-            dataMode = STOPREQD;                                     // Request STOP, do not touch longClick flag
-          } 
-          String uriLc = soapList[enc_nodeIndex].uri;
-          uriLc.toLowerCase();
-          if (soapList[enc_nodeIndex].size == 0 ||
-              soapList[enc_nodeIndex].fileType != fileTypeAudio ||
-              (!uriLc.endsWith(".mp3"))) {
-            dbgprint("error: %s is not a mp3 track", soapList[enc_nodeIndex].name.c_str());
-            tftset(4, "Error: Not a MP3 track !");                   // text on bottom in green
+        else if (lcml.startsWith("transfer-encoding:")) {
+          // Station provides chunked transfer
+          if (lcml.endsWith("chunked")) {
+            chunked = true;                            // Remember chunked transfer mode
+            chunkcount = 0;                            // Expect chunkcount in DATA
           }
-          else {
-            host = "soap/" + soapList[enc_nodeIndex].uri;
-            hostObject = soapList[enc_nodeIndex];
-            dbgprint("Selected host=%s", host.c_str());
-            encoderMode = IDLING;                                    // Back to default mode
-            currentIndex = enc_nodeIndex;
-            hostreq = true;                                          // Request this host
-            mp3fileRepeatFlag = DIRECTORY;
-            mp3filePause = false;  
-            muteFlag = 20;                                           // ca. 2 sec.
-            //xQueueReset (dataQueue);
-            //tftset(4, "");                                         // Clear text
+        }
+      }
+      metalinebfx = 0;                                 // Reset this line
+      if ((LFcount == 2) && ctseen) {                  // Content type seen and a double LF?
+        dbgprint("Switch to DATA, bitrate is %dkbps"   // Show bitrate
+                 ", metaint is %d", bitrate, metaint); // and metaint
+        dataMode = DATA;                               // Expecting data now
+        datacount = metaint;                           // Number of bytes before first metadata
+        skipStationAllowed = true;                     // now allow skip buttons in station mode
+        if (!nameseen) {                               // no name seen, that's highly unusual
+          // so we try to find it in the preset list
+          String tmp;
+          int8_t inx;
+
+          icyname = host;                              // by default display host instead of station name
+          if (icyname.length() > 62) {                 // line limiting
+            icyname.remove(59);
+            icyname += "...";
+          }
+          //nameseen = true;
+
+          dbgprint("No icy-name! Search name for host \"%s\" in presets", host.c_str());
+          for (int i = 0; i <= 99; i++) {
+            tmp = readhostfrompref(i);                 // Get host spec and possible comment
+            if (tmp == "") {                           // End of presets?
+              dbgprint("No preset for this host found! Index which breaked = %d.", i);
+              break;                                   // no matching entry found
+            }
+            if (tmp.indexOf(host) >= 0) {              // Found host in preset ?
+              dbgprint("Found host in preset %d.", i);
+              inx = tmp.indexOf("#");                  // Get position of "#"
+              if (inx > 0) {                           // Hash sign present?
+                tmp.remove(0, inx + 1);            // Yes, remove non-comment part
+                chomp(tmp);                        // Remove garbage from description
+                tmp.trim();                           // Remove leading & trailing whitespace
+                if (tmp.length() > 0) {                // Something left ?
+                  inx = tmp.indexOf(" - ");
+                  if (inx >= 0) {
+                    tmp.remove(0, inx + 3);
+                  }
+                  dbgprint("Name found = \"%s\"", tmp.c_str());
+                  icyname = tmp;
+                }
+              }
+              break;
+            }
           }
         }
-      }
-#endif      
-    }
-    else { // not in SELECT mode
-      // we mute when in station mode and we pause when in sdcard mode
-      if (SD_okay && playMode == SDCARD &&                       // while playing files from SD
-          currentSource == SDCARD && dataMode == DATA) {
-        mp3filePause = !mp3filePause;
-        dbgprint("Playing mp3 file %s", mp3filePause ? "has paused." : "continues.");
-        if (mp3filePause) {
-          xQueueReset (dataQueue);
+        if (brseen) {
+          icyname += " (" + String(bitrate) + "kbps)";
         }
+        tftset(1, "...waiting for text...");           // Set screen segment middle part
+        tftset(3, icyname);                            // Set screen segment bottom part
+        lastAlbumStation = icyname;
+        queuefunc(QSTARTSONG);                         // Queue a request to start song
       }
-      else {
-        muteFlag = (!muteFlag) ? -1 : 0;
-        dbgprint("Output is now %s", muteFlag ? "muted" : "unmuted");
+    }
+    else {
+      metalinebf[metalinebfx++] = (char)b;             // Normal character, put new char in metaline
+      if (metalinebfx >= METASIZ) {                    // Prevent overflow
+        metalinebfx--;
       }
+      LFcount = 0;                                     // Reset double CRLF detection
     }
-    // TEST
-    dbgprint("Total free memory of all regions=%d (minEver=%d), freeHeap=%d (minEver=%d), minStack=%d (in Bytes)", 
-             ESP.getFreeHeap(), ESP.getMinFreeHeap(), xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL)); 
-    //
     return;
   }
-  if (rotationcount == 0) return;
-  
-  // Evaluating Encoder turns
-  dbgprint("rotationcount: %d", rotationcount);
-  // TEST
-  //dbgprint("rotationcount=%d, dataMode=%d, playMode=%d, totalCount=%d, currentSource=%d, currentPreset=%d, encoderMode=%d",
-  //            rotationcount, dataMode, playMode, totalCount, currentSource, currentPreset, encoderMode);
-  if (encoderMode == IDLING) {
-    if ((SD_okay && playMode == SDCARD &&                   // while playing files from SD
-         currentSource == SDCARD && dataMode == DATA && !mp3filePause) ||
-        (playMode == MEDIASERVER &&                         // or playing from media server
-         currentSource == MEDIASERVER && dataMode == DATA)) {
-      if (rotationcount > 0) {
-        if (playMode == SDCARD || playMode == MEDIASERVER)
-          mp3fileJumpForward = true;
-      }  
-      else {  
-        if (playMode == SDCARD)
-          mp3fileJumpBack = true;
-      }  
+  if (dataMode == METADATA) {                          // Handle next byte of metadata
+    if (metalinebfx < 0) {                             // First byte of metadata?
+      metalinebfx = 0;                                 // Prepare to store first character
+      metacount = b * 16 + 1;                          // New count for metadata including length byte
     }
-    else if (playMode == STATION) {                        // we are in station mode
-      encoderMode = SELECT;                                // Switch to SELECT mode
-      dbgprint("Encoder mode set to SELECT");
-      tftset(4, "Turn to select station.\n"                // Show current option
-               "Press to confirm.");
-      if (currentPreset >= 0 && currentPreset <= highestPreset)
-        enc_preset = currentPreset;
-      else
-        enc_preset = 0;
-      tmp = readhostfrompref(enc_preset);                  // get host spec and possible comment
-      // Show just comment if available.  Otherwise the preset itself.
-      if ((inx = tmp.indexOf("#")) > 0) {                  // hash sign present?
-        tmp.remove(0, inx + 1);                            // remove non-comment part
+    else {
+      metalinebf[metalinebfx++] = (char)b;             // Normal character, put new char in metaline
+      if (metalinebfx >= METASIZ) {                    // Prevent overflow
+        metalinebfx--;
       }
-      chomp(tmp);                                          // remove garbage from description
-      dbgprint("Selected station is %d, %s", enc_preset, tmp.c_str());
-      tftset(2, tmp);                                      // Set screen segment
     }
-#ifdef ENABLE_SOAP      
-    else { // playMode == MEDIASERVER
-      // is handled above in SDCARD branch already
-    }
-#endif
-  }
-  else { // encoderMode == SELECT
-    if (playMode == STATION) {
-      if ((enc_preset + rotationcount) < 0) {
-        enc_preset = highestPreset;                          // from 0 to highest preset
-      }
-      else {
-        enc_preset += rotationcount;                         // next preset
+    if (--metacount == 0) {
+      metalinebf[metalinebfx] = '\0';                  // Make sure line is limited
+      if (strlen(metalinebf)) {                        // Any info present?
+        // metaline contains artist and song name.  For example:
+        // "StreamTitle='Don McLean - American Pie';StreamUrl='';"
+        // Sometimes it is just other info like:
+        // "StreamTitle='60s 03 05 Magic60s';StreamUrl='';"
+        // Isolate the StreamTitle, remove leading and trailing quotes if present.
+        showStreamTitle(metalinebf);                   // Show artist and title if present in metadata
       }
-      tmp = readhostfrompref (enc_preset);                   // get host spec and possible comment
-      if (tmp == "") {                                       // end of presets?
-        enc_preset = 0;                                      // wrap
-        tmp = readhostfrompref (enc_preset);                 // get host spec and possible comment
+      if (metalinebfx > (METASIZ - 10)) {              // Unlikely metaline length?
+        dbgprint("Metadata block too long! Skipping all Metadata from now on.");
+        metaint = 0;                                   // Probably no metadata or network problem
       }
-      // Show just comment if available.  Otherwise the preset itself.
-      if ((inx = tmp.indexOf("#")) > 0) {                    // hash sign present?
-        tmp.remove (0, inx + 1);                             // remove non-comment part
+      datacount = metaint;                             // Reset data count
+      //bufcnt = 0;                                    // Reset buffer count
+      dataMode = DATA;                                 // Expecting data
+    }
+  }
+  if (dataMode == PLAYLISTINIT) {                      // Initialize for receive .m3u file
+    // We are going to use metadata to read the lines from the .m3u file
+    // Sometimes this will only contain a single line
+    metalinebfx = 0;                                   // Prepare for new line
+    LFcount = 0;                                       // For detection end of header
+    dataMode = PLAYLISTHEADER;                         // Handle playlist data
+    playlistcnt = 1;                                   // Reset for compare
+    totalCount = 0;                                    // Reset totalCount
+    clength = 0xFFFF;                                  // Content-length unknown
+    dbgprint("Read from playlist");
+  }
+  if (dataMode == PLAYLISTHEADER) {                    // Read header
+    if ((b > 0x7F) ||                                  // Ignore unprintable characters
+        (b == '\r') ||                                 // Ignore CR
+        (b == '\0')) {                                 // Ignore NULL
+      return;                                          // Quick return
+    }
+    else if (b == '\n') {                              // Linefeed ?
+      LFcount++;                                       // Count linefeeds
+      metalinebf[metalinebfx] = '\0';                  // Take care of delimeter
+      dbgprint("Playlistheader: %s", metalinebf);      // Show playlistheader
+      scan_content_length(metalinebf);                 // Check if it is a content-length line
+      metalinebfx = 0;                                 // Ready for next line
+      if (LFcount == 2) {
+        dbgprint("Switch to PLAYLISTDATA, "            // For debug
+                 "search for entry %d", playlist_num);
+        dataMode = PLAYLISTDATA;                       // Expecting data now
+        return;
       }
-      chomp(tmp);                                            // remove garbage from description
-      dbgprint("Selected station is %d, %s", enc_preset, tmp.c_str());
-      tftset(2, tmp);                                        // set screen segment
     }
-    else if (playMode == SDCARD) {
-      if (!mp3nodeList[enc_nodeIndex].isDirectory && noSubDirInSameDir(enc_nodeIndex))
-        // if knob is turned left we jump from first to last file if necessary
-        enc_nodeIndex = nextSDfileIndexInSameDir (enc_nodeIndex, rotationcount);
-      else
-        // if knob is turned left we do not jump from first to last directory/file
-        enc_nodeIndex = nextSDindexInSameDir (enc_nodeIndex, rotationcount);
-      enc_dirIndex = mp3nodeList[enc_nodeIndex].parentDir;
-      tmp = mp3nodeList[enc_nodeIndex].name;
-      if (mp3nodeList[enc_nodeIndex].isDirectory) {
-        tftset(2, tmp);
+    else {
+      metalinebf[metalinebfx++] = (char)b;             // Normal character, put new char in metaline
+      if (metalinebfx >= METASIZ) {                    // Prevent overflow
+        metalinebfx--;
       }
-      else {
-        if ((inx = tmp.indexOf(".mp3")) > 0 ||
-            (inx = tmp.indexOf(".MP3")) > 0) {
-          tmp = tmp.substring(0, inx);
-        }
-        tftset(1, tmp);
+      LFcount = 0;                                     // Reset double CRLF detection
+    }
+  }
+  if (dataMode == PLAYLISTDATA) {                      // Read next byte of .m3u file data
+    clength--;                                         // Decrease content length by 1
+    if ((b > 0x7F) ||                                  // Ignore unprintable characters
+        (b == '\r') ||                                 // Ignore CR
+        (b == '\0')) {                                 // Ignore NULL
+      // Yes, ignore
+    }
+    if (b != '\n') {                                   // Linefeed?
+      // No, normal character in playlistdata,
+      metalinebf[metalinebfx++] = (char)b;             // add it to metaline
+      if (metalinebfx >= METASIZ) {                    // Prevent overflow
+        metalinebfx--;
       }
     }
-#ifdef ENABLE_SOAP      
-    else { // playMode == MEDIASERVER
-      enc_nodeIndex += rotationcount;
-      if (enc_nodeIndex < 0) {
-        // begin of browse list reached
-        if (soapChain.back().startingIndex > 0) {
-          soapChain.back().startingIndex -= SOAP_DEFAULT_BROWSE_MAX_COUNT;
-          if (soapChain.back().startingIndex < 0)
-            soapChain.back().startingIndex = 0;
-          // browse request with new starting index  
-          dbgprint("Search again in media server container \"%s\" (child count: %d, startingIndex: %d)", 
-                   soapChain.back().name.c_str(), soapChain.back().size, soapChain.back().startingIndex);
-          bool ret = soap.browseServer(0, soapChain.back().id.c_str(), &soapList, soapChain.back().startingIndex);
-          if (ret) { 
-            // browsing mediaserver successful
-            enc_nodeIndex = soapList.size() - 1;                 // new index in browse list
-            if (soapList.size() > 0) {
-              tftset(4, "Turn to select directory  or track.\n"  // Show current option
-                        "Press to confirm.");
-              tmp = soapList[enc_nodeIndex].name;
-              if (soapList[enc_nodeIndex].isDirectory) {
-                tftset(2, tmp);
-              }
-              else {
-                String uriLc = soapList[enc_nodeIndex].uri;
-                uriLc.toLowerCase();
-                if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
-                    !uriLc.endsWith(".mp3"))
-                  tmp += " [not mp3]";
-                tftset(1, tmp);
-              }
-            }
-            else {
-              // still to be done (very unlikely error)
-            }
-          }
-          else {
-            // error accessing media server
-            encoderMode = IDLING;
-            playMode = NONE;
-            dbgprint("rotationcount %d: error accessing media server for more items", rotationcount);
-            tftset(1, "Error accessing      media server !");
-            tftset(4, "Error");
-            rotationcount = 0;
-            return;
+    if ((b == '\n') ||                                 // linefeed ?
+         (clength == 0)) {                             // Or end of playlist data contents
+      int inx;                                         // Pointer in metaline
+      metalinebf[metalinebfx] = '\0';                  // Take care of delimeter
+      dbgprint("Playlistdata: %s", metalinebf);        // Show playlistheader
+      if (strlen(metalinebf) < 5) {                    // Skip short lines
+        metalinebfx = 0;                               // Flush line
+        metalinebf[0] = '\0';
+        return;
+      }
+      String metaline = String(metalinebf);            // Convert to string
+      if (metaline.indexOf("#EXTINF:") >= 0) {         // Info?
+        if (playlist_num == playlistcnt) {             // Info for this entry?
+          inx = metaline.indexOf(",");                 // Comma in this line?
+          if (inx > 0) {
+            // Show artist and title if present in metadata
+            showStreamTitle(metaline.substring(inx + 1).c_str(), true);
           }
         }
-        else {
-          enc_nodeIndex = 0;                                     // no circling
-          dbgprint("begin of list reached");
-        }
-      }  
-      else if (enc_nodeIndex >= soapList.size()) {
-        // end of browse list reached
-        size_t sizeDir = soapChain.back().size;                  // elements in our current directory 
-        if (sizeDir > (soapList.size() + soapChain.back().startingIndex)) {
-          // items left to be shown
-          size_t more = sizeDir - soapList.size() - soapChain.back().startingIndex;
-          dbgprint("end of this browse list but %d more items to come in this directory", more);
-          size_t newStartingIndex = soapChain.back().startingIndex + soapList.size();
-          // browse request with new starting index  
-           dbgprint("Search again in media server container \"%s\" (child count: %d, startingIndex: %d)", 
-                     soapChain.back().name.c_str(), soapChain.back().size, newStartingIndex);
-          bool ret = soap.browseServer(0, soapChain.back().id.c_str(), &soapList, newStartingIndex);
-          if (ret) { 
-            // browsing root of mediaserver was successful
-            enc_nodeIndex = 0;                                   // new index in browse list
-            soapChain.back().startingIndex = newStartingIndex;
-            if (soapList.size() > 0) {
-              tftset(4, "Turn to select directory  or track.\n"  // Show current option
-                        "Press to confirm.");
-              tmp = soapList[enc_nodeIndex].name;
-              if (soapList[enc_nodeIndex].isDirectory) {
-                tftset(2, tmp);
-              }
-              else {
-                String uriLc = soapList[enc_nodeIndex].uri;
-                uriLc.toLowerCase();
-                if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
-                    !uriLc.endsWith(".mp3"))
-                  tmp += " [not mp3]";
-                tftset(1, tmp);
-              }
-            }
-            else {
-              // still to be done (very unlikely error)
-            }
-          }
-          else {
-            // error accessing media server
-            encoderMode = IDLING;
-            playMode = NONE;
-            dbgprint("rotationcount %d: error accessing media server for more items", rotationcount);
-            tftset(1, "Error accessing      media server !");
-            tftset(4, "Error");
-            rotationcount = 0;
-            soapChain.back().startingIndex = 0;
-            return;
-          }
+      }
+      if (metaline.startsWith("#")) {                  // Commentline?
+        metalinebfx = 0;                               // Yes, ignore
+        return;                                        // Ignore commentlines
+      }
+      // Now we have an URL for a .mp3 file or stream.  Is it the rigth one?
+      dbgprint("Entry %d in playlist found: %s", playlistcnt, metalinebf);
+      if (playlist_num == playlistcnt) {
+        inx = metaline.indexOf("http://");             // Search for "http://"
+        if (inx >= 0) {                                // Does URL contain "http://"?
+          host = metaline.substring(inx + 7);          // Yes, remove it and set host
         }
         else {
-          enc_nodeIndex = soapList.size() - 1;
-          dbgprint("no more items in this directory \"%s\" to come - end of list", soapChain.back().name.c_str());
+          host = metaline;                             // Yes, set new host
         }
+        connectToHost();                               // Connect to it
       }
-      tmp = soapList[enc_nodeIndex].name;
-      // rudimentary line limiting
-#define MAX_NAME_LENGTH 96
-      if (soapList[enc_nodeIndex].isDirectory) {
-        if (tmp.length() > MAX_NAME_LENGTH) {
-          tmp.remove(MAX_NAME_LENGTH - 3);
-          tmp += "...";
-        }  
-        tftset(2, tmp);
-      }
-      else {
-        String uriLc = soapList[enc_nodeIndex].uri;
-        uriLc.toLowerCase();
-        if (soapList[enc_nodeIndex].fileType != fileTypeAudio ||
-            !uriLc.endsWith(".mp3")) {
-          if (tmp.length() > MAX_NAME_LENGTH) {
-            tmp.remove(MAX_NAME_LENGTH - 13);
-            tmp += "...";
-          }  
-          tmp += " [not mp3]";
+      metalinebfx = 0;                                 // Prepare for next line
+      host = playlist;                                 // Back to the .m3u host
+      playlistcnt++;                                   // Next entry in playlist
+    }
+  }
+}
+
+#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
+//**************************************************************************************************
+//                                     G E T C O N T E N T T Y P E                                 *
+//**************************************************************************************************
+// Returns the contenttype of a file to send.                                                      *
+//**************************************************************************************************
+String getContentType(String filename)
+{
+  if      (filename.endsWith(".html")) return "text/html";
+  else if (filename.endsWith(".png"))  return "image/png";
+  else if (filename.endsWith(".gif"))  return "image/gif";
+  else if (filename.endsWith(".jpg"))  return "image/jpeg";
+  else if (filename.endsWith(".ico"))  return "image/x-icon";
+  else if (filename.endsWith(".css"))  return "text/css";
+  else if (filename.endsWith(".zip"))  return "application/x-zip";
+  else if (filename.endsWith(".gz"))   return "application/x-gzip";
+  else if (filename.endsWith(".mp3"))  return "audio/mpeg";
+  else if (filename.endsWith(".pw"))   return "";        // Passwords are secret
+  return "text/plain";
+}
+
+//**************************************************************************************************
+//                                        H A N D L E F S F                                        *
+//**************************************************************************************************
+// Handling of requesting pages from the PROGMEM. Example: favicon.ico                             *
+//**************************************************************************************************
+void handleFSf(const String& pagename)
+{
+  String      ct;                                    // Content type
+  const char* p;
+  int         l;                                     // Size of requested page
+  int         TCPCHUNKSIZE = 1024;                   // Max number of bytes per write
+
+  dbgprint("FileRequest received %s", pagename.c_str());
+  ct = getContentType(pagename);                     // Get content type
+  if ((ct == "") || (pagename == "")) {              // Empty is illegal
+    _claimSPI("handlefsf1");                         // claim SPI bus
+    cmdclient.println("HTTP/1.1 404 Not Found");
+    cmdclient.println("");
+//#ifdef USE_ETHERNET
+//    cmdclient.flush();                             // not needed in the end
+//    cmdclient.stop();
+//#endif
+    _releaseSPI();                                   // release SPI bus
+    return;
+  }
+  else {
+    if (pagename.indexOf("index.html") >= 0) {       // Index page is in PROGMEM
+      p = index_html;
+      l = sizeof(index_html);
+    }
+    else if (pagename.indexOf("radio.css") >= 0) {   // CSS file is in PROGMEM
+      p = radio_css + 1;
+      l = sizeof(radio_css);
+    }
+    else if (pagename.indexOf("config.html") >= 0) { // Config page is in PROGMEM
+      p = config_html;
+      l = sizeof(config_html);
+    }
+    else if (pagename.indexOf("mp3play.html") >= 0) {// Mp3player page is in PROGMEM
+      p = mp3play_html;
+      l = sizeof(mp3play_html);
+    }
+    else if (pagename.indexOf("about.html") >= 0) {  // About page is in PROGMEM
+      p = about_html;
+      l = sizeof(about_html);
+    }
+    else if (pagename.indexOf("favicon.ico") >= 0) { // Favicon icon is in PROGMEM
+      p = (char*)favicon_ico;
+      l = sizeof(favicon_ico);
+    }
+    else {
+      p = index_html;
+      l = sizeof(index_html);
+    }
+    if (*p == '\n') {                                // If page starts with newline:
+      p++;                                           // Skip first character
+      l--;
+    }
+    dbgprint("Length of page is %d", strlen (p));
+    _claimSPI("handlefsf2");                        // claim SPI bus
+    cmdclient.print(httpHeader(ct));                // Send header
+    _releaseSPI();                                  // release SPI bus
+    // The content of the HTTP response follows the header:
+    if (l < 10) {
+      _claimSPI("handlefsf3");                      // claim SPI bus
+      cmdclient.println ("Testline<br>");
+      _releaseSPI();                                // release SPI bus
+    }
+    else {
+      while (l) {                                   // Loop through the output page
+        if (l <= TCPCHUNKSIZE) {                    // Near the end?
+          _claimSPI("handlefsf4");                  // claim SPI bus
+          cmdclient.write(p, l);                    // Yes, send last part
+          _releaseSPI();                            // release SPI bus
+          l = 0;
+        }
+        else {
+          _claimSPI("handlefsf5");                  // claim SPI bus
+          cmdclient.write(p, TCPCHUNKSIZE);         // Send part of the page
+          _releaseSPI();                            // release SPI bus
+          p += TCPCHUNKSIZE;                        // Update startpoint and rest of bytes
+          l -= TCPCHUNKSIZE;
         }
-        tftset(1, tmp);
       }
     }
-#endif    
+    // The HTTP response ends with another blank line:
+    _claimSPI("handlefsf6");                        // claim SPI bus
+    cmdclient.println();
+//#ifdef USE_ETHERNET
+//    cmdclient.flush();                            // not needed in the end
+//    cmdclient.stop();
+//#endif
+    _releaseSPI();                                  // release SPI bus
+    dbgprint("Response send");
+  }
+}
+#endif
+
+//**************************************************************************************************
+//                                         C H O M P                                               *
+//**************************************************************************************************
+// Do some filtering on de inputstring:                                                            *
+//  - String comment part (starting with "#").                                                     *
+//  - Strip trailing CR.                                                                           *
+//  - Strip leading spaces.                                                                        *
+//  - Strip trailing spaces.                                                                       *
+//**************************************************************************************************
+void chomp(String &str)
+{
+  int inx;                                           // Index in de input string
+
+  if ((inx = str.indexOf("#")) >= 0) {               // Comment line or partial comment?
+    str.remove(inx);                                 // Yes, remove
+  }
+  str.trim();                                        // Remove spaces and CR
+}
+
+//**************************************************************************************************
+//                                     A N A L Y Z E C M D                                         *
+//**************************************************************************************************
+// Handling of the various commands from remote webclient or Serial                                *
+// Version for handling string with: <parameter>=<value>                                           *
+//**************************************************************************************************
+const char* analyzeCmd(const char* str)
+{
+  char*       value;                            // Points to value after equalsign in command
+  const char* res;                              // Result of analyzeCmd
+
+  value = strstr(str, "=");                     // See if command contains a "="
+  if (value) {
+    *value = '\0';                              // Separate command from value
+    res = analyzeCmd(str, value + 1);           // Analyze command and handle it
+    *value = '=';                               // Restore equal sign
   }
-  rotationcount = 0;
+  else {
+    res = analyzeCmd(str, "0");                 // No value, assume zero
+  }
+  return res;
 }
 
 //**************************************************************************************************
-//                                           M P 3 L O O P                                         *
+//                                     A N A L Y Z E C M D                                         *
 //**************************************************************************************************
-void mp3loop()
+// Handling of the various commands from remote webclient or serial                                *
+// par holds the parametername and val holds the value.                                            *
+// "wifi_00" and "preset_00" may appear more than once, like wifi_01, wifi_02, etc.                *
+// Examples with available parameters:                                                             *
+//   preset     = 12                        // Select start preset to connect to                   *
+//   preset_00  = <mp3 stream>              // Specify station for a preset 00-99 *)               *
+//   toneha     = <0..15>                   // Setting treble gain                                 *
+//   tonehf     = <0..15>                   // Setting treble frequency                            *
+//   tonela     = <0..15>                   // Setting bass gain                                   *
+//   tonelf     = <0..15>                   // Setting treble frequency                            *
+//   station    = <mp3 stream>              // Select new station (will not be saved)              *
+//   station    = <URL>.mp3                 // Play standalone .mp3 file (not saved)               *
+//   station    = <URL>.m3u                 // Select playlist (will not be saved)                 *
+//   stop                                   // Stop playing                                        *
+//   resume                                 // Resume playing                                      *
+//   mute                                   // Mute/unmute the music (toggle)                      *
+//   fade_start = <down>,<hold>,<up>        // Volume fade curve in ms (also fade_stop/seek/mute)  *
+//   task_play  = <stack>,<prio>,<core>     // Task layout, core -1 = any (spf/extender/vumeter)   *
+//   task_sdread = 3072,1,-1,2              // Optional 4th value: priority while playing          *
+//   spectrum   = <0..30>                   // Spectrum analyzer frames per second, 0 = off        *
+//   wifi_00    = mySSID/mypassword         // Set WiFi SSID and password *)                       *
+//   clk_server = pool.ntp.org              // Time server to be used *)                           *
+//   clk_offset = <-11..+14>                // Offset with respect to UTC in hours *)              *
+//   clk_dst    = <1..2>                    // Offset during daylight saving time in hours *)      *
+//   mp3track   = <nodeIndex>               // Play track from SD card, nodeID 0 = random          *
+//   mp3track   = <text>                    // Play first SD track with text in its name           *
+//   search     = <text>[,<offset>]         // SD tracks with text in their name, max. 50 per page *
+//   gapless    = 0 or 1                    // Next SD/media server track without stopping decoder *
+//   sd_maxdepth = <1..32>                  // Directory levels on SD card (root = 1), see rescan  *
+//   sd_mmc     = 0, 1 or 4                 // SD card on SPI bus or SD/MMC bus 1/4 bit wide *)    *
+//   shuffle_dir = 0 or 1                   // RANDOM mode shuffles directory of current track     *
+//   sd_library = 0 or 1                    // Music library from ID3 tags, SD button switches to  *
+//                                          // it while selecting tracks                           *
+//   settings                               // Returns setting like presets and tone               *
+//   status                                 // Show current URL to play                            *
+//   test                                   // For test purposes                                   *
+//   tasks                                  // Task CPU usage, stack and core load to debug output *
+//   heap                                   // Heap history and fragmentation to debug output      *
+//   power                                  // Time and CPU clock per power mode to debug output   *
+//   pm_minfreq = <80/160/240>              // CPU clock in MHz while no audio flows *)            *
+//   debug      = 0 or 1                    // Switch debugging on or off                          *
+//   reset                                  // Restart the ESP32                                   *
+//  Commands marked with "*)" are sensible during initialization only                              *
+//   repeat                                 // repeat cmd                                          *
+//   mode                                   // switch between SDCARD / STATION mode                *
+//   previous/next                          // previous/next mp3 file or station                   *
+//   mediaserver_xxx                        // media server settings                               *
+//**************************************************************************************************
+const char* analyzeCmd(const char* par, const char* val)
 {
-  static uint8_t  tmpbuff[5000];                        // Input buffer for mp3 stream
-  uint32_t        maxchunk;                             // Max number of bytes to read
-  int             res = 0;                              // Result reading from mp3 stream
-  uint32_t        av = 0;                               // Available in stream
-  int             fileIndex;                            // Next file index of track on SD
-  uint32_t        qspace;                               // Free space in data queue
-  uint32_t        i;
+  HEAP_TAG("analyzeCmd");
+  String             argument;                       // Argument as string
+  String             value, valout;                  // Value of an argument as a string
+  int                ivalue;                         // Value of argument as an integer
+  static char        reply[180];                     // Reply to client, will be returned
+  //bool               relative;                       // Relative argument (+ or -)
+  String             tmpstr;                         // Temporary for value
+  uint32_t           av;                             // Available in stream/file
 
-  if (dataMode == STOPREQD) {                           // STOP requested?
-    dbgprint("mp3loop: STOP requested");
-    //if (currentSource != SDCARD && currentSource != MEDIASERVER)
-      xQueueReset (dataQueue);
-    if (currentSource == SDCARD) {
-      dbgprint("mp3loop: close mp3file");
-      claimSPI("close");                                // claim SPI bus
-      mp3file.close();
-      releaseSPI();                                     // release SPI bus
-      mp3fileLength = mp3fileBytesLeft = 0;
-    }
-    else if (currentSource == STATION) {
-      stopMp3client();                                  // Disconnect if still connected
-    }
-#ifdef ENABLE_SOAP    
-    else { // MEDIASERVER
-      soap.readStop();
-      mp3fileLength = mp3fileBytesLeft = 0;
-      dbgprint("mp3loop: media server data connection closed");
-    }
-#endif    
-    chunked = false;                                    // Not longer chunked
-    datacount = 0;                                      // Reset datacount
-    outqp = outchunk.buf;                               // and pointer
-    //if (currentSource != SDCARD && currentSource != MEDIASERVER)    
-      queuefunc(QSTOPSONG);                             // Queue a request to stop the song
-    metaint = 0;                                        // No metaint known now
-    dataMode = STOPPED;                                 // yes, state becomes STOPPED
-    currentSource = NONE;                               // currently no socket open
+  strcpy(reply, "Command accepted");                 // Default reply
+  argument = String(par);                            // Get the argument
+  chomp (argument);                                  // Remove comment and useless spaces
+  if (argument.length() == 0) {                      // Lege commandline (comment)?
+    return reply;                                    // Ignore
   }
-  // Try to keep the Queue to playTask filled up by adding as much bytes as possible
-  if (dataMode & (INIT | HEADER | DATA |                // Test if playing
-                  METADATA | PLAYLISTINIT |
-                  PLAYLISTHEADER | PLAYLISTDATA)) {
-    maxchunk = sizeof(tmpbuff);                         // Reduce byte count for this mp3loop()
-    qspace = uxQueueSpacesAvailable(dataQueue) *        // Compute free space in data queue
-             sizeof(qdata_struct);
-    if (currentSource == SDCARD) {                      // Playing file from SD card?
-      if (SD_okay) {
-        if (mp3filePause) {
-          mp3fileJumpForward = false;
-          mp3fileJumpBack = false;
-        }
-        else {
-          if (mp3fileJumpForward) {
-            int jumpSize, pos;
-            muteFlag = 3;                                  // temporarily muteing helps against chirps
-            mp3fileJumpForward = false;
-            jumpSize = mp3fileLength / 10;
-            jumpSize >>= 2; jumpSize <<= 2;
-            if (mp3fileBytesLeft < jumpSize) {
-              jumpSize = mp3fileBytesLeft;
-            }
-            claimSPI("sdread1");                            // claim SPI bus
-            pos = mp3file.position();
-            mp3file.seek(pos + jumpSize);
-            releaseSPI();                                   // release SPI bus
-            mp3fileBytesLeft -= jumpSize;                   // Number of bytes left
-            xQueueReset (dataQueue);
-            qspace = uxQueueSpacesAvailable(dataQueue) *    // recalculate free space in data queue
-                     sizeof(qdata_struct);
-            //dbgprint("F mp3fileLength=%d, jumpSize=%d, pos=%d, neu mp3fileBytesLeft=%d",
-            //           mp3fileLength, jumpSize, pos, mp3fileBytesLeft);
-          }
-          else if (mp3fileJumpBack) {
-            int jumpSize, pos;
-            muteFlag = 3;                                   // temporarily muteing helps against chirps
-            mp3fileJumpBack = false;
-            jumpSize = mp3fileLength / 10;
-            jumpSize >>= 2; jumpSize <<= 2;
-            if (jumpSize > mp3fileLength - mp3fileBytesLeft) {
-              jumpSize = mp3fileLength - mp3fileBytesLeft;
-            }
-            claimSPI("sdread2");                            // claim SPI bus
-            pos = mp3file.position();
-            mp3file.seek(pos - jumpSize);
-            releaseSPI();                                   // release SPI bus
-            mp3fileBytesLeft += jumpSize;                   // Number of bytes left
-            xQueueReset (dataQueue);
-            qspace = uxQueueSpacesAvailable(dataQueue) *    // recalculate free space in data queue
-                     sizeof(qdata_struct);
-          }
-          av = mp3fileBytesLeft;                            // Bytes left in file
-          if (maxchunk > av) {                              // Reduce byte count for this mp3loop()
-            maxchunk = av;
-          }
-          if (maxchunk > qspace) {                          // Enough space in queue?
-            maxchunk = qspace;                              // No, limit to free queue space
-          }
-          if (maxchunk) {                                   // Anything to read?
-            claimSPI("sdread3");                            // claim SPI bus
-            res = mp3file.read (tmpbuff, maxchunk);         // Read a block of data
-            releaseSPI();                                   // release SPI bus
-            mp3fileBytesLeft -= res;                        // Number of bytes left
-            if (res <= 0) {
-              dbgprint("mp3loop: STOP (mp3file.read() error)");
-              dataMode = STOPREQD;
-              SD_okay = false;
-              currentIndex = -1;
-              mp3fileLength = mp3fileBytesLeft = 0;
-              tftset(1, "SD-Card Error !");
-              tftset(4, "Error reading SD card");
-              // not needed
-              //claimSPI("sdclose");                        // claim SPI bus
-              //mp3file.close();                            // close file
-              //releaseSPI();                               // release SPI bus
-            }
-          }
-        }
-      }
-    }
-    else if (currentSource == STATION) { // STATION
-      _claimSPI("mp3loop1");                               // claim SPI bus
-      av = mp3client.available();                          // Available from stream
-      _releaseSPI();                                       // release SPI bus
-      if (maxchunk > av) {                                 // Limit read size
-        maxchunk = av;
-      }
-      if (maxchunk > qspace) {                          // Enough space in queue?
-        maxchunk = qspace;                              // No, limit to free queue space
-      }
-      if (maxchunk) {                                   // Anything to read?
-        _claimSPI("mp3loop2");                          // claim SPI bus
-        res = mp3client.read(tmpbuff, maxchunk);        // Read a number of bytes from the stream
-        _releaseSPI();                                  // release SPI bus
-        if (res == 0 || res == -1)
-          dbgprint("res: %d", res); 
-      }
-      else {
-        if (dataMode == PLAYLISTDATA) {                    // End of playlist
-          playlist_num = 0;                                // And reset
-          dbgprint("End of playlist seen");
-          dataMode = STOPPED;
-          ini_block.newpreset++;                           // Go to next preset
-        }
-      }
+  argument.toLowerCase();                            // Force to lower case
+  value = String(val);                               // Get the specified value
+  chomp (value);                                     // Remove comment and extra spaces
+  ivalue = value.toInt();                            // Also as an integer
+  ivalue = abs (ivalue);                             // Make positive
+  //relative = argument.indexOf("up") == 0;          // + relative setting?
+  if (argument.indexOf("down") == 0) {               // - relative setting?
+    //relative = true;                                 // It's relative
+    ivalue = - ivalue;                               // But with negative value
+  }
+  if (value.startsWith("http://")) {                 // Does (possible) URL contain "http://"?
+    value.remove (0, 7);                             // Yes, remove it
+  }
+  if (value.length()) {
+    tmpstr = value;                                  // Make local copy of value
+    if (argument.indexOf("passw") >= 0) {            // Password in value?
+      tmpstr = String("*******");                    // Yes, hide it
     }
-#ifdef ENABLE_SOAP    
-    else { // MEDIASERVER
-      if (mp3fileJumpForward) {
-        mp3fileJumpForward = false;
-        muteFlag = 2;                                      // temporarily muteing helps against chirps
-        // LS Mini has problems -> [RST, ACK] in Wireshark from LS Mini ... why ???
-        int jumpSize = mp3fileLength / 10;
-        jumpSize >>= 2; jumpSize <<= 2;
-        if (mp3fileBytesLeft < jumpSize) {
-          jumpSize = mp3fileBytesLeft;
-        }
-        int toRead = jumpSize;
-        for (; toRead > 0;) {
-          int ret = soap.read(tmpbuff, sizeof(tmpbuff) < toRead ? sizeof(tmpbuff) : toRead);
-          if (ret <= 0) {
-            // read error or EOF
-            soap.readStop();
-            break;
-          }  
-          toRead -= ret;
-          //mp3fileBytesLeft -= ret;                         // Number of bytes left
-        }
-        mp3fileBytesLeft = soap.available();               // Bytes left in file
-        xQueueReset (dataQueue);
-        qspace = uxQueueSpacesAvailable(dataQueue) *       // recalculate free space in data queue
-                  sizeof(qdata_struct);
-      }
-      av = soap.available();                               // Bytes left in file
-      //av = mp3fileBytesLeft;
-      if (maxchunk > av) {                                 // Reduce byte count for this mp3loop()
-        maxchunk = av;
-      }
-      if (maxchunk > qspace) {                             // Enough space in queue?
-        maxchunk = qspace;                                 // No, limit to free queue space
-      }
-      if (maxchunk) {                                      // Anything to read?
-        res = soap.read(tmpbuff, maxchunk);                // Read a block of data
-        mp3fileBytesLeft -= res;                           // Number of bytes left
-        if (res <= 0) {
-          soap.readStop();
-          dbgprint("mp3loop: STOP (soap.read() error)");
-          dataMode = STOPREQD;
-          mp3fileLength = mp3fileBytesLeft = 0;
-          tftset(1, "Media Server Error !");
-          tftset(4, "Error reading from media server");
-        }
-      }
+    dbgprint("Command: %s with parameter %s",
+               argument.c_str(), tmpstr.c_str());
+  }
+  else {
+    dbgprint("Command: %s (without parameter)",
+               argument.c_str());
+  }
+  if (argument.indexOf("volume") == 0) {             // absolute Volume setting?
+    ini_block.reqvol = ivalue;
+    if (ini_block.reqvol < 60) {
+      ini_block.reqvol = 60;                         // Limit to min value 60
     }
-#endif    
-    for (i = 0; i < res; i++) {
-      handlebyte_ch(tmpbuff[i]);                           // Handle one byte
+    else if (ini_block.reqvol > 92) {
+      ini_block.reqvol = 92;                         // Limit to value 92
     }
+    muteFlag = false;                                // Stop possibly muting
+    sprintf(reply, "Volume is now %d",               // Reply new volume
+              ini_block.reqvol);
   }
-  if (currentSource == SDCARD) {                           // Playing from SD?
-    if (dataMode & DATA && !mp3filePause &&                // Test if playing
-        av == 0) {                                         // End of mp3 data?
-      dbgprint("mp3loop: STOP (end of mp3 file -> close mp3file)");
-      claimSPI("close2");                                  // claim SPI bus
-      mp3file.close();                                     // Close file
-      releaseSPI();                                        // release SPI bus
-      dataMode = STOPREQD;                                 // End of local mp3-file detected
-      delay(100);
-      if (SD_okay && currentIndex > 0) {
-        if (!mp3fileRepeatFlag)
-          fileIndex = nextSDfileIndex(currentIndex, +1);   // Select the next file on SD
-        else if (mp3fileRepeatFlag == SONG)
-          fileIndex = currentIndex;                        // Select the same file
-        else if (mp3fileRepeatFlag == DIRECTORY)
-          fileIndex = nextSDfileIndexInSameDir(currentIndex, +1); // select next file in same directory
-        else
-          fileIndex = 0;                                   // random mode
-        host = getSDfilename(fileIndex);
-        if (host.startsWith("error")) {
-          dbgprint("SD problem: Can't find file with index %d", fileIndex);
-        }
-        else {
-          hostreq = true;                                  // Request this host
-        }
-      }
+  else if (argument.indexOf("volume") > 0) {         // relative Volume setting?
+    ini_block.reqvol += ivalue;
+    if (ini_block.reqvol < 60) {
+      ini_block.reqvol = 60;                         // Limit to min value 60
+    }
+    else if (ini_block.reqvol > 92) {
+      ini_block.reqvol = 92;                         // Limit to max value 92
     }
+    muteFlag = false;                                // Stop possibly muting
+    sprintf(reply, "Volume is now %d",               // Reply new volume
+            ini_block.reqvol);
   }
-#ifdef ENABLE_SOAP  
-  else if (currentSource == MEDIASERVER) {
-    if (dataMode & DATA && av == 0) {                      // playing and end of mp3 data? 
-      dbgprint("mp3loop: STOP (end of file from media server)");
-      soap.readStop();
-      dataMode = STOPREQD;                                     // End of local mp3-file detected
-      delay(100);
-      if (mp3fileRepeatFlag != NOREPEAT) {
-        int16_t newIndex;
-        if (mp3fileRepeatFlag == SONG) {
-          newIndex = currentIndex;                             // play same file
-        }
-        else {
-          newIndex = nextSoapFileIndex(currentIndex, +1);      // Select next mp3 file in list
-        }
-        if (newIndex != -1) {
-          dbgprint("Next file soapList[%d]: \"%s\"",newIndex, soapList[newIndex].name.c_str());
-          host = "soap/" + soapList[newIndex].uri;
-          hostObject = soapList[newIndex];
-          currentIndex = newIndex;
-          hostreq = true;                                      // Request this host
-        }
-        else {
-          dbgprint("Soap list problem: Can't find next entry in list");
-        }
-      }
-      else {
-        // stop playing after this file and show directory content
-        String tmp;
-        soapChain_t dir = soapChain.back();                    // retrieve last element in chain
-        dbgprint("Search in media server container \"%s\" (child count: %d)", 
-                 dir.name.c_str(), dir.size);
-        bool ret = soap.browseServer(0, dir.id.c_str(), &soapList);
-        if (ret) {                                             // browsing mediaserver one level higher
-          encoderMode = SELECT;
-          if (soapList.size() > 0) {
-            tftset(4, "Turn to select directory  or track.\n"  // Show current option
-                      "Press to confirm.");
-            currentIndex = 0;                                  // first entry on that level 
-            tmp = soapList[currentIndex].name;
-            if (soapList[currentIndex].isDirectory) {
-              tftset(2, tmp);
-            }
-            else {
-              String uriLc = soapList[currentIndex].uri;
-              uriLc.toLowerCase();
-              if (soapList[currentIndex].fileType != fileTypeAudio ||
-                  !uriLc.endsWith(".mp3"))
-                tmp += " [not mp3]";
-              tftset(1, tmp);
-            }
-          }
-        }
-        else {
-          // error accessing media server
-          encoderMode = IDLING;
-          playMode = NONE;
-          dbgprint("End of file: error re-accessing media server");
-          tftset(1, "End of file.         Error re-accessing   media server !");
-          tftset(4, "Error");
-        }
-      }
+  else if (argument == "mute") {                     // Mute/unmute request
+    muteFlag = !muteFlag;
+    volRamp(VR_MUTE);                                // Fade out resp. in
+    sprintf(reply, "Output is now %s",               // Reply mute status
+            muteFlag ? "muted" : "unmuted");
+  }
+#ifdef SPECTRUM_ANALYZER
+  else if (argument == "spectrum") {                 // spectrum analyzer frame rate?
+    spectrumRate = (ivalue > 30) ? 30 : ((ivalue < 0) ? 0 : ivalue); // 0 = off, max 30 Hz
+    sprintf(reply, "Spectrum analyzer rate is now %d Hz", spectrumRate);
+  }
+#endif
+  else if (argument.startsWith("task_")) {           // task layout, e.g. task_vumeter = 2048,1,1
+    unsigned int stack, prio, playprio = 0;
+    int          core;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(taskdef) / sizeof(taskdef[0]); i++) {
+      if (String(taskdef[i].name).equalsIgnoreCase(argument.substring(5) + "task")) break;
+    }
+    if (i == sizeof(taskdef) / sizeof(taskdef[0]) ||
+        sscanf(value.c_str(), "%u,%u,%d,%u", &stack, &prio, &core, &playprio) < 3) {
+      snprintf(reply, sizeof(reply), "%s: unknown task or illegal layout", argument.c_str());
+    }
+    else if (tasksStarted) {                         // only possible before setup() starts them
+      snprintf(reply, sizeof(reply), "%s: save preferences and reset to change layout",
+               argument.c_str());
+    }
+    else {
+      taskdef[i].stack = constrain(stack, 1024, 16384);
+      taskdef[i].prio  = constrain(prio, 1, configMAX_PRIORITIES - 1);
+      taskdef[i].core  = constrain(core, -1, 1);
+      taskdef[i].playprio = playprio ? constrain(playprio, 1, configMAX_PRIORITIES - 1) : 0;
+      sprintf(reply, "Task %s: stack %d, priority %d (playing %d), core %d", taskdef[i].name,
+              taskdef[i].stack, taskdef[i].prio,
+              taskdef[i].playprio ? taskdef[i].playprio : taskdef[i].prio, taskdef[i].core);
     }
   }
-#endif  
-  if (ini_block.newpreset != currentPreset) {              // new station or next from playlist requested?
-    dbgprint("mp3loop: ini_block.newpreset[%d] != currentPreset[%d]",
-               ini_block.newpreset, currentPreset);
-    if (dataMode != STOPPED) {                             // Yes, still busy?
-      dbgprint("mp3loop: STOP7 (dataMode != STOPPED)");
-      dataMode = STOPREQD;                                 // Yes, request STOP
+  else if (argument.startsWith("fade_")) {           // fade curve for volume ramp engine?
+    static const char* fadeNames[] = { "start", "stop", "seek", "mute" };
+    unsigned int       down, hold, up;               // times in ms
+    int                i;
+
+    for (i = VR_START; i <= VR_MUTE; i++) {          // search for kind of ramp
+      if (argument.substring(5) == fadeNames[i]) break;
+    }
+    if (i > VR_MUTE ||
+        sscanf(value.c_str(), "%u,%u,%u", &down, &hold, &up) != 3) {
+      snprintf(reply, sizeof(reply), "%s: illegal fade curve", argument.c_str());
     }
     else {
-      if (playlist_num) {                                  // Playing from playlist?
-        // Yes, retrieve URL of playlist
-        playlist_num += ini_block.newpreset -
-                        currentPreset;                     // Next entry in playlist
-        ini_block.newpreset = currentPreset;               // Stay at current preset
-      }
-      else {
-        host = readhostfrompref();                         // Lookup preset in preferences
-        chomp (host);                                      // Get rid of part after "#"
-      }
-      dbgprint("mp3loop: New preset/file requested (%d/%d) from %s",
-               ini_block.newpreset, playlist_num, host.c_str());
-      if (host != "") {                                    // Preset in ini-file?
-        hostreq = true;                                    // Force this station as new preset
-      }
-      else {
-        // This preset is not available, return to preset 0, will be handled in next mp3loop()
-        dbgprint("mp3loop: No host for this preset");
-        ini_block.newpreset = 0;                           // Wrap to first station
-      }
+      volramp[i].down = (down > 5000) ? 5000 : down; // limit to 5 sec
+      volramp[i].hold = (hold > 5000) ? 5000 : hold;
+      volramp[i].up   = (up > 5000) ? 5000 : up;
+      sprintf(reply, "Fade curve %s is now %d/%d/%d ms", fadeNames[i],
+              volramp[i].down, volramp[i].hold, volramp[i].up);
     }
   }
-  if (hostreq) {                                           // New preset or station?
-    dbgprint("mp3loop: hostreq=true");
-    hostreq = false;
-    mp3filePause = false;
-    currentPreset = ini_block.newpreset;                   // Remember current preset
+#ifdef POWER_SAVE
+  else if (argument == "pm_minfreq") {               // CPU clock while no audio flows?
+    if (pmStarted) {                                 // only possible before setup() applies it
+      snprintf(reply, sizeof(reply), "%s: save preferences and reset to change", argument.c_str());
+    }
+    else {
+      pmMinFreq = (ivalue >= 240) ? 240 : ((ivalue >= 160) ? 160 : 80); // keeps APB at 80 MHz
+      sprintf(reply, "CPU clock without audio is %d MHz", pmMinFreq);
+    }
+  }
+#endif
+#ifdef SD_MMC_BUS
+  else if (argument == "sd_mmc") {                   // SD card on SD/MMC bus?
+    if (((ivalue == 1 || ivalue == 4) ? ivalue : 0) != sdMmc) {
+      snprintf(reply, sizeof(reply), "%s: save preferences and reset to change", argument.c_str());
+    }
+    else {
+      sprintf(reply, "SD card is on the %s bus", sdMmc ? "SD/MMC" : "SPI");
+    }
+  }
+#endif
+  else if (argument == "sd_maxdepth") {              // max. nesting level on SD card?
+    sdMaxDepth = (ivalue > 32) ? 32 : ((ivalue < 1) ? 1 : ivalue);
+    sprintf(reply, "SD directory depth is now %d, active after rescan", sdMaxDepth);
+  }
+#ifdef SD_LIBRARY
+  else if (argument == "sd_library") {               // music library from ID3 tags?
+    sdLibEnabled = (ivalue != 0);
+    sdLibReq = true;                                 // load, build or drop it
+    sprintf(reply, "Music library is now %s", sdLibEnabled ? "on" : "off");
+  }
+#endif
+  else if (argument == "search") {                   // SD tracks with text in their name?
+    char     key[SDSEARCH_TEXTMAX];
+    int16_t  result[SDSEARCH_PAGE];                  // One page of matches
+    int      offset = sdSearchParse(value, key);
+    int      total, n;
+    uint32_t t0 = micros();
 
-    // Check source type
-    if (host.indexOf("sdcard/") == 0)
-      currentSource = SDCARD;
-    else if (host.indexOf("soap/") == 0)
-      currentSource = MEDIASERVER;
-    else
-      currentSource = STATION;
-    
-    if (currentSource == SDCARD) {                         // play file from SD card?
-      muteFlag = 15;
-      playMode = SDCARD;
-      mp3fileJumpForward = false;
-      mp3fileJumpBack = false;
-      if (connecttofile()) {                               // open mp3-file
-        dataMode = DATA;                                   // start in DATA mode
-        dbgprint("mp3loop: connecttofile() returns ok, dataMode=DATA");
+    if (!sdSearchCount) {
+      return "Search not ready";
+    }
+    total = sdSearch(key, offset, SDSEARCH_PAGE, result);
+    t0 = micros() - t0;                              // time taken by the search itself
+    n = constrain(total - offset, 0, SDSEARCH_PAGE);
+    for (int i = 0; i < n; i++) {
+      dbgprint("%5d %s", result[i], mp3nodeList.name(result[i]));
+    }
+    sprintf(reply, "%d of %d matches from %d shown, search took %d us", n, total, offset, t0);
+  }
+  else if (argument == "shuffle_dir") {              // shuffle directory of current track only?
+    shufflePerDir = (ivalue != 0);
+    sprintf(reply, "Random mode shuffles %s", shufflePerDir ? "current directory" : "whole card");
+  }
+  else if (argument == "shuffle_state") {            // RANDOM mode order saved by handleSaveReq()
+    unsigned long seed;
+    int           pos, dir;
+    unsigned int  count;
+
+    if (sscanf(value.c_str(), "%lu,%d,%d,%u", &seed, &pos, &dir, &count) != 4) {
+      snprintf(reply, sizeof(reply), "%s: illegal value", argument.c_str());
+    }
+    else {
+      shuffleList.clear();                           // shuffleNext() builds it again from seed
+      shuffleSeed = seed;
+      shufflePos = pos;
+      shuffleDir = dir;
+      shuffleCount = count;
+      sprintf(reply, "Random mode continues at position %d", shufflePos);
+    }
+  }
+  else if (argument == "gapless") {                  // gapless track transitions?
+    mp3fileGapless = (ivalue != 0);
+    sprintf(reply, "Gapless playback is now %s", mp3fileGapless ? "on" : "off");
+  }
+  else if (argument == "repeat") {                   // repeate request
+    if (currentSource == SDCARD && currentIndex > 0 &&
+         playMode == SDCARD && SD_okay) {
+      if (mp3fileRepeatFlag == NOREPEAT) {
+        mp3fileRepeatFlag = SONG;                    // repeat same file
+        sprintf(reply, "Repeat Mode = SONG");
+      }
+      else if (mp3fileRepeatFlag == SONG) {
+        mp3fileRepeatFlag = DIRECTORY;               // repeat same directory
+        sprintf(reply, "Repeat Mode = DIRECTORY");
+      }
+      else if (mp3fileRepeatFlag == DIRECTORY) {
+        mp3fileRepeatFlag = RANDOM;                  // random play
+        sprintf(reply, "Repeat Mode = RANDOM");
       }
       else {
-        SD_okay = false;
-        currentIndex = -1;
-        dataMode = STOPPED;                                // error happened by opening file on SD
-        currentSource = NONE;
-        host = "";
-        dbgprint("mp3loop: connecttofile() returned error");
-        tftset(1, "SD-Card Error !         If SD was swapped, please press SD Button again.");
-        tftset(4, "Error opening file.");
+        mp3fileRepeatFlag = NOREPEAT;                // clear repeat flag
+        sprintf(reply, "Repeat Mode = NOREPEAT");
       }
     }
-    else if (currentSource == STATION) {
-      muteFlag = 25;
-      playMode = STATION;
-      if (host.startsWith("ihr/")) {                       // iHeartRadio station requested?
-        host = host.substring(4);                          // Yes, remove "ihr/"
-        host = xmlgethost(host);                           // Parse the xml to get the host
+    else if (currentSource == MEDIASERVER && currentIndex >= 0) {
+      if (mp3fileRepeatFlag == NOREPEAT) {
+        mp3fileRepeatFlag = SONG;                    // repeat same file
+        sprintf(reply, "Repeat Mode = SONG");
       }
-      if (host.length() > 0) {                             // Basic check
-#ifdef USE_ETHERNET
-        if (reInitEthernet) {                              // set in timer10sec()
-          reInitEthernet = false;
-          dbgprint("mp3loop: we are requested to re-initialize the ethernet card");
-          initEthernet(false);                             // no TFT output
-        }
-#endif        
-        connectToHost();                                   // Switch to new host
+      else if (mp3fileRepeatFlag == SONG) {
+        mp3fileRepeatFlag = DIRECTORY;               // repeat same directory
+        sprintf(reply, "Repeat Mode = DIRECTORY");
       }
-      else {
-        dbgprint("mp3loop: host value invalid. Try next preset.");
-        ini_block.newpreset++;
-        if (ini_block.newpreset > highestPreset)
-          ini_block.newpreset = 0;
+      else if (mp3fileRepeatFlag == DIRECTORY) {
+        mp3fileRepeatFlag = NOREPEAT;               // repeat same directory
+        sprintf(reply, "Repeat Mode = NOREPEAT");
       }
     }
-#ifdef ENABLE_SOAP    
-    else { // MEDIASERVER
-      #define MAX_DLNA_RETRIES 3
-      for (i = 0; i < MAX_DLNA_RETRIES; i++) {
-        if (soap.readStart(&hostObject, &mp3fileLength)) break;  // request media server file
-        delay(200);
-      }
-      if (i == MAX_DLNA_RETRIES) {
-        // error requesting file from media server
-        dataMode = STOPPED;
-        currentSource = NONE;
-        host = "";
-        tftset(4, "Error retrieving file.");
-        dbgprint("readStart(%s:%d/%s) returned error", 
-                 hostObject.downloadIp.toString().c_str(), hostObject.downloadPort, hostObject.uri.c_str());
+    else {
+      sprintf(reply, "Command \'Repeat\' not allowed in this state.");
+    }
+  }
+  else if (argument.indexOf("ir_") >= 0) {           // Ir setting?
+    // No action required
+  }
+  else if (argument.indexOf("preset_") >= 0) {       // Enumerated preset?
+    // No action required
+  }
+  else if (argument.indexOf("preset") == 0) {        // Preset station?
+    mp3fileRepeatFlag = NOREPEAT;  
+    playMode = STATION;
+    ini_block.newpreset = ivalue;                    // Otherwise set station
+    playlist_num = 0;                                // Absolute, reset playlist
+    sprintf(reply, "Preset is now %d",               // Reply new preset
+            ini_block.newpreset);
+  }
+  else if (argument.indexOf("pause") >= 0) {
+    // TEST
+    //dbgprint("dataMode=%d, playMode=%d, totalCount=%d, currentSource=%d, currentPreset=%d, encoderMode=%d",
+    //            dataMode, playMode, totalCount, currentSource, currentPreset, encoderMode);
+    if (dataMode == DATA && currentSource == SDCARD &&
+         playMode == SDCARD && SD_okay && currentIndex > 0) {
+      mp3filePause = !mp3filePause;
+      snprintf(reply, sizeof(reply), "Playing mp3 file %s", // Reply pause status
+                 mp3filePause ? "has paused." : "continues.");
+      if (mp3filePause) {
+        xQueueReset (dataQueue);
       }
       else {
-        mp3fileBytesLeft = mp3fileLength;                  // file length as reported from media server
-        dbgprint("readStart(%s:%d/%s) successful", 
-                 hostObject.downloadIp.toString().c_str(), hostObject.downloadPort, hostObject.uri.c_str());
-        if (handleID3(host)) {                             // check for ID3 tags
-          dataMode = DATA;                                 // Start in DATA mode
-          icyname = "";                                    // No icy name yet
-          chunked = false;                                 // File not chunked
-          metaint = 0;                                     // no meta data
-          dbgprint("mp3loop: handleID3() returns ok, dataMode=DATA");
-        }
-        else {
-          // error reading from media server
-          dataMode = STOPPED;
-          currentSource = NONE;
-          tftset(4, "Error reading file from media server.");
-          dbgprint("handleID3(\"%s\") returned error", host.c_str());          
-          host = "";
-        }
+        //volRamp(VR_SEEK);                                 // suppresses chirps
       }
     }
-#endif
-  }
-}
-
-#ifdef PORT23_ACTIVE
-//**************************************************************************************************
-//                          H A N D L E C L I E N T O N P O R T 2 3                                *
-//**************************************************************************************************
-// Handle connect/disconnect of clients on port 23. Debug output gets sent via dbgprint() if open. *
-//**************************************************************************************************
-void handleClientOnPort23()
-{
-  static char dbgTextBuf[MAXSIZE_TELNET_CMD];          //someplace to put received cmd
-  static int  dbgCharsReceived = 0;
-  static bool EOLseen = false;
-  
-  if (!dbgConnectFlag)
-  {
-    _claimSPI("port231");                          // claim SPI bus
-    dbgclient = dbgserver.accept();
-    _releaseSPI();                                   // release SPI bus
-    if (dbgclient)
-    {
-      dbgConnectFlag = true;
-      _claimSPI("port232");                        // claim SPI bus
-      dbgclient.print("\r\nESP32-Radio Debug Server on port 23\r\n");
-#ifdef CHECK_LOOP_TIME
-      dbgclient.print("Press 't'+ENTER to reset loop timer.\r\n");
-#endif
-      dbgclient.print("Press 'q'+ENTER to quit.\r\n\r\n");
-      //dbgclient.println("");
-      _releaseSPI();                                 // release SPI bus
-      dbgprint("Debug Client on port 23 connected.");  // Get's already sent to debug client on port 23
+    else {
+      sprintf(reply, "Command \'Pause\' not allowed in this state.");
     }
   }
-  else { // connect flag still set
-    _claimSPI("port233");                          // claim SPI bus
-    // we don't accept another client, so recline
-    //dbgserver.available().stop();                   // not needed... ?
-    uint8_t con = dbgclient.connected();
-    _releaseSPI();                                   // release SPI bus
-    if (con) {                                        // debug client still connected ?
-      _claimSPI("port234");                        // claim SPI bus
-      int charsWaiting = dbgclient.available();
-      _releaseSPI();                                 // release SPI bus
-      if (charsWaiting) {                            // data available
-        do {
-          _claimSPI("port235");                    // claim SPI bus
-          char c = dbgclient.read();
-          _releaseSPI();                             // release SPI bus
-          dbgTextBuf[dbgCharsReceived++] = c;
-          charsWaiting--;
-          if (c ==  0x0D)                            // end of line (Enter key)
-            EOLseen = true;
-        } while (dbgCharsReceived <= MAXSIZE_TELNET_CMD && charsWaiting > 0);   
-        if (EOLseen) {
-          EOLseen = false;
-          dbgCharsReceived = 0;
-          switch (dbgTextBuf[0]) {
-            case 0x0D: break;                         // ignore empty line
-            case 'q':  
-              _claimSPI("port236");                // claim SPI bus
-              dbgclient.print("\r\nBye bye.\r\n");
-              dbgclient.flush();
-              dbgclient.stop();
-              _releaseSPI();                         // release SPI bus
-              dbgConnectFlag = false;
-              dbgprint("Debug Client on port 23 disconnected on his request.");
-              break;
-            case '?':
-              _claimSPI("port237");                // claim SPI bus
-#ifdef CHECK_LOOP_TIME
-              dbgclient.print("Press 't'+ENTER to reset loop timer.\r\n");
-#endif
-              dbgclient.print("Press 'q'+ENTER to quit.\r\n\r\n");
-              //dbgclient.println("");
-              _releaseSPI();                         // release SPI bus
-              break;            
-#ifdef CHECK_LOOP_TIME
-            case 't':                                  // CTRL-T resets loop timer
-              maxLoopTime = 0;
-              dbgprint("Loop timer resetted.");
-              break;
-#endif
-            default: 
-              _claimSPI("port238");                // claim SPI bus
-              dbgclient.print("\r\nUnrecognized command.  ? for help.\r\n");
-              _releaseSPI();                         // release SPI bus
-              break;
-          }
+  else if (argument.indexOf("previous") >= 0 ||
+           argument.indexOf("downpreset") >= 0) {
+    if (currentSource == SDCARD && playMode == SDCARD) {
+      if (SD_okay && currentIndex > 0) {
+        int fileIndex;                                  // Previous file index of track on SD
+        if (mp3fileRepeatFlag == SONG ||
+             ((mp3fileLength - mp3fileBytesLeft) > (mp3fileLength / 30)))
+          fileIndex = currentIndex;                     // Select the same file again
+        else if (mp3fileRepeatFlag == NOREPEAT)
+          fileIndex = nextSDfileIndex(currentIndex, -1); // Select the previous file on SD
+        else if (mp3fileRepeatFlag == DIRECTORY)
+          fileIndex = nextSDfileIndexInSameDir(currentIndex, -1); // select previous file in same directory
+        else
+          fileIndex = shuffleNext(-1);                  // random mode, previous shuffled track
+        host = getSDfilename(fileIndex);
+        if (host.startsWith("error")) {
+          dbgprint("SD problem: can't find file with index %d", fileIndex);
         }
-        if (dbgCharsReceived >= MAXSIZE_TELNET_CMD) {
-          dbgCharsReceived = 0;
-          //EOLseen = false;
-          _claimSPI("port239");                    // claim SPI bus
-          dbgclient.print("\r\nUnrecognized command.  ? for help.\r\n");
-          _releaseSPI();                             // release SPI bus
+        else {
+          dbgprint("STOP (command: previous file on SD)");
+          dataMode = STOPREQD;                          // Request STOP
+          hostreq = true;                               // Request this host
+          snprintf(reply, sizeof(reply), "Next playing %s", host.c_str());
+          utf8ascii(reply);
+          volRamp(VR_START);
         }
       }
     }
-    else { // connection gone (eg. client has disconnected)
-      _claimSPI("port2310");                       // claim SPI bus
-      dbgclient.flush();
-      dbgclient.stop();
-      _releaseSPI();                                 // release SPI bus
-      dbgConnectFlag = false;                         // remember connection state
-      EOLseen = false;
-      dbgCharsReceived = 0;
-      dbgprint("Debug Client on port 23 has disconnected.");
+    else if (currentSource == STATION && playMode == STATION) {
+      xQueueReset (dataQueue);
+      volRamp(VR_START);
+      ini_block.newpreset -= 1;                         // Yes, adjust currentPreset
+      if (ini_block.newpreset < 0)
+        ini_block.newpreset = highestPreset;
+      sprintf(reply, "Preset is now %d",                // Reply new preset
+                     ini_block.newpreset);
     }
-  }
-}
-#endif
+#ifdef ENABLE_SOAP    
+    else if (currentSource == MEDIASERVER && playMode == MEDIASERVER) {
+      const char* p;
+      int16_t newIndex;
 
-//**************************************************************************************************
-//                                           L O O P                                               *
-//**************************************************************************************************
-// Main loop of the program.                                                                       *
-//**************************************************************************************************
-void loop()
-{
-  //delay(1);                                             // resets task switcher watchdog, just in case it's needed
-#ifdef ENABLE_ESP32_HW_WDT
-  esp_task_wdt_reset();                                 // avoid panic and subsequent ESP32 restart
-#endif   
-#ifdef CHECK_LOOP_TIME
-  uint32_t timing;                                      // for calculation of loop() round times
-  timing = millis();
-#endif
-  mp3loop();                                            // Do mp3 related actions
-  if (resetreq) {                                       // Reset requested?
-    delay(1000);                                        // Yes, wait some time
-    ESP.restart();                                      // Reboot
-  }
-  scanserial();                                         // Handle serial input
-#ifdef ENABLE_DIGITAL_INPUTS  
-  scandigital();                                        // Scan digital inputs
-#endif  
-#ifdef ENABLE_INFRARED
-  scanIR();                                             // See if IR input
-#endif
-#ifndef USE_ETHERNET
-  ArduinoOTA.handle();                                  // Check for OTA
-#endif
-  mp3loop();                                            // Do more mp3 related actions
-#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
-  handlehttpreply();
-  _claimSPI("loop");                                    // claim SPI bus
-  cmdclient = cmdserver.available();                    // Check Input from client
-  _releaseSPI();                                        // release SPI bus
-  if (cmdclient) {                                      // Client connected ?
-    dbgprint("loop(): command client available");
-    handlehttp();
-  }
-#endif  
-  //
-  handleSaveReq();                                      // See if time to save settings
-  checkEncoderAndButtons();                             // check rotary encoder & button functions
-#ifdef PORT23_ACTIVE
-  handleClientOnPort23();                               // check possible debug client requests
+      if (mp3fileRepeatFlag == SONG ||
+            ((mp3fileLength - mp3fileBytesLeft) > (mp3fileLength / 30))) {
+        newIndex = currentIndex;                        // Select the same file again
+      }  
+      else {
+        newIndex = nextSoapFileIndex(currentIndex, -1); // Select the previous file on soap list
+      }
+      if (newIndex != -1) {
+        p = dbgprint("Next playing \"%s\"", soapList[newIndex].name.c_str());
+        host = "soap/" + soapList[newIndex].uri;
+        hostObject = soapList[newIndex];
+        currentIndex = newIndex;
+        dbgprint("STOP (command: previous file in soap list)");
+        dataMode = STOPREQD;                            // Request STOP
+        hostreq = true;                                 // Request this host
+        volRamp(VR_START);
+      }
+      else {
+        p = dbgprint("Soap list problem: can't find previous entry");
+      }
+      strcpy(reply, p);
+      utf8ascii(reply);  
+    }
 #endif
-#ifdef CHECK_LOOP_TIME
-  timing = millis() - timing;
-  if (timing > maxLoopTime) {                           // new maximum found?
-    maxLoopTime = timing;                               // yes, set new maximum
-    dbgprint("Max duration loop() = %d ms", timing);    // and report it
   }
-#endif
-}
-
-//**************************************************************************************************
-//                                    C H K H D R L I N E                                          *
-//**************************************************************************************************
-// Check if a line in the header is a reasonable headerline.                                       *
-// Normally it should contain something like "icy-xxxx:abcdef".                                    *
-//**************************************************************************************************
-bool chkhdrline(const char* str)
-{
-  char b;                                             // Byte examined
-  int  len = 0;                                       // Length of string
-
-  while ((b = *str++)) {                              // Search to end of string
-    len++;                                            // Update string length
-    if (!isalpha(b)) {                                // Alpha (a-z, A-Z)
-      if (b != '-') {                                 // Minus sign is allowed
-        if (b == ':') {                               // Found a colon?
-          return ((len > 5) && (len < 50));           // Yes, okay if length is okay
+  else if (argument.indexOf("next") >= 0 ||
+           argument.indexOf("uppreset") >= 0) {
+    if (currentSource == SDCARD && playMode == SDCARD) {
+      if (SD_okay && currentIndex > 0) {
+        int fileIndex;                                               // Next file index of track on SD
+        if (!mp3fileRepeatFlag)
+          fileIndex = nextSDfileIndex (currentIndex, +1);            // Select the next file on SD
+        else if (mp3fileRepeatFlag == SONG)
+          fileIndex = currentIndex;                                  // Select the same file
+        else if (mp3fileRepeatFlag == DIRECTORY)
+          fileIndex = nextSDfileIndexInSameDir (currentIndex, +1);   // select next file in same directory
+        else
+          fileIndex = shuffleNext(+1);                               // random mode
+        host = getSDfilename (fileIndex);
+        if (host.startsWith("error")) {
+          dbgprint("SD problem: can't find file with index %d", fileIndex);
         }
         else {
-          return false;                               // Not a legal character
+          dbgprint("STOP (command: next file on SD)");
+          dataMode = STOPREQD;                          // Request STOP
+          hostreq = true;                               // Request this host
+          snprintf(reply, sizeof(reply), "Next playing: %s", host.c_str());
+          utf8ascii(reply);
+          volRamp(VR_START);
         }
       }
     }
-  }
-  return false;                                       // End of string without colon
-}
-
-//**************************************************************************************************
-//                            S C A N _ C O N T E N T _ L E N G T H                                *
-//**************************************************************************************************
-// If the line contains content-length information: set clength (content length counter).          *
-//**************************************************************************************************
-void scan_content_length(const char* metalinebf)
-{
-  if (strstr(metalinebf, "Content-Length")) {        // Line contains content length
-    clength = atoi(metalinebf + 15);                 // Yes, set clength
-    dbgprint("Content-Length is %d", clength);       // Show for debugging purposes
-  }
-}
-
-//**************************************************************************************************
-//                                   H A N D L E B Y T E _ C H                                     *
-//**************************************************************************************************
-// Handle the next byte of data from server or mp3 file.                                           *
-// Chunked transfer encoding aware. Chunk extensions are not supported.                            *
-//**************************************************************************************************
-void handlebyte_ch(uint8_t b)
-{
-  static int       chunksize = 0;                      // Chunkcount read from stream
-  static uint16_t  playlistcnt;                        // Counter to find right entry in playlist
-  static int       LFcount;                            // Detection of end of header
-  static bool      ctseen = false;                     // First line of header seen or not
-  static bool      nameseen = false;                   // Name of station seen
-  static bool      brseen = false;                     // Bitrate of station seen
+    else if (currentSource == STATION && playMode == STATION) {
+      xQueueReset (dataQueue);
+      volRamp(VR_START);
+      ini_block.newpreset += 1;                         // Yes, adjust currentPreset
+      if (ini_block.newpreset > highestPreset)
+        ini_block.newpreset = 0;
+      sprintf(reply, "Preset is now %d",                // Reply new preset
+                ini_block.newpreset);
+    }
+#ifdef ENABLE_SOAP    
+    else if (currentSource == MEDIASERVER && playMode == MEDIASERVER) {
+      const char* p;
+      int16_t newIndex;
 
-  if (chunked &&
-       (dataMode & (DATA |                             // Test op DATA handling
-                    METADATA |
-                    PLAYLISTDATA))) {
-    if (chunkcount == 0) {                             // Expecting a new chunkcount?
-      if (b == '\r') {                                 // Skip CR
-        return;
+      if (mp3fileRepeatFlag == SONG) {
+        newIndex = currentIndex;                        // Select the same file again
+      }  
+      else {
+        newIndex = nextSoapFileIndex(currentIndex, +1); // Select the next file on soap list
       }
-      else if (b == '\n') {                            // LF ?
-        chunkcount = chunksize;                        // Yes, set new count
-        chunksize = 0;                                 // For next decode
-        return;
+      if (newIndex != -1) {
+        p = dbgprint("Next playing: \"%s\"", soapList[newIndex].name.c_str());
+        host = "soap/" + soapList[newIndex].uri;
+        hostObject = soapList[newIndex];
+        currentIndex = newIndex;
+        dbgprint("STOP (command: next file in soap list)");
+        dataMode = STOPREQD;                            // Request STOP
+        hostreq = true;                                 // Request this host
+        volRamp(VR_START);
       }
-      // We have received a hexadecimal character.  Decode it and add to the result.
-      b = toupper(b) - '0';                            // Be sure we have uppercase
-      if (b > 9) {
-        b = b - 7;                                     // Translate A..F to 10..15
+      else {
+        p = dbgprint("Soap list problem: Can't find next entry");
       }
-      chunksize = (chunksize << 4) + b;
-      return;
+      strcpy(reply, p);
+      utf8ascii(reply);  
     }
-    chunkcount--;                                      // Update count to next chunksize block
+#endif
   }
-  if (dataMode == DATA) {                              // Handle next byte of MP3/Ogg data
-    *outqp++ = b;
-    if (outqp == (outchunk.buf + sizeof(outchunk.buf))) { // Buffer full?
-      outchunk.datatyp = QDATA;                        // This chunk dedicated to QDATA
-      // Send data to playTask queue.  If the buffer cannot be placed within 200 ticks,
-      // the queue is full, while the sender tries to send more.  The chunk will be dis-
-      // carded in that case.
-      xQueueSend(dataQueue, &outchunk, 200);           // send to queue (wait max 200 ticks [resp. 200ms])
-      outqp = outchunk.buf;                            // item empty now
+  else if (argument == "stop") {                        // (un)Stop requested?
+    // TEST
+    //dbgprint("dataMode=%d, playMode=%d, totalCount=%d, currentSource=%d, currentPreset=%d, encoderMode=%d",
+    //            dataMode, playMode, totalCount, currentSource, currentPreset, encoderMode);
+    if (dataMode & (HEADER | DATA | METADATA | PLAYLISTINIT |
+                      PLAYLISTHEADER | PLAYLISTDATA)) {
+      dbgprint("STOP (command: stop)");
+      dataMode = STOPREQD;                              // Request STOP
+      strcpy(reply, "Player stopped.");
+      tftset(1, "Player stopped.");                     // Set screen segment text middle part
     }
-    //*/
-    if (metaint) {                                     // No METADATA on Ogg streams or mp3 files
-      if (--datacount == 0) {                          // End of datablock?
-        dataMode = METADATA;
-        metalinebfx = -1;                              // Expecting first metabyte (counter)
-      }
+    else {
+      if (dataMode == INIT)
+        sprintf(reply, "Player unstopped.");
+      else
+        sprintf(reply, "Playing from %.82s continues.", host.c_str());
+      hostreq = true;                                   // Request UNSTOP
+      volRamp(VR_START);
     }
-    return;
-  }
-  if (dataMode == INIT) {                              // Initialize for header receive
-    ctseen = false;                                    // Contents type not seen yet
-    nameseen = false;                                  // Name of station not seen yet
-    brseen = false;                                    // Bitrate of station not seen yet
-    metaint = 0;                                       // No metaint found
-    LFcount = 0;                                       // For detection end of header
-    bitrate = 0;                                       // Bitrate still unknown
-    dbgprint("Switch to HEADER"); 
-    dataMode = HEADER;                                 // Handle header
-    totalCount = 0;                                    // Reset totalCount
-    metalinebfx = 0;                                   // No metadata yet
-    metalinebf[0] = '\0';
-    muteFlag = 16;                                     // ca. 1,6 sek.
+    return reply;
   }
-  if (dataMode == HEADER) {                            // Handle next byte of MP3 header
-    b = utf8ascii(b);
-    if ((b > 0x7F) ||                                  // Ignore unprintable characters
-        (b == '\r') ||                                 // Ignore CR
-        (b == '\0')) {                                 // Ignore NULL
-      // Yes, ignore
+  else if (argument == "mode") {
+    if (currentSource == SDCARD) {
+      dbgprint("STOP (command: mode switch to STATION)");
+      dataMode = STOPREQD;                              // Stop player
+      currentPreset = -1;                               // Switch to station mode
+      volRamp(VR_START);
+      encoderMode = IDLING;
     }
-    else if (b == '\n') {                              // Linefeed ?
-      LFcount++;                                       // Count linefeeds
-      metalinebf[metalinebfx] = '\0';                  // Take care of delimiter
-      if (chkhdrline(metalinebf)) {                    // Reasonable input?
-        dbgprint("Headerline: %s", metalinebf);        // Show headerline
-        String metaline = String(metalinebf);          // Convert to string
-        String lcml = metaline;                        // Use lower case for compare
-        lcml.toLowerCase();
-        if (lcml.startsWith("location: http://")) {    // Redirection?
-          host = metaline.substring(17);               // Yes, get new URL
-          hostreq = true;                              // And request this one
-          dbgprint("Redirection to new host");
-        }
-        else if (lcml.indexOf("content-type") == 0) {  // Line beginning with "Content-Type: xxxx/yyy"
-          ctseen = true;                               // Yes, remember seeing this
-          //String ct = metaline.substring(13);        // Set contentstype. Not used yet
-          //ct.trim();
-          //dbgprint("%s seen.", ct.c_str());
-        }
-        else if (lcml.startsWith("icy-br:")) {
-          brseen = true;
-          bitrate = metaline.substring(7).toInt();     // Found bitrate tag, read the bitrate
-          if (bitrate == 0) {                          // For Ogg br is like "Quality 2"
-            bitrate = 87;                              // Dummy bitrate
-          }
-        }
-        else if (lcml.startsWith("icy-metaint:")) {
-          metaint = metaline.substring(12).toInt();    // Found metaint tag, read the value
-        }
-        else if (lcml.startsWith("icy-name:")) {
-          icyname = metaline.substring(9);             // Get station name
-          icyname.trim();                              // Remove leading and trailing spaces
-          if (icyname.length() > 0) {
-            nameseen = true;
-            if (icyname.length() > 62) {               // line limiting
-              icyname.remove(59);
-              icyname += "...";
-            }
-          }
-        }
-        else if (lcml.startsWith("transfer-encoding:")) {
-          // Station provides chunked transfer
-          if (lcml.endsWith("chunked")) {
-            chunked = true;                            // Remember chunked transfer mode
-            chunkcount = 0;                            // Expect chunkcount in DATA
-          }
-        }
-      }
-      metalinebfx = 0;                                 // Reset this line
-      if ((LFcount == 2) && ctseen) {                  // Content type seen and a double LF?
-        dbgprint("Switch to DATA, bitrate is %dkbps"   // Show bitrate
-                 ", metaint is %d", bitrate, metaint); // and metaint
-        dataMode = DATA;                               // Expecting data now
-        datacount = metaint;                           // Number of bytes before first metadata
-        skipStationAllowed = true;                     // now allow skip buttons in station mode
-        if (!nameseen) {                               // no name seen, that's highly unusual
-          // so we try to find it in the preset list
-          String tmp;
-          int8_t inx;
-
-          icyname = host;                              // by default display host instead of station name
-          if (icyname.length() > 62) {                 // line limiting
-            icyname.remove(59);
-            icyname += "...";
-          }
-          //nameseen = true;
-
-          dbgprint("No icy-name! Search name for host \"%s\" in presets", host.c_str());
-          for (int i = 0; i <= 99; i++) {
-            tmp = readhostfrompref(i);                 // Get host spec and possible comment
-            if (tmp == "") {                           // End of presets?
-              dbgprint("No preset for this host found! Index which breaked = %d.", i);
-              break;                                   // no matching entry found
-            }
-            if (tmp.indexOf(host) >= 0) {              // Found host in preset ?
-              dbgprint("Found host in preset %d.", i);
-              inx = tmp.indexOf("#");                  // Get position of "#"
-              if (inx > 0) {                           // Hash sign present?
-                tmp.remove(0, inx + 1);            // Yes, remove non-comment part
-                chomp(tmp);                        // Remove garbage from description
-                tmp.trim();                           // Remove leading & trailing whitespace
-                if (tmp.length() > 0) {                // Something left ?
-                  inx = tmp.indexOf(" - ");
-                  if (inx >= 0) {
-                    tmp.remove(0, inx + 3);
-                  }
-                  dbgprint("Name found = \"%s\"", tmp.c_str());
-                  icyname = tmp;
-                }
-              }
-              break;
-            }
-          }
+    else if (currentSource == STATION) {
+      if (SD_okay && SD_mp3fileCount > 0) {
+        mp3fileRepeatFlag = NOREPEAT; 
+        mp3filePause = 0;
+        int fileIndex = nextSDfileIndex(0, 0);          // Select the first file on SD
+        host = getSDfilename(fileIndex);
+        if (host.startsWith("error")) {
+          dbgprint("SD problem: Can't find file with index %d", fileIndex);
         }
-        if (brseen) {
-          icyname += " (" + String(bitrate) + "kbps)";
+        else {
+          dbgprint("STOP (command: mode switch to SDCARD)");
+          dataMode = STOPREQD;                          // Stop player
+          hostreq = true;                               // Request this host
         }
-        tftset(1, "...waiting for text...");           // Set screen segment middle part
-        tftset(3, icyname);                            // Set screen segment bottom part
-        lastAlbumStation = icyname;
-        queuefunc(QSTARTSONG);                         // Queue a request to start song
       }
     }
-    else {
-      metalinebf[metalinebfx++] = (char)b;             // Normal character, put new char in metaline
-      if (metalinebfx >= METASIZ) {                    // Prevent overflow
-        metalinebfx--;
+  }
+  else if (argument == "mp3track" ||                    // Select a track from SD card?
+            argument == "station") {                    // Station in the form address:port
+    if (value.length() == 0 ||
+         (argument == "station" && value.indexOf('.') < 0)) {
+      return "Error: parameter value invalid !";
+    }
+    if (argument == "mp3track") {                       // MP3 track to search for
+      playMode = SDCARD;
+      if (!SD_okay) {                                   // SD card present?
+        dbgprint("SD problem: Can't execute command %s=%s", par, val);
+        return "SD problem: Can't execute command !";
       }
-      LFcount = 0;                                     // Reset double CRLF detection
+      else if (SD_okay && !SD_mp3fileCount) {
+        dbgprint("SD empty: Can't execute command %s=%s", par, val);
+        return "SD empty: Can't execute command !";
+      }
+      if (strspn(value.c_str(), "0123456789") != value.length()) { // Text instead of node?
+        char    key[SDSEARCH_TEXTMAX];
+        int16_t node;
+        int     offset = sdSearchParse(value, key);    // ",<n>" selects the n-th match
+        if (sdSearch(key, offset, 1, &node) <= offset) {
+          dbgprint("No SD track matches %s", value.c_str());
+          return "No matching track found.";
+        }
+        value = String(node);
+      }
+      valout = getSDfilename(value.toInt());            // like "sdcard/........"
+      if (valout.startsWith("error")) {
+        dbgprint("SD problem: Can't find file %s", value.c_str());
+        return "SD problem: Can't find selected file.";
+      }
+      if (value.toInt() == 0) mp3fileRepeatFlag = RANDOM;
+      snprintf(reply, sizeof(reply), "Playing %s", valout.c_str());
     }
-    return;
+    else { // argument == station
+      playMode = STATION;
+      mp3fileRepeatFlag = NOREPEAT;
+      valout = value;
+      snprintf(reply, sizeof(reply), "Connecting to %s", valout.c_str());
+    }
+    if (dataMode & (HEADER | DATA | METADATA | PLAYLISTINIT |
+                      PLAYLISTHEADER | PLAYLISTDATA)) {
+      dbgprint("STOP (command: mp3track or station)");
+      dataMode = STOPREQD;                            // Request STOP
+    }
+    host = valout;                                    // Save it for storage and selection later
+    hostreq = true;                                   // Force this station or file as new preset
+    utf8ascii(reply);                                 // Remove possible strange characters in reply
   }
-  if (dataMode == METADATA) {                          // Handle next byte of metadata
-    if (metalinebfx < 0) {                             // First byte of metadata?
-      metalinebfx = 0;                                 // Prepare to store first character
-      metacount = b * 16 + 1;                          // New count for metadata including length byte
+  else if (argument == "status") {                    // Status request
+    if (dataMode == STOPPED) {
+      sprintf(reply, "Player stopped");               // Format reply
     }
     else {
-      metalinebf[metalinebfx++] = (char)b;             // Normal character, put new char in metaline
-      if (metalinebfx >= METASIZ) {                    // Prevent overflow
-        metalinebfx--;
+      if (currentSource == SDCARD || currentSource == MEDIASERVER) {
+        snprintf(reply, sizeof(reply), "Playing %s", host.c_str());
+        utf8ascii(reply);
       }
-    }
-    if (--metacount == 0) {
-      metalinebf[metalinebfx] = '\0';                  // Make sure line is limited
-      if (strlen(metalinebf)) {                        // Any info present?
-        // metaline contains artist and song name.  For example:
-        // "StreamTitle='Don McLean - American Pie';StreamUrl='';"
-        // Sometimes it is just other info like:
-        // "StreamTitle='60s 03 05 Magic60s';StreamUrl='';"
-        // Isolate the StreamTitle, remove leading and trailing quotes if present.
-        showStreamTitle(metalinebf);                   // Show artist and title if present in metadata
+      else if (currentSource == STATION) {
+        snprintf(reply, sizeof(reply), "%s - %s", icyname.c_str(),
+                   icystreamtitle.c_str());           // streamtitle from metadata
       }
-      if (metalinebfx > (METASIZ - 10)) {              // Unlikely metaline length?
-        dbgprint("Metadata block too long! Skipping all Metadata from now on.");
-        metaint = 0;                                   // Probably no metadata or network problem
+      if (vstelemetry.samplerate) {                   // stream info from VS1053 available?
+        int len = strlen(reply);
+        snprintf(reply + len, sizeof(reply) - len, " [%s %dHz %dkbps %d:%02d]",
+                 vstelemetry.codec, vstelemetry.samplerate, vstelemetry.bitrate,
+                 (int)(playSeconds() / 60), (int)(playSeconds() % 60));
       }
-      datacount = metaint;                             // Reset data count
-      //bufcnt = 0;                                    // Reset buffer count
-      dataMode = DATA;                                 // Expecting data
     }
   }
-  if (dataMode == PLAYLISTINIT) {                      // Initialize for receive .m3u file
-    // We are going to use metadata to read the lines from the .m3u file
-    // Sometimes this will only contain a single line
-    metalinebfx = 0;                                   // Prepare for new line
-    LFcount = 0;                                       // For detection end of header
-    dataMode = PLAYLISTHEADER;                         // Handle playlist data
-    playlistcnt = 1;                                   // Reset for compare
-    totalCount = 0;                                    // Reset totalCount
-    clength = 0xFFFF;                                  // Content-length unknown
-    dbgprint("Read from playlist");
+  else if (argument.startsWith("reset")) {            // reset request
+    resetreq = true;                                  // reset all
   }
-  if (dataMode == PLAYLISTHEADER) {                    // Read header
-    if ((b > 0x7F) ||                                  // Ignore unprintable characters
-        (b == '\r') ||                                 // Ignore CR
-        (b == '\0')) {                                 // Ignore NULL
-      return;                                          // Quick return
+  else if (argument == "jumpforward") {               // jump forward in mp3 file
+    if (currentSource == SDCARD) {
+      if (dataMode == DATA) mp3fileJumpForward = true;
     }
-    else if (b == '\n') {                              // Linefeed ?
-      LFcount++;                                       // Count linefeeds
-      metalinebf[metalinebfx] = '\0';                  // Take care of delimeter
-      dbgprint("Playlistheader: %s", metalinebf);      // Show playlistheader
-      scan_content_length(metalinebf);                 // Check if it is a content-length line
-      metalinebfx = 0;                                 // Ready for next line
-      if (LFcount == 2) {
-        dbgprint("Switch to PLAYLISTDATA, "            // For debug
-                 "search for entry %d", playlist_num);
-        dataMode = PLAYLISTDATA;                       // Expecting data now
-        return;
-      }
+    else if (currentSource == STATION) {
+      sprintf(reply, "Command not accepted in station mode"); // format reply
     }
-    else {
-      metalinebf[metalinebfx++] = (char)b;             // Normal character, put new char in metaline
-      if (metalinebfx >= METASIZ) {                    // Prevent overflow
-        metalinebfx--;
+    else { // MEDIASERVER
+      if (dataMode == DATA) {
+        // to be implemented if needed
       }
-      LFcount = 0;                                     // Reset double CRLF detection
     }
   }
-  if (dataMode == PLAYLISTDATA) {                      // Read next byte of .m3u file data
-    clength--;                                         // Decrease content length by 1
-    if ((b > 0x7F) ||                                  // Ignore unprintable characters
-        (b == '\r') ||                                 // Ignore CR
-        (b == '\0')) {                                 // Ignore NULL
-      // Yes, ignore
+  else if (argument == "jumpback") {                  // jump backwards in mp3 file
+    if (currentSource == SDCARD) {
+      if (dataMode == DATA) mp3fileJumpBack = true;
     }
-    if (b != '\n') {                                   // Linefeed?
-      // No, normal character in playlistdata,
-      metalinebf[metalinebfx++] = (char)b;             // add it to metaline
-      if (metalinebfx >= METASIZ) {                    // Prevent overflow
-        metalinebfx--;
-      }
+    else if (currentSource == STATION) {
+      sprintf(reply, "Command not accepted in station mode"); // format reply
     }
-    if ((b == '\n') ||                                 // linefeed ?
-         (clength == 0)) {                             // Or end of playlist data contents
-      int inx;                                         // Pointer in metaline
-      metalinebf[metalinebfx] = '\0';                  // Take care of delimeter
-      dbgprint("Playlistdata: %s", metalinebf);        // Show playlistheader
-      if (strlen(metalinebf) < 5) {                    // Skip short lines
-        metalinebfx = 0;                               // Flush line
-        metalinebf[0] = '\0';
-        return;
-      }
-      String metaline = String(metalinebf);            // Convert to string
-      if (metaline.indexOf("#EXTINF:") >= 0) {         // Info?
-        if (playlist_num == playlistcnt) {             // Info for this entry?
-          inx = metaline.indexOf(",");                 // Comma in this line?
-          if (inx > 0) {
-            // Show artist and title if present in metadata
-            showStreamTitle(metaline.substring(inx + 1).c_str(), true);
-          }
-        }
-      }
-      if (metaline.startsWith("#")) {                  // Commentline?
-        metalinebfx = 0;                               // Yes, ignore
-        return;                                        // Ignore commentlines
-      }
-      // Now we have an URL for a .mp3 file or stream.  Is it the rigth one?
-      dbgprint("Entry %d in playlist found: %s", playlistcnt, metalinebf);
-      if (playlist_num == playlistcnt) {
-        inx = metaline.indexOf("http://");             // Search for "http://"
-        if (inx >= 0) {                                // Does URL contain "http://"?
-          host = metaline.substring(inx + 7);          // Yes, remove it and set host
-        }
-        else {
-          host = metaline;                             // Yes, set new host
-        }
-        connectToHost();                               // Connect to it
+    else { // MEDIASERVER
+      if (dataMode == DATA) {
+        // to be implemented if needed
       }
-      metalinebfx = 0;                                 // Prepare for next line
-      host = playlist;                                 // Back to the .m3u host
-      playlistcnt++;                                   // Next entry in playlist
     }
   }
-}
-
-#if defined(ENABLE_CMDSERVER) && !defined(PORT23_ACTIVE)
-//**************************************************************************************************
-//                                     G E T C O N T E N T T Y P E                                 *
-//**************************************************************************************************
-// Returns the contenttype of a file to send.                                                      *
-//**************************************************************************************************
-String getContentType(String filename)
-{
-  if      (filename.endsWith(".html")) return "text/html";
-  else if (filename.endsWith(".png"))  return "image/png";
-  else if (filename.endsWith(".gif"))  return "image/gif";
-  else if (filename.endsWith(".jpg"))  return "image/jpeg";
-  else if (filename.endsWith(".ico"))  return "image/x-icon";
-  else if (filename.endsWith(".css"))  return "text/css";
-  else if (filename.endsWith(".zip"))  return "application/x-zip";
-  else if (filename.endsWith(".gz"))   return "application/x-gzip";
-  else if (filename.endsWith(".mp3"))  return "audio/mpeg";
-  else if (filename.endsWith(".pw"))   return "";        // Passwords are secret
-  return "text/plain";
-}
-
-//**************************************************************************************************
-//                                        H A N D L E F S F                                        *
-//**************************************************************************************************
-// Handling of requesting pages from the PROGMEM. Example: favicon.ico                             *
-//**************************************************************************************************
-void handleFSf(const String& pagename)
-{
-  String      ct;                                    // Content type
-  const char* p;
-  int         l;                                     // Size of requested page
-  int         TCPCHUNKSIZE = 1024;                   // Max number of bytes per write
+  else if (argument == "rescan") {                    // re-Scan SD-Card
+    SD_rescanReq = true;                              // don't use index file
+    SD_mp3fileCount = 0;                              // forces a new mount
+    buttonSD = true;                                  // we simulate a pressed button
+    enc_inactivity = 0;
+  }
+#ifdef HEAP_STATS
+  else if (argument == "heap") {                      // heap statistics
+    dbgprintLines(heapStatsText());                   // to debug output
+    sprintf(reply, "Free heap %d, largest block %d, smallest largest block %d",
+            ESP.getFreeHeap(), ESP.getMaxAllocHeap(), heapMinMaxAlloc);
+  }
+#endif
+#ifdef POWER_SAVE
+  else if (argument == "power") {                     // power mode statistics
+    dbgprintLines(powerStatsText());                  // to debug output
+    sprintf(reply, "CPU clock is %d MHz, mode %s", getCpuFrequencyMhz(), pmModeNames[pmMode]);
+  }
+#endif
+#ifdef TASK_STATS
+  else if (argument == "tasks") {                     // task statistics
+    dbgprintLines(taskStatsText());                   // to debug output
+    sprintf(reply, "Statistics of %d tasks sent to debug output", (int)taskCount);
+  }
+#endif
+  else if (argument == "test") {                      // test command
+    char tmpline[120];                                // SD read statistics
 
-  dbgprint("FileRequest received %s", pagename.c_str());
-  ct = getContentType(pagename);                     // Get content type
-  if ((ct == "") || (pagename == "")) {              // Empty is illegal
-    _claimSPI("handlefsf1");                         // claim SPI bus
-    cmdclient.println("HTTP/1.1 404 Not Found");
-    cmdclient.println("");
-//#ifdef USE_ETHERNET
-//    cmdclient.flush();                             // not needed in the end
-//    cmdclient.stop();
-//#endif
-    _releaseSPI();                                   // release SPI bus
-    return;
+    if (currentSource == SDCARD) {
+      av = mp3fileBytesLeft;                          // available bytes in file
+    }
+    else { // STATION or MEDIASERVER
+      _claimSPI("analyzecmd1");
+      av = mp3client.available();                     // available in stream
+      _releaseSPI();
+    }
+    sprintf(reply, "Free memory %d, chunks in queue %d, stream %d, bitrate %d kbps (decoder %d kbps), vol %d",
+              ESP.getFreeHeap(), uxQueueMessagesWaiting (dataQueue), av, mbitrate,
+              vstelemetry.bitrate, ini_block.reqvol);
+    dbgprint("Total free memory of all regions=%d (minEver=%d), freeHeap=%d (minEver=%d), minStack=%d (in Bytes)", 
+             ESP.getFreeHeap(), ESP.getMinFreeHeap(), xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL)); 
+    dbgprint("Stack minimum mainTask was %d", uxTaskGetStackHighWaterMark (mainTask));
+    dbgprint("Stack minimum playTask was %d", uxTaskGetStackHighWaterMark (xplayTask));
+    dbgprint("Stack minimum spfTask  was %d", uxTaskGetStackHighWaterMark (xspfTask));
+#ifdef FRONT_PANEL_BUTTONS    															
+    dbgprint("Stack minimum extenderTask  was %d", uxTaskGetStackHighWaterMark (xextenderTask));
+#endif   					
+#if defined VU_METER && defined LOAD_VS1053_PATCH
+    dbgprint("Stack minimum vumeterTask  was %d", uxTaskGetStackHighWaterMark (xvumeterTask));
+#endif    
+    dbgprint("Volume setting is %d", ini_block.reqvol);
+    dbgprint("Queue underruns while playing: %d", underruns);
+    sdReadStats(tmpline, sizeof(tmpline));
+    dbgprint("%s", tmpline);
+    if (mp3nodeList.size()) {                         // node table size and path lookup time
+      char     path[SDPATH_MAX];
+      uint32_t t0 = micros(), bytes = 0;
+      for (int16_t i = 1; i < mp3nodeList.size(); i++) {
+        bytes += max(sdPath(i, path, sizeof(path)), 0); // like getSDfilename()
+      }
+      t0 = micros() - t0;
+      dbgprint("SD nodes %d, %d bytes (%d per node), paths of all nodes %d us (%d bytes)",
+               mp3nodeList.size(), mp3nodeList.memUsage(),
+               mp3nodeList.memUsage() / mp3nodeList.size(), t0, bytes);
+    }
   }
-  else {
-    if (pagename.indexOf("index.html") >= 0) {       // Index page is in PROGMEM
-      p = index_html;
-      l = sizeof(index_html);
+  // Commands for bass/treble control
+  else if (argument.startsWith("tone")) {            // tone command
+    if (argument.indexOf("ha") > 0) {                // high amplitue? (for treble)
+      ini_block.rtone[0] = ivalue;                   // prepare to set ST_AMPLITUDE
     }
-    else if (pagename.indexOf("radio.css") >= 0) {   // CSS file is in PROGMEM
-      p = radio_css + 1;
-      l = sizeof(radio_css);
+    if (argument.indexOf("hf") > 0) {                // high frequency? (for treble)
+      ini_block.rtone[1] = ivalue;                   // prepare to set ST_FREQLIMIT
     }
-    else if (pagename.indexOf("config.html") >= 0) { // Config page is in PROGMEM
-      p = config_html;
-      l = sizeof(config_html);
+    if (argument.indexOf("la") > 0) {                // low amplitue? (for bass)
+      ini_block.rtone[2] = ivalue;                   // prepare to set SB_AMPLITUDE
     }
-    else if (pagename.indexOf("mp3play.html") >= 0) {// Mp3player page is in PROGMEM
-      p = mp3play_html;
-      l = sizeof(mp3play_html);
+    if (argument.indexOf("lf") > 0) {                // high frequency? (for bass)
+      ini_block.rtone[3] = ivalue;                   // prepare to set SB_FREQLIMIT
     }
-    else if (pagename.indexOf("about.html") >= 0) {  // About page is in PROGMEM
-      p = about_html;
-      l = sizeof(about_html);
+    reqtone = true;                                  // set change request
+    snprintf(reply, sizeof(reply), "Parameter for bass/treble %s set to %d",
+             argument.c_str(), ivalue);
+  }
+  else if (argument == "debug") {                    // debug on/off request?
+    DEBUG = ivalue;                                  // set flag accordingly
+  }
+  else if (argument == "getnetworks") {              // list all WiFi networks?
+    snprintf(reply, sizeof(reply), "%s", networks.c_str()); // reply is SSIDs
+  }
+  else if (argument.startsWith("clk_")) {            // TOD parameter?
+    if (argument.indexOf("server") > 0) {            // NTP server spec?
+      ini_block.clk_server = value;                  // set server
     }
-    else if (pagename.indexOf("favicon.ico") >= 0) { // Favicon icon is in PROGMEM
-      p = (char*)favicon_ico;
-      l = sizeof(favicon_ico);
+#ifdef USE_ETHERNET
+    if (argument.indexOf("tzstring") > 0) {          // time zone string?
+      ini_block.clk_tzstring = value;                // set time zone string
     }
-    else {
-      p = index_html;
-      l = sizeof(index_html);
+#else
+    if (argument.indexOf("offset") > 0) {            // offset with respect to UTC spec?
+      ini_block.clk_offset = ivalue;                 // set offset
     }
-    if (*p == '\n') {                                // If page starts with newline:
-      p++;                                           // Skip first character
-      l--;
+    if (argument.indexOf("dst") > 0) {               // offset duringe DST spec?
+      ini_block.clk_dst = ivalue;                    // set DST offset
     }
-    dbgprint("Length of page is %d", strlen (p));
-    _claimSPI("handlefsf2");                        // claim SPI bus
-    cmdclient.print(httpHeader(ct));                // Send header
-    _releaseSPI();                                  // release SPI bus
-    // The content of the HTTP response follows the header:
-    if (l < 10) {
-      _claimSPI("handlefsf3");                      // claim SPI bus
-      cmdclient.println ("Testline<br>");
-      _releaseSPI();                                // release SPI bus
+#endif
+  }
+#ifdef ENABLE_SOAP
+  else if (argument.startsWith("srv_")) {            // media server parameter?
+    if (argument.indexOf("ip") > 0) {                // media server ip ?
+      ini_block.srv_ip.fromString(value.c_str());
+      //dbgprint("New media server ip=%s", ini_block.srv_ip.toString().c_str());
     }
-    else {
-      while (l) {                                   // Loop through the output page
-        if (l <= TCPCHUNKSIZE) {                    // Near the end?
-          _claimSPI("handlefsf4");                  // claim SPI bus
-          cmdclient.write(p, l);                    // Yes, send last part
-          _releaseSPI();                            // release SPI bus
-          l = 0;
-        }
-        else {
-          _claimSPI("handlefsf5");                  // claim SPI bus
-          cmdclient.write(p, TCPCHUNKSIZE);         // Send part of the page
-          _releaseSPI();                            // release SPI bus
-          p += TCPCHUNKSIZE;                        // Update startpoint and rest of bytes
-          l -= TCPCHUNKSIZE;
-        }
-      }
+    if (argument.indexOf("port") > 0) {              // media server port ?
+      ini_block.srv_port = ivalue;
+      //dbgprint("New media server port=%d", ini_block.srv_port);
     }
-    // The HTTP response ends with another blank line:
-    _claimSPI("handlefsf6");                        // claim SPI bus
-    cmdclient.println();
-//#ifdef USE_ETHERNET
-//    cmdclient.flush();                            // not needed in the end
-//    cmdclient.stop();
-//#endif
-    _releaseSPI();                                  // release SPI bus
-    dbgprint("Response send");
+    if (argument.indexOf("controlurl") > 0) {        // media server port ?
+      ini_block.srv_controlUrl = value;
+      //dbgprint("New media server controlUrl=\"%s\"", ini_block.srv_controlUrl.c_str());
+    }
+    if (argument.indexOf("mac") > 0) {               // media server mac needed for WOL ?
+      ini_block.srv_macWOL = value;
+      //dbgprint("New media server macWOL=\"%s\"", ini_block.srv_macWOL.c_str());
+    }
+  }
+#endif  
+  else {
+    snprintf(reply, sizeof(reply), "%s called with illegal parameter: %s",
+             NAME, argument.c_str());
   }
+  return reply;                                      // return reply to the caller
 }
-#endif
 
 //**************************************************************************************************
-//                                         C H O M P                                               *
+//                                     H T T P H E A D E R                                         *
 //**************************************************************************************************
-// Do some filtering on de inputstring:                                                            *
-//  - String comment part (starting with "#").                                                     *
-//  - Strip trailing CR.                                                                           *
-//  - Strip leading spaces.                                                                        *
-//  - Strip trailing spaces.                                                                       *
+// Set http headers to a string.                                                                   *
 //**************************************************************************************************
-void chomp(String &str)
+String httpHeader(String contentstype)
 {
-  int inx;                                           // Index in de input string
-
-  if ((inx = str.indexOf("#")) >= 0) {               // Comment line or partial comment?
-    str.remove(inx);                                 // Yes, remove
-  }
-  str.trim();                                        // Remove spaces and CR
+  HEAP_TAG("httpHeader");
+  return String("HTTP/1.1 200 OK\nContent-type:") +
+         contentstype +
+         String("\n"
+                "Server: " NAME "\n"
+                "Cache-Control: " "max-age=3600\n"
+                "Last-Modified: " VERSION "\n\n");
 }
 
 //**************************************************************************************************
-//                                     A N A L Y Z E C M D                                         *
-//**************************************************************************************************
-// Handling of the various commands from remote webclient or Serial                                *
-// Version for handling string with: <parameter>=<value>                                           *
+//* Functions that are called from spfTask.                                                         *
 //**************************************************************************************************
-const char* analyzeCmd(const char* str)
-{
-  char*       value;                            // Points to value after equalsign in command
-  const char* res;                              // Result of analyzeCmd
-
-  value = strstr(str, "=");                     // See if command contains a "="
-  if (value) {
-    *value = '\0';                              // Separate command from value
-    res = analyzeCmd(str, value + 1);           // Analyze command and handle it
-    *value = '=';                               // Restore equal sign
-  }
-  else {
-    res = analyzeCmd(str, "0");                 // No value, assume zero
-  }
-  return res;
-}
 
 //**************************************************************************************************
-//                                     A N A L Y Z E C M D                                         *
+//                                 D I S P L A Y S D S T A T U S                                   *
 //**************************************************************************************************
-// Handling of the various commands from remote webclient or serial                                *
-// par holds the parametername and val holds the value.                                            *
-// "wifi_00" and "preset_00" may appear more than once, like wifi_01, wifi_02, etc.                *
-// Examples with available parameters:                                                             *
-//   preset     = 12                        // Select start preset to connect to                   *
-//   preset_00  = <mp3 stream>              // Specify station for a preset 00-99 *)               *
-//   toneha     = <0..15>                   // Setting treble gain                                 *
-//   tonehf     = <0..15>                   // Setting treble frequency                            *
-//   tonela     = <0..15>                   // Setting bass gain                                   *
-//   tonelf     = <0..15>                   // Setting treble frequency                            *
-//   station    = <mp3 stream>              // Select new station (will not be saved)              *
-//   station    = <URL>.mp3                 // Play standalone .mp3 file (not saved)               *
-//   station    = <URL>.m3u                 // Select playlist (will not be saved)                 *
-//   stop                                   // Stop playing                                        *
-//   resume                                 // Resume playing                                      *
-//   mute                                   // Mute/unmute the music (toggle)                      *
-//   wifi_00    = mySSID/mypassword         // Set WiFi SSID and password *)                       *
-//   clk_server = pool.ntp.org              // Time server to be used *)                           *
-//   clk_offset = <-11..+14>                // Offset with respect to UTC in hours *)              *
-//   clk_dst    = <1..2>                    // Offset during daylight saving time in hours *)      *
-//   mp3track   = <nodeIndex>               // Play track from SD card, nodeID 0 = random          *
-//   settings                               // Returns setting like presets and tone               *
-//   status                                 // Show current URL to play                            *
-//   test                                   // For test purposes                                   *
-//   debug      = 0 or 1                    // Switch debugging on or off                          *
-//   reset                                  // Restart the ESP32                                   *
-//  Commands marked with "*)" are sensible during initialization only                              *
-//   repeat                                 // repeat cmd                                          *
-//   mode                                   // switch between SDCARD / STATION mode                *
-//   previous/next                          // previous/next mp3 file or station                   *
-//   mediaserver_xxx                        // media server settings                               *
+// SD card missing or not ok: display a red "S", for repeat mode "r" (Song) or "R" (Directory),    *
+// for random mode 'F' (fluke....r/R for random is already in use).                                *
+// Status only painted if it has changed. A char on the screen is 8 pixels high and 6 pixels wide! *
 //**************************************************************************************************
-const char* analyzeCmd(const char* par, const char* val)
+void displaySDstatus()
 {
-  String             argument;                       // Argument as string
-  String             value, valout;                  // Value of an argument as a string
-  int                ivalue;                         // Value of argument as an integer
-  static char        reply[180];                     // Reply to client, will be returned
-  //bool               relative;                       // Relative argument (+ or -)
-  String             tmpstr;                         // Temporary for value
-  uint32_t           av;                             // Available in stream/file
+  static enum_repeat_mode repeatFlagOld = NOREPEAT;           // for compare
+  static bool             sdmissingFlagOld = false;           // for compare
+  enum_repeat_mode        repeatFlag = NOREPEAT;
+  bool                    sdmissingFlag = !SD_okay;
 
-  strcpy(reply, "Command accepted");                 // Default reply
-  argument = String(par);                            // Get the argument
-  chomp (argument);                                  // Remove comment and useless spaces
-  if (argument.length() == 0) {                      // Lege commandline (comment)?
-    return reply;                                    // Ignore
-  }
-  argument.toLowerCase();                            // Force to lower case
-  value = String(val);                               // Get the specified value
-  chomp (value);                                     // Remove comment and extra spaces
-  ivalue = value.toInt();                            // Also as an integer
-  ivalue = abs (ivalue);                             // Make positive
-  //relative = argument.indexOf("up") == 0;          // + relative setting?
-  if (argument.indexOf("down") == 0) {               // - relative setting?
-    //relative = true;                                 // It's relative
-    ivalue = - ivalue;                               // But with negative value
-  }
-  if (value.startsWith("http://")) {                 // Does (possible) URL contain "http://"?
-    value.remove (0, 7);                             // Yes, remove it
-  }
-  if (value.length()) {
-    tmpstr = value;                                  // Make local copy of value
-    if (argument.indexOf("passw") >= 0) {            // Password in value?
-      tmpstr = String("*******");                    // Yes, hide it
-    }
-    dbgprint("Command: %s with parameter %s",
-               argument.c_str(), tmpstr.c_str());
-  }
-  else {
-    dbgprint("Command: %s (without parameter)",
-               argument.c_str());
-  }
-  if (argument.indexOf("volume") == 0) {             // absolute Volume setting?
-    ini_block.reqvol = ivalue;
-    if (ini_block.reqvol < 60) {
-      ini_block.reqvol = 60;                         // Limit to min value 60
-    }
-    else if (ini_block.reqvol > 92) {
-      ini_block.reqvol = 92;                         // Limit to value 92
-    }
-    muteFlag = 0;                                    // Stop possibly muting
-    sprintf(reply, "Volume is now %d",               // Reply new volume
-              ini_block.reqvol);
-  }
-  else if (argument.indexOf("volume") > 0) {         // relative Volume setting?
-    ini_block.reqvol += ivalue;
-    if (ini_block.reqvol < 60) {
-      ini_block.reqvol = 60;                         // Limit to min value 60
-    }
-    else if (ini_block.reqvol > 92) {
-      ini_block.reqvol = 92;                         // Limit to max value 92
-    }
-    muteFlag = 0;                                    // Stop possibly muting
-    sprintf(reply, "Volume is now %d",               // Reply new volume
-            ini_block.reqvol);
+  if (currentSource == SDCARD) {
+    repeatFlag = (mp3fileRepeatFlag != NOREPEAT && SD_okay) ? mp3fileRepeatFlag : NOREPEAT;
+  }  
+  else if (currentSource == MEDIASERVER) {
+    repeatFlag = mp3fileRepeatFlag;
   }
-  else if (argument == "mute") {                     // Mute/unmute request
-    muteFlag = (!muteFlag) ? -1 : 0;
-    sprintf(reply, "Output is now %s",               // Reply mute status
-            muteFlag ? "muted" : "unmuted");
+  if (currentSource == SDCARD && sdmissingFlag) {             // all the others are useless in this case
+    repeatFlagOld = repeatFlag;
   }
-  else if (argument == "repeat") {                   // repeate request
-    if (currentSource == SDCARD && currentIndex > 0 &&
-         playMode == SDCARD && SD_okay) {
-      if (mp3fileRepeatFlag == NOREPEAT) {
-        mp3fileRepeatFlag = SONG;                    // repeat same file
-        sprintf(reply, "Repeat Mode = SONG");
-      }
-      else if (mp3fileRepeatFlag == SONG) {
-        mp3fileRepeatFlag = DIRECTORY;               // repeat same directory
-        sprintf(reply, "Repeat Mode = DIRECTORY");
-      }
-      else if (mp3fileRepeatFlag == DIRECTORY) {
-        mp3fileRepeatFlag = RANDOM;                  // random play
-        sprintf(reply, "Repeat Mode = RANDOM");
-      }
-      else {
-        mp3fileRepeatFlag = NOREPEAT;                // clear repeat flag
-        sprintf(reply, "Repeat Mode = NOREPEAT");
+  if (tft) {                                                  // TFT active?
+    if (repeatFlagOld == repeatFlag &&
+        ((currentSource == SDCARD && sdmissingFlagOld == sdmissingFlag) ||
+        (currentSource == MEDIASERVER))) {
+      return;                                                 // no change at all
+    }
+    uint8_t pos = dsp_getwidth() + SDSTATUSPOS;               // X-position of character
+    //dbgprint("displayrandom(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
+    //           pos, 0, 6, 8);
+    dsp_fillRect(pos, 0, 6, 8, BLACK);                        // clear the space for new character
+    if (currentSource == SDCARD && 
+        sdmissingFlagOld != sdmissingFlag) {                  // any Difference?
+      if (sdmissingFlag) {
+        dsp_setTextColor(RED);                                // set the requested color
+        dsp_setCursor(pos, 0);                                // prepare to show the info
+        dsp_print('S');                                       // show the character
       }
+      sdmissingFlagOld = sdmissingFlag;
     }
-    else if (currentSource == MEDIASERVER && currentIndex >= 0) {
-      if (mp3fileRepeatFlag == NOREPEAT) {
-        mp3fileRepeatFlag = SONG;                    // repeat same file
-        sprintf(reply, "Repeat Mode = SONG");
+    else if (repeatFlagOld != repeatFlag) {
+      if (repeatFlag != NOREPEAT) {
+        dsp_setTextColor(GREEN);                              // set the requested color
+        dsp_setCursor(pos, 0);                                // prepare to show the info
+        if (repeatFlag == SONG)
+          dsp_print('r');                                     // show the character
+        else if (repeatFlag == DIRECTORY)
+          dsp_print('R');
+        else // RANDOM
+          dsp_print('F');
       }
-      else if (mp3fileRepeatFlag == SONG) {
-        mp3fileRepeatFlag = DIRECTORY;               // repeat same directory
-        sprintf(reply, "Repeat Mode = DIRECTORY");
+      repeatFlagOld = repeatFlag;
+    }
+  }
+}
+
+//**************************************************************************************************
+//                               D I S P L A Y M U T E P A U S E                                   *
+//**************************************************************************************************
+// If muted show 'M' on the LCD, if paused a 'P' at a fixed position in a specified color.         *
+// The status is only displayed if it has changed.                                                 *
+// A character on the screen is 8 pixels high and 6 pixels wide.                                   *
+//**************************************************************************************************
+void displayMutePause()
+{
+  static uint8_t mpflagOld = 0;                   // For compare
+  uint8_t mpflag = 0;
+
+  if (tft) {                                      // TFT active?
+    if (muteFlag) mpflag |= 0x01;
+    else mpflag &= 0xFE;
+    if (mp3filePause) mpflag |= 0x02;
+    else mpflag &= 0xFD;
+    if (mpflagOld != mpflag) {                    // Any Difference?
+      uint8_t pos = dsp_getwidth() + MUTEPOS;     // X-position of character
+      //dbgprint("displaymute(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
+      //           pos, 0, 6, 8);
+      dsp_fillRect(pos, 0, 6, 8, BLACK);          // Clear the space for new character
+      if (mp3filePause) { 
+        // Pause prevails over mute
+        dsp_setTextColor(GREEN);                  // Set the requested color
+        dsp_setCursor(pos, 0);                    // Prepare to show the info
+        dsp_print('P');                           // Show the character
       }
-      else if (mp3fileRepeatFlag == DIRECTORY) {
-        mp3fileRepeatFlag = NOREPEAT;               // repeat same directory
-        sprintf(reply, "Repeat Mode = NOREPEAT");
+      else if (muteFlag) {
+        dsp_setTextColor(GREEN);                  // Set the requested color
+        dsp_setCursor(pos, 0);                    // Prepare to show the info
+        dsp_print('M');                           // Show the character
       }
+      mpflagOld = mpflag;                         // Remember for next compare
     }
-    else {
-      sprintf(reply, "Command \'Repeat\' not allowed in this state.");
-    }
-  }
-  else if (argument.indexOf("ir_") >= 0) {           // Ir setting?
-    // No action required
   }
-  else if (argument.indexOf("preset_") >= 0) {       // Enumerated preset?
-    // No action required
+}
+
+//**************************************************************************************************
+//                                   D I S P L A Y T E L E M E T R Y                               *
+//**************************************************************************************************
+// Show codec, bitrate and sample rate of the SD/media server track on the top line, like          *
+// "MP3 128k 44.1kHz" (no sample rate next to the spectrum analyzer).  The decode time is shown by *
+// the progress bar, a top line redrawn every second would flicker.                                *
+//**************************************************************************************************
+void displayTelemetry()
+{
+  static char oldtxt[24] = "";                         // shown last, empty = top line not used
+  char        txt[24];
+
+  if (currentSource != SDCARD && currentSource != MEDIASERVER) {
+    oldtxt[0] = '\0';                                  // top line belongs to radio mode
+    return;
   }
-  else if (argument.indexOf("preset") == 0) {        // Preset station?
-    mp3fileRepeatFlag = NOREPEAT;  
-    playMode = STATION;
-    ini_block.newpreset = ivalue;                    // Otherwise set station
-    playlist_num = 0;                                // Absolute, reset playlist
-    sprintf(reply, "Preset is now %d",               // Reply new preset
-            ini_block.newpreset);
+  if (encoderMode == SELECT) {                         // don't disturb selecting tracks
+    return;
   }
-  else if (argument.indexOf("pause") >= 0) {
-    // TEST
-    //dbgprint("dataMode=%d, playMode=%d, totalCount=%d, currentSource=%d, currentPreset=%d, encoderMode=%d",
-    //            dataMode, playMode, totalCount, currentSource, currentPreset, encoderMode);
-    if (dataMode == DATA && currentSource == SDCARD &&
-         playMode == SDCARD && SD_okay && currentIndex > 0) {
-      mp3filePause = !mp3filePause;
-      sprintf(reply, "Playing mp3 file %s",              // Reply pause status
-                mp3filePause ? "has paused." : "continues.");
-      if (mp3filePause) {
-        xQueueReset (dataQueue);
-      }
-      else {
-        //muteFlag = 6;                                     // suppresses chirps
-      }
-    }
-    else {
-      sprintf(reply, "Command \'Pause\' not allowed in this state.");
+  if (dataMode != DATA || !vstelemetry.samplerate || !vstelemetry.codec[0]) {
+    if (oldtxt[0]) {
+      oldtxt[0] = '\0';
+      tftset(0, (currentSource == SDCARD) ? TOPLINE_MP3 : "ESP32 DLNA"); // back to default
     }
+    return;
   }
-  else if (argument.indexOf("previous") >= 0 ||
-           argument.indexOf("downpreset") >= 0) {
-    if (currentSource == SDCARD && playMode == SDCARD) {
-      if (SD_okay && currentIndex > 0) {
-        int fileIndex;                                  // Previous file index of track on SD
-        if (mp3fileRepeatFlag == SONG ||
-             ((mp3fileLength - mp3fileBytesLeft) > (mp3fileLength / 30)))
-          fileIndex = currentIndex;                     // Select the same file again
-        else if (mp3fileRepeatFlag == NOREPEAT)
-          fileIndex = nextSDfileIndex(currentIndex, -1); // Select the previous file on SD
-        else if (mp3fileRepeatFlag == DIRECTORY)
-          fileIndex = nextSDfileIndexInSameDir(currentIndex, -1); // select previous file in same directory
-        else
-          fileIndex = 0;                                // random mode
-        host = getSDfilename(fileIndex);
-        if (host.startsWith("error")) {
-          dbgprint("SD problem: can't find file with index %d", fileIndex);
-        }
-        else {
-          dbgprint("STOP (command: previous file on SD)");
-          dataMode = STOPREQD;                          // Request STOP
-          hostreq = true;                               // Request this host
-          sprintf(reply, "Next playing %s", host.c_str());
-          utf8ascii(reply);
-          muteFlag = 10;
-        }
-      }
+#ifdef SPECTRUMPOS
+  snprintf(txt, sizeof(txt), "%s %dk", vstelemetry.codec, vstelemetry.bitrate); // no room for more
+#else
+  snprintf(txt, sizeof(txt), "%s %dk %d.%dkHz", vstelemetry.codec, vstelemetry.bitrate,
+           vstelemetry.samplerate / 1000, (vstelemetry.samplerate % 1000) / 100);
+#endif
+  if (strcmp(txt, oldtxt)) {                           // changed?
+    strcpy(oldtxt, txt);
+    tftset(0, txt);                                    // set screen segment top line
+  }
+}
+
+//**************************************************************************************************
+//                                    D I S P L A Y P R O G R E S S                                *
+//**************************************************************************************************
+// Show the mp3 file progress as an indicator (two red lines) on the very bottom of the display.   *
+// Position is taken from the decode time of the VS1053 if known, else from the bytes read.        *
+//**************************************************************************************************
+#define STEPS 20
+void displayProgress()
+{
+  if (tft && (currentSource == SDCARD || currentSource == MEDIASERVER) && encoderMode != SELECT) {
+    static uint8_t oldprog = 0;                        // previous progress
+    uint8_t        newprog = 0;                        // current setting
+    uint8_t        pos;                                // position of progress indicator
+    uint32_t       steps = mp3fileLength / STEPS;
+    uint32_t       played = mp3fileLength - mp3fileBytesLeft;
+
+    if (vstelemetry.byterate && !decodeResetQueued) {  // data rate known from VS1053?
+      uint32_t decoded = decodeBase +                  // yes, position of decoder in file
+                         (uint32_t)vstelemetry.decodetime * vstelemetry.byterate;
+      if (decoded < played) played = decoded;          // not more than read so far
     }
-    else if (currentSource == STATION && playMode == STATION) {
-      xQueueReset (dataQueue);
-      muteFlag = 30;
-      ini_block.newpreset -= 1;                         // Yes, adjust currentPreset
-      if (ini_block.newpreset < 0)
-        ini_block.newpreset = highestPreset;
-      sprintf(reply, "Preset is now %d",                // Reply new preset
-                     ini_block.newpreset);
+
+    for (int i = 1; i * steps <= played && mp3fileLength; i++) {
+      newprog = i;
     }
-#ifdef ENABLE_SOAP    
-    else if (currentSource == MEDIASERVER && playMode == MEDIASERVER) {
-      const char* p;
-      int16_t newIndex;
+    if ((forceProgressBar || (newprog != oldprog))     // force painting or has indicator changed
+         && !tftdata[3].update_req && !tftdata[4].update_req) { // and no work for section 3 or 4
+      forceProgressBar = false;
+      oldprog = newprog;                               // remember for next compare
+      pos = map(newprog, 0, STEPS, 0, dsp_getwidth()); // compute position on TFT
+      //dbgprint("displayvolume(): fillRect: x=%d y=%d w=%d h=%d col=RED",
+      //           0, dsp_getheight() - 2, pos, 2);
+      dsp_fillRect(0, dsp_getheight() - 2, pos, 2, RED);  // Paint red part
+      //dbgprint("displayvolume(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
+      //           pos, dsp_getheight() - 2, dsp_getwidth() - pos, 2);
+      dsp_fillRect(pos, dsp_getheight() - 2,
+                   dsp_getwidth() - pos, 2, BLACK);    // paint remainder black
+    }
+  }
+}
 
-      if (mp3fileRepeatFlag == SONG ||
-            ((mp3fileLength - mp3fileBytesLeft) > (mp3fileLength / 30))) {
-        newIndex = currentIndex;                        // Select the same file again
-      }  
-      else {
-        newIndex = nextSoapFileIndex(currentIndex, -1); // Select the previous file on soap list
-      }
-      if (newIndex != -1) {
-        p = dbgprint("Next playing \"%s\"", soapList[newIndex].name.c_str());
-        host = "soap/" + soapList[newIndex].uri;
-        hostObject = soapList[newIndex];
-        currentIndex = newIndex;
-        dbgprint("STOP (command: previous file in soap list)");
-        dataMode = STOPREQD;                            // Request STOP
-        hostreq = true;                                 // Request this host
-        muteFlag = 10;
-      }
-      else {
-        p = dbgprint("Soap list problem: can't find previous entry");
+//**************************************************************************************************
+//                                      D I S P L A Y T I M E                                      *
+//**************************************************************************************************
+// Show the time on the LCD at a fixed position in a specified color                               *
+// To prevent flickering, only the changed part of the timestring is displayed.                    *
+// An empty string will force a refresh on next call.                                              *
+// A character on the screen is 8 pixels high and 6 pixels wide.                                   *
+//**************************************************************************************************
+void displayTime(const char* str, uint16_t color)
+{
+  static char oldstr[6] = ".....";                // for compare
+  uint8_t     i;                                  // index in strings
+  uint8_t     pos = dsp_getwidth() + TIMEPOS;     // X-position of character
+
+  if (str[0] == '\0') {                           // empty string?
+    for (i = 0; i < 5; i++) {                     // set oldstr to dots
+      oldstr[i] = '.';
+    }
+    return;                                       // no actual display yet
+  }
+  if (tft) {                                      // TFT active?
+    dsp_setTextColor(color);                      // Set the requested color
+    for (i = 0; i < 5; i++) {                     // Compare old and new
+      if (str[i] != oldstr[i]) {                  // any change ?
+        //dbgprint("displayTime(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
+        //           pos, 0, 6, 8);
+        dsp_fillRect(pos, 0, 6, 8, BLACK);        // Clear the space for new character
+        dsp_setCursor(pos, 0);                    // Prepare to show the info
+        dsp_print(str[i]);                        // show the character
+        oldstr[i] = str[i];                       // remember for next compare
       }
-      strcpy(reply, p);
-      utf8ascii(reply);  
+      pos += 6;                                   // next position
     }
-#endif
   }
-  else if (argument.indexOf("next") >= 0 ||
-           argument.indexOf("uppreset") >= 0) {
-    if (currentSource == SDCARD && playMode == SDCARD) {
-      if (SD_okay && currentIndex > 0) {
-        int fileIndex;                                               // Next file index of track on SD
-        if (!mp3fileRepeatFlag)
-          fileIndex = nextSDfileIndex (currentIndex, +1);            // Select the next file on SD
-        else if (mp3fileRepeatFlag == SONG)
-          fileIndex = currentIndex;                                  // Select the same file
-        else if (mp3fileRepeatFlag == DIRECTORY)
-          fileIndex = nextSDfileIndexInSameDir (currentIndex, +1);   // select next file in same directory
-        else
-          fileIndex = 0;                                             // random mode
-        host = getSDfilename (fileIndex);
-        if (host.startsWith("error")) {
-          dbgprint("SD problem: can't find file with index %d", fileIndex);
-        }
-        else {
-          dbgprint("STOP (command: next file on SD)");
-          dataMode = STOPREQD;                          // Request STOP
-          hostreq = true;                               // Request this host
-          sprintf(reply, "Next playing: %s", host.c_str());
-          utf8ascii(reply);
-          muteFlag = 10;
-        }
-      }
+}
+
+//**************************************************************************************************
+//                                     L I M I T S T R I N G                                       *
+//**************************************************************************************************
+// Reduce string to a length that it's hight will fit into num pixels on the screen. The calcu-    *
+// lation considers the actual font size.                                                          *
+//**************************************************************************************************
+String limitString(String& strg, int maxPixel) {
+  int16_t  x = 0, y = 0;
+  uint16_t w = 0, h = 0;
+
+  while (strg.length() > 32) {
+    dsp_getTextBounds(strg, 0, 0, &x, &y, &w, &h);
+    if (h <= maxPixel) break;
+    strg = strg.substring(0, strg.length() - 1); // cut 1 byte off at the end
+  }
+  strg.trim();
+  return strg;
+}
+
+//**************************************************************************************************
+//                                      D I S P L A Y I N F O                                      *
+//**************************************************************************************************
+// Show a string on the LCD at a specified y-position (0..4) in a specified color.                 *
+// The parameter is the index in tftdata[]. Strings are evaluated for wide/narrow characters and   *
+// their length adjusted to not wrap around into the next section.                                 *
+//**************************************************************************************************
+void displayinfo(uint16_t inx)
+{
+  scrseg_struct *p = &tftdata[inx];
+  uint16_t width = dsp_getwidth(),                      // normal number of colums
+           len = p->str.length();
+  int8_t   i;
+  String   strg;
+
+  if (tft && len > 0) {                                 // any action required ?
+    if (inx == 0) {                                     // topline is shorter
+#ifdef SPECTRUMPOS
+      width += SPECTRUMPOS;                             // leave space for spectrum, flags + time
+#else
+      width += SDSTATUSPOS;                             // leave space for flags + time
+#endif
     }
-    else if (currentSource == STATION && playMode == STATION) {
-      xQueueReset (dataQueue);
-      muteFlag = 30;
-      ini_block.newpreset += 1;                         // Yes, adjust currentPreset
-      if (ini_block.newpreset > highestPreset)
-        ini_block.newpreset = 0;
-      sprintf(reply, "Preset is now %d",                // Reply new preset
-                ini_block.newpreset);
+    //dbgprint("displayinfo(%d): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
+    //           inx, 0, p->y, width, p->height);
+    dsp_fillRect(0, p->y, width, p->height, BLACK);     // clear the space for new info
+    if ((dsp_getheight() > 64) && (p->y > 1)) {         // need any space for divider?
+      //dbgprint("displayinfo(): fillRect: x=%d y=%d w=%d h=%d col=GREEN",
+      //           0, p->y - 1, width, 1);
+      dsp_fillRect(0, p->y - 1, width, 1, GREEN);       // generate divider between segment 0 and 1/2
     }
-#ifdef ENABLE_SOAP    
-    else if (currentSource == MEDIASERVER && playMode == MEDIASERVER) {
-      const char* p;
-      int16_t newIndex;
 
-      if (mp3fileRepeatFlag == SONG) {
-        newIndex = currentIndex;                        // Select the same file again
-      }  
-      else {
-        newIndex = nextSoapFileIndex(currentIndex, +1); // Select the next file on soap list
-      }
-      if (newIndex != -1) {
-        p = dbgprint("Next playing: \"%s\"", soapList[newIndex].name.c_str());
-        host = "soap/" + soapList[newIndex].uri;
-        hostObject = soapList[newIndex];
-        currentIndex = newIndex;
-        dbgprint("STOP (command: next file in soap list)");
-        dataMode = STOPREQD;                            // Request STOP
-        hostreq = true;                                 // Request this host
-        muteFlag = 10;
+    p->str = utf8ascii(p->str.c_str());                 // convert possible UTF8 chars
+    dsp_setTextColor(p->color);                         // set requested color
+    if (inx == 1 || inx == 2) {                         // name on 1. line, Title on 2. line (if 2 lines)
+      dsp_setFontBig();
+      dsp_setCursor(0, p->y + 18);                      // set cursor for first line for big font
+      i = p->str.indexOf('\n');                         // find position of CR (separates the line)
+      if (i > 0) {                                      // separate segments ?
+        // Processing first line
+        strg = p->str.substring(0, i);                  // extract first line
+        strg = limitString(strg, (p->height / 2) - 2 ); // make sure it fits into 2 lines on the display
+        dsp_print(strg.c_str());                        // show the string on TFT
+        // show divider in the middle of segment
+        dsp_fillRect(0, p->y + (p->height / 2), width, 1, YELLOW);
+        // Processing second line
+        dsp_setCursor(0, p->y + 62);                    // set cursor for second line for big font
+        strg = p->str.substring(i + 1);                 // extract second line
+        strg = limitString(strg, (p->height / 2) - 2);  // make sure it fits into 2 lines on the display
+        dsp_print(strg.c_str());                               // show the string on TFT
       }
-      else {
-        p = dbgprint("Soap list problem: Can't find next entry");
+      else {                                            // just one line
+        // got to fit into 4 lines on display
+        strg = p->str;
+        strg = limitString(strg, p->height - 2);        // make sure it fits into 4 lines on the display
+        dsp_print(strg.c_str());                        // show string on TFT
       }
-      strcpy(reply, p);
-      utf8ascii(reply);  
-    }
-#endif
-  }
-  else if (argument == "stop") {                        // (un)Stop requested?
-    // TEST
-    //dbgprint("dataMode=%d, playMode=%d, totalCount=%d, currentSource=%d, currentPreset=%d, encoderMode=%d",
-    //            dataMode, playMode, totalCount, currentSource, currentPreset, encoderMode);
-    if (dataMode & (HEADER | DATA | METADATA | PLAYLISTINIT |
-                      PLAYLISTHEADER | PLAYLISTDATA)) {
-      dbgprint("STOP (command: stop)");
-      dataMode = STOPREQD;                              // Request STOP
-      strcpy(reply, "Player stopped.");
-      tftset(1, "Player stopped.");                     // Set screen segment text middle part
+      dsp_setFont();                                    // back to normal font
     }
-    else {
-      if (dataMode == INIT)
-        sprintf(reply, "Player unstopped.");
+    else {                                              // segments 0, 3 or 4
+      if (inx == 3 || inx == 4) {                       // segment at bottom
+        unsigned int len = (currentSource != STATION) ? 53 : 72;// in radio mode is room for third line
+        if (p->str.length() > len) p->str.setCharAt(len, '\0'); // rudimentary line limiting
+      }
+      if (inx == 0)
+        dsp_setCursor(0, p->y);                         // prepare to show the info on top line
       else
-        sprintf(reply, "Playing from %.82s continues.", host.c_str());
-      hostreq = true;                                   // Request UNSTOP
-      muteFlag = 20;
+        dsp_setCursor(0, p->y + 4);                     // prepare to show the info on bottom line
+      dsp_print(p->str.c_str());                        // show the string on TFT
     }
-    return reply;
   }
-  else if (argument == "mode") {
-    if (currentSource == SDCARD) {
-      dbgprint("STOP (command: mode switch to STATION)");
-      dataMode = STOPREQD;                              // Stop player
-      currentPreset = -1;                               // Switch to station mode
-      muteFlag = 15;
-      encoderMode = IDLING;
-    }
-    else if (currentSource == STATION) {
-      if (SD_okay && SD_mp3fileCount > 0) {
-        mp3fileRepeatFlag = NOREPEAT; 
-        mp3filePause = 0;
-        int fileIndex = nextSDfileIndex(0, 0);          // Select the first file on SD
-        host = getSDfilename(fileIndex);
-        if (host.startsWith("error")) {
-          dbgprint("SD problem: Can't find file with index %d", fileIndex);
-        }
-        else {
-          dbgprint("STOP (command: mode switch to SDCARD)");
-          dataMode = STOPREQD;                          // Stop player
-          hostreq = true;                               // Request this host
-        }
-      }
-    }
+}
+
+#ifdef USE_ETHERNET
+//**************************************************************************************************
+//                            G E T L O C A L T I M E E T H                                        *
+//**************************************************************************************************
+// Retrieve local time from NTP server & convert to string. Only needed when using Ethernet/LAN.   *
+//**************************************************************************************************
+bool getLocalTimeEth(struct tm *info)
+{
+  static bool initialized = false;
+  int ret, tt = 0, num = 0;
+  unsigned long epoch;
+  byte packetBuffer[NTP_PACKET_SIZE];         // buffer to hold incoming and outgoing packets
+
+  if (!initialized) {                        // executing only once
+    initialized = true;
+    setenv("TZ", ini_block.clk_tzstring.c_str(), 1);
+    tzset();
   }
-  else if (argument == "mp3track" ||                    // Select a track from SD card?
-            argument == "station") {                    // Station in the form address:port
-    if (value.length() == 0 ||
-         (argument == "station" && value.indexOf('.') < 0)) {
-      return "Error: parameter value invalid !";
+
+  memset(packetBuffer, 0, NTP_PACKET_SIZE);   // set all bytes in the buffer to 0
+  // Initialize values needed to form NTP request
+  packetBuffer[0] = 0b11100011;   // LI, Version, Mode
+  packetBuffer[1] = 0;                        // Stratum, or type of clock
+  packetBuffer[2] = 6;                        // Polling Interval
+  packetBuffer[3] = 0xEC;                     // Peer Clock Precision
+  // 8 bytes of zero for Root Delay & Root Dispersion
+  packetBuffer[12]  = 49;
+  packetBuffer[13]  = 0x4E;
+  packetBuffer[14]  = 49;
+  packetBuffer[15]  = 52;
+  _claimSPI("time1");                     // claim SPI bus
+  udpclient.begin(localPortNtp);              // needed for ntp time server
+  ret = udpclient.beginPacket(ini_block.clk_server.c_str(), 123);
+  _releaseSPI();                            // release SPI bus
+  if (ret) {                                 //NTP requests are to port 123
+    // the host exists (we got positive DNS answer)
+    _claimSPI("time2");                   // claim SPI bus
+    udpclient.write(packetBuffer, NTP_PACKET_SIZE);
+    udpclient.endPacket();
+    _releaseSPI();                          // release SPI bus
+    do {
+      delay(100);
+      _claimSPI("time3");                 // claim SPI bus
+      num = udpclient.parsePacket();
+      _releaseSPI();                        // release SPI bus
+      tt++;
+    } while ((tt <= 15) && !num);
+  }
+  if (num) {
+    dbgprint("NTP server response after %d ms from %s", tt * 100, ini_block.clk_server.c_str());
+    _claimSPI("time4");                   // claim SPI bus
+    udpclient.read(packetBuffer, NTP_PACKET_SIZE);  // read the packet into the buffer
+    udpclient.stop();
+    _releaseSPI();                          // release SPI bus
+    long highWord = word(packetBuffer[40], packetBuffer[41]);
+    long lowWord = word(packetBuffer[42], packetBuffer[43]);
+    // this is NTP time (seconds since Jan 1 1900):
+    long secsSince1900 = highWord << 16 | lowWord;       // combine the four bytes (two words) into a long integer
+    epoch = secsSince1900 - 2208988800UL;                // convert into Unix time (secs since 1.1.1970)
+    dbgprint("Posix time zone string: \"%s\"", ini_block.clk_tzstring.c_str());
+    localtime_r((const time_t*)&epoch, info);
+    dbgprint("TZ applied -> Date: %d.%d.%d Time: %02d:%02d",
+               info->tm_mday, info->tm_mon + 1, info->tm_year + 1900, info->tm_hour, info->tm_min);
+    return true;
+  }
+  dbgprint("Can't connect NTP-Server %s. Incorrect server name ?", ini_block.clk_server.c_str());
+  _claimSPI("time5");                   // claim SPI bus
+  udpclient.stop();
+  _releaseSPI();                          // release SPI bus
+  return false;
+}
+#endif  // USE_ETHERNET
+
+//**************************************************************************************************
+//                                         G E T T I M E                                           *
+//**************************************************************************************************
+// Retrieve the local time from NTP server and convert to string.                                  *
+// Will be called every minute.                                                                    *
+//**************************************************************************************************
+void getTime()
+{
+  static int16_t delaycount = 0;                           // To reduce number of NTP requests
+  static int16_t retrycount = 5;                           // max 5 attempts to sync time
+
+  if (tft) {                                               // TFT used?
+    if (timeinfo.tm_year) {                                // Legal time found?
+      sprintf(timetxt, "%02d:%02d",                        // Yes, format to a string
+              timeinfo.tm_hour,
+              timeinfo.tm_min);
     }
-    if (argument == "mp3track") {                       // MP3 track to search for
-      playMode = SDCARD;
-      if (!SD_okay) {                                   // SD card present?
-        dbgprint("SD problem: Can't execute command %s=%s", par, val);
-        return "SD problem: Can't execute command !";
+    if (--delaycount <= 0) {                               // Sync every 24 hours
+      delaycount = 1440;                                   // Reset counter to 1440min (24 hours)
+      if (timeinfo.tm_year) {                              // Legal time found?
+        dbgprint("Sync TOD, old value is %s", timetxt);
       }
-      else if (SD_okay && !SD_mp3fileCount) {
-        dbgprint("SD empty: Can't execute command %s=%s", par, val);
-        return "SD empty: Can't execute command !";
+      dbgprint("Sync TOD");
+#ifdef USE_ETHERNET
+      if (!getLocalTimeEth (&timeinfo)) {                  // Read from NTP server
+#else
+      if (!getLocalTime (&timeinfo)) {                     // Read from NTP server
+#endif
+        dbgprint("Failed to obtain time!");                // Error
+        timeinfo.tm_year = 0;                              // Set current time to illegal
+        if (retrycount) {                                  // Give up syncing?
+          retrycount--;                                    // No try again
+          delaycount = 1;                                  // Retry after 1 minute
+        }
       }
-      valout = getSDfilename(value.toInt());            // like "sdcard/........"
-      if (valout.startsWith("error")) {
-        dbgprint("SD problem: Can't find file %s", value.c_str());
-        return "SD problem: Can't find selected file.";
+      else {
+        sprintf(timetxt, "%02d:%02d",                      // Format new time to a string
+                timeinfo.tm_hour,
+                timeinfo.tm_min);
+        dbgprint("Sync TOD successful, new value is %s", timetxt);
       }
-      if (value.toInt() == 0) mp3fileRepeatFlag = RANDOM;
-      sprintf(reply, "Playing %s", valout.c_str());
-    }
-    else { // argument == station
-      playMode = STATION;
-      mp3fileRepeatFlag = NOREPEAT;
-      valout = value;
-      sprintf(reply, "Connecting to %s", valout.c_str());
-    }
-    if (dataMode & (HEADER | DATA | METADATA | PLAYLISTINIT |
-                      PLAYLISTHEADER | PLAYLISTDATA)) {
-      dbgprint("STOP (command: mp3track or station)");
-      dataMode = STOPREQD;                            // Request STOP
     }
-    host = valout;                                    // Save it for storage and selection later
-    hostreq = true;                                   // Force this station or file as new preset
-    utf8ascii(reply);                                 // Remove possible strange characters in reply
   }
-  else if (argument == "status") {                    // Status request
-    if (dataMode == STOPPED) {
-      sprintf(reply, "Player stopped");               // Format reply
+}
+
+//**************************************************************************************************
+//                                H A N D L E _ T F T _ T X T                                      *
+//**************************************************************************************************
+// Check if tft refresh is requested.                                                              *
+//**************************************************************************************************
+bool handle_tft_txt()
+{
+  for (uint16_t i = 0; i < TFTSECS; i++) {              // handle all sections
+    if (tftdata[i].update_req) {                        // refresh requested ?
+      displayinfo(i);                                   // do the refresh
+      dsp_update();                                     // send updates to the screen
+      tftdata[i].update_req = false;                    // reset request
+      return true;                                      // handle only 1 request at a time
     }
-    else {
-      if (currentSource == SDCARD || currentSource == MEDIASERVER) {
-        sprintf(reply, "Playing %s", host.c_str());
-        utf8ascii(reply);
+  }
+  return false;                                         // no request was pending
+}
+
+//**************************************************************************************************
+//                                     P L A Y T A S K                                             *
+//**************************************************************************************************
+// Play stream data from input queue.                                                              *
+// Handle all I/O to VS1053B during normal playing.                                                *
+// Handles display of text, time and volume on TFT as well.                                        *
+//**************************************************************************************************
+void playTask(void * parameter)
+{
+  bool starved = true;                                           // No data since last chunk/start
+
+  while (true) {
+    if (xQueueReceive (dataQueue, &inchunk, 5)) {
+      while (!vs1053player->data_request()) {                    // If FIFO is full..
+        vTaskDelay(1);                                           // Yes, take a break
       }
-      else if (currentSource == STATION) {
-        sprintf(reply, "%s - %s", icyname.c_str(),
-                  icystreamtitle.c_str());            // streamtitle from metadata
+      switch (inchunk.datatyp) {                                 // What kind of chunk?
+        case QDATA:
+          starved = false;                                       // Data is flowing
+#ifdef POWER_SAVE
+          pmHold(PM_PLAY, true);                                 // Full clock while audio flows
+#endif
+          claimSPI("chunk");                                     // claim SPI bus
+          vs1053player->playChunk(inchunk.buf,                   // DATA, send to player
+                                  sizeof(inchunk.buf));
+          volRampStep();                                         // next volume step if due
+#if defined VU_METER && defined LOAD_VS1053_PATCH
+          vuSample();                                            // VU-Meter read if due
+#endif
+          releaseSPI();                                          // release SPI bus
+          totalCount += sizeof(inchunk.buf);                     // Count the bytes
+          if (uxQueueSpacesAvailable(dataQueue) == LOOP_QSPACE_WAKE) {
+            wakeLoop();                                          // room for refilling the queue
+          }
+          break;
+        case QSTARTSONG:
+          starved = true;                                        // Waiting for first data is no underrun
+          claimSPI("startsong");                                 // claim SPI bus
+          vs1053player->startSong();                             // START, start player
+          releaseSPI();                                          // release SPI bus
+          break;
+        case QSTOPSONG:
+          rampDownTime = volramp[VR_STOP].down;                  // fade out what is left in VS1053 FIFO
+          while (true) {
+            claimSPI("stopfade");                                // claim SPI bus
+            bool busy = volRampStep(true);                       // next volume step down
+            releaseSPI();                                        // release SPI bus
+            if (!busy) break;                                    // silent now
+            vTaskDelay(VOLRAMP_STEP / portTICK_PERIOD_MS);       // wait for next frame
+          }
+          claimSPI("stopsong");                                  // claim SPI bus
+          vs1053player->stopSong();                              // STOP, stop player
+          releaseSPI();                                          // release SPI bus
+          vTaskDelay(500 / portTICK_PERIOD_MS);                  // Pause for a short time
+          break;
+        case QNEWTRACK:
+          decodeResetQueued = false;                             // Gapless: last track played,
+          decodeTimeReset = true;                                // decode time of new one from 0
+          break;
+        default:
+          break;
       }
     }
-  }
-  else if (argument.startsWith("reset")) {            // reset request
-    resetreq = true;                                  // reset all
-  }
-  else if (argument == "jumpforward") {               // jump forward in mp3 file
-    if (currentSource == SDCARD) {
-      if (dataMode == DATA) mp3fileJumpForward = true;
-    }
-    else if (currentSource == STATION) {
-      sprintf(reply, "Command not accepted in station mode"); // format reply
-    }
-    else { // MEDIASERVER
-      if (dataMode == DATA) {
-        // to be implemented if needed
+    else {                                                       // No data within 5 ticks
+      if (volRampTarget() != vs1053player->getVolume()) {        // Paused, stopped or stalled,
+        claimSPI("volramp");                                     // but volume still to change
+        volRampStep();                                           // next volume step if due
+        releaseSPI();                                            // release SPI bus
       }
-    }
-  }
-  else if (argument == "jumpback") {                  // jump backwards in mp3 file
-    if (currentSource == SDCARD) {
-      if (dataMode == DATA) mp3fileJumpBack = true;
-    }
-    else if (currentSource == STATION) {
-      sprintf(reply, "Command not accepted in station mode"); // format reply
-    }
-    else { // MEDIASERVER
-      if (dataMode == DATA) {
-        // to be implemented if needed
+      if (dataMode == DATA && !mp3filePause) {                   // Playing but no data?
+        if (!starved) {                                          // Data was flowing until now?
+          underruns++;                                           // Count for comparing task layouts
+          starved = true;                                        // Once per gap in the data
+        }
       }
+#ifdef POWER_SAVE
+      else {
+        pmHold(PM_PLAY, false);                                  // No audio, clock may drop
+      }
+#endif
     }
+    // TEST 
+    //esp_task_wdt_reset();                                      // Protect against idle cpu
   }
-  else if (argument == "rescan") {                    // re-Scan SD-Card
-    buttonSD = true;                                  // we simulate a pressed button
-    enc_inactivity = 0;
-  }
-  else if (argument == "test") {                      // test command
-    if (currentSource == SDCARD) {
-      av = mp3fileBytesLeft;                          // available bytes in file
-    }
-    else { // STATION or MEDIASERVER
-      _claimSPI("analyzecmd1");
-      av = mp3client.available();                     // available in stream
-      _releaseSPI();
-    }
-    sprintf(reply, "Free memory %d, chunks in queue %d, stream %d, bitrate %d kbps, vol %d",
-              ESP.getFreeHeap(), uxQueueMessagesWaiting (dataQueue), av, mbitrate, ini_block.reqvol);
-    dbgprint("Total free memory of all regions=%d (minEver=%d), freeHeap=%d (minEver=%d), minStack=%d (in Bytes)", 
-             ESP.getFreeHeap(), ESP.getMinFreeHeap(), xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL)); 
-    dbgprint("Stack minimum mainTask was %d", uxTaskGetStackHighWaterMark (mainTask));
-    dbgprint("Stack minimum playTask was %d", uxTaskGetStackHighWaterMark (xplayTask));
-    dbgprint("Stack minimum spfTask  was %d", uxTaskGetStackHighWaterMark (xspfTask));
-#ifdef FRONT_PANEL_BUTTONS    															
-    dbgprint("Stack minimum extenderTask  was %d", uxTaskGetStackHighWaterMark (xextenderTask));
-#endif   					
-#if defined VU_METER && defined LOAD_VS1053_PATCH
-    dbgprint("Stack minimum vumeterTask  was %d", uxTaskGetStackHighWaterMark (xvumeterTask));
-#endif    
-    dbgprint("Volume setting is %d", ini_block.reqvol);
-  }
-  // Commands for bass/treble control
-  else if (argument.startsWith("tone")) {            // tone command
-    if (argument.indexOf("ha") > 0) {                // high amplitue? (for treble)
-      ini_block.rtone[0] = ivalue;                   // prepare to set ST_AMPLITUDE
-    }
-    if (argument.indexOf("hf") > 0) {                // high frequency? (for treble)
-      ini_block.rtone[1] = ivalue;                   // prepare to set ST_FREQLIMIT
-    }
-    if (argument.indexOf("la") > 0) {                // low amplitue? (for bass)
-      ini_block.rtone[2] = ivalue;                   // prepare to set SB_AMPLITUDE
-    }
-    if (argument.indexOf("lf") > 0) {                // high frequency? (for bass)
-      ini_block.rtone[3] = ivalue;                   // prepare to set SB_FREQLIMIT
-    }
-    reqtone = true;                                  // set change request
-    sprintf(reply, "Parameter for bass/treble %s set to %d",
-            argument.c_str(), ivalue);
-  }
-  else if (argument == "debug") {                    // debug on/off request?
-    DEBUG = ivalue;                                  // set flag accordingly
-  }
-  else if (argument == "getnetworks") {              // list all WiFi networks?
-    sprintf(reply, networks.c_str());                // reply is SSIDs
+  //vTaskDelete(NULL);                                           // Will never arrive here
+}
+
+#ifdef TASK_STATS
+#if !configGENERATE_RUN_TIME_STATS
+//**************************************************************************************************
+//                                  T A S K T I C K H O O K                                        *
+//**************************************************************************************************
+// Called from the tick interrupt of each core (1 kHz).  Counts a tick for the task that was       *
+// interrupted, so taskTick[] gives the run time of every task in ticks without the FreeRTOS run   *
+// time counters, which are not enabled in the Arduino core.                                       *
+//**************************************************************************************************
+void IRAM_ATTR taskTickHook()
+{
+  TaskHandle_t h = xTaskGetCurrentTaskHandle();        // Task running on this core
+  int          i, empty = -1;
+
+  portENTER_CRITICAL_ISR(&taskTickMux);
+  if (xPortGetCoreID() == 0) {
+    taskTickTotal++;                                   // Both cores see the same number of ticks
   }
-  else if (argument.startsWith("clk_")) {            // TOD parameter?
-    if (argument.indexOf("server") > 0) {            // NTP server spec?
-      ini_block.clk_server = value;                  // set server
-    }
-#ifdef USE_ETHERNET
-    if (argument.indexOf("tzstring") > 0) {          // time zone string?
-      ini_block.clk_tzstring = value;                // set time zone string
-    }
-#else
-    if (argument.indexOf("offset") > 0) {            // offset with respect to UTC spec?
-      ini_block.clk_offset = ivalue;                 // set offset
+  for (i = 0; i < TASKSTAT_MAXTASKS; i++) {
+    if (taskTick[i].handle == h) {
+      break;
     }
-    if (argument.indexOf("dst") > 0) {               // offset duringe DST spec?
-      ini_block.clk_dst = ivalue;                    // set DST offset
+    if (empty < 0 && taskTick[i].handle == NULL) {
+      empty = i;                                       // Use it if task is not in the table yet
     }
-#endif
   }
-#ifdef ENABLE_SOAP
-  else if (argument.startsWith("srv_")) {            // media server parameter?
-    if (argument.indexOf("ip") > 0) {                // media server ip ?
-      ini_block.srv_ip.fromString(value.c_str());
-      //dbgprint("New media server ip=%s", ini_block.srv_ip.toString().c_str());
-    }
-    if (argument.indexOf("port") > 0) {              // media server port ?
-      ini_block.srv_port = ivalue;
-      //dbgprint("New media server port=%d", ini_block.srv_port);
-    }
-    if (argument.indexOf("controlurl") > 0) {        // media server port ?
-      ini_block.srv_controlUrl = value;
-      //dbgprint("New media server controlUrl=\"%s\"", ini_block.srv_controlUrl.c_str());
-    }
-    if (argument.indexOf("mac") > 0) {               // media server mac needed for WOL ?
-      ini_block.srv_macWOL = value;
-      //dbgprint("New media server macWOL=\"%s\"", ini_block.srv_macWOL.c_str());
-    }
+  if (i == TASKSTAT_MAXTASKS && empty >= 0) {
+    i = empty;
+    taskTick[i].handle = h;
+    taskTick[i].ticks = 0;
   }
-#endif  
-  else {
-    sprintf(reply, "%s called with illegal parameter: %s",
-            NAME, argument.c_str());
+  if (i < TASKSTAT_MAXTASKS) {
+    taskTick[i].ticks++;
   }
-  return reply;                                      // return reply to the caller
+  portEXIT_CRITICAL_ISR(&taskTickMux);
 }
+#endif
 
+#if !configGENERATE_RUN_TIME_STATS
 //**************************************************************************************************
-//                                     H T T P H E A D E R                                         *
+//                                 T A S K T I C K S N A P                                         *
 //**************************************************************************************************
-// Set http headers to a string.                                                                   *
+// Copies taskTick[] to taskTickCopy[] and frees the entries of tasks that are gone.  Only the     *
+// copy is made in the critical section, the tasks are looked up in the copy, so the tick          *
+// interrupts of both cores are held up for a few microseconds only.                               *
 //**************************************************************************************************
-String httpHeader(String contentstype)
+void taskTickSnap()
 {
-  return String("HTTP/1.1 200 OK\nContent-type:") +
-         contentstype +
-         String("\n"
-                "Server: " NAME "\n"
-                "Cache-Control: " "max-age=3600\n"
-                "Last-Modified: " VERSION "\n\n");
-}
+  UBaseType_t k;
+  int         j;
 
-//**************************************************************************************************
-//* Functions that are called from spfTask.                                                         *
-//**************************************************************************************************
+  portENTER_CRITICAL(&taskTickMux);
+  memcpy(taskTickCopy, taskTick, sizeof(taskTickCopy));
+  portEXIT_CRITICAL(&taskTickMux);
+  for (j = 0; j < TASKSTAT_MAXTASKS; j++) {
+    if (taskTickCopy[j].handle == NULL) {
+      continue;
+    }
+    for (k = 0; k < taskCount && taskStat[k].xHandle != taskTickCopy[j].handle; k++);
+    if (k == taskCount) {                              // Deleted task?
+      portENTER_CRITICAL(&taskTickMux);
+      if (taskTick[j].handle == taskTickCopy[j].handle) {
+        taskTick[j].handle = NULL;                     // Yes, free the entry
+      }
+      portEXIT_CRITICAL(&taskTickMux);
+      taskTickCopy[j].handle = NULL;
+    }
+  }
+}
+#endif
 
 //**************************************************************************************************
-//                                 D I S P L A Y S D S T A T U S                                   *
+//                                 T A S K R U N T I M E                                           *
 //**************************************************************************************************
-// SD card missing or not ok: display a red "S", for repeat mode "r" (Song) or "R" (Directory),    *
-// for random mode 'F' (fluke....r/R for random is already in use).                                *
-// Status only painted if it has changed. A char on the screen is 8 pixels high and 6 pixels wide! *
+// Returns the run time counter of taskStat[i].  Without configGENERATE_RUN_TIME_STATS the ticks   *
+// counted by taskTickHook() are taken from the copy made by taskTickSnap().                       *
 //**************************************************************************************************
-void displaySDstatus()
+uint32_t taskRunTime(UBaseType_t i)
 {
-  static enum_repeat_mode repeatFlagOld = NOREPEAT;           // for compare
-  static bool             sdmissingFlagOld = false;           // for compare
-  enum_repeat_mode        repeatFlag = NOREPEAT;
-  bool                    sdmissingFlag = !SD_okay;
+#if configGENERATE_RUN_TIME_STATS
+  return taskStat[i].ulRunTimeCounter;
+#else
+  int j;
 
-  if (currentSource == SDCARD) {
-    repeatFlag = (mp3fileRepeatFlag != NOREPEAT && SD_okay) ? mp3fileRepeatFlag : NOREPEAT;
-  }  
-  else if (currentSource == MEDIASERVER) {
-    repeatFlag = mp3fileRepeatFlag;
-  }
-  if (currentSource == SDCARD && sdmissingFlag) {             // all the others are useless in this case
-    repeatFlagOld = repeatFlag;
-  }
-  if (tft) {                                                  // TFT active?
-    if (repeatFlagOld == repeatFlag &&
-        ((currentSource == SDCARD && sdmissingFlagOld == sdmissingFlag) ||
-        (currentSource == MEDIASERVER))) {
-      return;                                                 // no change at all
-    }
-    uint8_t pos = dsp_getwidth() + SDSTATUSPOS;               // X-position of character
-    //dbgprint("displayrandom(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
-    //           pos, 0, 6, 8);
-    dsp_fillRect(pos, 0, 6, 8, BLACK);                        // clear the space for new character
-    if (currentSource == SDCARD && 
-        sdmissingFlagOld != sdmissingFlag) {                  // any Difference?
-      if (sdmissingFlag) {
-        dsp_setTextColor(RED);                                // set the requested color
-        dsp_setCursor(pos, 0);                                // prepare to show the info
-        dsp_print('S');                                       // show the character
-      }
-      sdmissingFlagOld = sdmissingFlag;
-    }
-    else if (repeatFlagOld != repeatFlag) {
-      if (repeatFlag != NOREPEAT) {
-        dsp_setTextColor(GREEN);                              // set the requested color
-        dsp_setCursor(pos, 0);                                // prepare to show the info
-        if (repeatFlag == SONG)
-          dsp_print('r');                                     // show the character
-        else if (repeatFlag == DIRECTORY)
-          dsp_print('R');
-        else // RANDOM
-          dsp_print('F');
-      }
-      repeatFlagOld = repeatFlag;
+  for (j = 0; j < TASKSTAT_MAXTASKS; j++) {
+    if (taskTickCopy[j].handle == taskStat[i].xHandle) {
+      return taskTickCopy[j].ticks;
     }
   }
+  return 0;
+#endif
 }
 
 //**************************************************************************************************
-//                               D I S P L A Y M U T E P A U S E                                   *
+//                                S A M P L E T A S K S T A T S                                    *
 //**************************************************************************************************
-// If muted show 'M' on the LCD, if paused a 'P' at a fixed position in a specified color.         *
-// The status is only displayed if it has changed.                                                 *
-// A character on the screen is 8 pixels high and 6 pixels wide.                                   *
+// Takes a snapshot of all tasks every TASKSTAT_INTERVAL ms.  CPU usage per task is the difference *
+// of the run time counters of two snapshots.  Without configGENERATE_RUN_TIME_STATS (the Arduino  *
+// core) taskTickHook() samples the running task of each core at every tick instead, which is      *
+// exact enough for a 2 s interval.  Core load is 100% minus the share of the IDLE task of that    *
+// core.  Core loads and the busiest task go into taskRing[], so short peaks can be seen.          *
 //**************************************************************************************************
-void displayMutePause()
+void sampleTaskStats()
 {
-  static uint8_t mpflagOld = 0;                   // For compare
-  uint8_t mpflag = 0;
+  static uint32_t    lastSample = 0;                   // Time of last snapshot
+  static uint32_t    prevTotal = 0;                    // Total run time at last snapshot
+  static UBaseType_t prevNum[TASKSTAT_MAXTASKS];       // Task numbers of last snapshot
+  static uint32_t    prevRun[TASKSTAT_MAXTASKS];       // Run time counters of last snapshot
+  static uint32_t    taskRun[TASKSTAT_MAXTASKS];       // Run time counters of this snapshot
+  static uint32_t    prevStack[TASKSTAT_MAXTASKS];     // Stack high water marks of last snapshot
+  UBaseType_t        prevCount = taskCount;
+  uint32_t           total = 0;                        // Total run time
+  taskstat_struct*   r = &taskRing[taskRingInx];       // Entry to fill
+  UBaseType_t        i, k;
+  uint32_t           run;                              // Run time counter of a task
+  uint8_t            core;
 
-  if (tft) {                                      // TFT active?
-    if (muteFlag == -1) mpflag |= 0x01;
-    else mpflag &= 0xFE;
-    if (mp3filePause) mpflag |= 0x02;
-    else mpflag &= 0xFD;
-    if (mpflagOld != mpflag) {                    // Any Difference?
-      uint8_t pos = dsp_getwidth() + MUTEPOS;     // X-position of character
-      //dbgprint("displaymute(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
-      //           pos, 0, 6, 8);
-      dsp_fillRect(pos, 0, 6, 8, BLACK);          // Clear the space for new character
-      if (mp3filePause) { 
-        // Pause prevails over mute
-        dsp_setTextColor(GREEN);                  // Set the requested color
-        dsp_setCursor(pos, 0);                    // Prepare to show the info
-        dsp_print('P');                           // Show the character
-      }
-      else if (muteFlag == -1) {
-        dsp_setTextColor(GREEN);                  // Set the requested color
-        dsp_setCursor(pos, 0);                    // Prepare to show the info
-        dsp_print('M');                           // Show the character
-      }
-      mpflagOld = mpflag;                         // Remember for next compare
+  if ((millis() - lastSample) < TASKSTAT_INTERVAL) {   // Time for next snapshot?
+    return;
+  }
+  lastSample = millis();
+  for (i = 0; i < prevCount; i++) {                    // Remember counters of last snapshot
+    prevNum[i] = taskStat[i].xTaskNumber;
+    prevRun[i] = taskRun[i];
+    prevStack[i] = taskStat[i].usStackHighWaterMark;
+  }
+  taskCount = uxTaskGetSystemState(taskStat, TASKSTAT_MAXTASKS, &total);
+#if !configGENERATE_RUN_TIME_STATS
+  total = taskTickTotal;                               // Time base is ticks of one core
+  taskTickSnap();                                      // Ticks of all tasks at this moment
+#endif
+  r->time = millis() / 1000;
+  r->load[0] = r->load[1] = 0xFF;                      // unknown
+  r->topload = 0;
+  r->top[0] = '\0';
+  for (i = 0; i < taskCount; i++) {
+    taskCpu[i] = 0xFF;                                 // unknown
+    run = taskRun[i] = taskRunTime(i);
+    for (k = 0; k < prevCount && prevNum[k] != taskStat[i].xTaskNumber; k++);
+    if (k == prevCount || total == prevTotal) {        // New task or first snapshot
+      continue;
+    }
+    if (taskStat[i].usStackHighWaterMark < TASKSTAT_STACKLOW &&
+        taskStat[i].usStackHighWaterMark < prevStack[k]) { // Stack getting short?
+      dbgprint("Task %s: only %d bytes of stack left", taskStat[i].pcTaskName,
+               (int)taskStat[i].usStackHighWaterMark);
+    }
+    // Run time counts per core, so 100% is one core busy
+    taskCpu[i] = min((uint64_t)100, (uint64_t)(run - prevRun[k]) * 100 / (total - prevTotal));
+    if (strncmp(taskStat[i].pcTaskName, "IDLE", 4) == 0) {
+#if configTASKLIST_INCLUDE_COREID
+      core = taskStat[i].xCoreID ? 1 : 0;
+#else
+      core = (taskStat[i].pcTaskName[4] == '1') ? 1 : 0;
+#endif
+      r->load[core] = 100 - taskCpu[i];
     }
+    else if (taskCpu[i] > r->topload) {                // Busiest task so far?
+      r->topload = taskCpu[i];
+      strlcpy(r->top, taskStat[i].pcTaskName, sizeof(r->top));
+    }
+  }
+  prevTotal = total;
+  taskRingInx = (taskRingInx + 1) % TASKSTAT_RING;     // Next entry in ring
+  if (taskRingCount < TASKSTAT_RING) {
+    taskRingCount++;
   }
 }
 
 //**************************************************************************************************
-//                                    D I S P L A Y P R O G R E S S                                *
+//                                  T A S K S T A T S T E X T                                      *
 //**************************************************************************************************
-// Show the mp3 file progress as an indicator (two red lines) on the very bottom of the display.   *
+// Returns the last snapshot (one line per task) followed by the core loads in taskRing[].         *
 //**************************************************************************************************
-#define STEPS 20
-void displayProgress()
+String taskStatsText()
 {
-  if (tft && (currentSource == SDCARD || currentSource == MEDIASERVER) && encoderMode != SELECT) {
-    static uint8_t oldprog = 0;                        // previous progress
-    uint8_t        newprog = 0;                        // current setting
-    uint8_t        pos;                                // position of progress indicator
-    uint32_t       steps = mp3fileLength / STEPS;
-    uint32_t       played = mp3fileLength - mp3fileBytesLeft;
+  static const char* states[] = { "run", "ready", "block", "susp", "del", "?" };
+  String             res;
+  char               line[120];
+  char               core[4], cpu[5], load[2][5];
+  taskstat_struct*   r;
+  UBaseType_t        i;
+  uint8_t            k;
 
-    for (int i = 1; i * steps <= played && mp3fileLength; i++) {
-      newprog = i;
+  res = "Task             Core Prio Stack State  CPU\n";
+  for (i = 0; i < taskCount; i++) {
+    strcpy(core, "-");
+#if configTASKLIST_INCLUDE_COREID
+    if (taskStat[i].xCoreID != tskNO_AFFINITY) {
+      sprintf(core, "%d", (int)taskStat[i].xCoreID);
     }
-    if ((forceProgressBar || (newprog != oldprog))     // force painting or has indicator changed
-         && !tftdata[3].update_req && !tftdata[4].update_req) { // and no work for section 3 or 4
-      forceProgressBar = false;
-      oldprog = newprog;                               // remember for next compare
-      pos = map(newprog, 0, STEPS, 0, dsp_getwidth()); // compute position on TFT
-      //dbgprint("displayvolume(): fillRect: x=%d y=%d w=%d h=%d col=RED",
-      //           0, dsp_getheight() - 2, pos, 2);
-      dsp_fillRect(0, dsp_getheight() - 2, pos, 2, RED);  // Paint red part
-      //dbgprint("displayvolume(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
-      //           pos, dsp_getheight() - 2, dsp_getwidth() - pos, 2);
-      dsp_fillRect(pos, dsp_getheight() - 2,
-                   dsp_getwidth() - pos, 2, BLACK);    // paint remainder black
+    else {
+      strcpy(core, "any");
     }
+#endif
+    if (taskCpu[i] == 0xFF) strcpy(cpu, "n/a");
+    else                    sprintf(cpu, "%d%%", taskCpu[i]);
+    sprintf(line, "%-16s %4s %4d %5d %-5s %4s\n", taskStat[i].pcTaskName, core,
+            (int)taskStat[i].uxCurrentPriority, (int)taskStat[i].usStackHighWaterMark,
+            states[min((int)taskStat[i].eCurrentState, 5)], cpu);
+    res += line;
+  }
+  sprintf(line, "Queue underruns while playing: %d\n", underruns);
+  res += line;
+  sdReadStats(line, sizeof(line));                    // SD bus time for playing
+  res += String(line) + "\n";
+  sprintf(line, "Core load every %d s, oldest first:\n", TASKSTAT_INTERVAL / 1000);
+  res += line;
+  for (k = 0; k < taskRingCount; k++) {
+    r = &taskRing[(taskRingInx + TASKSTAT_RING - taskRingCount + k) % TASKSTAT_RING];
+    for (i = 0; i < 2; i++) {
+      if (r->load[i] == 0xFF) strcpy(load[i], "n/a");
+      else                    sprintf(load[i], "%d%%", r->load[i]);
+    }
+    sprintf(line, "%6lus  core0 %4s  core1 %4s  top %s %d%%\n", (unsigned long)r->time,
+            load[0], load[1], r->top, r->topload);
+    res += line;
   }
+  return res;
 }
+#endif
 
+#ifdef HEAP_STATS
 //**************************************************************************************************
-//                                      D I S P L A Y T I M E                                      *
+//                                S A M P L E H E A P S T A T S                                    *
 //**************************************************************************************************
-// Show the time on the LCD at a fixed position in a specified color                               *
-// To prevent flickering, only the changed part of the timestring is displayed.                    *
-// An empty string will force a refresh on next call.                                              *
-// A character on the screen is 8 pixels high and 6 pixels wide.                                   *
+// Records free heap, largest free block and lowest free heap every HEAPSTAT_INTERVAL ms in        *
+// heapRing[].  Fragmentation is 100% minus the largest block in percent of the free heap.         *
 //**************************************************************************************************
-void displayTime(const char* str, uint16_t color)
+void sampleHeapStats()
 {
-  static char oldstr[6] = ".....";                // for compare
-  uint8_t     i;                                  // index in strings
-  uint8_t     pos = dsp_getwidth() + TIMEPOS;     // X-position of character
+  static uint32_t  lastSample = 0;                     // Time of last snapshot
+  heapstat_struct* r = &heapRing[heapRingInx];         // Entry to fill
 
-  if (str[0] == '\0') {                           // empty string?
-    for (i = 0; i < 5; i++) {                     // set oldstr to dots
-      oldstr[i] = '.';
-    }
-    return;                                       // no actual display yet
+  if ((millis() - lastSample) < HEAPSTAT_INTERVAL && heapRingCount) {
+    return;
   }
-  if (tft) {                                      // TFT active?
-    dsp_setTextColor(color);                      // Set the requested color
-    for (i = 0; i < 5; i++) {                     // Compare old and new
-      if (str[i] != oldstr[i]) {                  // any change ?
-        //dbgprint("displayTime(): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
-        //           pos, 0, 6, 8);
-        dsp_fillRect(pos, 0, 6, 8, BLACK);        // Clear the space for new character
-        dsp_setCursor(pos, 0);                    // Prepare to show the info
-        dsp_print(str[i]);                        // show the character
-        oldstr[i] = str[i];                       // remember for next compare
-      }
-      pos += 6;                                   // next position
-    }
+  lastSample = millis();
+  r->time = millis() / 1000;
+  r->free = ESP.getFreeHeap();
+  r->maxalloc = ESP.getMaxAllocHeap();
+  r->minfree = ESP.getMinFreeHeap();
+  if (r->maxalloc < heapMinMaxAlloc) {
+    heapMinMaxAlloc = r->maxalloc;
+  }
+  heapRingInx = (heapRingInx + 1) % HEAPSTAT_RING;     // Next entry in ring
+  if (heapRingCount < HEAPSTAT_RING) {
+    heapRingCount++;
   }
 }
 
 //**************************************************************************************************
-//                                     L I M I T S T R I N G                                       *
+//                                  H E A P S T A T S T E X T                                      *
 //**************************************************************************************************
-// Reduce string to a length that it's hight will fit into num pixels on the screen. The calcu-    *
-// lation considers the actual font size.                                                          *
+// Returns the heap snapshots and, with HEAP_TRACE, the allocations counted per tag.               *
 //**************************************************************************************************
-String limitString(String& strg, int maxPixel) {
-  int16_t  x = 0, y = 0;
-  uint16_t w = 0, h = 0;
+String heapStatsText()
+{
+  String           res;
+  char             line[80];
+  heapstat_struct* r;
+  uint8_t          k;
 
-  while (strg.length() > 32) {
-    dsp_getTextBounds(strg, 0, 0, &x, &y, &w, &h);
-    if (h <= maxPixel) break;
-    strg = strg.substring(0, strg.length() - 1); // cut 1 byte off at the end
+  sprintf(line, "Smallest largest free block since boot: %d\n", heapMinMaxAlloc);
+  res = line;
+  res += "  Time    Free MaxAlloc MinFree Frag\n";
+  for (k = 0; k < heapRingCount; k++) {
+    r = &heapRing[(heapRingInx + HEAPSTAT_RING - heapRingCount + k) % HEAPSTAT_RING];
+    sprintf(line, "%6lus %7d %8d %7d %3d%%\n", (unsigned long)r->time, r->free, r->maxalloc,
+            r->minfree, r->free ? 100 - (int)((uint64_t)r->maxalloc * 100 / r->free) : 0);
+    res += line;
   }
-  strg.trim();
-  return strg;
+#ifdef HEAP_TRACE
+  heaptrace_struct trace[HEAPTRACE_TAGS];              // Copy, String below allocates as well
+
+  portENTER_CRITICAL(&heapTraceMux);
+  memcpy(trace, heapTrace, sizeof(trace));
+  portEXIT_CRITICAL(&heapTraceMux);
+  res += "Tag               Allocs    Bytes\n";
+  for (k = 0; k < HEAPTRACE_TAGS && trace[k].tag[0]; k++) {
+    sprintf(line, "%-16s %7d %8d\n", trace[k].tag, trace[k].count, trace[k].bytes);
+    res += line;
+  }
+#endif
+  return res;
 }
+#endif
 
+#ifdef HEAP_TRACE
 //**************************************************************************************************
-//                                      D I S P L A Y I N F O                                      *
+//                                     H E A P T R A C E                                           *
 //**************************************************************************************************
-// Show a string on the LCD at a specified y-position (0..4) in a specified color.                 *
-// The parameter is the index in tftdata[]. Strings are evaluated for wide/narrow characters and   *
-// their length adjusted to not wrap around into the next section.                                 *
+// Counts an allocation for the current HEAP_TAG, or for the name of the running task if it set    *
+// no tag.  Called from the malloc/realloc wrappers, so it must not allocate itself.  Before the   *
+// scheduler runs there is no current task, allocations are counted as "startup" then.             *
 //**************************************************************************************************
-void displayinfo(uint16_t inx)
+void heapTraceCount(size_t size)
 {
-  scrseg_struct *p = &tftdata[inx];
-  uint16_t width = dsp_getwidth(),                      // normal number of colums
-           len = p->str.length();
-  int8_t   i;
-  String   strg;
-
-  if (tft && len > 0) {                                 // any action required ?
-    if (inx == 0) {                                     // topline is shorter
-      width += SDSTATUSPOS;                             // leave space for flags + time
-    }
-    //dbgprint("displayinfo(%d): fillRect: x=%d y=%d w=%d h=%d col=BLACK",
-    //           inx, 0, p->y, width, p->height);
-    dsp_fillRect(0, p->y, width, p->height, BLACK);     // clear the space for new info
-    if ((dsp_getheight() > 64) && (p->y > 1)) {         // need any space for divider?
-      //dbgprint("displayinfo(): fillRect: x=%d y=%d w=%d h=%d col=GREEN",
-      //           0, p->y - 1, width, 1);
-      dsp_fillRect(0, p->y - 1, width, 1, GREEN);       // generate divider between segment 0 and 1/2
-    }
+  const char* tag = "startup";                         // Default before scheduler start
+  int         i;
 
-    p->str = utf8ascii(p->str.c_str());                 // convert possible UTF8 chars
-    dsp_setTextColor(p->color);                         // set requested color
-    if (inx == 1 || inx == 2) {                         // name on 1. line, Title on 2. line (if 2 lines)
-      dsp_setFontBig();
-      dsp_setCursor(0, p->y + 18);                      // set cursor for first line for big font
-      i = p->str.indexOf('\n');                         // find position of CR (separates the line)
-      if (i > 0) {                                      // separate segments ?
-        // Processing first line
-        strg = p->str.substring(0, i);                  // extract first line
-        strg = limitString(strg, (p->height / 2) - 2 ); // make sure it fits into 2 lines on the display
-        dsp_print(strg.c_str());                        // show the string on TFT
-        // show divider in the middle of segment
-        dsp_fillRect(0, p->y + (p->height / 2), width, 1, YELLOW);
-        // Processing second line
-        dsp_setCursor(0, p->y + 62);                    // set cursor for second line for big font
-        strg = p->str.substring(i + 1);                 // extract second line
-        strg = limitString(strg, (p->height / 2) - 2);  // make sure it fits into 2 lines on the display
-        dsp_print(strg.c_str());                               // show the string on TFT
-      }
-      else {                                            // just one line
-        // got to fit into 4 lines on display
-        strg = p->str;
-        strg = limitString(strg, p->height - 2);        // make sure it fits into 4 lines on the display
-        dsp_print(strg.c_str());                        // show string on TFT
-      }
-      dsp_setFont();                                    // back to normal font
+  if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+    tag = (const char*)pvTaskGetThreadLocalStoragePointer(NULL, HEAPTRACE_TLS);
+    if (tag == NULL) {                                 // No HEAP_TAG in this task?
+      tag = pcTaskGetTaskName(NULL);                   // Use name of task
     }
-    else {                                              // segments 0, 3 or 4
-      if (inx == 3 || inx == 4) {                       // segment at bottom
-        unsigned int len = (currentSource != STATION) ? 53 : 72;// in radio mode is room for third line
-        if (p->str.length() > len) p->str.setCharAt(len, '\0'); // rudimentary line limiting
-      }
-      if (inx == 0)
-        dsp_setCursor(0, p->y);                         // prepare to show the info on top line
-      else
-        dsp_setCursor(0, p->y + 4);                     // prepare to show the info on bottom line
-      dsp_print(p->str.c_str());                        // show the string on TFT
+  }
+  portENTER_CRITICAL(&heapTraceMux);
+  for (i = 0; i < HEAPTRACE_TAGS && heapTrace[i].tag[0]; i++) {
+    if (strncmp(heapTrace[i].tag, tag, sizeof(heapTrace[i].tag) - 1) == 0) {
+      break;
     }
   }
+  if (i == HEAPTRACE_TAGS) {                           // Table full, count in last entry
+    i--;
+  }
+  if (heapTrace[i].tag[0] == '\0') {                   // New tag
+    strlcpy(heapTrace[i].tag, tag, sizeof(heapTrace[i].tag));
+  }
+  heapTrace[i].count++;
+  heapTrace[i].bytes += size;
+  portEXIT_CRITICAL(&heapTraceMux);
+}
+
+extern "C" void* __real_malloc(size_t size);
+extern "C" void* __real_realloc(void* ptr, size_t size);
+
+extern "C" void* __wrap_malloc(size_t size)
+{
+  heapTraceCount(size);
+  return __real_malloc(size);
 }
 
-#ifdef USE_ETHERNET
+extern "C" void* __wrap_realloc(void* ptr, size_t size)
+{
+  heapTraceCount(size);
+  return __real_realloc(ptr, size);
+}
+#endif
+
+#ifdef POWER_SAVE
 //**************************************************************************************************
-//                            G E T L O C A L T I M E E T H                                        *
+//                                        P M B E G I N                                            *
 //**************************************************************************************************
-// Retrieve local time from NTP server & convert to string. Only needed when using Ethernet/LAN.   *
+// Sets up clock scaling.  With power management in the SDK, esp_pm lowers the clock to            *
+// pmMinFreq as soon as no PM lock is held.  Otherwise loop() switches the clock itself.  The      *
+// minimum is 80 MHz so the APB clock (SPI, I2C, timer100) never changes.  There is no light       *
+// sleep: it would stop timer100, and encoder, IR and extender inputs have no wakeup source.       *
 //**************************************************************************************************
-bool getLocalTimeEth(struct tm *info)
+void pmBegin()
 {
-  static bool initialized = false;
-  int ret, tt = 0, num = 0;
-  unsigned long epoch;
-  byte packetBuffer[NTP_PACKET_SIZE];         // buffer to hold incoming and outgoing packets
-
-  if (!initialized) {                        // executing only once
-    initialized = true;
-    setenv("TZ", ini_block.clk_tzstring.c_str(), 1);
-    tzset();
-  }
+  pmStarted = true;
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pmconf;
+  const char*           names[PM_HOLDERS] = { "stream", "play" };
 
-  memset(packetBuffer, 0, NTP_PACKET_SIZE);   // set all bytes in the buffer to 0
-  // Initialize values needed to form NTP request
-  packetBuffer[0] = 0b11100011;   // LI, Version, Mode
-  packetBuffer[1] = 0;                        // Stratum, or type of clock
-  packetBuffer[2] = 6;                        // Polling Interval
-  packetBuffer[3] = 0xEC;                     // Peer Clock Precision
-  // 8 bytes of zero for Root Delay & Root Dispersion
-  packetBuffer[12]  = 49;
-  packetBuffer[13]  = 0x4E;
-  packetBuffer[14]  = 49;
-  packetBuffer[15]  = 52;
-  _claimSPI("time1");                     // claim SPI bus
-  udpclient.begin(localPortNtp);              // needed for ntp time server
-  ret = udpclient.beginPacket(ini_block.clk_server.c_str(), 123);
-  _releaseSPI();                            // release SPI bus
-  if (ret) {                                 //NTP requests are to port 123
-    // the host exists (we got positive DNS answer)
-    _claimSPI("time2");                   // claim SPI bus
-    udpclient.write(packetBuffer, NTP_PACKET_SIZE);
-    udpclient.endPacket();
-    _releaseSPI();                          // release SPI bus
-    do {
-      delay(100);
-      _claimSPI("time3");                 // claim SPI bus
-      num = udpclient.parsePacket();
-      _releaseSPI();                        // release SPI bus
-      tt++;
-    } while ((tt <= 15) && !num);
+  pmconf.max_freq_mhz = PM_MAXFREQ;
+  pmconf.min_freq_mhz = pmMinFreq;
+  pmconf.light_sleep_enable = false;                   // inputs could be missed while asleep
+  for (int i = 0; i < PM_HOLDERS; i++) {
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, names[i], &pmLock[i]) != ESP_OK) {
+      dbgprint("PM lock %s failed, clock switched by loop()", names[i]);
+      return;
+    }
   }
-  if (num) {
-    dbgprint("NTP server response after %d ms from %s", tt * 100, ini_block.clk_server.c_str());
-    _claimSPI("time4");                   // claim SPI bus
-    udpclient.read(packetBuffer, NTP_PACKET_SIZE);  // read the packet into the buffer
-    udpclient.stop();
-    _releaseSPI();                          // release SPI bus
-    long highWord = word(packetBuffer[40], packetBuffer[41]);
-    long lowWord = word(packetBuffer[42], packetBuffer[43]);
-    // this is NTP time (seconds since Jan 1 1900):
-    long secsSince1900 = highWord << 16 | lowWord;       // combine the four bytes (two words) into a long integer
-    epoch = secsSince1900 - 2208988800UL;                // convert into Unix time (secs since 1.1.1970)
-    dbgprint("Posix time zone string: \"%s\"", ini_block.clk_tzstring.c_str());
-    localtime_r((const time_t*)&epoch, info);
-    dbgprint("TZ applied -> Date: %d.%d.%d Time: %02d:%02d",
-               info->tm_mday, info->tm_mon + 1, info->tm_year + 1900, info->tm_hour, info->tm_min);
-    return true;
+  if (esp_pm_configure(&pmconf) == ESP_OK) {
+    pmDFS = true;
+    dbgprint("Power management active, CPU clock %d..%d MHz", pmMinFreq, PM_MAXFREQ);
+    return;
   }
-  dbgprint("Can't connect NTP-Server %s. Incorrect server name ?", ini_block.clk_server.c_str());
-  _claimSPI("time5");                   // claim SPI bus
-  udpclient.stop();
-  _releaseSPI();                          // release SPI bus
-  return false;
+  dbgprint("esp_pm_configure failed, clock switched by loop()");
+#endif
 }
-#endif  // USE_ETHERNET
 
 //**************************************************************************************************
-//                                         G E T T I M E                                           *
+//                                          P M H O L D                                            *
 //**************************************************************************************************
-// Retrieve the local time from NTP server and convert to string.                                  *
-// Will be called every minute.                                                                    *
+// The stream reader (loop) and playTask ask for the full CPU clock while audio is flowing.        *
+// Every holder changes only its own entry, so no locking is needed.                               *
 //**************************************************************************************************
-void getTime()
+void pmHold(enum_pmholder holder, bool hold)
 {
-  static int16_t delaycount = 0;                           // To reduce number of NTP requests
-  static int16_t retrycount = 5;                           // max 5 attempts to sync time
-
-  if (tft) {                                               // TFT used?
-    if (timeinfo.tm_year) {                                // Legal time found?
-      sprintf(timetxt, "%02d:%02d",                        // Yes, format to a string
-              timeinfo.tm_hour,
-              timeinfo.tm_min);
+  if (pmHeld[holder] == hold) {                        // no change?
+    return;
+  }
+  pmHeld[holder] = hold;
+#ifdef CONFIG_PM_ENABLE
+  if (pmDFS) {
+    if (hold) {
+      esp_pm_lock_acquire(pmLock[holder]);
     }
-    if (--delaycount <= 0) {                               // Sync every 24 hours
-      delaycount = 1440;                                   // Reset counter to 1440min (24 hours)
-      if (timeinfo.tm_year) {                              // Legal time found?
-        dbgprint("Sync TOD, old value is %s", timetxt);
-      }
-      dbgprint("Sync TOD");
-#ifdef USE_ETHERNET
-      if (!getLocalTimeEth (&timeinfo)) {                  // Read from NTP server
-#else
-      if (!getLocalTime (&timeinfo)) {                     // Read from NTP server
-#endif
-        dbgprint("Failed to obtain time!");                // Error
-        timeinfo.tm_year = 0;                              // Set current time to illegal
-        if (retrycount) {                                  // Give up syncing?
-          retrycount--;                                    // No try again
-          delaycount = 1;                                  // Retry after 1 minute
-        }
-      }
-      else {
-        sprintf(timetxt, "%02d:%02d",                      // Format new time to a string
-                timeinfo.tm_hour,
-                timeinfo.tm_min);
-        dbgprint("Sync TOD successful, new value is %s", timetxt);
-      }
+    else {
+      esp_pm_lock_release(pmLock[holder]);
     }
   }
+#endif
 }
 
 //**************************************************************************************************
-//                                H A N D L E _ T F T _ T X T                                      *
+//                                        P M U P D A T E                                          *
 //**************************************************************************************************
-// Check if tft refresh is requested.                                                              *
+// Called from loop().  Holds the stream lock while audio is read, counts the time per power mode  *
+// and, without esp_pm, switches the CPU clock itself.  The switch waits until SPI, SD/MMC, the    *
+// port extenders on I2C and the serial output are idle.                                           *
 //**************************************************************************************************
-bool handle_tft_txt()
+void pmUpdate()
 {
-  for (uint16_t i = 0; i < TFTSECS; i++) {              // handle all sections
-    if (tftdata[i].update_req) {                        // refresh requested ?
-      displayinfo(i);                                   // do the refresh
-      dsp_update();                                     // send updates to the screen
-      tftdata[i].update_req = false;                    // reset request
-      return true;                                      // handle only 1 request at a time
+  static uint32_t last = 0;                            // time of last call
+  uint32_t        now = millis();
+  bool            flowing;                             // audio is read and played
+
+  if (!pmStarted) {
+    return;
+  }
+  flowing = (dataMode & (INIT | HEADER | DATA | METADATA |
+                         PLAYLISTINIT | PLAYLISTHEADER | PLAYLISTDATA)) &&
+            !(currentSource == SDCARD && mp3filePause);
+  pmHold(PM_STREAM, flowing);
+  pmTime[pmMode] += now - last;                        // time spent in previous mode
+  last = now;
+  if (encoderMode != IDLING) {
+    pmMode = PM_MENU;
+  }
+  else if (flowing) {
+    pmMode = PM_PLAYING;
+  }
+  else if (currentSource == SDCARD && mp3filePause) {
+    pmMode = PM_PAUSED;
+  }
+  else {
+    pmMode = PM_STOPPED;
+  }
+  if (!pmDFS) {
+    uint32_t freq = (pmHeld[PM_STREAM] || pmHeld[PM_PLAY]) ? PM_MAXFREQ : pmMinFreq;
+    if (getCpuFrequencyMhz() != freq) {
+#ifdef FRONT_PANEL_BUTTONS
+      // I2C first, extenderTask holds it while dbgprint() may claim the SPI bus
+      xSemaphoreTake(I2Csem, portMAX_DELAY);           // no I2C transfer of extenderTask
+#endif
+      if (sdMmc) {
+        claimSD("pmclock");                            // no SD/MMC transfer during the switch
+      }
+      claimSPI("pmclock");                             // no SPI transfer during the switch
+      Serial.flush();                                  // no UART output pending
+      setCpuFrequencyMhz(freq);                        // APB stays at 80 MHz
+      releaseSPI();                                    // release SPI bus
+      if (sdMmc) {
+        releaseSD();                                   // release SD card
+      }
+#ifdef FRONT_PANEL_BUTTONS
+      xSemaphoreGive(I2Csem);
+#endif
     }
   }
-  return false;                                         // no request was pending
+  pmFreq[pmMode] = getCpuFrequencyMhz();
 }
 
 //**************************************************************************************************
-//                                     P L A Y T A S K                                             *
+//                                  P O W E R S T A T S T E X T                                    *
 //**************************************************************************************************
-// Play stream data from input queue.                                                              *
-// Handle all I/O to VS1053B during normal playing.                                                *
-// Handles display of text, time and volume on TFT as well.                                        *
+// Returns time, share and CPU clock per power mode.  The supply current of each mode has to be    *
+// measured once, the shares tell how much each mode contributes.                                  *
 //**************************************************************************************************
-void playTask(void * parameter)
+String powerStatsText()
 {
-  while (true) {
-    if (xQueueReceive (dataQueue, &inchunk, 5)) {
-      while (!vs1053player->data_request()) {                    // If FIFO is full..
-        vTaskDelay(1);                                           // Yes, take a break
-      }
-      switch (inchunk.datatyp) {                                 // What kind of chunk?
-        case QDATA:
-          claimSPI("chunk");                                     // claim SPI bus
-          vs1053player->playChunk(inchunk.buf,                   // DATA, send to player
-                                  sizeof(inchunk.buf));
-          releaseSPI();                                          // release SPI bus
-          totalCount += sizeof(inchunk.buf);                     // Count the bytes
-          break;
-        case QSTARTSONG:
-          claimSPI("startsong");                                 // claim SPI bus
-          vs1053player->startSong();                             // START, start player
-          releaseSPI();                                          // release SPI bus
-          break;
-        case QSTOPSONG:
-          claimSPI("stopsong");                                  // claim SPI bus
-          vs1053player->setVolume(0);                            // Mute
-          vs1053player->stopSong();                              // STOP, stop player
-          releaseSPI();                                          // release SPI bus
-          vTaskDelay(500 / portTICK_PERIOD_MS);                  // Pause for a short time
-          break;
-        default:
-          break;
-      }
-    }
-    // TEST 
-    //esp_task_wdt_reset();                                      // Protect against idle cpu
+  String   res;
+  char     line[80];
+  uint32_t total = 0;
+  int      i;
+
+  for (i = 0; i < PM_MODES; i++) {
+    total += pmTime[i];
   }
-  //vTaskDelete(NULL);                                           // Will never arrive here
+  sprintf(line, "Clock by %s, min. %d MHz\n", pmDFS ? "esp_pm" : "loop()", pmMinFreq);
+  res = line;
+  res += "Mode         Time Share  MHz\n";
+  for (i = 0; i < PM_MODES; i++) {
+    sprintf(line, "%-8s %7lus %4d%% %4d\n", pmModeNames[i], (unsigned long)(pmTime[i] / 1000),
+            total ? (int)((uint64_t)pmTime[i] * 100 / total) : 0, pmFreq[i]);
+    res += line;
+  }
+  return res;
 }
+#endif
 
 //**************************************************************************************************
 //                                   H A N D L E _ S P E C                                         *
@@ -7133,36 +11250,36 @@ void playTask(void * parameter)
 void handle_spec()
 {
   const char* p;
-  uint8_t     vol;
 
   // Do some special functions if necessary
   if (tft) {                                                 // Need to update TFT?
+    displayTelemetry();                                      // Stream info on top line
     handle_tft_txt();                                        // Yes, TFT refresh necessary
     displayMutePause();
     displaySDstatus();
     displayProgress();                                       // Show mp3-file progress on display
     dsp_update();                                            // Be sure to paint physical screen
   }
-  claimSPI("hspec1");                                        // claim SPI bus
-  if (muteFlag > 0) {
-    vs1053player->setVolume(0);                              // mute
-    muteFlag--;                                              // minus 1 sec
-  }
-  else {
-    if (muteFlag) {                                          // Mute permanently or not?
-      vs1053player->setVolume(0);                            // mute
-    }
-    else {
-      vol = (currentSource == SDCARD) ? (ini_block.reqvol + 8) : ini_block.reqvol; // increase loudness when playing mp3 files
-      if (vol > 100) vol = 100;
-      vs1053player->setVolume (vol);                         // unmute
-    }
+  // Volume (muting included) is handled by volRampStep() in playTask
+#if !(defined VU_METER && defined LOAD_VS1053_PATCH)
+  if (dataMode == DATA) {                                    // No VU-meter task reading stream info
+    claimSPI("hspec2");                                      // claim SPI bus
+    readTelemetry();                                         // stream info if due
+    releaseSPI();                                            // release SPI bus
   }
+#endif
+#ifdef TASK_STATS
+  sampleTaskStats();                                         // snapshot of tasks if due
+#endif
+#ifdef HEAP_STATS
+  sampleHeapStats();                                         // snapshot of heap if due
+#endif
   if (reqtone) {                                             // Request to change tone?
     reqtone = false;
+    claimSPI("hspec1");                                      // claim SPI bus
     vs1053player->setTone(ini_block.rtone);                  // Set SCI_BASS to requested value
+    releaseSPI();                                            // release SPI bus
   }
-  releaseSPI();                                              // release SPI bus
   if (time_req) {                                            // Time to refresh timetxt?
     time_req = false;                                        // Yes, clear request
     if (NetworkFound) {                                      // Time available?
@@ -7180,18 +11297,21 @@ void handle_spec()
     }
   }
 #endif
+  if (tryToMountSD && (sdScanReq || sdScanActive || sdLoadDone)) { // scan running, nothing to mount
+    tryToMountSD = false;
+  }
   if (tryToMountSD && (!SD_okay || (SD_okay && !SD_mp3fileCount))) {
     tryToMountSD = false;
     dbgprint("handle_spec: tryToMountSD detected");
     currentIndex = -1;
-    if (ini_block.sd_cs_pin >= 0) {                          // SD configured?
-      claimSPI("hspec4");
-      SD.end();                                              // to make a clean start
-      releaseSPI();
+    if (sdConfigured()) {                                    // SD configured?
+      claimSD("hspec4");
+      sdEnd();                                               // to make a clean start
+      releaseSD();
       delay(50);
-      claimSPI("hspec5");
-      bool res = SD.begin(ini_block.sd_cs_pin, SPI, SDSPEED);// try to init SD card driver
-      releaseSPI();
+      claimSD("hspec5");
+      bool res = sdBegin();                                  // try to init SD card driver
+      releaseSD();
       if (!res) {
         p = dbgprint("SD Card Mount Failed!");               // no success, check formatting (FAT)
         tftset(1, "SD-Card Error !");
@@ -7200,9 +11320,9 @@ void handle_spec()
         lastAlbumStation = p;
       }
       else {
-        claimSPI("hspec6");
-        SD_okay = (SD.cardType() != CARD_NONE);              // see if known card
-        releaseSPI();
+        claimSD("hspec6");
+        SD_okay = (sdCardType() != CARD_NONE);               // see if known card
+        releaseSD();
         if (!SD_okay) {
           p = dbgprint("SD card not readable");              // card not readable
           tftset(1, "SD-Card Error !");
@@ -7218,17 +11338,10 @@ void handle_spec()
           dbgprint("Total free memory of all regions=%d (minEver=%d), freeHeap=%d (minEver=%d), minStack=%d (in Bytes)", 
                    ESP.getFreeHeap(), ESP.getMinFreeHeap(), xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL)); 
           //            
-          SD_mp3fileCount = listsdtracks("/", 0, true);      // build SD file index
-          p = dbgprint("%d mp3 tracks on SD", SD_mp3fileCount);
-          // TEST
-          dbgprint("Total free memory of all regions=%d (minEver=%d), freeHeap=%d (minEver=%d), minStack=%d (in Bytes)", 
-                   ESP.getFreeHeap(), ESP.getMinFreeHeap(), xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL)); 
-          //            
-          tftset(4, p);                                      // show number of tracks on TFT
-          if (!SD_mp3fileCount)
-            tftset(1, "SD Card is empty !");
-          if (SD_okay && SD_mp3fileCount)
-            buttonSD = true;
+          if (SD_rescanReq || !loadSDindex()) {              // index file outdated or missing?
+            sdScanReq = true;                                // loop() scans in the background
+          }                                                  // else loop() takes the loaded index
+          SD_rescanReq = false;
         }
       }
     }
@@ -7610,6 +11723,21 @@ bool handlePCF8574()
 
 
 #ifdef FRONT_PANEL_BUTTONS													
+//**************************************************************************************************
+//                                  B U T T O N P E N D I N G                                      *
+//**************************************************************************************************
+// Returns true if a front panel button has been registered but not handled by loop() yet.         *
+//**************************************************************************************************
+bool buttonPending()
+{
+  return buttonReturn || buttonRepeatMode || (buttonPreset >= 0) ||
+         buttonSD || buttonStation ||
+#ifdef ENABLE_SOAP
+         buttonMediaserver ||
+#endif
+         buttonSkipBack || buttonSkipForward;
+}
+
 //**************************************************************************************************
 //                                  E X T E N D E R T A S K                                        *
 //**************************************************************************************************
@@ -7618,11 +11746,20 @@ bool handlePCF8574()
 //**************************************************************************************************
 void extenderTask (void * parameter)
 {
+  bool ok;
+
   while (true) {
-    if (!handlePCF8574())
+    xSemaphoreTake(I2Csem, portMAX_DELAY);             // no I2C transfer during clock switch
+    ok = handlePCF8574();
+    xSemaphoreGive(I2Csem);
+    if (!ok)
       vTaskDelay(20000 / portTICK_PERIOD_MS);          // I2C error occurred, pause 20 sec
-    else
+    else {
+      if (buttonPending()) {                           // button for checkEncoderAndButtons()?
+        wakeLoop();
+      }
       vTaskDelay(60 / portTICK_PERIOD_MS);             // pause only for a short time
+    }
   }
   //vTaskDelete(NULL);                                 // will never arrive here
 }
@@ -7632,113 +11769,209 @@ void extenderTask (void * parameter)
 //**************************************************************************************************
 //                                  V U M E T E R T A S K                                          *
 //**************************************************************************************************
-// Reads the VU-Meter level from the VS1053B and shows it on the display. Needs patch V2.7 !       *
+// Shows the VU-Meter level read from the VS1053B on the display. Needs patch V2.7 !               *
 // Max VU meter value (per channel) is 96 (0dB), but this means the signal is clipping already.    *
 // In praxis the highest level encountered will be 95. Every digit less means 1dB less (90 = -6dB) *
 // Only levels above a (dynamic) threshold will be displayed. This task runs on a low priority.    *
+// The VS1053 is read by vuSample() in the SPI window playTask holds for a data chunk anyway, this *
+// task just waits for the notification and paints.                                                *
 //**************************************************************************************************
 #define VU_MAX_DIFF    21     // only 21 highest dB are shown
 #define VU_START_VALUE 88
+#define VU_MIN_INTERVAL 20    // sample every 20 ms while levels change
+#define VU_MAX_INTERVAL 100   // slowly back off to 100 ms while levels are stable
+#define VU_WIDTH        7     // 2 bars of 3 pixels, 1 pixel gap
+#define VU_HEIGHT       11
 uint8_t  maxEncountered = VU_START_VALUE, 
          threshold = VU_START_VALUE - VU_MAX_DIFF;
+// Bar height in pixels for a level above threshold (0..VU_MAX_DIFF)
+const uint8_t vuTable[2][VU_MAX_DIFF + 1] = {
+  { 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 3, 4, 5, 5, 7, 7, 9, 9, 11 },   // Radio (higher base levels, lower dynamic)
+  { 0, 1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 4, 4, 5, 5, 7, 7, 9, 9, 11, 11 }   // SD card or media server (higher dynamic)
+};
+volatile bool     vuReady = false;                     // Sample taken, vumeterTask not done yet
+volatile bool     vuNew = false;                       // vuLevelRaw holds a new sample
+volatile uint16_t vuLevelRaw;                          // Last VU-Meter register value
+volatile uint16_t vuInterval = VU_MIN_INTERVAL;        // Current sample interval in ms
+#ifdef SPECTRUM_ANALYZER
+uint16_t          spectrum[2 + SPECTRUM_BANDS];        // Band count, reserved, band values
+volatile bool     spectrumNew = false;                 // spectrum[] holds a new frame
+#endif
+
+//**************************************************************************************************
+//                                       V U S A M P L E                                           *
+//**************************************************************************************************
+// Called by playTask after a data chunk, the SPI bus is claimed already. Reads the VU-Meter (and  *
+// spectrum, stream info) if due and wakes up vumeterTask. Nothing is read as long as vumeterTask  *
+// hasn't painted the last sample.                                                                 *
+//**************************************************************************************************
+void vuSample()
+{
+  static uint32_t vuLast = 0;                          // Time of last VU-Meter read
+  bool            vuDue, notify = false;
+#ifdef SPECTRUM_ANALYZER
+  static uint32_t spectrumNext = 0;                    // Time for next spectrum frame
+#endif
+
+  if (vuReady || dataMode != DATA ||
+      ((currentSource == SDCARD || currentSource == MEDIASERVER) && mp3fileBytesLeft == 0)) {
+    return;
+  }
+  readTelemetry();                                     // stream info if due
+  vuDue = (millis() - vuLast) >= vuInterval;
+  if (vuDue) {
+    vuLast = millis();
+    vuLevelRaw = vs1053player->readVuMeter();          // read VS1053 VU-Meter value
+    vuNew = true;
+    notify = true;
+  }
+#ifdef SPECTRUM_ANALYZER
+  if (spectrumRate && (int32_t)(millis() - spectrumNext) >= 0) {
+    spectrumNext = millis() + 1000 / spectrumRate;
+    vs1053player->readSpectrum(spectrum);              // band count and all band values
+    spectrumNew = true;
+    notify = true;
+  }
+#endif
+  if (notify && xvumeterTask) {                        // vumeterTask may not have been created
+    vuReady = true;
+    xTaskNotifyGive(xvumeterTask);                     // vumeterTask paints
+  }
+}
+
+#ifdef SPECTRUM_ANALYZER
+//**************************************************************************************************
+//                                  D I S P L A Y S P E C T R U M                                  *
+//**************************************************************************************************
+// Shows the band levels read from the spectrum analyzer plugin as SPECTRUM_BARS bars (11 pixels   *
+// high) left of the VU-meter. Bands are merged if the plugin delivers more than SPECTRUM_BARS.    *
+// Only the part of a bar that changed is painted. buf holds the words read by readSpectrum(),     *
+// buf == NULL clears the whole area.                                                              *
+//**************************************************************************************************
+void displaySpectrum(const uint16_t* buf)
+{
+  static uint8_t barOld[SPECTRUM_BARS] = { 0 };        // Bar heights on display
+  uint8_t        posX = dsp_getwidth() + SPECTRUMPOS;  // X-position of first bar
+  uint16_t       nbands, group, level;
+  uint8_t        bar, i, k;
+
+  if (buf == NULL) {                                   // Clear request?
+    dsp_fillRect(posX, 0, SPECTRUM_BARS * 3, 11, BLACK);
+    memset(barOld, 0, sizeof(barOld));
+    return;
+  }
+  nbands = buf[0];
+  if (nbands == 0 || nbands > SPECTRUM_BANDS) {        // Plugin not (yet) running
+    return;
+  }
+  group = (nbands + SPECTRUM_BARS - 1) / SPECTRUM_BARS; // Bands per bar
+  for (i = 0; i < SPECTRUM_BARS; i++) {
+    level = 0;
+    for (k = i * group; k < (i + 1) * group && k < nbands; k++) {
+      if ((buf[2 + k] & 0x3F) > level) {               // Loudest band of this group
+        level = buf[2 + k] & 0x3F;
+      }
+    }
+    bar = (level >= 31) ? 11 : (level * 11) / 31;      // 0..31 (3dB steps) to 0..11 pixels
+    if (bar > barOld[i]) {                             // Bar grows, paint the new part only
+      dsp_fillRect(posX + i * 3, 11 - bar, 2, bar - barOld[i], CYAN);
+    }
+    else if (bar < barOld[i]) {                        // Bar shrinks, clear the top part only
+      dsp_fillRect(posX + i * 3, 11 - barOld[i], 2, barOld[i] - bar, BLACK);
+    }
+    barOld[i] = bar;
+  }
+}
+#endif
 
 void vumeterTask(void *parameter)
 {
-  uint16_t vuLevel, vuLevelOld = 0;
-  uint8_t  vuLevelL, vuLevelR;
-  uint8_t  ampL, ampLOld = 0, ampR, ampROld = 0;
-  uint8_t  posX = dsp_getwidth() + VUMETERPOS;         // X-position of VU-meter
-  bool     update = false;
+  static uint16_t frame[2][VU_WIDTH * VU_HEIGHT];      // Double buffered VU-Meter pixels
+  uint8_t         front = 0;                           // frame[front] is on display
+  uint16_t        vuLevel;
+  uint8_t         vuLevelL, vuLevelR;
+  uint8_t         amp[2], ampOld[2] = { 0, 0 };        // Bar heights left/right
+  uint8_t         posX = dsp_getwidth() + VUMETERPOS;  // X-position of VU-meter
+  uint8_t         x, y, back;
+  bool            update = false;
+#ifdef SPECTRUM_ANALYZER
+  bool            spectrumOn = false;                  // Bars on display
+#endif
  
   while (true) {
-    if (tft) { 
-      if ((dataMode == INIT || dataMode == STOPREQD || dataMode == STOPPED) && update) {
-        dsp_fillRect(posX, 0, 7, 11, BLACK);           // clear the space for VU-Meter
+    if (ulTaskNotifyTake(pdTRUE, VU_MAX_INTERVAL * 2 / portTICK_PERIOD_MS) == 0) {
+      // No sample for a while: stopped or between stations
+      if (tft && update &&
+          (dataMode == INIT || dataMode == STOPREQD || dataMode == STOPPED)) {
+        dsp_fillRect(posX, 0, VU_WIDTH, VU_HEIGHT, BLACK); // clear the space for VU-Meter
+        memset(frame, 0, sizeof(frame));
+        ampOld[0] = ampOld[1] = 0;
+#ifdef SPECTRUM_ANALYZER
+        displaySpectrum(NULL);                         // and for the spectrum
+        spectrumOn = false;
+#endif
         update = false;
         maxEncountered = VU_START_VALUE;
         threshold = VU_START_VALUE - VU_MAX_DIFF;
+        vuInterval = VU_MIN_INTERVAL;
       }
-      else if (dataMode == DATA && 
-               !((currentSource == SDCARD || currentSource == MEDIASERVER) &&
-               mp3fileBytesLeft == 0)) {
-        claimSPI("vumeter");                           // claim SPI bus
-        vuLevel = vs1053player->readVuMeter();         // read VS1053 VU-Meter value
-        releaseSPI();                                  // release SPI bus
-        if (vuLevel != vuLevelOld) {
-          vuLevelOld = vuLevel;
-          vuLevelL = (uint8_t)(vuLevel >> 8);
-          vuLevelR = (uint8_t)(vuLevel & 0x00FF);
-          if (maxEncountered < vuLevelL || maxEncountered < vuLevelR) {
-            maxEncountered = (vuLevelL > vuLevelR) ? vuLevelL : vuLevelR;
-            threshold = maxEncountered - VU_MAX_DIFF;
-          }
-
-          // normalize to NULL 
-          vuLevelL = (vuLevelL <= threshold) ? 0 : vuLevelL - threshold;
-          vuLevelR = (vuLevelR <= threshold) ? 0 : vuLevelR - threshold;
- 
-          if (currentSource == STATION) { 
-            // Radio (higher base levels, lower dynamic)
-            if (vuLevelL == 0)                   ampL = 0;    // left channel  
-            else if (vuLevelL < VU_MAX_DIFF - 9) ampL = 1;
-            else if (vuLevelL < VU_MAX_DIFF - 8) ampL = 2;
-            else if (vuLevelL < VU_MAX_DIFF - 7) ampL = 3;
-            else if (vuLevelL < VU_MAX_DIFF - 6) ampL = 4;
-            else if (vuLevelL < VU_MAX_DIFF - 4) ampL = 5;
-            else if (vuLevelL < VU_MAX_DIFF - 2) ampL = 7;
-            else if (vuLevelL < VU_MAX_DIFF)     ampL = 9;
-            else                                 ampL = 11;
-            if (vuLevelR == 0)                   ampR = 0;    // right channel
-            else if (vuLevelR < VU_MAX_DIFF - 9) ampR = 1;
-            else if (vuLevelR < VU_MAX_DIFF - 8) ampR = 2;
-            else if (vuLevelR < VU_MAX_DIFF - 7) ampR = 3;
-            else if (vuLevelR < VU_MAX_DIFF - 6) ampR = 4;
-            else if (vuLevelR < VU_MAX_DIFF - 4) ampR = 5;
-            else if (vuLevelR < VU_MAX_DIFF - 2) ampR = 7;
-            else if (vuLevelR < VU_MAX_DIFF)     ampR = 9;
-            else                                 ampR = 11;
-          }
-          else {
-            // SD card or media server (lower base levels, higher dynamic)                            
-            if (vuLevelL == 0)                    ampL = 0;   // left channel    
-            else if (vuLevelL < VU_MAX_DIFF - 15) ampL = 1;
-            else if (vuLevelL < VU_MAX_DIFF - 11) ampL = 2;
-            else if (vuLevelL < VU_MAX_DIFF - 9)  ampL = 3;
-            else if (vuLevelL < VU_MAX_DIFF - 9)  ampL = 4;
-            else if (vuLevelL < VU_MAX_DIFF - 5)  ampL = 5;
-            else if (vuLevelL < VU_MAX_DIFF - 3)  ampL = 7;
-            else if (vuLevelL < VU_MAX_DIFF - 1)  ampL = 9;
-            else                                  ampL = 11;
-            if (vuLevelR == 0)                    ampR = 0;   // right channel
-            else if (vuLevelR < VU_MAX_DIFF - 15) ampR = 1;
-            else if (vuLevelR < VU_MAX_DIFF - 11) ampR = 2;
-            else if (vuLevelR < VU_MAX_DIFF - 9)  ampR = 3;
-            else if (vuLevelR < VU_MAX_DIFF - 7)  ampR = 4;
-            else if (vuLevelR < VU_MAX_DIFF - 5)  ampR = 5;
-            else if (vuLevelR < VU_MAX_DIFF - 3)  ampR = 7;
-            else if (vuLevelR < VU_MAX_DIFF - 1)  ampR = 9;
-            else                                  ampR = 11;
-          }
-          if (ampL != ampLOld) {
-            if (ampL < ampLOld) dsp_fillRect(posX, 0, 3, 11, BLACK); // clear the space for left meter
-            if (ampL > 0) {
-              dsp_fillRect(posX, 11 - ampL, 3, ampL, YELLOW);
-              update = true;
-            }  
-          }  
-          if (ampR != ampROld) {
-            if (ampR < ampROld) dsp_fillRect(posX + 4, 0, 3, 11, BLACK); // clear the space for right meter
-            if (ampR > 0) {
-              dsp_fillRect(posX + 4, 11 - ampR, 3, ampR, YELLOW);
-              update = true;
-            }
-          }  
-          ampLOld = ampL;
-          ampROld = ampR;
-        }
+      continue;
+    }
+    if (!tft) {
+      vuReady = false;                                 // nothing to show, allow next sample
+      continue;
+    }
+#ifdef SPECTRUM_ANALYZER
+    if (spectrumNew) {
+      spectrumNew = false;
+      displaySpectrum(spectrum);                       // paint changed bar parts
+      spectrumOn = true;
+      update = true;
+    }
+    else if (spectrumOn && spectrumRate == 0) {        // switched off
+      displaySpectrum(NULL);
+      spectrumOn = false;
+    }
+#endif
+    if (!vuNew) {                                      // spectrum frame only?
+      vuReady = false;
+      continue;
+    }
+    vuNew = false;
+    vuLevel = vuLevelRaw;
+    vuReady = false;                                   // playTask may sample again
+    vuLevelL = (uint8_t)(vuLevel >> 8);
+    vuLevelR = (uint8_t)(vuLevel & 0x00FF);
+    if (maxEncountered < vuLevelL || maxEncountered < vuLevelR) {
+      maxEncountered = (vuLevelL > vuLevelR) ? vuLevelL : vuLevelR;
+      threshold = maxEncountered - VU_MAX_DIFF;
+    }
+    // normalize to NULL and map to bar height
+    vuLevelL = (vuLevelL <= threshold) ? 0 : vuLevelL - threshold;
+    vuLevelR = (vuLevelR <= threshold) ? 0 : vuLevelR - threshold;
+    amp[0] = vuTable[currentSource != STATION][min(vuLevelL, (uint8_t)VU_MAX_DIFF)];
+    amp[1] = vuTable[currentSource != STATION][min(vuLevelR, (uint8_t)VU_MAX_DIFF)];
+    if (amp[0] == ampOld[0] && amp[1] == ampOld[1]) {
+      if (vuInterval < VU_MAX_INTERVAL) {
+        vuInterval += 10;                              // stable, sample less often
       }
+      continue;
+    }
+    vuInterval = VU_MIN_INTERVAL;                      // moving, sample at full rate
+    ampOld[0] = amp[0];
+    ampOld[1] = amp[1];
+    back = front ^ 1;                                  // render into the hidden frame
+    for (y = 0; y < VU_HEIGHT; y++) {
+      for (x = 0; x < VU_WIDTH; x++) {
+        frame[back][y * VU_WIDTH + x] =
+          (x != 3 && y >= VU_HEIGHT - amp[x > 3]) ? YELLOW : BLACK;
+      }
+    }
+    if (memcmp(frame[back], frame[front], sizeof(frame[0]))) {
+      dsp_drawRGBBitmap(posX, 0, frame[back], VU_WIDTH, VU_HEIGHT); // one transfer for the meter
+      front = back;
+      update = true;
     }
-    vTaskDelay(20 / portTICK_PERIOD_MS);               // pause only for a short time
   }
   //vTaskDelete(NULL);                                 // will never arrive here
 }